@@ -628,6 +628,7 @@ int CL_ReadFromServer (void)
 
 	CL_RelinkEntities ();
 	CL_UpdateTEnts ();
+	Mod_PrefetchFrame ();
 
 //johnfitz -- devstats
 
@@ -370,6 +370,7 @@ void CL_ParseServerInfo (void)
 	// copy the naked name of the map file to the cl structure -- O.S
 	COM_StripExtension (COM_SkipPath(model_precache[1]), cl.mapname, sizeof(cl.mapname));
 
+	TexMgr_BeginBatch (false); // convert and mipmap the textures on other threads
 	for (i = 1; i < nummodels; i++)
 	{
 		cl.model_precache[i] = Mod_ForName (model_precache[i], false);
@@ -379,6 +380,7 @@ void CL_ParseServerInfo (void)
 		}
 		CL_KeepaliveMessage ();
 	}
+	TexMgr_EndBatch (true);
 
 	S_BeginPrecaching ();
 	for (i = 1; i < numsounds; i++)
@@ -602,6 +604,7 @@ void CL_ParseUpdate (int bits)
 	if (model != ent->model)
 	{
 		ent->model = model;
+		Mod_Prefetch (model);
 	// automatic animation (torches, etc) can be either all together
 	// or randomized
 		if (model)
@@ -887,6 +890,7 @@ void CL_ParseStatic (int version) //johnfitz -- added a parameter
 // copy it to the current state
 
 	ent->model = cl.model_precache[ent->baseline.modelindex];
+	Mod_Prefetch (ent->model);
 	ent->lerpflags |= LERP_RESETANIM; //johnfitz -- lerping
 	ent->frame = ent->baseline.frame;
 
@@ -1428,6 +1428,50 @@ char *va (const char *format, ...)
 	return va_buf;
 }
 
+/*
+============
+COM_HashBytes
+
+two 32 bit hashes side by side (FNV-1a and sdbm), used as one 64 bit key.
+start from COM_HashInit and feed in as many blocks as needed.
+============
+*/
+void COM_HashInit (unsigned *key)
+{
+	key[0] = 2166136261u;
+	key[1] = 0;
+}
+
+void COM_HashBytes (unsigned *key, const void *data, int size)
+{
+	const byte	*p = (const byte *) data;
+	int			i;
+
+	for (i = 0; i < size; i++)
+	{
+		key[0] = (key[0] ^ p[i]) * 16777619u;
+		key[1] = p[i] + (key[1] << 6) + (key[1] << 16) - key[1];
+	}
+}
+
+/*
+============
+COM_HashString
+
+FNV-1a of a string with the high bits folded down, so callers can mask it
+to a power of two table size
+============
+*/
+unsigned COM_HashString (const char *s)
+{
+	unsigned	hash = 2166136261u;
+
+	while (*s)
+		hash = (hash ^ (byte)*s++) * 16777619u;
+
+	return hash ^ (hash >> 16);
+}
+
 /*
 =============================================================================
 
@@ -188,6 +188,11 @@ void COM_CreatePath (char *path);
 char *va (const char *format, ...) __attribute__((__format__(__printf__,1,2)));
 // does a varargs printf into a temp buffer
 
+void COM_HashInit (unsigned *key);
+void COM_HashBytes (unsigned *key, const void *data, int size);
+unsigned COM_HashString (const char *s);
+// 64 bit (two unsigned) content hash, for cache file keys
+
 
 //============================================================================
 
@@ -576,6 +576,7 @@ void GLMesh_LoadVertexBuffers (void)
 	{
 		if (!(m = cl.model_precache[j])) break;
 		if (m->type != mod_alias) continue;
+		if (m->deferred) continue; //uploaded when it's loaded
 
 		hdr = (const aliashdr_t *) Mod_Extradata (m);
 		
@@ -36,12 +36,33 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash);
 
 cvar_t	external_ents = {"external_ents", "1", CVAR_ARCHIVE};
 
+static cvar_t	gl_bspcache = {"gl_bspcache", "1", CVAR_ARCHIVE};
+static cvar_t	gl_lazymodels = {"gl_lazymodels", "1", CVAR_ARCHIVE}; //0 = load alias models at precache, 1 = when first used, 2 = when first drawn
+static qboolean	mod_loadprofile; //-loadprofile: time each lump and stage of brush model loading
+
+static qboolean	mod_loadalldata; //Mod_Extradata is loading, so alias models can't be deferred
+static double	mod_headertime, mod_aliastime; //time spent on deferred and full alias model loads this map
+static int		mod_numheaderloads, mod_numaliasloads;
+
+static double Mod_LoadTime (void);
+static void Mod_LoadAliasHeader (qmodel_t *mod, void *buffer);
+static void Mod_TimeFindName_f (void);
+static void Mod_TimeNodes_f (void);
+
 byte	mod_novis[MAX_MAP_LEAFS/8];
 
 #define	MAX_MOD_KNOWN	2048 /*johnfitz -- was 512 */
+#define	MAX_SURFACE_EXTENTS	2000 //johnfitz -- was 512 in glquake, 256 in winquake
 qmodel_t	mod_known[MAX_MOD_KNOWN];
 int		mod_numknown;
 
+#define	MODHASH_SIZE	1024	//power of two
+static int	mod_hash[MODHASH_SIZE];		//index+1 of the last mod_known entry with each name hash, 0 = none
+static int	mod_hashnext[MAX_MOD_KNOWN];	//index+1 of the previous entry in the same chain
+
+static qmodel_t	*mod_prefetch[MAX_MOD_KNOWN]; //deferred models entities have started using
+static int		mod_numprefetch;
+
 texture_t	*r_notexture_mip; //johnfitz -- moved here from r_main.c
 texture_t	*r_notexture_mip2; //johnfitz -- used for non-lightmapped surfs with a missing texture
 
@@ -54,6 +75,13 @@ void Mod_Init (void)
 {
 	Cvar_RegisterVariable (&gl_subdivide_size);
 	Cvar_RegisterVariable (&external_ents);
+	Cvar_RegisterVariable (&gl_bspcache);
+	Cvar_RegisterVariable (&gl_lazymodels);
+
+	Cmd_AddCommand ("timemodelnames", &Mod_TimeFindName_f);
+	Cmd_AddCommand ("timenodes", &Mod_TimeNodes_f);
+
+	mod_loadprofile = (COM_CheckParm ("-loadprofile") != 0);
 
 	memset (mod_novis, 0xff, sizeof(mod_novis));
 
@@ -83,7 +111,9 @@ void *Mod_Extradata (qmodel_t *mod)
 	if (r)
 		return r;
 
+	mod_loadalldata = true; //a deferred alias model is wanted now
 	Mod_LoadModel (mod, true);
+	mod_loadalldata = false;
 
 	if (!mod->cache.data)
 		Sys_Error ("Mod_Extradata: caching failed");
@@ -97,13 +127,42 @@ Mod_PointInLeaf
 */
 mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model)
 {
-	mnode_t		*node;
+	mcompactnode_t	*node;
 	float		d;
-	mplane_t	*plane;
+	int			i;
 
-	if (!model || !model->nodes)
+	if (!model || !model->compactnodes)
 		Sys_Error ("Mod_PointInLeaf: bad model");
 
+	i = model->nodes->compactnode;
+	while (i >= 0)
+	{
+		node = model->compactnodes + i;
+		if (node->plane.type < 3)
+			d = p[node->plane.type] - node->plane.dist;
+		else
+			d = DotProduct (p,node->plane.normal) - node->plane.dist;
+		if (d > 0)
+			i = node->children[0];
+		else
+			i = node->children[1];
+	}
+
+	return model->leafs + (-1 - i);
+}
+
+/*
+===============
+Mod_PointInLeafLinked -- the old walk over mnode_t pointers, kept for
+timenodes to compare against
+===============
+*/
+static mleaf_t *Mod_PointInLeafLinked (vec3_t p, qmodel_t *model)
+{
+	mnode_t		*node;
+	float		d;
+	mplane_t	*plane;
+
 	node = model->nodes;
 	while (1)
 	{
@@ -116,8 +175,118 @@ mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model)
 		else
 			node = node->children[1];
 	}
+}
 
-	return NULL;	// never reached
+/*
+===============
+Mod_BoxLeafs / Mod_BoxLeafsLinked -- count the leafs a box touches, the way
+R_SplitEntityOnNode walks the tree
+===============
+*/
+static int Mod_BoxLeafs (qmodel_t *model, int i, vec3_t mins, vec3_t maxs)
+{
+	mcompactnode_t	*node;
+	int			sides, count;
+
+	if (i < 0)
+		return 1;
+
+	node = model->compactnodes + i;
+	sides = BOX_ON_PLANE_SIDE (mins, maxs, &node->plane);
+	count = 0;
+	if (sides & 1)
+		count += Mod_BoxLeafs (model, node->children[0], mins, maxs);
+	if (sides & 2)
+		count += Mod_BoxLeafs (model, node->children[1], mins, maxs);
+	return count;
+}
+
+static int Mod_BoxLeafsLinked (mnode_t *node, vec3_t mins, vec3_t maxs)
+{
+	int			sides, count;
+
+	if (node->contents < 0)
+		return 1;
+
+	sides = BOX_ON_PLANE_SIDE (mins, maxs, node->plane);
+	count = 0;
+	if (sides & 1)
+		count += Mod_BoxLeafsLinked (node->children[0], mins, maxs);
+	if (sides & 2)
+		count += Mod_BoxLeafsLinked (node->children[1], mins, maxs);
+	return count;
+}
+
+/*
+===============
+Mod_TimeNodes_f -- timenodes [count]: drops count random points and boxes
+into the current map and times finding their leafs through compactnodes
+and through the linked nodes, checking both agree
+===============
+*/
+static void Mod_TimeNodes_f (void)
+{
+	qmodel_t	*model = cl.worldmodel;
+	vec3_t		*points;
+	vec3_t		mins, maxs;
+	int			count, i, j, k, mismatches, leafs[2];
+	double		start, pointtime[2], boxtime[2];
+
+	if (!model || model->type != mod_brush)
+	{
+		Con_Printf ("timenodes: no map loaded\n");
+		return;
+	}
+
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100000;
+	count = q_max (count, 1);
+
+	points = (vec3_t *) malloc (count * sizeof(vec3_t));
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 3; j++)
+			points[i][j] = model->mins[j] + (model->maxs[j] - model->mins[j]) * (rand () / (float)RAND_MAX);
+
+	for (i = 0, mismatches = 0; i < count; i++)
+	{
+		if (Mod_PointInLeaf (points[i], model) != Mod_PointInLeafLinked (points[i], model))
+			mismatches++;
+	}
+
+	for (k = 0; k < 2; k++)
+	{
+		start = Sys_DoubleTime ();
+		for (i = 0; i < count; i++)
+		{
+			if (k)
+				Mod_PointInLeafLinked (points[i], model);
+			else
+				Mod_PointInLeaf (points[i], model);
+		}
+		pointtime[k] = Sys_DoubleTime () - start;
+
+		leafs[k] = 0;
+		start = Sys_DoubleTime ();
+		for (i = 0; i < count; i++)
+		{
+			for (j = 0; j < 3; j++)
+			{
+				mins[j] = points[i][j] - 32;
+				maxs[j] = points[i][j] + 32;
+			}
+			if (k)
+				leafs[k] += Mod_BoxLeafsLinked (model->nodes, mins, maxs);
+			else
+				leafs[k] += Mod_BoxLeafs (model, model->nodes->compactnode, mins, maxs);
+		}
+		boxtime[k] = Sys_DoubleTime () - start;
+	}
+
+	free (points);
+
+	if (mismatches || leafs[0] != leafs[1])
+		Con_Printf ("compact nodes disagree: %i points in other leafs, %i vs %i box leafs\n", mismatches, leafs[0], leafs[1]);
+	Con_Printf ("%i nodes, %i lookups: points %.2f ms (linked %.2f ms), boxes %.2f ms (linked %.2f ms)\n",
+		model->numnodes, count, pointtime[0] * 1000.0, pointtime[1] * 1000.0, boxtime[0] * 1000.0, boxtime[1] * 1000.0);
 }
 
 
@@ -188,11 +357,20 @@ void Mod_ClearAll (void)
 	qmodel_t	*mod;
 
 	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
+	{
 		if (mod->type != mod_alias)
 		{
 			mod->needload = true;
 			TexMgr_FreeTexturesForOwner (mod); //johnfitz
 		}
+		mod->prefetch = false;
+	}
+
+	GL_FreeWarpPolys (); //polys r_oldwater subdivided after the brush models loaded
+
+	mod_numprefetch = 0;
+	mod_headertime = mod_aliastime = 0;
+	mod_numheaderloads = mod_numaliasloads = 0;
 }
 
 void Mod_ResetAll (void)
@@ -210,6 +388,8 @@ void Mod_ResetAll (void)
 		memset(mod, 0, sizeof(qmodel_t));
 	}
 	mod_numknown = 0;
+	mod_numprefetch = 0;
+	memset (mod_hash, 0, sizeof(mod_hash));
 }
 
 /*
@@ -221,6 +401,7 @@ Mod_FindName
 qmodel_t *Mod_FindName (const char *name)
 {
 	int		i;
+	unsigned	hash;
 	qmodel_t	*mod;
 
 	if (!name[0])
@@ -229,20 +410,79 @@ qmodel_t *Mod_FindName (const char *name)
 //
 // search the currently loaded models
 //
+	hash = COM_HashString (name) & (MODHASH_SIZE - 1);
+	for (i = mod_hash[hash]; i; i = mod_hashnext[i-1])
+		if (!strcmp (mod_known[i-1].name, name) )
+			return &mod_known[i-1];
+
+	if (mod_numknown == MAX_MOD_KNOWN)
+		Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
+	mod = &mod_known[mod_numknown];
+	q_strlcpy (mod->name, name, MAX_QPATH);
+	mod->needload = true;
+	mod_numknown++;
+
+	//entries are never removed or renamed until Mod_ResetAll, so the chains
+	//only grow and each model keeps its slot in mod_known
+	mod_hashnext[mod_numknown-1] = mod_hash[hash];
+	mod_hash[hash] = mod_numknown;
+
+	return mod;
+}
+
+/*
+==================
+Mod_FindNameLinear -- the old scan, kept for timemodelnames to compare against
+==================
+*/
+static qmodel_t *Mod_FindNameLinear (const char *name)
+{
+	int		i;
+	qmodel_t	*mod;
+
 	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
 		if (!strcmp (mod->name, name) )
-			break;
+			return mod;
+
+	return NULL;
+}
+
+/*
+==================
+Mod_TimeFindName_f -- timemodelnames [passes]: looks up every known model
+name through the hash and the linear scan, and checks they agree
+==================
+*/
+static void Mod_TimeFindName_f (void)
+{
+	int		passes, i, j, mismatches;
+	double	start, hashtime, lineartime;
 
-	if (i == mod_numknown)
+	passes = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
+	passes = q_max (passes, 1);
+
+	for (i = 0, mismatches = 0; i < mod_numknown; i++)
 	{
-		if (mod_numknown == MAX_MOD_KNOWN)
-			Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
-		q_strlcpy (mod->name, name, MAX_QPATH);
-		mod->needload = true;
-		mod_numknown++;
+		if (Mod_FindName (mod_known[i].name) != &mod_known[i] || Mod_FindNameLinear (mod_known[i].name) != &mod_known[i])
+			mismatches++;
 	}
 
-	return mod;
+	start = Sys_DoubleTime ();
+	for (j = 0; j < passes; j++)
+		for (i = 0; i < mod_numknown; i++)
+			Mod_FindName (mod_known[i].name);
+	hashtime = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < passes; j++)
+		for (i = 0; i < mod_numknown; i++)
+			Mod_FindNameLinear (mod_known[i].name);
+	lineartime = Sys_DoubleTime () - start;
+
+	if (mismatches)
+		Con_Printf ("%i of %i models found in the wrong slot\n", mismatches, mod_numknown);
+	Con_Printf ("%i models x %i passes: hashed %.2f ms, linear scan %.2f ms\n",
+		mod_numknown, passes, hashtime * 1000.0, lineartime * 1000.0);
 }
 
 /*
@@ -264,6 +504,54 @@ void Mod_TouchModel (const char *name)
 	}
 }
 
+/*
+==================
+Mod_Prefetch -- an entity started using mod; if it is deferred, load it over
+the next few frames rather than when it first comes into view
+==================
+*/
+void Mod_Prefetch (qmodel_t *mod)
+{
+	if (!mod || !mod->deferred || mod->prefetch || gl_lazymodels.value != 1 || mod_numprefetch == MAX_MOD_KNOWN)
+		return;
+
+	mod->prefetch = true;
+	mod_prefetch[mod_numprefetch++] = mod;
+}
+
+/*
+==================
+Mod_PrefetchFrame -- loads queued models for a few ms each frame. their skins
+are converted on the texture worker threads and uploaded by
+TexMgr_ResidencyFrame on whichever later frame they finish.
+==================
+*/
+#define PREFETCH_BUDGET	0.004
+
+void Mod_PrefetchFrame (void)
+{
+	qmodel_t	*mod;
+	double		start;
+	int			i;
+
+	if (!mod_numprefetch)
+		return;
+
+	start = Mod_LoadTime ();
+	TexMgr_BeginBatch (true);
+	for (i = 0; i < mod_numprefetch && (i == 0 || Mod_LoadTime () - start < PREFETCH_BUDGET); i++)
+	{
+		mod = mod_prefetch[i];
+		mod->prefetch = false;
+		if (mod->deferred)
+			Mod_Extradata (mod);
+	}
+	TexMgr_EndBatch (false);
+
+	mod_numprefetch -= i;
+	memmove (mod_prefetch, mod_prefetch + i, mod_numprefetch * sizeof(mod_prefetch[0]));
+}
+
 /*
 ==================
 Mod_LoadModel
@@ -283,6 +571,8 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 		{
 			if (Cache_Check (&mod->cache))
 				return mod;
+			if (mod->deferred && !mod_loadalldata)
+				return mod;	// flags and bounds are all anyone needs yet
 		}
 		else
 			return mod;		// not cached at all
@@ -325,7 +615,11 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 	switch (mod_type)
 	{
 	case IDPOLYHEADER:
-		Mod_LoadAliasModel (mod, buf);
+		mod->filesize = com_filesize;
+		if (gl_lazymodels.value && !mod_loadalldata)
+			Mod_LoadAliasHeader (mod, buf);
+		else
+			Mod_LoadAliasModel (mod, buf);
 		break;
 
 	case IDSPRITEHEADER:
@@ -357,6 +651,589 @@ qmodel_t *Mod_ForName (const char *name, qboolean crash)
 }
 
 
+/*
+===============================================================================
+
+					LOAD THREADS
+
+lump conversion and per-surface work that touches nothing shared is queued
+with Mod_QueueLoadJob and split across threads by Mod_RunLoadJobs. anything
+that allocates, prints or errors stays on the main thread; a job returns an
+error string instead, and the first one is raised once the threads are done.
+
+===============================================================================
+*/
+
+#define MAX_LOADTHREADS	16
+#define MAX_LOADJOBS	256
+#define LOADJOB_CHUNK	1024	//elements a thread takes at a time
+
+typedef struct
+{
+	const char		*name;
+	modjobfunc_t	func;
+	void			*data;
+	int				count;
+	int				next;		//first element not handed out yet
+	double			time;		//summed over the threads, for -loadprofile
+} modloadjob_t;
+
+static modloadjob_t	loadjobs[MAX_LOADJOBS];
+static int			numloadjobs;
+static int			numloadthreads = -1;	//besides the main thread; -1 until Mod_StartLoadThreads
+static SDL_mutex	*loadjobmutex;
+static const char	*loadjoberror;
+
+/*
+=================
+Mod_LoadTime
+=================
+*/
+static double Mod_LoadTime (void)
+{
+#if defined(USE_SDL2)
+	return (double)SDL_GetPerformanceCounter () / (double)SDL_GetPerformanceFrequency ();
+#else
+	return Sys_DoubleTime ();
+#endif
+}
+
+/*
+=================
+Mod_ProfileStage -- with -loadprofile, prints the time since *start under
+name and restarts it
+=================
+*/
+void Mod_ProfileStage (const char *name, double *start)
+{
+	double	now;
+
+	if (!mod_loadprofile)
+		return;
+	now = Mod_LoadTime ();
+	if (name)
+		Con_Printf ("  %-16s %8.2f ms\n", name, (now - *start) * 1000.0);
+	*start = now;
+}
+
+/*
+=================
+Mod_StartLoadThreads
+=================
+*/
+static void Mod_StartLoadThreads (void)
+{
+	int		i;
+
+	i = COM_CheckParm ("-loadthreads");
+	if (i && i < com_argc-1)
+		numloadthreads = atoi (com_argv[i+1]) - 1;
+	else
+#if defined(USE_SDL2)
+		numloadthreads = SDL_GetCPUCount () - 1;
+#else
+		numloadthreads = 1;
+#endif
+	numloadthreads = CLAMP (0, numloadthreads, MAX_LOADTHREADS);
+	if (numloadthreads && !(loadjobmutex = SDL_CreateMutex ()))
+		numloadthreads = 0;
+}
+
+/*
+=================
+Mod_LoadJobThread -- takes chunks of the queued jobs until there are none left
+=================
+*/
+static int Mod_LoadJobThread (void *unused)
+{
+	modloadjob_t	*job;
+	const char		*error;
+	double			start;
+	int				i, first, last;
+
+	if (loadjobmutex)
+		SDL_LockMutex (loadjobmutex);
+	for (i = 0; i < numloadjobs; )
+	{
+		job = &loadjobs[i];
+		if (job->next >= job->count)
+		{
+			i++;
+			continue;
+		}
+		first = job->next;
+		last = job->next = q_min(first + LOADJOB_CHUNK, job->count);
+		if (loadjobmutex)
+			SDL_UnlockMutex (loadjobmutex);
+
+		start = Mod_LoadTime ();
+		error = job->func (first, last, job->data);
+		start = Mod_LoadTime () - start;
+
+		if (loadjobmutex)
+			SDL_LockMutex (loadjobmutex);
+		job->time += start;
+		if (error && !loadjoberror)
+			loadjoberror = error;
+	}
+	if (loadjobmutex)
+		SDL_UnlockMutex (loadjobmutex);
+
+	return 0;
+}
+
+/*
+=================
+Mod_QueueLoadJob -- func will be called for ranges of [0, count) on any
+thread, by the next Mod_RunLoadJobs
+=================
+*/
+void Mod_QueueLoadJob (const char *name, modjobfunc_t func, int count, void *data)
+{
+	modloadjob_t	*job;
+
+	if (numloadjobs == MAX_LOADJOBS)
+		Mod_RunLoadJobs ();
+
+	job = &loadjobs[numloadjobs++];
+	job->name = name;
+	job->func = func;
+	job->data = data;
+	job->count = count;
+	job->next = 0;
+	job->time = 0;
+}
+
+/*
+=================
+Mod_RunLoadJobs -- runs everything queued and waits for it
+=================
+*/
+void Mod_RunLoadJobs (void)
+{
+	SDL_Thread	*threads[MAX_LOADTHREADS];
+	const char	*error;
+	int			i, numthreads, chunks;
+
+	if (!numloadjobs)
+		return;
+	if (numloadthreads == -1)
+		Mod_StartLoadThreads ();
+
+	for (i = 0, chunks = 0; i < numloadjobs; i++)
+		chunks += (loadjobs[i].count + LOADJOB_CHUNK - 1) / LOADJOB_CHUNK;
+	for (numthreads = 0; numthreads < q_min(numloadthreads, chunks - 1); numthreads++)
+	{
+#if defined(USE_SDL2)
+		threads[numthreads] = SDL_CreateThread (Mod_LoadJobThread, "modload", NULL);
+#else
+		threads[numthreads] = SDL_CreateThread (Mod_LoadJobThread, NULL);
+#endif
+		if (!threads[numthreads])
+			break;
+	}
+	Mod_LoadJobThread (NULL);
+	for (i = 0; i < numthreads; i++)
+		SDL_WaitThread (threads[i], NULL);
+
+	if (mod_loadprofile)
+		for (i = 0; i < numloadjobs; i++)
+			Con_Printf ("    %-14s %8.2f ms on %i threads\n", loadjobs[i].name, loadjobs[i].time * 1000.0, numthreads + 1);
+
+	numloadjobs = 0;
+	if (loadjoberror)
+	{
+		error = loadjoberror;
+		loadjoberror = NULL;
+		Host_Error ("%s in %s", error, loadmodel->name);
+	}
+}
+
+/*
+===============================================================================
+
+					BSP CACHE
+
+what the loader and GL_BuildLightmaps derive from a map (surface extents and
+bounds, unlit and subdivided warp polys, lightmap placement and display
+lists, hull0) is saved in <gamedir>/bspcache/<map>.qbc, keyed by a 64 bit
+hash of the bsp and the settings that change the result. the file is an image of the
+hunk data with pointers stored as offsets + 1, so a hit reads it into one
+hunk block and patches the pointers in one pass.
+
+===============================================================================
+*/
+
+#define BSPCACHE_VERSION	2
+#define BSPCACHE_PARAMS		7
+
+enum
+{
+	BSPCACHE_SURFACES,
+	BSPCACHE_POLYS,
+	BSPCACHE_HULL0,
+	BSPCACHE_LIGHTMAPS,
+	BSPCACHE_LUMPS
+};
+
+typedef struct
+{
+	char		magic[4];	//"QSBC"
+	int			version;
+	unsigned	key[2];
+	int			params[BSPCACHE_PARAMS];
+	int			numsurfaces;
+	int			numhull0;
+	int			numlightmaps;
+	lump_t		lumps[BSPCACHE_LUMPS];
+} bspcacheheader_t;
+
+static bspcacheheader_t	*bspcache; //cache of the model being loaded, NULL on a miss
+
+/*
+=================
+Mod_BSPCacheParams -- everything besides the bsp itself that changes what is cached
+=================
+*/
+static void Mod_BSPCacheParams (int *params)
+{
+	params[0] = sizeof(void *);
+	params[1] = sizeof(msurface_t);
+	params[2] = sizeof(glpoly_t);
+	params[3] = sizeof(mclipnode_t);
+	params[4] = LMBLOCK_WIDTH | (LMBLOCK_HEIGHT << 16);
+	params[5] = (int)(gl_subdivide_size.value * 256);
+	params[6] = R_WaterShaderActive ();
+}
+
+/*
+=================
+Mod_BSPCachePath
+=================
+*/
+static void Mod_BSPCachePath (qmodel_t *mod, char *path, size_t pathsize)
+{
+	char	base[MAX_QPATH];
+
+	COM_FileBase (mod->name, base, sizeof(base));
+	q_snprintf (path, pathsize, "%s/bspcache/%s.qbc", com_gamedir, base);
+}
+
+/*
+=================
+Mod_PolySize -- hunk size of a poly, rounded so the next one stays aligned
+=================
+*/
+static int Mod_PolySize (int numverts)
+{
+	return ((int)sizeof(glpoly_t) + (numverts-4) * VERTEXSIZE * (int)sizeof(float) + 15) & ~15;
+}
+
+/*
+=================
+Mod_ReadBSPCache -- reads the whole file into one hunk block
+=================
+*/
+static bspcacheheader_t *Mod_ReadBSPCache (void)
+{
+	bspcacheheader_t	header, *cache;
+	int		params[BSPCACHE_PARAMS];
+	char	path[MAX_OSPATH];
+	FILE	*f;
+	long	filesize;
+	int		i, size;
+	qboolean	ok;
+
+	Mod_BSPCachePath (loadmodel, path, sizeof(path));
+	if (!(f = fopen (path, "rb")))
+		return NULL;
+
+	fseek (f, 0, SEEK_END);
+	filesize = ftell (f);
+	fseek (f, 0, SEEK_SET);
+
+	Mod_BSPCacheParams (params);
+	ok = fread (&header, sizeof(header), 1, f) == 1 && !memcmp (header.magic, "QSBC", 4) &&
+		header.version == BSPCACHE_VERSION && header.key[0] == loadmodel->cachekey[0] &&
+		header.key[1] == loadmodel->cachekey[1] && !memcmp (header.params, params, sizeof(params));
+
+	size = sizeof(header);
+	for (i = 0; ok && i < BSPCACHE_LUMPS; i++)
+	{
+		if (header.lumps[i].fileofs < (int)sizeof(header) || (header.lumps[i].fileofs & 15) ||
+			header.lumps[i].filelen < 0 || header.lumps[i].filelen > filesize - header.lumps[i].fileofs)
+			ok = false;
+		else
+			size = q_max(size, header.lumps[i].fileofs + header.lumps[i].filelen);
+	}
+	if (!ok)
+	{
+		fclose (f);
+		return NULL;
+	}
+
+	cache = (bspcacheheader_t *) Hunk_AllocName (size, loadname);
+	*cache = header;
+	ok = fread (cache + 1, size - sizeof(header), 1, f) == 1;
+	fclose (f);
+	return ok ? cache : NULL;
+}
+
+/*
+=================
+Mod_LoadCachedFaces -- fills in loadmodel->surfaces from the cache; false
+if there is no usable cache
+=================
+*/
+static qboolean Mod_LoadCachedFaces (int count)
+{
+	msurface_t	*s;
+	glpoly_t	*p;
+	byte		*polys;
+	int			i, mark, polysize, size, pofs, smax, tmax, maps;
+	intptr_t	ofs;
+
+	if (!gl_bspcache.value || !loadmodel->cachekeyed)
+		return false;
+
+	mark = Hunk_LowMark ();
+	if (!(bspcache = Mod_ReadBSPCache ()))
+		goto fail;
+
+	if (bspcache->numsurfaces != count ||
+		bspcache->lumps[BSPCACHE_SURFACES].filelen != count * (int)sizeof(msurface_t) ||
+		bspcache->lumps[BSPCACHE_HULL0].filelen % (int)sizeof(mclipnode_t) ||
+		bspcache->numhull0 != bspcache->lumps[BSPCACHE_HULL0].filelen / (int)sizeof(mclipnode_t) ||
+		bspcache->numlightmaps < 1 || bspcache->numlightmaps > MAX_LIGHTMAPS ||
+		bspcache->numlightmaps * LMBLOCK_WIDTH * (int)sizeof(int) != bspcache->lumps[BSPCACHE_LIGHTMAPS].filelen)
+		goto fail;
+
+	// polys: one pass over the block, turning offsets back into pointers
+	polys = (byte *)bspcache + bspcache->lumps[BSPCACHE_POLYS].fileofs;
+	polysize = bspcache->lumps[BSPCACHE_POLYS].filelen;
+	for (i = 0; i < polysize; i += size)
+	{
+		p = (glpoly_t *)(polys + i);
+		if (polysize - i < (int)offsetof(glpoly_t, verts) || p->numverts < 1 ||
+			p->numverts > polysize / (VERTEXSIZE * (int)sizeof(float)) ||
+			(size = Mod_PolySize (p->numverts)) > polysize - i)
+			goto fail;
+		if ((ofs = (intptr_t)p->next))
+		{
+			if (ofs != i + size + 1 || ofs > polysize) //chains are written back to back
+				goto fail;
+			p->next = (glpoly_t *)(polys + ofs - 1);
+		}
+		p->chain = NULL;
+	}
+
+	// surfaces
+	s = (msurface_t *)((byte *)bspcache + bspcache->lumps[BSPCACHE_SURFACES].fileofs);
+	pofs = 0;
+	loadmodel->surfaces = s;
+	loadmodel->numsurfaces = count;
+	for (i = 0; i < count; i++, s++)
+	{
+		ofs = (intptr_t)s->plane - 1;
+		if (ofs < 0 || ofs >= loadmodel->numplanes)
+			goto fail;
+		s->plane = loadmodel->planes + ofs;
+
+		ofs = (intptr_t)s->texinfo - 1;
+		if (ofs < 0 || ofs >= loadmodel->numtexinfo)
+			goto fail;
+		s->texinfo = loadmodel->texinfo + ofs;
+
+		ofs = (intptr_t)s->polys - 1;
+		if (ofs != pofs || ofs >= polysize) //so are the surfaces' chains, in order
+			goto fail;
+		s->polys = (glpoly_t *)(polys + ofs);
+		for (p = s->polys; p; p = p->next)
+			pofs += Mod_PolySize (p->numverts);
+
+		if (s->numedges < 1 || s->firstedge < 0 || s->firstedge > loadmodel->numsurfedges - s->numedges ||
+			s->polys->numverts < s->numedges)
+			goto fail;
+
+		// everything GL_FillSurfaceLightmap and R_BuildLightMap index with
+		if (s->extents[0] < 0 || s->extents[1] < 0 || (!(s->texinfo->flags & TEX_SPECIAL) &&
+			(s->extents[0] > MAX_SURFACE_EXTENTS || s->extents[1] > MAX_SURFACE_EXTENTS)))
+			goto fail;
+		smax = (s->extents[0]>>4)+1;
+		tmax = (s->extents[1]>>4)+1;
+		if (!(s->flags & SURF_DRAWTILED) &&
+			(s->lightmaptexturenum < 0 || s->lightmaptexturenum >= bspcache->numlightmaps ||
+			s->light_s < 0 || s->light_t < 0 || s->light_s + smax > LMBLOCK_WIDTH || s->light_t + tmax > LMBLOCK_HEIGHT))
+			goto fail;
+
+		if ((ofs = (intptr_t)s->samples))
+		{
+			for (maps = 0; maps < MAXLIGHTMAPS && s->styles[maps] != 255; maps++)
+				;
+			if (!loadmodel->lightdata || ofs < 1 ||
+				s->extents[0] > MAX_SURFACE_EXTENTS || s->extents[1] > MAX_SURFACE_EXTENTS ||
+				ofs - 1 > loadmodel->lightdatasize - maps * smax * tmax * 3)
+				goto fail;
+			s->samples = loadmodel->lightdata + ofs - 1;
+		}
+		s->texturechain = NULL;
+	}
+
+	loadmodel->cacheloaded = true;
+	loadmodel->cachedlightmaps = bspcache->numlightmaps;
+	loadmodel->cachedallocated = (int *)((byte *)bspcache + bspcache->lumps[BSPCACHE_LIGHTMAPS].fileofs);
+	return true;
+
+fail:
+	// the cache block is the last thing on the hunk
+	Hunk_FreeToLowMark (mark);
+	bspcache = NULL;
+	loadmodel->surfaces = NULL;
+	return false;
+}
+
+/*
+=================
+Mod_CachedHull0 -- hull0 from the cache, or NULL
+=================
+*/
+static mclipnode_t *Mod_CachedHull0 (int count)
+{
+	mclipnode_t	*node;
+	int			i, j;
+
+	if (!bspcache || bspcache->numhull0 != count)
+		return NULL;
+
+	node = (mclipnode_t *)((byte *)bspcache + bspcache->lumps[BSPCACHE_HULL0].fileofs);
+	for (i = 0; i < count; i++)
+	{
+		if (node[i].planenum < 0 || node[i].planenum >= loadmodel->numplanes)
+			return NULL;
+		for (j = 0; j < 2; j++)
+			if (node[i].children[j] >= count)
+				return NULL;
+	}
+	return node;
+}
+
+/*
+=================
+Mod_SetCacheLump
+=================
+*/
+static void Mod_SetCacheLump (lump_t *lump, int *ofs, int size)
+{
+	lump->fileofs = *ofs;
+	lump->filelen = size;
+	*ofs = (*ofs + size + 15) & ~15;
+}
+
+/*
+=================
+Mod_WriteBSPCache -- called by GL_BuildLightmaps once the world's lightmaps are
+placed and its display lists built. allocated is the lightmap allocator state
+right after the world.
+=================
+*/
+void Mod_WriteBSPCache (qmodel_t *mod, const int *allocated, int numlightmaps)
+{
+	bspcacheheader_t	*header;
+	msurface_t	*s, *out;
+	glpoly_t	*p, *outp;
+	byte		*buf, *polys;
+	char		path[MAX_OSPATH], temp[MAX_OSPATH];
+	FILE		*f;
+	int			i, size, polysize, pofs;
+	qboolean	ok;
+
+	if (!gl_bspcache.value || mod->type != mod_brush || mod->cacheloaded || !mod->cachekeyed)
+		return;
+
+	polysize = 0;
+	for (i = 0, s = mod->surfaces; i < mod->numsurfaces; i++, s++)
+	{
+		if (!s->polys)
+			return; //not fully built, nothing to cache
+		for (p = s->polys; p; p = p->next)
+			polysize += Mod_PolySize (p->numverts);
+	}
+
+	header = (bspcacheheader_t *) calloc (1, sizeof(*header));
+	memcpy (header->magic, "QSBC", 4);
+	header->version = BSPCACHE_VERSION;
+	header->key[0] = mod->cachekey[0];
+	header->key[1] = mod->cachekey[1];
+	Mod_BSPCacheParams (header->params);
+	header->numsurfaces = mod->numsurfaces;
+	header->numhull0 = mod->hulls[0].lastclipnode + 1;
+	header->numlightmaps = numlightmaps;
+	size = (sizeof(*header) + 15) & ~15;
+	Mod_SetCacheLump (&header->lumps[BSPCACHE_SURFACES], &size, mod->numsurfaces * sizeof(msurface_t));
+	Mod_SetCacheLump (&header->lumps[BSPCACHE_POLYS], &size, polysize);
+	Mod_SetCacheLump (&header->lumps[BSPCACHE_HULL0], &size, header->numhull0 * sizeof(mclipnode_t));
+	Mod_SetCacheLump (&header->lumps[BSPCACHE_LIGHTMAPS], &size, numlightmaps * LMBLOCK_WIDTH * sizeof(int));
+
+	buf = (byte *) calloc (1, size);
+	memcpy (buf, header, sizeof(*header));
+	free (header);
+	header = (bspcacheheader_t *)buf;
+
+	// surfaces and their poly chains, pointers turned into offsets + 1
+	out = (msurface_t *)(buf + header->lumps[BSPCACHE_SURFACES].fileofs);
+	polys = buf + header->lumps[BSPCACHE_POLYS].fileofs;
+	pofs = 0;
+	for (i = 0, s = mod->surfaces; i < mod->numsurfaces; i++, s++, out++)
+	{
+		memset (out, 0, sizeof(*out));
+		out->mins[0] = s->mins[0]; out->mins[1] = s->mins[1]; out->mins[2] = s->mins[2];
+		out->maxs[0] = s->maxs[0]; out->maxs[1] = s->maxs[1]; out->maxs[2] = s->maxs[2];
+		out->plane = (mplane_t *)(intptr_t)(s->plane - mod->planes + 1);
+		out->flags = s->flags;
+		out->firstedge = s->firstedge;
+		out->numedges = s->numedges;
+		out->texturemins[0] = s->texturemins[0];
+		out->texturemins[1] = s->texturemins[1];
+		out->extents[0] = s->extents[0];
+		out->extents[1] = s->extents[1];
+		out->light_s = s->light_s;
+		out->light_t = s->light_t;
+		out->polys = (glpoly_t *)(intptr_t)(pofs + 1);
+		out->texinfo = (mtexinfo_t *)(intptr_t)(s->texinfo - mod->texinfo + 1);
+		out->lightmaptexturenum = s->lightmaptexturenum;
+		memcpy (out->styles, s->styles, sizeof(out->styles));
+		out->samples = s->samples ? (byte *)(intptr_t)(s->samples - mod->lightdata + 1) : NULL;
+
+		for (p = s->polys; p; p = p->next)
+		{
+			outp = (glpoly_t *)(polys + pofs);
+			memcpy (outp, p, offsetof(glpoly_t, verts) + p->numverts * VERTEXSIZE * sizeof(float));
+			pofs += Mod_PolySize (p->numverts);
+			outp->next = p->next ? (glpoly_t *)(intptr_t)(pofs + 1) : NULL;
+			outp->chain = NULL;
+		}
+	}
+
+	memcpy (buf + header->lumps[BSPCACHE_HULL0].fileofs, mod->hulls[0].clipnodes, header->lumps[BSPCACHE_HULL0].filelen);
+	memcpy (buf + header->lumps[BSPCACHE_LIGHTMAPS].fileofs, allocated, header->lumps[BSPCACHE_LIGHTMAPS].filelen);
+
+	// write to a temporary name and rename, so a crash never leaves half a file
+	q_snprintf (temp, sizeof(temp), "%s/bspcache", com_gamedir);
+	Sys_mkdir (temp);
+	Mod_BSPCachePath (mod, path, sizeof(path));
+	q_snprintf (temp, sizeof(temp), "%s.tmp", path);
+	ok = false;
+	if ((f = fopen (temp, "wb")))
+	{
+		ok = fwrite (buf, size, 1, f) == 1;
+		ok = (fclose (f) == 0) && ok;
+		remove (path); //rename won't replace a file on windows
+		if (!ok || rename (temp, path))
+			remove (temp);
+	}
+	free (buf);
+}
+
 /*
 ===============================================================================
 
@@ -399,6 +1276,7 @@ void Mod_LoadTextures (lump_t *l)
 	int			nummiptex;
 	src_offset_t		offset;
 	int			mark, fwidth, fheight;
+	enum srcformat	fformat;
 	char		filename[MAX_OSPATH], filename2[MAX_OSPATH], mapname[MAX_OSPATH];
 	byte		*data;
 	extern byte *hunk_base;
@@ -472,11 +1350,11 @@ void Mod_LoadTextures (lump_t *l)
 				mark = Hunk_LowMark();
 				COM_StripExtension (loadmodel->name + 5, mapname, sizeof(mapname));
 				q_snprintf (filename, sizeof(filename), "textures/%s/#%s", mapname, tx->name+1); //this also replaces the '*' with a '#'
-				data = Image_LoadImage (filename, &fwidth, &fheight);
+				data = TexMgr_LoadExternalImage (filename, &fwidth, &fheight, &fformat);
 				if (!data)
 				{
 					q_snprintf (filename, sizeof(filename), "textures/#%s", tx->name+1);
-					data = Image_LoadImage (filename, &fwidth, &fheight);
+					data = TexMgr_LoadExternalImage (filename, &fwidth, &fheight, &fformat);
 				}
 
 				//now load whatever we found
@@ -484,7 +1362,7 @@ void Mod_LoadTextures (lump_t *l)
 				{
 					q_strlcpy (texturename, filename, sizeof(texturename));
 					tx->gltexture = TexMgr_LoadImage (loadmodel, texturename, fwidth, fheight,
-						SRC_RGBA, data, filename, 0, TEXPREF_NONE);
+						fformat, data, filename, 0, TEXPREF_NONE);
 				}
 				else //use the texture from the bsp file
 				{
@@ -516,32 +1394,32 @@ void Mod_LoadTextures (lump_t *l)
 				mark = Hunk_LowMark ();
 				COM_StripExtension (loadmodel->name + 5, mapname, sizeof(mapname));
 				q_snprintf (filename, sizeof(filename), "textures/%s/%s", mapname, tx->name);
-				data = Image_LoadImage (filename, &fwidth, &fheight);
+				data = TexMgr_LoadExternalImage (filename, &fwidth, &fheight, &fformat);
 				if (!data)
 				{
 					q_snprintf (filename, sizeof(filename), "textures/%s", tx->name);
-					data = Image_LoadImage (filename, &fwidth, &fheight);
+					data = TexMgr_LoadExternalImage (filename, &fwidth, &fheight, &fformat);
 				}
 
 				//now load whatever we found
 				if (data) //load external image
 				{
 					tx->gltexture = TexMgr_LoadImage (loadmodel, filename, fwidth, fheight,
-						SRC_RGBA, data, filename, 0, TEXPREF_MIPMAP | extraflags );
+						fformat, data, filename, 0, TEXPREF_MIPMAP | extraflags );
 
 					//now try to load glow/luma image from the same place
 					Hunk_FreeToLowMark (mark);
 					q_snprintf (filename2, sizeof(filename2), "%s_glow", filename);
-					data = Image_LoadImage (filename2, &fwidth, &fheight);
+					data = TexMgr_LoadExternalImage (filename2, &fwidth, &fheight, &fformat);
 					if (!data)
 					{
 						q_snprintf (filename2, sizeof(filename2), "%s_luma", filename);
-						data = Image_LoadImage (filename2, &fwidth, &fheight);
+						data = TexMgr_LoadExternalImage (filename2, &fwidth, &fheight, &fformat);
 					}
 
 					if (data)
 						tx->fullbright = TexMgr_LoadImage (loadmodel, filename2, fwidth, fheight,
-							SRC_RGBA, data, filename, 0, TEXPREF_MIPMAP | extraflags );
+							fformat, data, filename2, 0, TEXPREF_MIPMAP | extraflags );
 				}
 				else //use the texture from the bsp file
 				{
@@ -679,6 +1557,7 @@ void Mod_LoadLighting (lump_t *l)
 	unsigned int path_id;
 
 	loadmodel->lightdata = NULL;
+	loadmodel->lightdatasize = 0;
 	// LordHavoc: check for a .lit file
 	q_strlcpy(litfilename, loadmodel->name, sizeof(litfilename));
 	COM_StripExtension(litfilename, litfilename, sizeof(litfilename));
@@ -702,6 +1581,7 @@ void Mod_LoadLighting (lump_t *l)
 			{
 				Con_DPrintf2("%s loaded\n", litfilename);
 				loadmodel->lightdata = data + 8;
+				loadmodel->lightdatasize = com_filesize - 8;
 				return;
 			}
 			else
@@ -720,6 +1600,7 @@ void Mod_LoadLighting (lump_t *l)
 	if (!l->filelen)
 		return;
 	loadmodel->lightdata = (byte *) Hunk_AllocName ( l->filelen*3, litfilename);
+	loadmodel->lightdatasize = l->filelen*3;
 	in = loadmodel->lightdata + l->filelen*2; // place the file at the end, so it will not be overwritten until the very last write
 	out = loadmodel->lightdata;
 	memcpy (in, mod_base + l->fileofs, l->filelen);
@@ -799,6 +1680,26 @@ _load_embedded:
 }
 
 
+/*
+=================
+Mod_ConvertVertexes -- load job
+=================
+*/
+static const char *Mod_ConvertVertexes (int first, int last, void *data)
+{
+	dvertex_t	*in = (dvertex_t *)data + first;
+	mvertex_t	*out = loadmodel->vertexes + first;
+	int			i;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		out->position[0] = LittleFloat (in->point[0]);
+		out->position[1] = LittleFloat (in->point[1]);
+		out->position[2] = LittleFloat (in->point[2]);
+	}
+	return NULL;
+}
+
 /*
 =================
 Mod_LoadVertexes
@@ -808,7 +1709,7 @@ void Mod_LoadVertexes (lump_t *l)
 {
 	dvertex_t	*in;
 	mvertex_t	*out;
-	int			i, count;
+	int			count;
 
 	in = (dvertex_t *)(mod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
@@ -819,12 +1720,40 @@ void Mod_LoadVertexes (lump_t *l)
 	loadmodel->vertexes = out;
 	loadmodel->numvertexes = count;
 
-	for (i=0 ; i<count ; i++, in++, out++)
+	Mod_QueueLoadJob ("vertexes", Mod_ConvertVertexes, count, in);
+}
+
+/*
+=================
+Mod_ConvertEdges -- load jobs
+=================
+*/
+static const char *Mod_ConvertEdges_S (int first, int last, void *data)
+{
+	dsedge_t	*in = (dsedge_t *)data + first;
+	medge_t		*out = loadmodel->edges + first;
+	int			i;
+
+	for (i=first ; i<last ; i++, in++, out++)
 	{
-		out->position[0] = LittleFloat (in->point[0]);
-		out->position[1] = LittleFloat (in->point[1]);
-		out->position[2] = LittleFloat (in->point[2]);
+		out->v[0] = (unsigned short)LittleShort(in->v[0]);
+		out->v[1] = (unsigned short)LittleShort(in->v[1]);
+	}
+	return NULL;
+}
+
+static const char *Mod_ConvertEdges_L (int first, int last, void *data)
+{
+	dledge_t	*in = (dledge_t *)data + first;
+	medge_t		*out = loadmodel->edges + first;
+	int			i;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		out->v[0] = LittleLong(in->v[0]);
+		out->v[1] = LittleLong(in->v[1]);
 	}
+	return NULL;
 }
 
 /*
@@ -835,7 +1764,7 @@ Mod_LoadEdges
 void Mod_LoadEdges (lump_t *l, int bsp2)
 {
 	medge_t *out;
-	int 	i, count;
+	int 	count;
 
 	if (bsp2)
 	{
@@ -850,11 +1779,7 @@ void Mod_LoadEdges (lump_t *l, int bsp2)
 		loadmodel->edges = out;
 		loadmodel->numedges = count;
 
-		for (i=0 ; i<count ; i++, in++, out++)
-		{
-			out->v[0] = LittleLong(in->v[0]);
-			out->v[1] = LittleLong(in->v[1]);
-		}
+		Mod_QueueLoadJob ("edges", Mod_ConvertEdges_L, count, in);
 	}
 	else
 	{
@@ -869,11 +1794,7 @@ void Mod_LoadEdges (lump_t *l, int bsp2)
 		loadmodel->edges = out;
 		loadmodel->numedges = count;
 
-		for (i=0 ; i<count ; i++, in++, out++)
-		{
-			out->v[0] = (unsigned short)LittleShort(in->v[0]);
-			out->v[1] = (unsigned short)LittleShort(in->v[1]);
-		}
+		Mod_QueueLoadJob ("edges", Mod_ConvertEdges_S, count, in);
 	}
 }
 
@@ -954,10 +1875,10 @@ void Mod_LoadTexinfo (lump_t *l)
 ================
 CalcSurfaceExtents
 
-Fills in s->texturemins[] and s->extents[]
+Fills in s->texturemins[] and s->extents[]; false if they're too big
 ================
 */
-void CalcSurfaceExtents (msurface_t *s)
+static qboolean CalcSurfaceExtents (msurface_t *s)
 {
 	float	mins[2], maxs[2], val;
 	int		i,j, e;
@@ -1015,9 +1936,10 @@ void CalcSurfaceExtents (msurface_t *s)
 		s->texturemins[i] = bmins[i] * 16;
 		s->extents[i] = (bmaxs[i] - bmins[i]) * 16;
 
-		if ( !(tex->flags & TEX_SPECIAL) && s->extents[i] > 2000) //johnfitz -- was 512 in glquake, 256 in winquake
-			Sys_Error ("Bad surface extents");
+		if ( !(tex->flags & TEX_SPECIAL) && s->extents[i] > MAX_SURFACE_EXTENTS)
+			return false;
 	}
+	return true;
 }
 
 /*
@@ -1106,44 +2028,20 @@ void Mod_CalcSurfaceBounds (msurface_t *s)
 
 /*
 =================
-Mod_LoadFaces
+Mod_ConvertFaces -- load job: everything about a face that only reads the
+lumps already loaded
 =================
 */
-void Mod_LoadFaces (lump_t *l, qboolean bsp2)
+static const char *Mod_ConvertFaces (int first, int last, void *data)
 {
-	dsface_t	*ins;
-	dlface_t	*inl;
-	msurface_t 	*out;
-	int			i, count, surfnum, lofs;
+	dsface_t	*ins = (dsface_t *)data + first;
+	dlface_t	*inl = (dlface_t *)data + first;
+	msurface_t 	*out = loadmodel->surfaces + first;
+	qboolean	bsp2 = (loadmodel->bspversion != BSPVERSION);
+	int			i, surfnum, lofs;
 	int			planenum, side, texinfon;
 
-	if (bsp2)
-	{
-		ins = NULL;
-		inl = (dlface_t *)(mod_base + l->fileofs);
-		if (l->filelen % sizeof(*inl))
-			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-		count = l->filelen / sizeof(*inl);
-	}
-	else
-	{
-		ins = (dsface_t *)(mod_base + l->fileofs);
-		inl = NULL;
-		if (l->filelen % sizeof(*ins))
-			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-		count = l->filelen / sizeof(*ins);
-	}
-	out = (msurface_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
-
-	//johnfitz -- warn mappers about exceeding old limits
-	if (count > 32767 && !bsp2)
-		Con_DWarning ("%i faces exceeds standard limit of 32767.\n", count);
-	//johnfitz
-
-	loadmodel->surfaces = out;
-	loadmodel->numsurfaces = count;
-
-	for (surfnum=0 ; surfnum<count ; surfnum++, out++)
+	for (surfnum=first ; surfnum<last ; surfnum++, out++)
 	{
 		if (bsp2)
 		{
@@ -1179,16 +2077,61 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 
 		out->texinfo = loadmodel->texinfo + texinfon;
 
-		CalcSurfaceExtents (out);
+		if (!CalcSurfaceExtents (out))
+			return "Bad surface extents";
+
+		Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+
+	// lighting info
+		if (lofs == -1)
+			out->samples = NULL;
+		else
+			out->samples = loadmodel->lightdata + (lofs * 3); //johnfitz -- lit support via lordhavoc (was "+ i")
+	}
+	return NULL;
+}
+
+/*
+=================
+Mod_LoadFaces
+=================
+*/
+void Mod_LoadFaces (lump_t *l, qboolean bsp2)
+{
+	msurface_t 	*out;
+	int			count, surfnum;
+
+	if (bsp2)
+	{
+		if (l->filelen % sizeof(dlface_t))
+			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+		count = l->filelen / sizeof(dlface_t);
+	}
+	else
+	{
+		if (l->filelen % sizeof(dsface_t))
+			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+		count = l->filelen / sizeof(dsface_t);
+	}
+
+	//johnfitz -- warn mappers about exceeding old limits
+	if (count > 32767 && !bsp2)
+		Con_DWarning ("%i faces exceeds standard limit of 32767.\n", count);
+	//johnfitz
+
+	if (Mod_LoadCachedFaces (count))
+		return;
 
-		Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+	out = (msurface_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
+	loadmodel->surfaces = out;
+	loadmodel->numsurfaces = count;
 
-	// lighting info
-		if (lofs == -1)
-			out->samples = NULL;
-		else
-			out->samples = loadmodel->lightdata + (lofs * 3); //johnfitz -- lit support via lordhavoc (was "+ i")
+	Mod_QueueLoadJob ("faces", Mod_ConvertFaces, count, mod_base + l->fileofs);
+	Mod_RunLoadJobs ();
 
+	// the rest allocates polys, so it stays on this thread
+	for (surfnum=0 ; surfnum<count ; surfnum++, out++)
+	{
 		//johnfitz -- this section rewritten
 		if (!q_strncasecmp(out->texinfo->texture->name,"sky",3)) // sky surface //also note -- was Q_strncmp, changed to match qbsp
 		{
@@ -1209,7 +2152,8 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 			else out->flags |= SURF_DRAWWATER;
 
 			Mod_PolyForUnlitSurface (out);
-			GL_SubdivideSurface (out);
+			if (!R_WaterShaderActive ()) //per-pixel warp doesn't need it; r_oldwater subdivides on demand
+				GL_SubdivideSurface (out);
 		}
 		else if (out->texinfo->texture->name[0] == '{') // ericw -- fence textures
 		{
@@ -1246,6 +2190,68 @@ void Mod_SetParent (mnode_t *node, mnode_t *parent)
 	Mod_SetParent (node->children[1], node);
 }
 
+/*
+=================
+Mod_BuildCompactNodes -- packs the nodes into compactnodes, depth-first from
+each model's head node with the front side first, so walking down a tree
+mostly reads forwards through memory.  submodel head nodes are never
+children, so a sweep in file order starts a walk at each of them
+=================
+*/
+static void Mod_BuildCompactNodes (void)
+{
+	mnode_t		*node, *child, **stack;
+	mcompactnode_t	*out;
+	int			i, j, count, sp, next;
+
+	count = loadmodel->numnodes;
+	loadmodel->compactnodes = (mcompactnode_t *) Hunk_AllocName (count*sizeof(mcompactnode_t), loadname);
+
+	for (i=0, node=loadmodel->nodes ; i<count ; i++, node++)
+		node->compactnode = -1;
+
+	// each node is pushed at most once, so the stack can't outgrow count
+	stack = (mnode_t **) malloc (count * sizeof(mnode_t *));
+	for (i=0, next=0 ; i<count ; i++)
+	{
+		if (loadmodel->nodes[i].compactnode != -1)
+			continue;
+		loadmodel->nodes[i].compactnode = -2; //queued
+		stack[0] = &loadmodel->nodes[i];
+		sp = 1;
+		while (sp)
+		{
+			node = stack[--sp];
+			node->compactnode = next++;
+			for (j=1 ; j>=0 ; j--) //back side first, so the front is popped next
+			{
+				child = node->children[j];
+				if (child->contents >= 0 && child->compactnode == -1)
+				{
+					child->compactnode = -2;
+					stack[sp++] = child;
+				}
+			}
+		}
+	}
+	free (stack);
+
+	for (i=0, node=loadmodel->nodes ; i<count ; i++, node++)
+	{
+		out = loadmodel->compactnodes + node->compactnode;
+		out->plane = *node->plane;
+		out->node = i;
+		for (j=0 ; j<2 ; j++)
+		{
+			child = node->children[j];
+			if (child->contents < 0)
+				out->children[j] = -1 - (int)((mleaf_t *)child - loadmodel->leafs);
+			else
+				out->children[j] = child->compactnode;
+		}
+	}
+}
+
 /*
 =================
 Mod_LoadNodes
@@ -1421,6 +2427,7 @@ void Mod_LoadNodes (lump_t *l, int bsp2)
 		Mod_LoadNodes_S(l);
 
 	Mod_SetParent (loadmodel->nodes, NULL);	// sets nodes and leafs
+	Mod_BuildCompactNodes ();
 }
 
 void Mod_ProcessLeafs_S (dsleaf_t *in, int filelen)
@@ -1580,6 +2587,61 @@ void Mod_LoadLeafs (lump_t *l, int bsp2)
 		Mod_ProcessLeafs_S  ((dsleaf_t *) in, l->filelen);
 }
 
+/*
+=================
+Mod_ConvertClipnodes -- load jobs
+=================
+*/
+static const char *Mod_ConvertClipnodes_S (int first, int last, void *data)
+{
+	dsclipnode_t	*ins = (dsclipnode_t *)data + first;
+	mclipnode_t		*out = loadmodel->clipnodes + first;
+	int				i, count = loadmodel->numclipnodes;
+
+	for (i=first ; i<last ; i++, out++, ins++)
+	{
+		out->planenum = LittleLong(ins->planenum);
+
+	//johnfitz -- bounds check
+	if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
+		return "Mod_LoadClipnodes: planenum out of bounds";
+	//johnfitz
+
+		//johnfitz -- support clipnodes > 32k
+		out->children[0] = (unsigned short)LittleShort(ins->children[0]);
+		out->children[1] = (unsigned short)LittleShort(ins->children[1]);
+
+		if (out->children[0] >= count)
+			out->children[0] -= 65536;
+		if (out->children[1] >= count)
+			out->children[1] -= 65536;
+		//johnfitz
+	}
+	return NULL;
+}
+
+static const char *Mod_ConvertClipnodes_L (int first, int last, void *data)
+{
+	dlclipnode_t	*inl = (dlclipnode_t *)data + first;
+	mclipnode_t		*out = loadmodel->clipnodes + first;
+	int				i;
+
+	for (i=first ; i<last ; i++, out++, inl++)
+	{
+		out->planenum = LittleLong(inl->planenum);
+
+		//johnfitz -- bounds check
+		if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
+			return "Mod_LoadClipnodes: planenum out of bounds";
+		//johnfitz
+
+		out->children[0] = LittleLong(inl->children[0]);
+		out->children[1] = LittleLong(inl->children[1]);
+		//Spike: FIXME: bounds check
+	}
+	return NULL;
+}
+
 /*
 =================
 Mod_LoadClipnodes
@@ -1591,7 +2653,7 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 	dlclipnode_t *inl;
 
 	mclipnode_t *out; //johnfitz -- was dclipnode_t
-	int			i, count;
+	int			count;
 	hull_t		*hull;
 
 	if (bsp2)
@@ -1647,43 +2709,9 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 	hull->clip_maxs[2] = 64;
 
 	if (bsp2)
-	{
-		for (i=0 ; i<count ; i++, out++, inl++)
-		{
-			out->planenum = LittleLong(inl->planenum);
-
-			//johnfitz -- bounds check
-			if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-				Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-			//johnfitz
-
-			out->children[0] = LittleLong(inl->children[0]);
-			out->children[1] = LittleLong(inl->children[1]);
-			//Spike: FIXME: bounds check
-		}
-	}
+		Mod_QueueLoadJob ("clipnodes", Mod_ConvertClipnodes_L, count, inl);
 	else
-	{
-		for (i=0 ; i<count ; i++, out++, ins++)
-		{
-			out->planenum = LittleLong(ins->planenum);
-
-		//johnfitz -- bounds check
-		if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-			Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-		//johnfitz
-
-			//johnfitz -- support clipnodes > 32k
-			out->children[0] = (unsigned short)LittleShort(ins->children[0]);
-			out->children[1] = (unsigned short)LittleShort(ins->children[1]);
-
-			if (out->children[0] >= count)
-				out->children[0] -= 65536;
-			if (out->children[1] >= count)
-				out->children[1] -= 65536;
-			//johnfitz
-		}
-	}
+		Mod_QueueLoadJob ("clipnodes", Mod_ConvertClipnodes_S, count, ins);
 }
 
 /*
@@ -1704,12 +2732,15 @@ void Mod_MakeHull0 (void)
 
 	in = loadmodel->nodes;
 	count = loadmodel->numnodes;
-	out = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
 
-	hull->clipnodes = out;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
 	hull->planes = loadmodel->planes;
+	if ((hull->clipnodes = Mod_CachedHull0 (count)))
+		return;
+
+	out = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
+	hull->clipnodes = out;
 
 	for (i=0 ; i<count ; i++, out++, in++)
 	{
@@ -1783,6 +2814,21 @@ void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 	}
 }
 
+/*
+=================
+Mod_ConvertSurfedges -- load job
+=================
+*/
+static const char *Mod_ConvertSurfedges (int first, int last, void *data)
+{
+	int		*in = (int *)data;
+	int		i;
+
+	for (i=first ; i<last ; i++)
+		loadmodel->surfedges[i] = LittleLong (in[i]);
+	return NULL;
+}
+
 /*
 =================
 Mod_LoadSurfedges
@@ -1790,7 +2836,7 @@ Mod_LoadSurfedges
 */
 void Mod_LoadSurfedges (lump_t *l)
 {
-	int		i, count;
+	int		count;
 	int		*in, *out;
 
 	in = (int *)(mod_base + l->fileofs);
@@ -1802,11 +2848,38 @@ void Mod_LoadSurfedges (lump_t *l)
 	loadmodel->surfedges = out;
 	loadmodel->numsurfedges = count;
 
-	for (i=0 ; i<count ; i++)
-		out[i] = LittleLong (in[i]);
+	Mod_QueueLoadJob ("surfedges", Mod_ConvertSurfedges, count, in);
 }
 
 
+/*
+=================
+Mod_ConvertPlanes -- load job
+=================
+*/
+static const char *Mod_ConvertPlanes (int first, int last, void *data)
+{
+	dplane_t	*in = (dplane_t *)data + first;
+	mplane_t	*out = loadmodel->planes + first;
+	int			i, j, bits;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		bits = 0;
+		for (j=0 ; j<3 ; j++)
+		{
+			out->normal[j] = LittleFloat (in->normal[j]);
+			if (out->normal[j] < 0)
+				bits |= 1<<j;
+		}
+
+		out->dist = LittleFloat (in->dist);
+		out->type = LittleLong (in->type);
+		out->signbits = bits;
+	}
+	return NULL;
+}
+
 /*
 =================
 Mod_LoadPlanes
@@ -1814,11 +2887,9 @@ Mod_LoadPlanes
 */
 void Mod_LoadPlanes (lump_t *l)
 {
-	int			i, j;
 	mplane_t	*out;
 	dplane_t 	*in;
 	int			count;
-	int			bits;
 
 	in = (dplane_t *)(mod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
@@ -1829,20 +2900,7 @@ void Mod_LoadPlanes (lump_t *l)
 	loadmodel->planes = out;
 	loadmodel->numplanes = count;
 
-	for (i=0 ; i<count ; i++, in++, out++)
-	{
-		bits = 0;
-		for (j=0 ; j<3 ; j++)
-		{
-			out->normal[j] = LittleFloat (in->normal[j]);
-			if (out->normal[j] < 0)
-				bits |= 1<<j;
-		}
-
-		out->dist = LittleFloat (in->dist);
-		out->type = LittleLong (in->type);
-		out->signbits = bits;
-	}
+	Mod_QueueLoadJob ("planes", Mod_ConvertPlanes, count, in);
 }
 
 /*
@@ -1973,11 +3031,25 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 	dheader_t	*header;
 	dmodel_t 	*bm;
 	float		radius; //johnfitz
+	double		start, total;
 
 	loadmodel->type = mod_brush;
 
 	header = (dheader_t *)buffer;
 
+	// key for the derived data cache, taken before anything is swapped in place
+	bspcache = NULL;
+	mod->cacheloaded = false;
+	mod->cachedlightmaps = 0;
+	mod->cachedallocated = NULL;
+	mod->cachekeyed = (gl_bspcache.value != 0);
+	if (mod->cachekeyed)
+	{
+		COM_HashInit (mod->cachekey);
+		COM_HashBytes (mod->cachekey, &com_filesize, sizeof(com_filesize));
+		COM_HashBytes (mod->cachekey, buffer, com_filesize);
+	}
+
 	mod->bspversion = LittleLong (header->version);
 
 	switch(mod->bspversion)
@@ -2003,24 +3075,42 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 		((int *)header)[i] = LittleLong ( ((int *)header)[i]);
 
 // load into heap
+	if (mod_loadprofile)
+		Con_Printf ("loading %s:\n", mod->name);
+	Mod_ProfileStage (NULL, &start);
+	total = start;
 
+	// lumps that depend on nothing else are converted together on the load threads
 	Mod_LoadVertexes (&header->lumps[LUMP_VERTEXES]);
 	Mod_LoadEdges (&header->lumps[LUMP_EDGES], bsp2);
 	Mod_LoadSurfedges (&header->lumps[LUMP_SURFEDGES]);
+	Mod_LoadPlanes (&header->lumps[LUMP_PLANES]);
+	Mod_LoadClipnodes (&header->lumps[LUMP_CLIPNODES], bsp2);
+	Mod_RunLoadJobs ();
+	Mod_ProfileStage ("lumps", &start);
+
 	Mod_LoadTextures (&header->lumps[LUMP_TEXTURES]);
+	Mod_ProfileStage ("textures", &start);
 	Mod_LoadLighting (&header->lumps[LUMP_LIGHTING]);
-	Mod_LoadPlanes (&header->lumps[LUMP_PLANES]);
+	Mod_ProfileStage ("lighting", &start);
 	Mod_LoadTexinfo (&header->lumps[LUMP_TEXINFO]);
+	Mod_ProfileStage ("texinfo", &start);
 	Mod_LoadFaces (&header->lumps[LUMP_FACES], bsp2);
+	Mod_ProfileStage (loadmodel->cacheloaded ? "faces (cached)" : "faces", &start);
 	Mod_LoadMarksurfaces (&header->lumps[LUMP_MARKSURFACES], bsp2);
 	Mod_LoadVisibility (&header->lumps[LUMP_VISIBILITY]);
 	Mod_LoadLeafs (&header->lumps[LUMP_LEAFS], bsp2);
+	Mod_ProfileStage ("leafs", &start);
 	Mod_LoadNodes (&header->lumps[LUMP_NODES], bsp2);
-	Mod_LoadClipnodes (&header->lumps[LUMP_CLIPNODES], bsp2);
+	Mod_ProfileStage ("nodes", &start);
 	Mod_LoadEntities (&header->lumps[LUMP_ENTITIES]);
+	Mod_ProfileStage ("entities", &start);
 	Mod_LoadSubmodels (&header->lumps[LUMP_MODELS]);
 
 	Mod_MakeHull0 ();
+	bspcache = NULL;
+	Mod_ProfileStage ("submodels", &start);
+	Mod_ProfileStage ("total", &total);
 
 	mod->numframes = 2;		// regular and alternate animation
 
@@ -2487,81 +3577,183 @@ void Mod_SetExtraFlags (qmodel_t *mod)
 
 /*
 =================
-Mod_LoadAliasModel
+Mod_ReadAliasHeader -- endian-adjusts and checks the mdl header, shared by
+the full and the deferred load
 =================
 */
-void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
+static void Mod_ReadAliasHeader (qmodel_t *mod, mdl_t *pinmodel, aliashdr_t *hdr)
 {
-	int					i, j;
-	mdl_t				*pinmodel;
-	stvert_t			*pinstverts;
-	dtriangle_t			*pintriangles;
-	int					version, numframes;
-	int					size;
-	daliasframetype_t	*pframetype;
-	daliasskintype_t	*pskintype;
-	int					start, end, total;
-
-	start = Hunk_LowMark ();
-
-	pinmodel = (mdl_t *)buffer;
-	mod_base = (byte *)buffer; //johnfitz
+	int		i, version;
 
 	version = LittleLong (pinmodel->version);
 	if (version != ALIAS_VERSION)
 		Sys_Error ("%s has wrong version number (%i should be %i)",
 				 mod->name, version, ALIAS_VERSION);
 
-//
-// allocate space for a working header, plus all the data except the frames,
-// skin and group info
-//
-	size	= sizeof(aliashdr_t) +
-		 (LittleLong (pinmodel->numframes) - 1) * sizeof (pheader->frames[0]);
-	pheader = (aliashdr_t *) Hunk_AllocName (size, loadname);
-
 	mod->flags = LittleLong (pinmodel->flags);
 
 //
 // endian-adjust and copy the data, starting with the alias model header
 //
-	pheader->boundingradius = LittleFloat (pinmodel->boundingradius);
-	pheader->numskins = LittleLong (pinmodel->numskins);
-	pheader->skinwidth = LittleLong (pinmodel->skinwidth);
-	pheader->skinheight = LittleLong (pinmodel->skinheight);
+	hdr->boundingradius = LittleFloat (pinmodel->boundingradius);
+	hdr->numskins = LittleLong (pinmodel->numskins);
+	hdr->skinwidth = LittleLong (pinmodel->skinwidth);
+	hdr->skinheight = LittleLong (pinmodel->skinheight);
 
-	if (pheader->skinheight > MAX_LBM_HEIGHT)
+	if (hdr->skinheight > MAX_LBM_HEIGHT)
 		Sys_Error ("model %s has a skin taller than %d", mod->name,
 				   MAX_LBM_HEIGHT);
 
-	pheader->numverts = LittleLong (pinmodel->numverts);
+	hdr->numverts = LittleLong (pinmodel->numverts);
 
-	if (pheader->numverts <= 0)
+	if (hdr->numverts <= 0)
 		Sys_Error ("model %s has no vertices", mod->name);
 
-	if (pheader->numverts > MAXALIASVERTS)
+	if (hdr->numverts > MAXALIASVERTS)
 		Sys_Error ("model %s has too many vertices", mod->name);
 
-	pheader->numtris = LittleLong (pinmodel->numtris);
+	hdr->numtris = LittleLong (pinmodel->numtris);
 
-	if (pheader->numtris <= 0)
+	if (hdr->numtris <= 0)
 		Sys_Error ("model %s has no triangles", mod->name);
 
-	pheader->numframes = LittleLong (pinmodel->numframes);
-	numframes = pheader->numframes;
-	if (numframes < 1)
-		Sys_Error ("Mod_LoadAliasModel: Invalid # of frames: %d\n", numframes);
+	hdr->numframes = LittleLong (pinmodel->numframes);
+	if (hdr->numframes < 1)
+		Sys_Error ("Mod_LoadAliasModel: Invalid # of frames: %d\n", hdr->numframes);
 
-	pheader->size = LittleFloat (pinmodel->size) * ALIAS_BASE_SIZE_RATIO;
+	hdr->size = LittleFloat (pinmodel->size) * ALIAS_BASE_SIZE_RATIO;
 	mod->synctype = (synctype_t) LittleLong (pinmodel->synctype);
-	mod->numframes = pheader->numframes;
+	mod->numframes = hdr->numframes;
 
 	for (i=0 ; i<3 ; i++)
 	{
-		pheader->scale[i] = LittleFloat (pinmodel->scale[i]);
-		pheader->scale_origin[i] = LittleFloat (pinmodel->scale_origin[i]);
-		pheader->eyeposition[i] = LittleFloat (pinmodel->eyeposition[i]);
+		hdr->scale[i] = LittleFloat (pinmodel->scale[i]);
+		hdr->scale_origin[i] = LittleFloat (pinmodel->scale_origin[i]);
+		hdr->eyeposition[i] = LittleFloat (pinmodel->eyeposition[i]);
+	}
+}
+
+/*
+=================
+Mod_LoadAliasHeader -- deferred load: just what the server and the entity
+code use (flags, sync type, frame count and bounds). nothing goes in the
+cache, so Mod_Extradata loads the whole model when it is first needed.
+=================
+*/
+static void Mod_LoadAliasHeader (qmodel_t *mod, void *buffer)
+{
+	aliashdr_t			header;
+	mdl_t				*pinmodel;
+	daliasskintype_t	*pskintype;
+	daliasskingroup_t	*pinskingroup;
+	daliasframetype_t	*pframetype;
+	daliasgroup_t		*pingroup;
+	daliasframe_t		*pinframe;
+	int					i, j, size, count;
+	double				start;
+
+	start = Mod_LoadTime ();
+
+	pinmodel = (mdl_t *)buffer;
+	memset (&header, 0, sizeof(header));
+	Mod_ReadAliasHeader (mod, pinmodel, &header);
+	pheader = &header; //Mod_CalcAliasBounds scales by it
+
+	if (header.numskins < 1 || header.numskins > MAX_SKINS)
+		Sys_Error ("Mod_LoadAliasModel: Invalid # of skins: %d\n", header.numskins);
+
+//
+// step over the skins, s and t vertices and triangles
+//
+	size = header.skinwidth * header.skinheight;
+	pskintype = (daliasskintype_t *)&pinmodel[1];
+	for (i=0 ; i<header.numskins ; i++)
+	{
+		if (pskintype->type == ALIAS_SKIN_SINGLE)
+			pskintype = (daliasskintype_t *)((byte *)(pskintype+1) + size);
+		else
+		{
+			pinskingroup = (daliasskingroup_t *)(pskintype+1);
+			count = LittleLong (pinskingroup->numskins);
+			pskintype = (daliasskintype_t *)((byte *)((daliasskininterval_t *)(pinskingroup+1) + count) + count*size);
+		}
+	}
+	pframetype = (daliasframetype_t *)((dtriangle_t *)((stvert_t *)pskintype + header.numverts) + header.numtris);
+
+//
+// find the poses, for the bounds
+//
+	posenum = 0;
+	for (i=0 ; i<header.numframes ; i++)
+	{
+		if ((aliasframetype_t) LittleLong (pframetype->type) == ALIAS_SINGLE)
+		{
+			pinframe = (daliasframe_t *)(pframetype + 1);
+			count = 1;
+		}
+		else
+		{
+			pingroup = (daliasgroup_t *)(pframetype + 1);
+			count = LittleLong (pingroup->numframes);
+			pinframe = (daliasframe_t *)((daliasinterval_t *)(pingroup + 1) + count);
+		}
+
+		if (count < 0 || count > MAXALIASFRAMES - posenum)
+			Sys_Error ("model %s has too many poses", mod->name);
+		for (j=0 ; j<count ; j++)
+		{
+			poseverts[posenum++] = (trivertx_t *)(pinframe + 1);
+			pinframe = (daliasframe_t *)((trivertx_t *)(pinframe + 1) + header.numverts);
+		}
+		pframetype = (daliasframetype_t *)pinframe;
 	}
+	header.numposes = posenum;
+
+	mod->type = mod_alias;
+	mod->deferred = true;
+
+	Mod_SetExtraFlags (mod);
+
+	Mod_CalcAliasBounds (&header);
+
+	mod_headertime += Mod_LoadTime () - start;
+	mod_numheaderloads++;
+}
+
+/*
+=================
+Mod_LoadAliasModel
+=================
+*/
+void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
+{
+	int					i, j;
+	mdl_t				*pinmodel;
+	stvert_t			*pinstverts;
+	dtriangle_t			*pintriangles;
+	int					numframes;
+	int					size;
+	daliasframetype_t	*pframetype;
+	daliasskintype_t	*pskintype;
+	int					start, end, total;
+	double				time;
+
+	time = Mod_LoadTime ();
+	start = Hunk_LowMark ();
+
+	pinmodel = (mdl_t *)buffer;
+	mod_base = (byte *)buffer; //johnfitz
+
+//
+// allocate space for a working header, plus all the data except the frames,
+// skin and group info
+//
+	size	= sizeof(aliashdr_t) +
+		 (LittleLong (pinmodel->numframes) - 1) * sizeof (pheader->frames[0]);
+	pheader = (aliashdr_t *) Hunk_AllocName (size, loadname);
+
+	Mod_ReadAliasHeader (mod, pinmodel, pheader);
+	numframes = pheader->numframes;
 
 
 //
@@ -2617,6 +3809,7 @@ void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
 	pheader->numposes = posenum;
 
 	mod->type = mod_alias;
+	mod->deferred = false;
 
 	Mod_SetExtraFlags (mod); //johnfitz
 
@@ -2627,6 +3820,9 @@ void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
 	//
 	GL_MakeAliasModelDisplayLists (mod, pheader);
 
+	mod_aliastime += Mod_LoadTime () - time;
+	mod_numaliasloads++;
+
 //
 // move the complete, relocatable alias model to the cache
 //
@@ -2829,12 +4025,25 @@ void Mod_Print (void)
 {
 	int		i;
 	qmodel_t	*mod;
+	int		numdeferred, deferredsize;
 
 	Con_SafePrintf ("Cached models:\n"); //johnfitz -- safeprint instead of print
+	numdeferred = deferredsize = 0;
 	for (i=0, mod=mod_known ; i < mod_numknown ; i++, mod++)
 	{
-		Con_SafePrintf ("%8p : %s\n", mod->cache.data, mod->name); //johnfitz -- safeprint instead of print
+		if (mod->type == mod_alias && mod->deferred && !mod->cache.data)
+		{
+			Con_SafePrintf ("deferred : %s\n", mod->name);
+			numdeferred++;
+			deferredsize += mod->filesize;
+		}
+		else
+			Con_SafePrintf ("%8p : %s\n", mod->cache.data, mod->name); //johnfitz -- safeprint instead of print
 	}
 	Con_Printf ("%i models\n",mod_numknown); //johnfitz -- print the total too
+
+	Con_Printf ("%i alias models deferred, %i KB of mdl data not loaded\n", numdeferred, deferredsize / 1024);
+	Con_Printf ("this map: %i header loads in %.1f ms, %i full loads in %.1f ms\n",
+		mod_numheaderloads, mod_headertime * 1000.0, mod_numaliasloads, mod_aliastime * 1000.0);
 }
 
@@ -96,6 +96,9 @@ typedef struct texture_s
 	struct texture_s	*anim_next;		// in the animation sequence
 	struct texture_s	*alternate_anims;	// bmodels in frmae 1 use these
 	unsigned			offsets[MIPLEVELS];		// four mip maps stored
+	struct gltexarray_s	*texarray;	// world texture array holding gltexture, if built
+	struct gltexarray_s	*fbarray;	// world texture array holding fullbright
+	int					texlayer, fblayer;	// layers in texarray and fbarray
 } texture_t;
 
 
@@ -191,8 +194,19 @@ typedef struct mnode_s
 
 	unsigned int		firstsurface;
 	unsigned int		numsurfaces;
+
+	int			compactnode;	// index in compactnodes
 } mnode_t;
 
+// the part of an mnode_t that traversals read, packed into one array in
+// depth-first order.  the plane is copied in so there's no pointer to chase
+typedef struct mcompactnode_s
+{
+	mplane_t	plane;
+	int			children[2];	// compactnodes index, or -1 - leaf number
+	int			node;			// index in nodes, for surfaces and bounds
+} mcompactnode_t;
+
 
 
 typedef struct mleaf_s
@@ -454,6 +468,7 @@ typedef struct qmodel_s
 
 	int			numnodes;
 	mnode_t		*nodes;
+	mcompactnode_t	*compactnodes;	// [numnodes], shared with the submodels like nodes
 
 	int			numtexinfo;
 	mtexinfo_t	*texinfo;
@@ -477,10 +492,17 @@ typedef struct qmodel_s
 
 	byte		*visdata;
 	byte		*lightdata;
+	int			lightdatasize;		// bytes at lightdata, 3 per sample
 	char		*entities;
 
 	int			bspversion;
 
+	unsigned	cachekey[2];		// 64 bit hash of the bsp file, for the derived data cache
+	qboolean	cachekeyed;			// cachekey was taken; gl_bspcache was on at load
+	qboolean	cacheloaded;		// surfaces, polys and hull0 came from the cache
+	int			cachedlightmaps;	// lightmap blocks the cached surfaces were placed in
+	int			*cachedallocated;	// [cachedlightmaps][LMBLOCK_WIDTH] block heights after placing them
+
 //
 // alias model
 //
@@ -496,6 +518,10 @@ typedef struct qmodel_s
 //
 	cache_user_t	cache;		// only access through Mod_Extradata
 
+	qboolean	deferred;		// alias model with only flags and bounds loaded, Mod_Extradata loads the rest
+	qboolean	prefetch;		// deferred and queued for Mod_PrefetchFrame
+	int			filesize;		// size of the model file, for mcache
+
 } qmodel_t;
 
 //============================================================================
@@ -506,10 +532,20 @@ void	Mod_ResetAll (void); // for gamedir changes (Host_Game_f)
 qmodel_t *Mod_ForName (const char *name, qboolean crash);
 void	*Mod_Extradata (qmodel_t *mod);	// handles caching
 void	Mod_TouchModel (const char *name);
+void	Mod_Prefetch (qmodel_t *mod);	// an entity uses it, load it in the next few frames
+void	Mod_PrefetchFrame (void);
 
 mleaf_t *Mod_PointInLeaf (float *p, qmodel_t *model);
 byte	*Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model);
 
 void Mod_SetExtraFlags (qmodel_t *mod);
 
+//load threads: func is called for ranges of [0, count) and returns NULL or an error
+typedef const char *(*modjobfunc_t) (int first, int last, void *data);
+void Mod_QueueLoadJob (const char *name, modjobfunc_t func, int count, void *data);
+void Mod_RunLoadJobs (void);
+void Mod_ProfileStage (const char *name, double *start);
+
+void Mod_WriteBSPCache (qmodel_t *mod, const int *allocated, int numlightmaps);
+
 #endif	// __MODEL__
@@ -86,29 +86,27 @@ void R_RemoveEfrags (entity_t *ent)
 
 /*
 ===================
-R_SplitEntityOnNode
+R_SplitEntityOnNode -- nodenum is a cl.worldmodel->compactnodes index, or
+-1 - leaf number
 ===================
 */
-void R_SplitEntityOnNode (mnode_t *node)
+void R_SplitEntityOnNode (int nodenum)
 {
 	efrag_t		*ef;
-	mplane_t	*splitplane;
+	mcompactnode_t	*node;
 	mleaf_t		*leaf;
 	int			sides;
 
-	if (node->contents == CONTENTS_SOLID)
-	{
-		return;
-	}
-
 // add an efrag if the node is a leaf
 
-	if ( node->contents < 0)
+	if (nodenum < 0)
 	{
-		if (!r_pefragtopnode)
-			r_pefragtopnode = node;
+		leaf = cl.worldmodel->leafs + (-1 - nodenum);
+		if (leaf->contents == CONTENTS_SOLID)
+			return;
 
-		leaf = (mleaf_t *)node;
+		if (!r_pefragtopnode)
+			r_pefragtopnode = (mnode_t *)leaf;
 
 // grab an efrag off the free list
 		ef = cl.free_efrags;
@@ -142,15 +140,15 @@ void R_SplitEntityOnNode (mnode_t *node)
 
 // NODE_MIXED
 
-	splitplane = node->plane;
-	sides = BOX_ON_PLANE_SIDE(r_emins, r_emaxs, splitplane);
+	node = cl.worldmodel->compactnodes + nodenum;
+	sides = BOX_ON_PLANE_SIDE(r_emins, r_emaxs, &node->plane);
 
 	if (sides == 3)
 	{
 	// split on this plane
 	// if this is the first splitter of this bmodel, remember it
 		if (!r_pefragtopnode)
-			r_pefragtopnode = node;
+			r_pefragtopnode = cl.worldmodel->nodes + node->node;
 	}
 
 // recurse down the contacted sides
@@ -210,7 +208,7 @@ void R_AddEfrags (entity_t *ent)
 		r_emaxs[i] = ent->origin[i] + entmodel->maxs[i];
 	}
 
-	R_SplitEntityOnNode (cl.worldmodel->nodes);
+	R_SplitEntityOnNode (cl.worldmodel->nodes->compactnode);
 
 	ent->topnode = r_pefragtopnode;
 
@@ -163,12 +163,14 @@ DYNAMIC LIGHTS
 
 /*
 =============
-R_MarkLights -- johnfitz -- rewritten to use LordHavoc's lighting speedup
+R_MarkLightsNode -- johnfitz -- rewritten to use LordHavoc's lighting speedup
+walks the world's compactnodes, going back to nodes only for the surfaces
 =============
 */
-void R_MarkLights (dlight_t *light, int num, mnode_t *node)
+static void R_MarkLightsNode (dlight_t *light, int num, int nodenum)
 {
-	mplane_t	*splitplane;
+	mcompactnode_t	*node;
+	mnode_t		*surfnode;
 	msurface_t	*surf;
 	vec3_t		impact;
 	float		dist, l, maxdist;
@@ -176,30 +178,31 @@ void R_MarkLights (dlight_t *light, int num, mnode_t *node)
 
 start:
 
-	if (node->contents < 0)
+	if (nodenum < 0)
 		return;
 
-	splitplane = node->plane;
-	if (splitplane->type < 3)
-		dist = light->origin[splitplane->type] - splitplane->dist;
+	node = cl.worldmodel->compactnodes + nodenum;
+	if (node->plane.type < 3)
+		dist = light->origin[node->plane.type] - node->plane.dist;
 	else
-		dist = DotProduct (light->origin, splitplane->normal) - splitplane->dist;
+		dist = DotProduct (light->origin, node->plane.normal) - node->plane.dist;
 
 	if (dist > light->radius)
 	{
-		node = node->children[0];
+		nodenum = node->children[0];
 		goto start;
 	}
 	if (dist < -light->radius)
 	{
-		node = node->children[1];
+		nodenum = node->children[1];
 		goto start;
 	}
 
 	maxdist = light->radius*light->radius;
 // mark the polygons
-	surf = cl.worldmodel->surfaces + node->firstsurface;
-	for (i=0 ; i<node->numsurfaces ; i++, surf++)
+	surfnode = cl.worldmodel->nodes + node->node;
+	surf = cl.worldmodel->surfaces + surfnode->firstsurface;
+	for (i=0 ; i<surfnode->numsurfaces ; i++, surf++)
 	{
 		for (j=0 ; j<3 ; j++)
 			impact[j] = light->origin[j] - surf->plane->normal[j]*dist;
@@ -223,10 +226,22 @@ start:
 		}
 	}
 
-	if (node->children[0]->contents >= 0)
-		R_MarkLights (light, num, node->children[0]);
-	if (node->children[1]->contents >= 0)
-		R_MarkLights (light, num, node->children[1]);
+	if (node->children[0] >= 0)
+		R_MarkLightsNode (light, num, node->children[0]);
+	if (node->children[1] >= 0)
+		R_MarkLightsNode (light, num, node->children[1]);
+}
+
+/*
+=============
+R_MarkLights -- node is the world's or a submodel's head node
+=============
+*/
+void R_MarkLights (dlight_t *light, int num, mnode_t *node)
+{
+	if (node->contents < 0)
+		return;
+	R_MarkLightsNode (light, num, node->compactnode);
 }
 
 /*
@@ -251,6 +266,7 @@ void R_PushDlights (void)
 		if (l->die < cl.time || !l->radius)
 			continue;
 		R_MarkLights (l, i, cl.worldmodel->nodes);
+		R_MarkMergedLights (l, i);
 	}
 }
 
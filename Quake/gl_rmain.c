@@ -36,6 +36,11 @@ mplane_t	frustum[4];
 //johnfitz -- rendering statistics
 int rs_brushpolys, rs_aliaspolys, rs_skypolys, rs_particles, rs_fogpolys;
 int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+int rs_particlebytes;
+int rs_transitems, rs_transbatches;
+int rs_mergedbmodels;
+int rs_texbinds;
+double rs_transsort;
 float rs_megatexels;
 
 //
@@ -69,6 +74,12 @@ cvar_t	r_shadows = {"r_shadows","0",CVAR_ARCHIVE};
 cvar_t	r_wateralpha = {"r_wateralpha","1",CVAR_ARCHIVE};
 cvar_t	r_dynamic = {"r_dynamic","1",CVAR_ARCHIVE};
 cvar_t	r_novis = {"r_novis","0",CVAR_ARCHIVE};
+cvar_t	r_alphasort = {"r_alphasort","1",CVAR_ARCHIVE};
+cvar_t	r_zprepass = {"r_zprepass","0",CVAR_ARCHIVE};
+cvar_t	r_chainsort = {"r_chainsort","1",CVAR_ARCHIVE};
+cvar_t	r_overdraw = {"r_overdraw","0",CVAR_NONE};
+cvar_t	r_mergebmodels = {"r_mergebmodels","1",CVAR_ARCHIVE};
+cvar_t	r_texturearrays = {"r_texturearrays","0",CVAR_ARCHIVE};
 
 cvar_t	gl_finish = {"gl_finish","0",CVAR_NONE};
 cvar_t	gl_clear = {"gl_clear","1",CVAR_NONE};
@@ -127,6 +138,16 @@ static GLuint gammaLoc;
 static GLuint contrastLoc;
 static GLuint textureLoc;
 
+static GLuint r_resolve_program;
+static qboolean r_resolve_failed; // don't retry a shader the driver can't compile every frame
+
+// uniforms used in resolve shader
+static GLuint resolveTextureLoc;
+static GLuint resolveSamplesLoc;
+static GLuint resolveGammaLoc;
+static GLuint resolveContrastLoc;
+static GLuint resolveBlendLoc;
+
 /*
 =============
 GLSLGamma_DeleteTexture
@@ -137,6 +158,29 @@ void GLSLGamma_DeleteTexture (void)
 	glDeleteTextures (1, &r_gamma_texture);
 	r_gamma_texture = 0;
 	r_gamma_program = 0; // deleted in R_DeleteShaders
+	r_resolve_program = 0;
+	r_resolve_failed = false;
+}
+
+/*
+=============
+GLSLGamma_DrawQuad
+
+full screen quad for the post-process shaders, which ignore the matrices
+=============
+*/
+static void GLSLGamma_DrawQuad (float smax, float tmax)
+{
+	glBegin (GL_QUADS);
+	glTexCoord2f (0, 0);
+	glVertex2f (-1, -1);
+	glTexCoord2f (smax, 0);
+	glVertex2f (1, -1);
+	glTexCoord2f (smax, tmax);
+	glVertex2f (1, 1);
+	glTexCoord2f (0, tmax);
+	glVertex2f (-1, 1);
+	glEnd ();
 }
 
 /*
@@ -242,16 +286,7 @@ void GLSLGamma_GammaCorrect (void)
 	smax = glwidth/(float)r_gamma_texture_width;
 	tmax = glheight/(float)r_gamma_texture_height;
 
-	glBegin (GL_QUADS);
-	glTexCoord2f (0, 0);
-	glVertex2f (-1, -1);
-	glTexCoord2f (smax, 0);
-	glVertex2f (1, -1);
-	glTexCoord2f (smax, tmax);
-	glVertex2f (1, 1);
-	glTexCoord2f (0, tmax);
-	glVertex2f (-1, 1);
-	glEnd ();
+	GLSLGamma_DrawQuad (smax, tmax);
 	
 	GL_UseProgramFunc (0);
 	
@@ -259,6 +294,227 @@ void GLSLGamma_GammaCorrect (void)
 	GL_ClearBindings ();
 }
 
+/*
+=============
+GLSLGamma_CreateResolveShader
+
+resolves a multisampled VR eye, shifts it towards v_blend the way
+V_PolyBlend's quad would, and applies gamma and contrast, all in one pass
+=============
+*/
+static void GLSLGamma_CreateResolveShader (void)
+{
+	const GLchar *vertSource = \
+		"#version 130\n"
+		"\n"
+		"void main(void) {\n"
+		"	gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);\n"
+		"}\n";
+
+	const GLchar *fragSource = \
+		"#version 130\n"
+		"#extension GL_ARB_texture_multisample : enable\n"
+		"\n"
+		"uniform sampler2DMS ResolveTexture;\n"
+		"uniform int Samples;\n"
+		"uniform float GammaValue;\n"
+		"uniform float ContrastValue;\n"
+		"uniform vec4 BlendColor;\n"
+		"\n"
+		"void main(void) {\n"
+		"	  ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+		"	  vec4 frag = vec4(0.0);\n"
+		"	  for (int i = 0; i < Samples; i++)\n"
+		"		  frag += texelFetch(ResolveTexture, coord, i);\n"
+		"	  frag /= float(Samples);\n"
+		"	  frag.rgb = mix(frag.rgb, BlendColor.rgb, BlendColor.a);\n"
+		"	  frag.rgb = frag.rgb * ContrastValue;\n"
+		"	  gl_FragColor = vec4(pow(frag.rgb, vec3(GammaValue)), 1.0);\n"
+		"}\n";
+
+	if (!gl_glsl_gamma_able)
+		return;
+
+	r_resolve_program = GL_CreateProgram (vertSource, fragSource, 0, NULL);
+
+// get uniform locations
+	resolveTextureLoc = GL_GetUniformLocation (&r_resolve_program, "ResolveTexture");
+	resolveSamplesLoc = GL_GetUniformLocation (&r_resolve_program, "Samples");
+	resolveGammaLoc = GL_GetUniformLocation (&r_resolve_program, "GammaValue");
+	resolveContrastLoc = GL_GetUniformLocation (&r_resolve_program, "ContrastValue");
+	resolveBlendLoc = GL_GetUniformLocation (&r_resolve_program, "BlendColor");
+}
+
+/*
+=============
+GLSLGamma_EyeNeedsPostProcess
+
+true if a VR eye needs more than a plain resolve
+=============
+*/
+qboolean GLSLGamma_EyeNeedsPostProcess (void)
+{
+	return (gl_polyblend.value && v_blend[3]) || vid_gamma.value != 1 || vid_contrast.value != 1;
+}
+
+/*
+=============
+GLSLGamma_ResolveEye
+
+draws the multisampled texture into the bound framebuffer with the resolve
+shader. returns false if the shader isn't available, so the caller can blit
+instead.
+=============
+*/
+qboolean GLSLGamma_ResolveEye (GLuint mstexture, int samples, int width, int height)
+{
+	if (!gl_glsl_gamma_able || r_resolve_failed)
+		return false;
+
+// create shader if needed
+	if (!r_resolve_program)
+	{
+		GLSLGamma_CreateResolveShader ();
+		if (!r_resolve_program)
+		{
+			Con_Warning ("GLSLGamma_CreateResolveShader failed, VR eyes get no gamma or blend\n");
+			r_resolve_failed = true;
+			return false;
+		}
+	}
+
+	GL_DisableMultitexture();
+	glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, mstexture);
+
+	GL_UseProgramFunc (r_resolve_program);
+	GL_Uniform1iFunc (resolveTextureLoc, 0); // use texture unit 0
+	GL_Uniform1iFunc (resolveSamplesLoc, samples);
+	GL_Uniform1fFunc (resolveGammaLoc, vid_gamma.value);
+	GL_Uniform1fFunc (resolveContrastLoc, q_min(2.0, q_max(1.0, vid_contrast.value)));
+	if (gl_polyblend.value)
+		GL_Uniform4fFunc (resolveBlendLoc, v_blend[0], v_blend[1], v_blend[2], v_blend[3]);
+	else
+		GL_Uniform4fFunc (resolveBlendLoc, 0, 0, 0, 0);
+
+	glDisable (GL_ALPHA_TEST);
+	glDisable (GL_DEPTH_TEST);
+	glDisable (GL_BLEND);
+	glDisable (GL_CULL_FACE);
+
+	glViewport (0, 0, width, height);
+
+	GLSLGamma_DrawQuad (1, 1);
+
+	GL_UseProgramFunc (0);
+	glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+	return true;
+}
+
+/*
+=============
+R_TimePostProcess_f -- timepostprocess [passes]
+
+times the left eye's resolve done as separate passes (a blit, a blend quad,
+then a copy and a gamma pass, as the desktop does) against the single
+GLSLGamma_ResolveEye pass, and prints the framebuffer traffic of each
+=============
+*/
+void R_TimePostProcess_f (void)
+{
+	FramebufferDesc_t	*fb = &VR_framebuffers[0];
+	GLuint		scratch;
+	int			i, passes;
+	double		start, separate, single;
+	float		pixels, separatemb, singlemb;
+
+	if (!vr_initialized)
+	{
+		Con_Printf ("timepostprocess needs VR running\n");
+		return;
+	}
+
+	if (!r_gamma_program)
+		GLSLGamma_CreateShaders ();
+	if (!r_resolve_program && !r_resolve_failed)
+		GLSLGamma_CreateResolveShader ();
+	if (!r_gamma_program || !r_resolve_program)
+	{
+		Con_Printf ("timepostprocess needs the GLSL gamma and resolve shaders\n");
+		return;
+	}
+
+	passes = (Cmd_Argc () == 2) ? q_max(1, atoi (Cmd_Argv (1))) : 100;
+
+	GL_DisableMultitexture();
+	glGenTextures (1, &scratch);
+	glBindTexture (GL_TEXTURE_2D, scratch);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, vr_width, vr_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	glDisable (GL_ALPHA_TEST);
+	glDisable (GL_DEPTH_TEST);
+	glDisable (GL_CULL_FACE);
+	glViewport (0, 0, vr_width, vr_height);
+	glMatrixMode (GL_PROJECTION);
+	glLoadIdentity ();
+	glMatrixMode (GL_MODELVIEW);
+	glLoadIdentity ();
+
+	glFinish ();
+	start = Sys_DoubleTime ();
+	for (i = 0; i < passes; i++)
+	{
+		GL_BindFramebufferFunc (GL_READ_FRAMEBUFFER, fb->m_nRenderFramebufferId);
+		GL_BindFramebufferFunc (GL_DRAW_FRAMEBUFFER, fb->m_nResolveFramebufferId);
+		GL_BlitFramebufferFunc (0, 0, vr_width, vr_height, 0, 0, vr_width, vr_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		GL_BindFramebufferFunc (GL_FRAMEBUFFER, fb->m_nResolveFramebufferId);
+
+		glDisable (GL_TEXTURE_2D);
+		glEnable (GL_BLEND);
+		glColor4f (1, 0, 0, 0.25f);
+		GLSLGamma_DrawQuad (1, 1);
+		glColor4f (1, 1, 1, 1);
+		glDisable (GL_BLEND);
+		glEnable (GL_TEXTURE_2D);
+
+		glBindTexture (GL_TEXTURE_2D, scratch);
+		glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, 0, 0, vr_width, vr_height);
+		GL_UseProgramFunc (r_gamma_program);
+		GL_Uniform1fFunc (gammaLoc, vid_gamma.value);
+		GL_Uniform1fFunc (contrastLoc, q_min(2.0, q_max(1.0, vid_contrast.value)));
+		GL_Uniform1iFunc (textureLoc, 0);
+		GLSLGamma_DrawQuad (1, 1);
+		GL_UseProgramFunc (0);
+	}
+	glFinish ();
+	separate = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (i = 0; i < passes; i++)
+	{
+		GL_BindFramebufferFunc (GL_FRAMEBUFFER, fb->m_nResolveFramebufferId);
+		GLSLGamma_ResolveEye (fb->m_nRenderTextureId, msaa_samples, vr_width, vr_height);
+	}
+	glFinish ();
+	single = Sys_DoubleTime () - start;
+
+	GL_BindFramebufferFunc (GL_FRAMEBUFFER, 0);
+	glDeleteTextures (1, &scratch);
+	GL_ClearBindings ();
+
+// both ways read every sample and write the resolved pixel; the blend quad,
+// the copy and the gamma pass each read and write the whole eye once more
+	pixels = (float)vr_width * vr_height;
+	singlemb = pixels * 4 * (msaa_samples + 1) / (1024 * 1024);
+	separatemb = singlemb + pixels * 4 * 6 / (1024 * 1024);
+
+	Con_Printf ("separate passes: %.3f ms, %.1f MB per eye\n", separate * 1000 / passes, separatemb);
+	Con_Printf ("single pass:     %.3f ms, %.1f MB per eye\n", single * 1000 / passes, singlemb);
+	Con_Printf ("%.1f MB less traffic per frame for both eyes\n", 2 * (separatemb - singlemb));
+}
+
 /*
 =================
 R_CullBox -- johnfitz -- replaced with new function from lordhavoc
@@ -609,6 +865,208 @@ void R_SetupView (void)
 //
 //==============================================================================
 
+/*
+=============
+R_DrawEntity
+=============
+*/
+static void R_DrawEntity (entity_t *e)
+{
+	currententity = e;
+
+	switch (e->model->type)
+	{
+		case mod_alias:
+			R_DrawAliasModel (e);
+			break;
+		case mod_brush:
+			R_DrawBrushModel (e);
+			break;
+		case mod_sprite:
+			R_DrawSpriteModel (e);
+			break;
+	}
+}
+
+/*
+=============
+TRANSPARENCY QUEUE
+
+translucent water surfaces, alpha entities and the particles are collected
+here, sorted back to front by view depth, and drawn in runs that share a
+texture and alpha
+=============
+*/
+
+#define MAX_TRANSITEMS	16384
+
+typedef struct
+{
+	unsigned	key;		// sortable depth, far to near
+	transkind_t	kind;
+	void		*data;		// msurface_t or entity_t
+	gltexture_t	*texture;	// for batching
+	float		alpha;
+} transitem_t;
+
+static transitem_t	transitems[MAX_TRANSITEMS];
+static int			transorder[2][MAX_TRANSITEMS];
+static int			numtransitems;
+
+/*
+=============
+R_AddTransparent
+
+returns false if the queue is full, in which case the caller should draw it
+right away
+=============
+*/
+qboolean R_AddTransparent (transkind_t kind, void *data, vec3_t org, gltexture_t *texture, float alpha)
+{
+	transitem_t	*item;
+	vec3_t		dir;
+	union { float f; unsigned u; } depth;
+
+	if (numtransitems == MAX_TRANSITEMS)
+		return false;
+
+	VectorSubtract (org, r_origin, dir);
+	depth.f = DotProduct (dir, vpn);
+	if (!(depth.f > 0)) // anything centered behind the eye ties with the glows and particles, which are queued last
+		depth.f = 0;
+
+	item = &transitems[numtransitems++];
+	// flip the float bits so larger depths sort first as unsigned ints
+	item->key = (depth.u & 0x80000000) ? depth.u : ~(depth.u | 0x80000000);
+	item->kind = kind;
+	item->data = data;
+	item->texture = texture;
+	item->alpha = alpha;
+	return true;
+}
+
+/*
+=============
+R_AddTransparentEntity
+=============
+*/
+static qboolean R_AddTransparentEntity (entity_t *e)
+{
+	vec3_t	org;
+
+	if (e->model->type == mod_brush)
+	{
+		// brush model origins are usually 0,0,0 so use the bounds
+		VectorAdd (e->model->mins, e->model->maxs, org);
+		VectorMA (e->origin, 0.5, org, org);
+	}
+	else
+		VectorCopy (e->origin, org);
+
+	return R_AddTransparent (trans_entity, e, org, NULL, ENTALPHA_DECODE(e->alpha));
+}
+
+/*
+=============
+R_SortTransparent -- 4 pass LSD radix sort on the keys, returns the sorted order
+=============
+*/
+static int *R_SortTransparent (void)
+{
+	int		count[256];
+	int		*in, *out, *swap;
+	int		i, pass, shift, sum, b;
+
+	in = transorder[0];
+	out = transorder[1];
+	for (i=0 ; i<numtransitems ; i++)
+		in[i] = i;
+
+	for (pass=0 ; pass<4 ; pass++)
+	{
+		shift = pass * 8;
+		memset (count, 0, sizeof(count));
+		for (i=0 ; i<numtransitems ; i++)
+			count[(transitems[i].key >> shift) & 255]++;
+
+		// skip passes where every key has the same byte
+		if (count[(transitems[0].key >> shift) & 255] == numtransitems)
+			continue;
+
+		for (i=0, sum=0 ; i<256 ; i++)
+		{
+			b = count[i];
+			count[i] = sum;
+			sum += b;
+		}
+		for (i=0 ; i<numtransitems ; i++)
+			out[count[(transitems[in[i]].key >> shift) & 255]++] = in[i];
+
+		swap = in;
+		in = out;
+		out = swap;
+	}
+
+	return in;
+}
+
+/*
+=============
+R_DrawTransparent -- draws and empties the queue
+=============
+*/
+void R_DrawTransparent (void)
+{
+	static msurface_t	*batch[MAX_TRANSITEMS];
+	transitem_t	*item, *next;
+	int			*order;
+	int			i, numbatch;
+	double		time;
+
+	if (!numtransitems)
+		return;
+
+	time = Sys_DoubleTime ();
+	order = R_SortTransparent ();
+	rs_transsort += Sys_DoubleTime () - time;
+	rs_transitems += numtransitems;
+
+	for (i=0 ; i<numtransitems ; )
+	{
+		item = &transitems[order[i++]];
+		rs_transbatches++;
+
+		switch (item->kind)
+		{
+		case trans_water:
+			// surfaces with the same texture and alpha that sort together go in one batch
+			numbatch = 0;
+			batch[numbatch++] = (msurface_t *)item->data;
+			while (i < numtransitems)
+			{
+				next = &transitems[order[i]];
+				if (next->kind != trans_water || next->texture != item->texture || next->alpha != item->alpha)
+					break;
+				batch[numbatch++] = (msurface_t *)next->data;
+				i++;
+			}
+			R_DrawWaterBatch (batch, numbatch, item->alpha);
+			break;
+		case trans_entity:
+			R_DrawEntity ((entity_t *)item->data);
+			break;
+		case trans_dlights:
+			R_RenderDlights ();
+			break;
+		case trans_particles:
+			R_DrawParticles ();
+			break;
+		}
+	}
+
+	numtransitems = 0;
+}
+
 /*
 =============
 R_DrawEntitiesOnList
@@ -637,19 +1095,23 @@ void R_DrawEntitiesOnList (qboolean alphapass) //johnfitz -- added parameter
 			currententity->angles[0] *= 0.3;
 		//johnfitz
 
-		switch (currententity->model->type)
+		if (currententity->merged) //drawn with the world
+			continue;
+
+		if (alphapass && r_alphasort.value && R_AddTransparentEntity (currententity))
+			continue;
+
+		// opaque sprites are drawn together, sorted by texture
+		if (!alphapass && currententity->model->type == mod_sprite)
 		{
-			case mod_alias:
-				R_DrawAliasModel (currententity);
-				break;
-			case mod_brush:
-				R_DrawBrushModel (currententity);
-				break;
-			case mod_sprite:
-				R_DrawSpriteModel (currententity);
-				break;
+			R_BatchSpriteModel (currententity);
+			continue;
 		}
+
+		R_DrawEntity (currententity);
 	}
+
+	R_FlushSpriteBatch ();
 }
 
 /*
@@ -816,7 +1278,8 @@ void R_ShowTris (void)
 			switch (currententity->model->type)
 			{
 			case mod_brush:
-				R_DrawBrushModel_ShowTris (currententity);
+				if (!currententity->merged) //drawn with the world
+					R_DrawBrushModel_ShowTris (currententity);
 				break;
 			case mod_alias:
 				R_DrawAliasModel_ShowTris (currententity);
@@ -868,11 +1331,28 @@ R_DrawShadows
 */
 void R_DrawShadows (void)
 {
-	int i;
+	static entity_t	*casters[MAX_VISEDICTS];
+	int i, numcasters;
 
 	if (!r_shadows.value || !r_drawentities.value || r_drawflat_cheatsafe || r_lightmap_cheatsafe)
 		return;
 
+	// gather the casters so they're drawn in one batch
+	numcasters = 0;
+	for (i=0 ; i<cl_numvisedicts ; i++)
+	{
+		if (cl_visedicts[i]->model->type != mod_alias)
+			continue;
+
+		if (cl_visedicts[i] == &cl.viewent)
+			break;
+
+		casters[numcasters++] = cl_visedicts[i];
+	}
+
+	if (!numcasters)
+		return;
+
 	// Use stencil buffer to prevent self-intersecting shadows, from Baker (MarkV)
 	if (gl_stencilbits)
 	{
@@ -882,18 +1362,7 @@ void R_DrawShadows (void)
 		glEnable(GL_STENCIL_TEST);
 	}
 
-	for (i=0 ; i<cl_numvisedicts ; i++)
-	{
-		currententity = cl_visedicts[i];
-
-		if (currententity->model->type != mod_alias)
-			continue;
-
-		if (currententity == &cl.viewent)
-			return;
-
-		GL_DrawAliasShadow (currententity);
-	}
+	GL_DrawAliasShadows (casters, numcasters);
 
 	if (gl_stencilbits)
 	{
@@ -922,13 +1391,39 @@ void R_RenderScene (void)
 
 	R_DrawEntitiesOnList (false); //johnfitz -- false means this is the pass for nonalpha entities
 
-	R_DrawWorld_Water (); //johnfitz -- drawn here since they might have transparency
+	if (r_alphasort.value)
+	{
+		R_DrawWorld_Water (); //queues the water surfaces
+
+		R_DrawEntitiesOnList (true); //queues the alpha entities
+
+		// both at the eye, which is as near as any key gets, and the sort is
+		// stable, so the glows come after the water and alpha entities and
+		// just before the particles
+		if (!R_AddTransparent (trans_dlights, NULL, r_origin, NULL, 1))
+		{
+			R_DrawTransparent ();
+			R_RenderDlights ();
+		}
+
+		if (!R_AddTransparent (trans_particles, NULL, r_origin, NULL, 1))
+		{
+			R_DrawTransparent ();
+			R_DrawParticles ();
+		}
+
+		R_DrawTransparent ();
+	}
+	else
+	{
+		R_DrawWorld_Water (); //johnfitz -- drawn here since they might have transparency
 
-	R_DrawEntitiesOnList (true); //johnfitz -- true means this is the pass for alpha entities
+		R_DrawEntitiesOnList (true); //johnfitz -- true means this is the pass for alpha entities
 
-	R_RenderDlights (); //triangle fan dlights -- johnfitz -- moved after water
+		R_RenderDlights (); //triangle fan dlights -- johnfitz -- moved after water
 
-	R_DrawParticles ();
+		R_DrawParticles ();
+	}
 
 	Fog_DisableGFog (); //johnfitz
 
@@ -962,7 +1457,9 @@ void R_RenderView (void)
 
 		//johnfitz -- rendering statistics
 		rs_brushpolys = rs_aliaspolys = rs_skypolys = rs_particles = rs_fogpolys = rs_megatexels =
-		rs_dynamiclightmaps = rs_aliaspasses = rs_skypasses = rs_brushpasses = 0;
+		rs_dynamiclightmaps = rs_aliaspasses = rs_skypasses = rs_brushpasses = rs_particlebytes = 0;
+		rs_transitems = rs_transbatches = rs_texbinds = 0;
+		rs_transsort = 0;
 	}
 	else if (gl_finish.value)
 		glFinish ();
@@ -1019,8 +1516,16 @@ void R_RenderView (void)
 			(int)cl.viewangles[PITCH],
 			(int)cl.viewangles[YAW],
 			(int)cl.viewangles[ROLL]);
+	else if (r_speeds.value == 3)
+		Con_Printf ("%3i ms  %4i trans %4i batches %.3f ms sort %4i merged bmodels %4i binds\n",
+					(int)((time2-time1)*1000),
+					rs_transitems,
+					rs_transbatches,
+					rs_transsort * 1000,
+					rs_mergedbmodels,
+					rs_texbinds);
 	else if (r_speeds.value == 2)
-		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i lmap %4i/%4i sky %1.1f mtex\n",
+		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i lmap %4i/%4i sky %1.1f mtex %5i part %4i kb\n",
 					(int)((time2-time1)*1000),
 					rs_brushpolys,
 					rs_brushpasses,
@@ -1029,7 +1534,9 @@ void R_RenderView (void)
 					rs_dynamiclightmaps,
 					rs_skypolys,
 					rs_skypasses,
-					TexMgr_FrameUsage ());
+					TexMgr_FrameUsage (),
+					rs_particles,
+					rs_particlebytes / 1024);
 	else if (r_speeds.value)
 		Con_Printf ("%3i ms  %4i wpoly %4i epoly %3i lmap\n",
 					(int)((time2-time1)*1000),
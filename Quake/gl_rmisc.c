@@ -37,6 +37,12 @@ extern cvar_t gl_overbright_models;
 extern cvar_t r_waterquality;
 extern cvar_t r_oldwater;
 extern cvar_t r_waterwarp;
+extern cvar_t r_watershader;
+extern cvar_t r_zprepass;
+extern cvar_t r_chainsort;
+extern cvar_t r_overdraw;
+extern cvar_t r_mergebmodels;
+extern cvar_t r_texturearrays;
 extern cvar_t r_oldskyleaf;
 extern cvar_t r_drawworld;
 extern cvar_t r_showtris;
@@ -178,6 +184,10 @@ void R_Init (void)
 
 	Cmd_AddCommand ("timerefresh", R_TimeRefresh_f);
 	Cmd_AddCommand ("pointfile", R_ReadPointFile_f);
+	Cmd_AddCommand ("comparewarp", R_CompareWarp_f);
+	Cmd_AddCommand ("checktexarrays", R_CheckTexArrays_f);
+	Cmd_AddCommand ("timepostprocess", R_TimePostProcess_f);
+	Cmd_AddCommand ("timesprites", R_TimeSprites_f);
 
 	Cvar_RegisterVariable (&r_norefresh);
 	Cvar_RegisterVariable (&r_lightmap);
@@ -190,6 +200,13 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_dynamic);
 	Cvar_RegisterVariable (&r_novis);
 	Cvar_SetCallback (&r_novis, R_VisChanged);
+	Cvar_RegisterVariable (&r_alphasort);
+	Cvar_RegisterVariable (&r_zprepass);
+	Cvar_RegisterVariable (&r_chainsort);
+	Cvar_RegisterVariable (&r_overdraw);
+	Cvar_RegisterVariable (&r_mergebmodels);
+	Cvar_SetCallback (&r_mergebmodels, R_VisChanged);
+	Cvar_RegisterVariable (&r_texturearrays);
 	Cvar_RegisterVariable (&r_speeds);
 	Cvar_RegisterVariable (&r_pos);
 
@@ -211,6 +228,7 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_waterquality);
 	Cvar_RegisterVariable (&r_oldwater);
 	Cvar_RegisterVariable (&r_waterwarp);
+	Cvar_RegisterVariable (&r_watershader);
 	Cvar_RegisterVariable (&r_drawflat);
 	Cvar_RegisterVariable (&r_flatlightstyles);
 	Cvar_RegisterVariable (&r_oldskyleaf);
@@ -395,6 +413,8 @@ void R_NewMap (void)
 
 	r_viewleaf = NULL;
 	R_ClearParticles ();
+	R_ClearMergedBModels ();
+	R_DeleteWorldTextureArrays ();
 
 	GL_BuildLightmaps ();
 	GL_BuildBModelVertexBuffer ();
@@ -119,6 +119,9 @@ float		scr_disabled_time;
 int	scr_tileclear_updates = 0; //johnfitz
 
 void SCR_ScreenShot_f (void);
+static void SCR_CaptureStart_f (void);
+static void SCR_CaptureStop_f (void);
+extern cvar_t capture_fps, capture_format;
 
 /*
 ===============================================================================
@@ -423,6 +426,10 @@ void SCR_Init (void)
 	Cvar_RegisterVariable (&gl_triplebuffer);
 
 	Cmd_AddCommand ("screenshot",SCR_ScreenShot_f);
+	Cvar_RegisterVariable (&capture_fps);
+	Cvar_RegisterVariable (&capture_format);
+	Cmd_AddCommand ("capture_start",SCR_CaptureStart_f);
+	Cmd_AddCommand ("capture_stop",SCR_CaptureStop_f);
 	Cmd_AddCommand ("sizeup",SCR_SizeUp_f);
 	Cmd_AddCommand ("sizedown",SCR_SizeDown_f);
 
@@ -757,49 +764,612 @@ SCREEN SHOTS
 ==============================================================================
 */
 
+/*
+===============================================================================
+
+SCREEN CAPTURE
+
+screenshot and capture_start frames are read back into pixel buffer objects
+and mapped a frame later, so glReadPixels doesn't wait for the frame to
+finish. the files are written by a thread of their own.
+
+===============================================================================
+*/
+
+cvar_t		capture_fps = {"capture_fps", "30", CVAR_ARCHIVE}; // 0 = capture every frame in real time
+cvar_t		capture_format = {"capture_format", "tga", CVAR_ARCHIVE}; // tga, rle or raw
+
+#define CAPTURE_QUEUE	8	// frames waiting for the writer thread
+
+typedef enum {capture_tga, capture_rle, capture_raw, capture_close} captureformat_t;
+
+typedef struct
+{
+	captureformat_t	format;
+	byte			*data;		// rgb, bottom row first; freed by the writer
+	int				width, height;
+	char			path[MAX_OSPATH];	// tga and rle
+	FILE			*file;		// raw and close
+	qboolean		screenshot;	// report when written
+} capturejob_t;
+
+typedef struct
+{
+	GLuint		pbo;
+	int			size;
+	int			width, height;
+	qboolean	pending;		// read into pbo, not queued yet
+	char		screenshot[MAX_OSPATH];	// write this frame here too, if set
+	int			frame;			// capture frame number, or -1
+} capturereadback_t;
+
+static capturereadback_t	capture_readbacks[2];
+static int		capture_nextreadback;
+
+static SDL_Thread	*capture_thread;
+static SDL_mutex	*capture_mutex;
+static SDL_cond		*capture_cond;	// signalled whenever the queue changes
+static capturejob_t	capture_queue[CAPTURE_QUEUE];
+static int		capture_head, capture_count;
+static char		capture_messages[1024];	// from the writer thread, printed by the main thread
+
+static qboolean	capture_active;
+static captureformat_t	capture_activeformat;
+static int		capture_number;
+static int		capture_width, capture_height;
+static int		capture_frames, capture_dropped;
+static double	capture_waited;
+static FILE		*capture_rawfile;
+static char		capture_screenshot[MAX_OSPATH];
+
 /*
 ==================
-SCR_ScreenShot_f -- johnfitz -- rewritten to use Image_WriteTGA
+SCR_CaptureThread
+
+writes queued jobs in order; the job stays at the head of the queue until it
+is written, so capture_count == 0 means everything is on disk
 ==================
 */
-void SCR_ScreenShot_f (void)
+static int SCR_CaptureThread (void *unused)
+{
+	capturejob_t	job;
+	qboolean		ok;
+	size_t			len;
+
+	SDL_LockMutex (capture_mutex);
+	for (;;)
+	{
+		while (!capture_count)
+			SDL_CondWait (capture_cond, capture_mutex);
+		job = capture_queue[capture_head];
+		SDL_UnlockMutex (capture_mutex);
+
+		switch (job.format)
+		{
+		case capture_tga:
+		case capture_rle:
+			ok = Image_WriteTGAFile (job.path, job.data, job.width, job.height, 24, false, job.format == capture_rle);
+			break;
+		case capture_raw:
+			ok = fwrite (job.data, job.width * job.height * 3, 1, job.file) == 1;
+			break;
+		case capture_close:
+		default:
+			ok = fclose (job.file) == 0;
+			break;
+		}
+		free (job.data);
+
+		SDL_LockMutex (capture_mutex);
+		len = strlen (capture_messages);
+		if (!ok)
+			q_snprintf (capture_messages + len, sizeof(capture_messages) - len, "Couldn't write %s\n", job.path[0] ? job.path : "capture");
+		else if (job.screenshot)
+			q_snprintf (capture_messages + len, sizeof(capture_messages) - len, "Wrote %s\n", COM_SkipPath (job.path));
+		capture_head = (capture_head + 1) % CAPTURE_QUEUE;
+		capture_count--;
+		SDL_CondBroadcast (capture_cond);
+	}
+
+	return 0;
+}
+
+/*
+==================
+SCR_QueueCaptureJob
+
+hands a job to the writer thread. if the queue is full the job is dropped
+and false returned, unless wait is set.
+==================
+*/
+static qboolean SCR_QueueCaptureJob (capturejob_t *job, qboolean wait)
+{
+	double	start;
+
+	if (!capture_thread)
+	{
+		capture_mutex = SDL_CreateMutex ();
+		capture_cond = SDL_CreateCond ();
+#if defined(USE_SDL2)
+		capture_thread = SDL_CreateThread (SCR_CaptureThread, "capture", NULL);
+#else
+		capture_thread = SDL_CreateThread (SCR_CaptureThread, NULL);
+#endif
+		if (!capture_thread)
+			Sys_Error ("SCR_QueueCaptureJob: couldn't create the capture thread");
+	}
+
+	SDL_LockMutex (capture_mutex);
+	if (capture_count == CAPTURE_QUEUE)
+	{
+		if (!wait)
+		{
+			SDL_UnlockMutex (capture_mutex);
+			free (job->data);
+			return false;
+		}
+		start = Sys_DoubleTime ();
+		while (capture_count == CAPTURE_QUEUE)
+			SDL_CondWait (capture_cond, capture_mutex);
+		capture_waited += Sys_DoubleTime () - start;
+	}
+	capture_queue[(capture_head + capture_count) % CAPTURE_QUEUE] = *job;
+	capture_count++;
+	SDL_CondBroadcast (capture_cond);
+	SDL_UnlockMutex (capture_mutex);
+
+	return true;
+}
+
+/*
+==================
+SCR_FlushCaptureQueue
+
+waits for the writer thread to finish everything queued, and prints what it
+had to say
+==================
+*/
+static void SCR_FlushCaptureQueue (void)
+{
+	if (!capture_thread)
+		return;
+
+	SDL_LockMutex (capture_mutex);
+	while (capture_count)
+		SDL_CondWait (capture_cond, capture_mutex);
+	SDL_UnlockMutex (capture_mutex);
+}
+
+/*
+==================
+SCR_PrintCaptureMessages
+==================
+*/
+static void SCR_PrintCaptureMessages (void)
+{
+	char	messages[sizeof(capture_messages)];
+
+	if (!capture_thread)
+		return;
+
+	SDL_LockMutex (capture_mutex);
+	q_strlcpy (messages, capture_messages, sizeof(messages));
+	capture_messages[0] = 0;
+	SDL_UnlockMutex (capture_mutex);
+
+	if (messages[0])
+		Con_SafePrintf ("%s", messages);
+}
+
+/*
+==================
+SCR_QueueReadback
+
+turns a finished readback into jobs for the writer thread; takes ownership
+of data
+==================
+*/
+static void SCR_QueueReadback (capturereadback_t *rb, byte *data)
+{
+	capturejob_t	job;
+	int				size = rb->width * rb->height * 3;
+
+	if (rb->screenshot[0])
+	{
+		memset (&job, 0, sizeof(job));
+		job.format = capture_tga;
+		job.width = rb->width;
+		job.height = rb->height;
+		job.screenshot = true;
+		q_snprintf (job.path, sizeof(job.path), "%s/%s", com_gamedir, rb->screenshot);
+		if (rb->frame == -1)
+			job.data = data;
+		else
+		{
+			job.data = (byte *) malloc (size);
+			memcpy (job.data, data, size);
+		}
+		SCR_QueueCaptureJob (&job, true); // never drop a screenshot
+		rb->screenshot[0] = 0;
+	}
+
+	if (rb->frame != -1)
+	{
+		memset (&job, 0, sizeof(job));
+		job.format = capture_activeformat;
+		job.data = data;
+		job.width = rb->width;
+		job.height = rb->height;
+		if (job.format == capture_raw)
+			job.file = capture_rawfile;
+		else
+			q_snprintf (job.path, sizeof(job.path), "%s/capture/cap%04i_%06i.tga", com_gamedir, capture_number, rb->frame);
+
+	// at a fixed timestep the game waits for the writer instead, since
+	// nobody is watching it in real time
+		if (!SCR_QueueCaptureJob (&job, capture_fps.value > 0))
+			capture_dropped++;
+		rb->frame = -1;
+	}
+}
+
+/*
+==================
+SCR_CollectReadback
+
+maps a pixel buffer read back on an earlier frame and queues its contents
+==================
+*/
+static void SCR_CollectReadback (capturereadback_t *rb)
+{
+	byte	*src, *data;
+
+	if (!rb->pending)
+		return;
+	rb->pending = false;
+
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, rb->pbo);
+	src = (byte *) GL_MapBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+	if (src)
+	{
+		data = (byte *) malloc (rb->size);
+		memcpy (data, src, rb->size);
+		GL_UnmapBufferFunc (GL_PIXEL_PACK_BUFFER_ARB);
+		SCR_QueueReadback (rb, data);
+	}
+	else
+	{
+		Con_SafePrintf ("SCR_CollectReadback: couldn't map the pixel buffer\n");
+		if (rb->frame != -1)
+			capture_dropped++;
+		rb->screenshot[0] = 0;
+		rb->frame = -1;
+	}
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, 0);
+}
+
+/*
+==================
+SCR_ReadbackFrame
+
+starts reading the finished frame into the next pixel buffer. without pixel
+buffer objects the read is synchronous, but the write still isn't.
+==================
+*/
+static void SCR_ReadbackFrame (void)
+{
+	capturereadback_t	*rb = &capture_readbacks[capture_nextreadback];
+	byte	*data;
+
+	SCR_CollectReadback (rb);
+
+	rb->width = glwidth;
+	rb->height = glheight;
+	rb->size = glwidth * glheight * 3;
+	q_strlcpy (rb->screenshot, capture_screenshot, sizeof(rb->screenshot));
+	rb->frame = capture_active ? capture_frames++ : -1;
+	capture_screenshot[0] = 0;
+
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);/* for widths that aren't a multiple of 4 */
+
+	if (!gl_pbo_able)
+	{
+		if (!(data = (byte *) malloc (rb->size)))
+		{
+			Con_SafePrintf ("SCR_ReadbackFrame: Couldn't allocate memory\n");
+			return;
+		}
+		glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, data);
+		SCR_QueueReadback (rb, data);
+		return;
+	}
+
+	if (!rb->pbo)
+		GL_GenBuffersFunc (1, &rb->pbo);
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, rb->pbo);
+	GL_BufferDataFunc (GL_PIXEL_PACK_BUFFER_ARB, rb->size, NULL, GL_STREAM_READ_ARB);
+	glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, (void *) 0);
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, 0);
+	rb->pending = true;
+
+	capture_nextreadback ^= 1;
+}
+
+/*
+==================
+SCR_CollectAllReadbacks
+==================
+*/
+static void SCR_CollectAllReadbacks (void)
+{
+	if (!gl_pbo_able)
+		return;
+
+	SCR_CollectReadback (&capture_readbacks[capture_nextreadback]);
+	SCR_CollectReadback (&capture_readbacks[capture_nextreadback ^ 1]);
+}
+
+/*
+==================
+SCR_CaptureFrame
+
+called with the finished frame still in the back buffer
+==================
+*/
+void SCR_CaptureFrame (void)
+{
+	SCR_PrintCaptureMessages ();
+
+	if (capture_active && (glwidth != capture_width || glheight != capture_height))
+	{
+		Con_SafePrintf ("Video mode changed, stopping capture\n");
+		SCR_StopCapture ();
+	}
+
+	if (capture_active || capture_screenshot[0])
+	{
+		SCR_ReadbackFrame ();
+
+	// the other buffer was read back last frame and should be done by now
+		if (gl_pbo_able)
+			SCR_CollectReadback (&capture_readbacks[capture_nextreadback]);
+	}
+	else // nothing read this frame, so anything still pending is a frame old
+		SCR_CollectAllReadbacks ();
+}
+
+/*
+==================
+SCR_ScreenShotPending
+
+whether a screenshot with this name has been taken but not written yet
+==================
+*/
+static qboolean SCR_ScreenShotPending (const char *tganame, const char *path)
+{
+	capturejob_t	*job;
+	qboolean	pending = false;
+	int			i;
+
+	if (!q_strcasecmp (tganame, capture_screenshot))
+		return true;
+	for (i=0 ; i<2 ; i++)
+		if (!q_strcasecmp (tganame, capture_readbacks[i].screenshot))
+			return true;
+
+	if (!capture_thread)
+		return false;
+	SDL_LockMutex (capture_mutex);
+	for (i=0 ; i<capture_count && !pending ; i++)
+	{
+		job = &capture_queue[(capture_head + i) % CAPTURE_QUEUE];
+		if (job->screenshot && !q_strcasecmp (job->path, path))
+			pending = true;
+	}
+	SDL_UnlockMutex (capture_mutex);
+	return pending;
+}
+
+/*
+==================
+SCR_CaptureFrametime
+
+the fixed frame time capture_start runs the game at, or 0
+==================
+*/
+double SCR_CaptureFrametime (void)
+{
+	if (!capture_active || capture_fps.value <= 0)
+		return 0;
+
+	return 1.0 / CLAMP (1, capture_fps.value, 1000);
+}
+
+/*
+==================
+SCR_StopCapture
+==================
+*/
+void SCR_StopCapture (void)
+{
+	capturejob_t	job;
+
+	if (!capture_active)
+		return;
+
+	SCR_CollectAllReadbacks ();
+	capture_active = false;
+
+	if (capture_rawfile)
+	{
+		memset (&job, 0, sizeof(job));
+		job.format = capture_close;
+		job.file = capture_rawfile;
+		SCR_QueueCaptureJob (&job, true);
+		capture_rawfile = NULL;
+	}
+
+	SCR_FlushCaptureQueue ();
+	SCR_PrintCaptureMessages ();
+
+	Con_SafePrintf ("capture %04i: %i frames, %i dropped", capture_number, capture_frames - capture_dropped, capture_dropped);
+	if (capture_waited > 0)
+		Con_SafePrintf (", waited %.1f s for the writer", capture_waited);
+	Con_SafePrintf ("\n");
+
+	if (capture_activeformat == capture_raw)
+		Con_SafePrintf ("ffmpeg -f rawvideo -pix_fmt rgb24 -s %ix%i -r %g -i capture/cap%04i.rgb -vf vflip cap%04i.mp4\n",
+				capture_width, capture_height, capture_fps.value > 0 ? capture_fps.value : 30, capture_number, capture_number);
+}
+
+/*
+==================
+SCR_CaptureStart_f -- capture_start [fps]
+
+writes every frame until capture_stop, running the game at a fixed timestep
+of 1/capture_fps so demos can be turned into video at any frame rate
+==================
+*/
+static void SCR_CaptureStart_f (void)
 {
-	byte	*buffer;
-	char	tganame[16];  //johnfitz -- was [80]
 	char	checkname[MAX_OSPATH];
-	int	i;
+	int		i;
 
-// find a file name to save it to
+	if (capture_active)
+	{
+		Con_Printf ("Already capturing, use capture_stop first\n");
+		return;
+	}
+
+	if (Cmd_Argc () == 2)
+		Cvar_Set ("capture_fps", Cmd_Argv (1));
+
+	if (!q_strcasecmp (capture_format.string, "raw"))
+		capture_activeformat = capture_raw;
+	else if (!q_strcasecmp (capture_format.string, "rle"))
+		capture_activeformat = capture_rle;
+	else
+		capture_activeformat = capture_tga;
+
+	q_snprintf (checkname, sizeof(checkname), "%s/capture", com_gamedir);
+	Sys_mkdir (com_gamedir);
+	Sys_mkdir (checkname);
+
+// find a capture number that hasn't been used
 	for (i=0; i<10000; i++)
 	{
-		q_snprintf (tganame, sizeof(tganame), "spasm%04i.tga", i);	// "fitz%04i.tga"
-		q_snprintf (checkname, sizeof(checkname), "%s/%s", com_gamedir, tganame);
+		if (capture_activeformat == capture_raw)
+			q_snprintf (checkname, sizeof(checkname), "%s/capture/cap%04i.rgb", com_gamedir, i);
+		else
+			q_snprintf (checkname, sizeof(checkname), "%s/capture/cap%04i_000000.tga", com_gamedir, i);
 		if (Sys_FileTime(checkname) == -1)
 			break;	// file doesn't exist
 	}
 	if (i == 10000)
 	{
-		Con_Printf ("SCR_ScreenShot_f: Couldn't find an unused filename\n");
+		Con_Printf ("SCR_CaptureStart_f: Couldn't find an unused filename\n");
 		return;
 	}
 
-//get data
-	if (!(buffer = (byte *) malloc(glwidth*glheight*3)))
+	if (capture_activeformat == capture_raw && !(capture_rawfile = fopen (checkname, "wb")))
 	{
-		Con_Printf ("SCR_ScreenShot_f: Couldn't allocate memory\n");
+		Con_Printf ("SCR_CaptureStart_f: Couldn't create %s\n", checkname);
 		return;
 	}
 
-	glPixelStorei (GL_PACK_ALIGNMENT, 1);/* for widths that aren't a multiple of 4 */
-	glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+	capture_number = i;
+	capture_width = glwidth;
+	capture_height = glheight;
+	capture_frames = capture_dropped = 0;
+	capture_waited = 0;
+	capture_active = true;
 
-// now write the file
-	if (Image_WriteTGA (tganame, buffer, glwidth, glheight, 24, false))
-		Con_Printf ("Wrote %s\n", tganame);
+	if (capture_fps.value > 0)
+		Con_Printf ("Capturing to capture/cap%04i at %g fps\n", i, CLAMP (1, capture_fps.value, 1000));
 	else
-		Con_Printf ("SCR_ScreenShot_f: Couldn't create a TGA file\n");
+		Con_Printf ("Capturing to capture/cap%04i in real time\n", i);
+}
+
+/*
+==================
+SCR_CaptureStop_f
+==================
+*/
+static void SCR_CaptureStop_f (void)
+{
+	if (!capture_active)
+	{
+		Con_Printf ("Not capturing\n");
+		return;
+	}
+
+	SCR_StopCapture ();
+}
+
+/*
+==================
+SCR_DeleteCaptureBuffers
+
+called before the GL context goes away; finishes any readbacks in flight
+==================
+*/
+void SCR_DeleteCaptureBuffers (void)
+{
+	int		i;
+
+	SCR_CollectAllReadbacks ();
+
+	for (i = 0; i < 2; i++)
+	{
+		if (capture_readbacks[i].pbo)
+			GL_DeleteBuffersFunc (1, &capture_readbacks[i].pbo);
+		capture_readbacks[i].pbo = 0;
+	}
+}
+
+/*
+==================
+SCR_ShutdownCapture
 
-	free (buffer);
+stops any capture and waits for the writer thread to get everything on disk
+==================
+*/
+void SCR_ShutdownCapture (void)
+{
+	SCR_StopCapture ();
+	SCR_CollectAllReadbacks ();
+	SCR_FlushCaptureQueue ();
+}
+
+/*
+==================
+SCR_ScreenShot_f -- johnfitz -- rewritten to use Image_WriteTGA
+
+the frame is read back and written by SCR_CaptureFrame
+==================
+*/
+void SCR_ScreenShot_f (void)
+{
+	char	tganame[16];  //johnfitz -- was [80]
+	char	checkname[MAX_OSPATH];
+	int	i;
+
+// find a file name to save it to
+	for (i=0; i<10000; i++)
+	{
+		q_snprintf (tganame, sizeof(tganame), "spasm%04i.tga", i);	// "fitz%04i.tga"
+		q_snprintf (checkname, sizeof(checkname), "%s/%s", com_gamedir, tganame);
+		if (Sys_FileTime(checkname) == -1 && !SCR_ScreenShotPending (tganame, checkname))
+			break;	// file doesn't exist and isn't about to
+	}
+	if (i == 10000)
+	{
+		Con_Printf ("SCR_ScreenShot_f: Couldn't find an unused filename\n");
+		return;
+	}
+
+	Sys_mkdir (com_gamedir); //if we've switched to a nonexistant gamedir, create it now so we don't crash
+	q_strlcpy (capture_screenshot, tganame, sizeof(capture_screenshot));
 }
 
 
@@ -1082,6 +1652,10 @@ void SCR_UpdateScreen (void)
 
 	GLSLGamma_GammaCorrect ();
 
+	SCR_CaptureFrame ();
+
+	TexMgr_ResidencyFrame ();
+
 	GL_EndRendering ();
 }
 
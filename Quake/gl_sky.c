@@ -45,6 +45,7 @@ cvar_t r_fastsky = {"r_fastsky", "0", CVAR_NONE};
 cvar_t r_sky_quality = {"r_sky_quality", "12", CVAR_NONE};
 cvar_t r_skyalpha = {"r_skyalpha", "1", CVAR_NONE};
 cvar_t r_skyfog = {"r_skyfog","0.5",CVAR_NONE};
+cvar_t r_skyshader = {"r_skyshader","1",CVAR_ARCHIVE};
 
 int		skytexorder[6] = {0,2,1,3,4,5}; //for skybox
 
@@ -79,6 +80,28 @@ int	vec_to_st[6][3] =
 
 float	skyfog; // ericw
 
+static GLuint r_skylayer_program;
+static GLuint r_skybox_program;
+
+// uniforms used in layer shader
+static GLuint layerEyePosLoc;
+static GLuint layerSolidLoc;
+static GLuint layerAlphaLoc;
+static GLuint layerSolidScrollLoc;
+static GLuint layerAlphaScrollLoc;
+static GLuint layerSkyAlphaLoc;
+static GLuint layerFogLoc;
+
+// uniforms used in skybox shader
+static GLuint boxEyePosLoc;
+static GLuint boxFaceLoc[6];
+static GLuint boxSeamLoc[3];
+static GLuint boxFogLoc;
+
+static qboolean	sky_shaded; // sky polys are being shaded per pixel, don't bother clipping them
+
+void Sky_TimeSky_f (void);
+
 //==============================================================================
 //
 //  INIT
@@ -154,6 +177,7 @@ void Sky_LoadSkyBox (const char *name)
 	int		i, mark, width, height;
 	char	filename[MAX_OSPATH];
 	byte	*data;
+	enum srcformat	format;
 	qboolean nonefound = true;
 
 	if (strcmp(skybox_name, name) == 0)
@@ -179,10 +203,10 @@ void Sky_LoadSkyBox (const char *name)
 	{
 		mark = Hunk_LowMark ();
 		q_snprintf (filename, sizeof(filename), "gfx/env/%s%s", name, suf[i]);
-		data = Image_LoadImage (filename, &width, &height);
+		data = TexMgr_LoadExternalImage (filename, &width, &height, &format);
 		if (data)
 		{
-			skybox_textures[i] = TexMgr_LoadImage (cl.worldmodel, filename, width, height, SRC_RGBA, data, filename, 0, TEXPREF_NONE);
+			skybox_textures[i] = TexMgr_LoadImage (cl.worldmodel, filename, width, height, format, data, filename, 0, TEXPREF_NONE);
 			nonefound = false;
 		}
 		else
@@ -318,8 +342,10 @@ void Sky_Init (void)
 	Cvar_RegisterVariable (&r_skyalpha);
 	Cvar_RegisterVariable (&r_skyfog);
 	Cvar_SetCallback (&r_skyfog, R_SetSkyfog_f);
+	Cvar_RegisterVariable (&r_skyshader);
 
 	Cmd_AddCommand ("sky",Sky_SkyCommand_f);
+	Cmd_AddCommand ("timesky",Sky_TimeSky_f);
 
 	for (i=0; i<6; i++)
 		skybox_textures[i] = NULL;
@@ -516,10 +542,16 @@ void Sky_ProcessPoly (glpoly_t	*p)
 
 	//draw it
 	DrawGLPoly(p);
-	rs_brushpasses++;
+	if (sky_shaded)
+	{
+		rs_skypolys++;
+		rs_skypasses++;
+	}
+	else
+		rs_brushpasses++;
 
 	//update sky bounds
-	if (!r_fastsky.value)
+	if (!r_fastsky.value && !sky_shaded)
 	{
 		for (i=0 ; i<p->numverts ; i++)
 			VectorSubtract (p->verts[i], r_origin, verts[i]);
@@ -970,14 +1002,269 @@ void Sky_DrawSkyLayers (void)
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 }
 
+//==============================================================================
+//
+//  RENDER SKY WITH GLSL
+//
+//==============================================================================
+
 /*
-==============
-Sky_DrawSky
+=============
+GLSky_CreateShaders
 
-called once per frame before drawing anything else
+the sky polys are drawn once and the sky is looked up per pixel from the view
+direction, so nothing needs to be clipped or subdivided on the CPU
+=============
+*/
+void GLSky_CreateShaders (void)
+{
+	GLint	units;
+	char	name[16];
+	int		i;
+
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 EyePos;\n"
+		"varying vec3 Dir;\n"
+		"void main()\n"
+		"{\n"
+		"	Dir = gl_Vertex.xyz - EyePos;\n"
+		"	gl_Position = ftransform();\n"
+		"}\n";
+
+	// same projection as Sky_GetTexCoord
+	const GLchar *layerFragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Solid;\n"
+		"uniform sampler2D Alpha;\n"
+		"uniform float SolidScroll;\n"
+		"uniform float AlphaScroll;\n"
+		"uniform float SkyAlpha;\n"
+		"uniform vec4 Fog; // a is the skyfog amount \n"
+		"varying vec3 Dir;\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 dir = Dir;\n"
+		"	dir.z *= 3.0; // flatten the sphere \n"
+		"	vec2 st = dir.xy * (6.0 * 63.0 / length(dir));\n"
+		"	vec4 solid = texture2D(Solid, (st + SolidScroll) / 128.0);\n"
+		"	vec4 alpha = texture2D(Alpha, (st + AlphaScroll) / 128.0);\n"
+		"	vec3 result = mix(solid.rgb, alpha.rgb, alpha.a * SkyAlpha);\n"
+		"	gl_FragColor = vec4(mix(result, Fog.rgb, Fog.a), 1.0);\n"
+		"}\n";
+
+	// same projection as Sky_ProjectPoly and Sky_EmitSkyBoxVertex
+	const GLchar *boxFragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Face0;\n"
+		"uniform sampler2D Face1;\n"
+		"uniform sampler2D Face2;\n"
+		"uniform sampler2D Face3;\n"
+		"uniform sampler2D Face4;\n"
+		"uniform sampler2D Face5;\n"
+		"uniform vec4 Seam01; // bilerp seam scale for each face \n"
+		"uniform vec4 Seam23;\n"
+		"uniform vec4 Seam45;\n"
+		"uniform vec4 Fog;\n"
+		"varying vec3 Dir;\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 a = abs(Dir);\n"
+		"	vec2 st, seam;\n"
+		"	int axis;\n"
+		"	if (a.x > a.y && a.x > a.z)\n"
+		"	{\n"
+		"		axis = (Dir.x < 0.0) ? 1 : 0;\n"
+		"		st = vec2(-Dir.y, Dir.z) / Dir.x;\n"
+		"		if (axis == 1) st.y = -st.y;\n"
+		"		seam = (axis == 1) ? Seam01.zw : Seam01.xy;\n"
+		"	}\n"
+		"	else if (a.y > a.z && a.y > a.x)\n"
+		"	{\n"
+		"		axis = (Dir.y < 0.0) ? 3 : 2;\n"
+		"		st = vec2(Dir.x, Dir.z) / Dir.y;\n"
+		"		if (axis == 3) st.y = -st.y;\n"
+		"		seam = (axis == 3) ? Seam23.zw : Seam23.xy;\n"
+		"	}\n"
+		"	else\n"
+		"	{\n"
+		"		axis = (Dir.z < 0.0) ? 5 : 4;\n"
+		"		st = vec2(-Dir.y, -Dir.x) / Dir.z;\n"
+		"		if (axis == 5) st.x = -st.x;\n"
+		"		seam = (axis == 5) ? Seam45.zw : Seam45.xy;\n"
+		"	}\n"
+		"	// convert from range [-1,1] to [0,1] and avoid bilerp seam \n"
+		"	st = (st + 1.0) * 0.5 * seam + (1.0 - seam) * 0.5;\n"
+		"	st.y = 1.0 - st.y;\n"
+		"	vec4 result;\n"
+		"	if (axis == 0) result = texture2D(Face0, st);\n"
+		"	else if (axis == 1) result = texture2D(Face1, st);\n"
+		"	else if (axis == 2) result = texture2D(Face2, st);\n"
+		"	else if (axis == 3) result = texture2D(Face3, st);\n"
+		"	else if (axis == 4) result = texture2D(Face4, st);\n"
+		"	else result = texture2D(Face5, st);\n"
+		"	gl_FragColor = vec4(mix(result.rgb, Fog.rgb, Fog.a), 1.0);\n"
+		"}\n";
+
+	r_skylayer_program = 0;
+	r_skybox_program = 0;
+
+	if (!gl_glsl_able || !gl_mtexable)
+		return;
+
+	r_skylayer_program = GL_CreateProgram (vertSource, layerFragSource, 0, NULL);
+
+	if (r_skylayer_program != 0)
+	{
+	// get uniform locations
+		layerEyePosLoc = GL_GetUniformLocation (&r_skylayer_program, "EyePos");
+		layerSolidLoc = GL_GetUniformLocation (&r_skylayer_program, "Solid");
+		layerAlphaLoc = GL_GetUniformLocation (&r_skylayer_program, "Alpha");
+		layerSolidScrollLoc = GL_GetUniformLocation (&r_skylayer_program, "SolidScroll");
+		layerAlphaScrollLoc = GL_GetUniformLocation (&r_skylayer_program, "AlphaScroll");
+		layerSkyAlphaLoc = GL_GetUniformLocation (&r_skylayer_program, "SkyAlpha");
+		layerFogLoc = GL_GetUniformLocation (&r_skylayer_program, "Fog");
+	}
+
+	// the skybox needs all six faces bound at once
+	glGetIntegerv (GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+	if (units < 6)
+		return;
+
+	r_skybox_program = GL_CreateProgram (vertSource, boxFragSource, 0, NULL);
+
+	if (r_skybox_program != 0)
+	{
+	// get uniform locations
+		boxEyePosLoc = GL_GetUniformLocation (&r_skybox_program, "EyePos");
+		for (i=0 ; i<6 ; i++)
+		{
+			q_snprintf (name, sizeof(name), "Face%i", i);
+			boxFaceLoc[i] = GL_GetUniformLocation (&r_skybox_program, name);
+		}
+		for (i=0 ; i<3 ; i++)
+		{
+			q_snprintf (name, sizeof(name), "Seam%i%i", i*2, i*2+1);
+			boxSeamLoc[i] = GL_GetUniformLocation (&r_skybox_program, name);
+		}
+		boxFogLoc = GL_GetUniformLocation (&r_skybox_program, "Fog");
+	}
+}
+
+/*
+=============
+Sky_ShaderAvailable
+
+true if this frame's sky can be shaded per pixel, whether or not r_skyshader
+asks for it
+=============
+*/
+static qboolean Sky_ShaderAvailable (void)
+{
+	if (r_fastsky.value || (Fog_GetDensity() > 0 && skyfog >= 1))
+		return false;
+
+	if (skybox_name[0])
+		return r_skybox_program != 0;
+	else
+		return r_skylayer_program != 0 && solidskytexture && alphaskytexture;
+}
+
+/*
+=============
+Sky_SeamScale
+=============
+*/
+static float Sky_SeamScale (int size)
+{
+	return (size - 1) / (float)size;
+}
+
+/*
+=============
+Sky_DrawSkyShader
+
+draws all visible sky polys in a single pass, with the skybox or cloud layers
+looked up per pixel
+=============
+*/
+static void Sky_DrawSkyShader (void)
+{
+	gltexture_t	*face[6];
+	float		fog[4], scroll[2];
+	float		*c;
+	int			i;
+
+	if (Fog_GetDensity() > 0)
+	{
+		c = Fog_GetColor();
+		fog[0] = c[0];
+		fog[1] = c[1];
+		fog[2] = c[2];
+		fog[3] = CLAMP(0.0, skyfog, 1.0);
+	}
+	else
+		fog[0] = fog[1] = fog[2] = fog[3] = 0;
+
+	if (skybox_name[0])
+	{
+		GL_UseProgramFunc (r_skybox_program);
+		GL_Uniform3fFunc (boxEyePosLoc, r_origin[0], r_origin[1], r_origin[2]);
+		GL_Uniform4fFunc (boxFogLoc, fog[0], fog[1], fog[2], fog[3]);
+
+		for (i=0 ; i<6 ; i++)
+		{
+			face[i] = skybox_textures[skytexorder[i]];
+			GL_Uniform1iFunc (boxFaceLoc[i], i);
+			GL_SelectTexture (GL_TEXTURE0_ARB + i);
+			glBindTexture (GL_TEXTURE_2D, face[i]->texnum);
+		}
+		for (i=0 ; i<3 ; i++)
+			GL_Uniform4fFunc (boxSeamLoc[i], Sky_SeamScale (face[i*2]->width), Sky_SeamScale (face[i*2]->height),
+											Sky_SeamScale (face[i*2+1]->width), Sky_SeamScale (face[i*2+1]->height));
+		GL_SelectTexture (GL_TEXTURE0_ARB);
+		GL_ClearBindings ();
+	}
+	else
+	{
+		for (i=0 ; i<2 ; i++)
+		{
+			scroll[i] = cl.time * (i ? 16 : 8);
+			scroll[i] -= (int)scroll[i] & ~127;
+		}
+
+		GL_UseProgramFunc (r_skylayer_program);
+		GL_Uniform3fFunc (layerEyePosLoc, r_origin[0], r_origin[1], r_origin[2]);
+		GL_Uniform1iFunc (layerSolidLoc, 0);
+		GL_Uniform1iFunc (layerAlphaLoc, 1);
+		GL_Uniform1fFunc (layerSolidScrollLoc, scroll[0]);
+		GL_Uniform1fFunc (layerAlphaScrollLoc, scroll[1]);
+		GL_Uniform1fFunc (layerSkyAlphaLoc, CLAMP(0.0, r_skyalpha.value, 1.0));
+		GL_Uniform4fFunc (layerFogLoc, fog[0], fog[1], fog[2], fog[3]);
+
+		GL_SelectTexture (GL_TEXTURE1_ARB);
+		GL_Bind (alphaskytexture);
+		GL_SelectTexture (GL_TEXTURE0_ARB);
+		GL_Bind (solidskytexture);
+	}
+
+	sky_shaded = true;
+	Sky_ProcessTextureChains ();
+	Sky_ProcessEntities ();
+	sky_shaded = false;
+
+	GL_UseProgramFunc (0);
+}
+
+/*
+==============
+Sky_DrawSkyMode -- shader picks the per pixel path, if it's available
 ==============
 */
-void Sky_DrawSky (void)
+static void Sky_DrawSkyMode (qboolean shader)
 {
 	int				i;
 
@@ -985,6 +1272,17 @@ void Sky_DrawSky (void)
 	if (r_drawflat_cheatsafe || r_lightmap_cheatsafe )
 		return;
 
+	//
+	// shade sky surfs directly, no bounds needed
+	//
+	if (shader && Sky_ShaderAvailable ())
+	{
+		Fog_DisableGFog ();
+		Sky_DrawSkyShader ();
+		Fog_EnableGFog ();
+		return;
+	}
+
 	//
 	// reset sky bounds
 	//
@@ -1027,3 +1325,58 @@ void Sky_DrawSky (void)
 
 	Fog_EnableGFog ();
 }
+
+/*
+==============
+Sky_DrawSky
+
+called once per frame before drawing anything else
+==============
+*/
+void Sky_DrawSky (void)
+{
+	Sky_DrawSkyMode (r_skyshader.value != 0);
+}
+
+/*
+==============
+Sky_TimeSky_f
+
+times the CPU side of the sky pass for the current view, with and without
+the shader path
+==============
+*/
+void Sky_TimeSky_f (void)
+{
+	int			i, mode, frames, nummodes;
+	double		start, time;
+	static const char *names[2] = {"clipped", "shader"};
+
+	if (cls.state != ca_connected || !cl.worldmodel)
+	{
+		Con_Printf ("no map loaded\n");
+		return;
+	}
+
+	frames = (Cmd_Argc() > 1) ? q_max(atoi(Cmd_Argv(1)), 1) : 100;
+	nummodes = Sky_ShaderAvailable () ? 2 : 1;
+
+	for (mode=0 ; mode<nummodes ; mode++)
+	{
+		rs_skypolys = rs_skypasses = 0;
+
+		glFinish ();
+		start = Sys_DoubleTime ();
+		for (i=0 ; i<frames ; i++)
+			Sky_DrawSkyMode (mode);
+		time = Sys_DoubleTime () - start;
+
+		Con_Printf ("%-7s %.3f ms/frame, %i sky polys, %i passes\n", names[mode],
+					time * 1000 / frames, rs_skypolys / frames, rs_skypasses / frames);
+	}
+
+	if (nummodes == 1)
+		Con_Printf ("shader  not available\n");
+
+	glFinish ();
+}
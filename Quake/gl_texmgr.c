@@ -24,6 +24,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXMGR_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(USE_SDL2) && SDL_VERSION_ATLEAST(2,0,4)
+#define TEXMGR_AVX2	//built with a target attribute, only used if SDL_HasAVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TEXMGR_NEON
+#include <arm_neon.h>
+#endif
+
 const int	gl_solid_format = 3;
 const int	gl_alpha_format = 4;
 
@@ -31,11 +44,17 @@ static cvar_t	gl_texturemode = {"gl_texturemode", "", CVAR_ARCHIVE};
 static cvar_t	gl_texture_anisotropy = {"gl_texture_anisotropy", "1", CVAR_ARCHIVE};
 static cvar_t	gl_max_size = {"gl_max_size", "0", CVAR_NONE};
 static cvar_t	gl_picmip = {"gl_picmip", "0", CVAR_NONE};
+static cvar_t	gl_texcache = {"gl_texcache", "1", CVAR_ARCHIVE};
+static cvar_t	gl_texcache_compress = {"gl_texcache_compress", "0", CVAR_ARCHIVE}; //store BC1/BC3 instead of rgba
+static qboolean	texcachedirready; //<gamedir>/texcache has been created
+static cvar_t	gl_texture_budget = {"gl_texture_budget", "0", CVAR_ARCHIVE}; //megabytes, 0 for no limit
 static GLint	gl_hardware_maxsize;
 
-#define	MAX_GLTEXTURES	2048
+#define	MAX_GLTEXTURES	32768
+#define	TEXHASH_SIZE	4096	//power of two
 static int numgltextures;
 static gltexture_t	*active_gltextures, *free_gltextures;
+static gltexture_t	*texhash[TEXHASH_SIZE];	//(owner, name) index of active_gltextures
 gltexture_t		*notexture, *nulltexture;
 
 unsigned int d_8to24table[256];
@@ -55,6 +74,12 @@ unsigned int d_8to24table_pants[256];
 ================================================================================
 */
 
+static void TexMgr_LoadTimes_f (void);
+static void TexMgr_TimeTexLoad_f (void);
+static void TexMgr_TestKernels_f (void);
+static void TexMgr_CompressTextures_f (void);
+static void TexMgr_InitKernels (void);
+
 typedef struct
 {
 	int	magfilter;
@@ -139,6 +164,7 @@ static void TexMgr_TextureMode_f (cvar_t *var)
 				for (glt = active_gltextures; glt; glt = glt->next)
 					TexMgr_SetFilterModes (glt);
 				Sbar_Changed (); //sbar graphics need to be redrawn with new filter mode
+				R_DeleteWorldTextureArrays (); //rebuilt with the new filter mode on the next frame
 				//FIXME: warpimages need to be redrawn, too.
 			}
 			return;
@@ -193,6 +219,7 @@ static void TexMgr_Anisotropy_f (cvar_t *var)
 			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, gl_texture_anisotropy.value);
 		    }
 		}
+		R_DeleteWorldTextureArrays ();
 	}
 }
 
@@ -201,23 +228,62 @@ static void TexMgr_Anisotropy_f (cvar_t *var)
 TexMgr_Imagelist_f -- report loaded textures
 ===============
 */
+static const char *TexMgr_FormatName (gltexture_t *glt)
+{
+	if (glt->source_format == SRC_LIGHTMAP)
+		return "lmap";
+	switch (glt->glformat)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:	return "bc1 ";
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:	return "bc2 ";
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:	return "bc3 ";
+	case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:	return "bc7 ";
+	}
+	return (glt->glformat == (unsigned int)gl_alpha_format) ? "rgba" : "rgb ";
+}
+
 static void TexMgr_Imagelist_f (void)
 {
+	static const char *cachestates[] = {"    ", "hit ", "miss"};
+	static const char *residencies[] = {"    ", "low ", "req ", "load"};
+	char residency[8];
 	float mb;
 	float texels = 0;
+	float resident = R_WorldTextureArrayBytes (); //not in any gltexture_t
+	int hits = 0, misses = 0, evicted = 0;
 	gltexture_t	*glt;
 
 	for (glt = active_gltextures; glt; glt = glt->next)
 	{
-		Con_SafePrintf ("   %4i x%4i %s\n", glt->width, glt->height, glt->name);
+		//evicted textures show the fraction of their size still resident
+		if (glt->residency == TEXRES_EVICTED || (glt->residency == TEXRES_FULL && glt->evictlevel))
+			q_snprintf (residency, sizeof(residency), "1/%-2i", 1 << glt->evictlevel);
+		else
+			q_strlcpy (residency, residencies[glt->residency], sizeof(residency));
+		Con_SafePrintf ("   %4i x%4i %s %6ik %s %s %6.2fms %s\n", glt->width, glt->height, TexMgr_FormatName (glt), (glt->bytes + 1023) / 1024,
+			residency, cachestates[glt->cachestate], glt->loadtime * 1000.0f, glt->name);
+		resident += glt->bytes;
+		if (glt->evictlevel)
+			evicted++;
 		if (glt->flags & TEXPREF_MIPMAP)
 			texels += glt->width * glt->height * 4.0f / 3.0f;
 		else
 			texels += (glt->width * glt->height);
+		if (glt->cachestate == TEXCACHE_HIT)
+			hits++;
+		else if (glt->cachestate == TEXCACHE_MISS)
+			misses++;
 	}
 
 	mb = texels * (Cvar_VariableValue("vid_bpp") / 8.0f) / 0x100000;
 	Con_Printf ("%i textures %i pixels %1.1f megabytes\n", numgltextures, (int)texels, mb);
+	if (hits + misses)
+		Con_Printf ("texture cache: %i hits, %i misses (%i%%)\n", hits, misses, hits * 100 / (hits + misses));
+	if (gl_texture_budget.value > 0)
+		Con_Printf ("%1.1f of %i megabytes resident, %i textures at low detail\n", resident / 0x100000, (int)gl_texture_budget.value, evicted);
+	else
+		Con_Printf ("%1.1f megabytes resident\n", resident / 0x100000);
 }
 
 /*
@@ -245,6 +311,7 @@ static void TexMgr_Imagedump_f (void)
 		while ( (c = strchr(tempname, '*')) ) *c = '_';
 		q_snprintf(tganame, sizeof(tganame), "imagedump/%s.tga", tempname);
 
+		TexMgr_MakeResident (glt);
 		GL_Bind (glt);
 		if (glt->flags & TEXPREF_ALPHA)
 		{
@@ -271,23 +338,16 @@ TexMgr_FrameUsage -- report texture memory usage for this frame
 */
 float TexMgr_FrameUsage (void)
 {
-	float mb;
-	float texels = 0;
+	float bytes = 0;
 	gltexture_t	*glt;
 
 	for (glt = active_gltextures; glt; glt = glt->next)
 	{
 		if (glt->visframe == r_framecount)
-		{
-			if (glt->flags & TEXPREF_MIPMAP)
-				texels += glt->width * glt->height * 4.0f / 3.0f;
-			else
-				texels += (glt->width * glt->height);
-		}
+			bytes += glt->bytes;
 	}
 
-	mb = texels * (Cvar_VariableValue("vid_bpp") / 8.0f) / 0x100000;
-	return mb;
+	return bytes / 0x100000;
 }
 
 /*
@@ -298,6 +358,21 @@ float TexMgr_FrameUsage (void)
 ================================================================================
 */
 
+/*
+================
+TexMgr_HashKey
+================
+*/
+static unsigned TexMgr_HashKey (qmodel_t *owner, const char *name)
+{
+	unsigned	hash = (unsigned)(src_offset_t)owner * 2654435761u;
+
+	while (*name)
+		hash = (hash ^ (byte)*name++) * 16777619u;
+
+	return (hash ^ (hash >> 16)) & (TEXHASH_SIZE - 1);
+}
+
 /*
 ================
 TexMgr_FindTexture
@@ -309,7 +384,7 @@ gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name)
 
 	if (name)
 	{
-		for (glt = active_gltextures; glt; glt = glt->next)
+		for (glt = texhash[TexMgr_HashKey (owner, name)]; glt; glt = glt->hashnext)
 		{
 			if (glt->owner == owner && !strcmp (glt->name, name))
 				return glt;
@@ -321,12 +396,32 @@ gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name)
 
 /*
 ================
-TexMgr_NewTexture
+TexMgr_FindTextureLinear -- the old scan, kept for timetexload to compare against
+================
+*/
+static gltexture_t *TexMgr_FindTextureLinear (qmodel_t *owner, const char *name)
+{
+	gltexture_t	*glt;
+
+	for (glt = active_gltextures; glt; glt = glt->next)
+	{
+		if (glt->owner == owner && !strcmp (glt->name, name))
+			return glt;
+	}
+
+	return NULL;
+}
+
+/*
+================
+TexMgr_NewTexture -- the owner and name can't change afterwards, since
+they're the key of the index
 ================
 */
-gltexture_t *TexMgr_NewTexture (void)
+gltexture_t *TexMgr_NewTexture (qmodel_t *owner, const char *name)
 {
 	gltexture_t *glt;
+	unsigned	hash;
 
 	if (numgltextures == MAX_GLTEXTURES)
 		Sys_Error("numgltextures == MAX_GLTEXTURES\n");
@@ -334,14 +429,28 @@ gltexture_t *TexMgr_NewTexture (void)
 	glt = free_gltextures;
 	free_gltextures = glt->next;
 	glt->next = active_gltextures;
+	glt->prev = NULL;
+	if (active_gltextures)
+		active_gltextures->prev = glt;
 	active_gltextures = glt;
 
+	glt->owner = owner;
+	q_strlcpy (glt->name, name, sizeof(glt->name));
+	hash = TexMgr_HashKey (glt->owner, glt->name);
+	glt->hashnext = texhash[hash];
+	texhash[hash] = glt;
+
+	glt->packed = false; //slots are reused from free_gltextures
+	glt->queued = 0;
+
 	glGenTextures(1, &glt->texnum);
 	numgltextures++;
 	return glt;
 }
 
 static void GL_DeleteTexture (gltexture_t *texture);
+static void TexMgr_FinishJobs (void);
+static void TexMgr_UploadFinished (qboolean wait);
 
 //ericw -- workaround for preventing TexMgr_FreeTexture during TexMgr_ReloadImages
 static qboolean in_reload_images;
@@ -353,10 +462,12 @@ TexMgr_FreeTexture
 */
 void TexMgr_FreeTexture (gltexture_t *kill)
 {
-	gltexture_t *glt;
+	gltexture_t **link;
 
 	if (in_reload_images)
 		return;
+
+	TexMgr_FinishJobs (); //the workers may still be holding on to it
 	
 	if (kill == NULL)
 	{
@@ -364,32 +475,30 @@ void TexMgr_FreeTexture (gltexture_t *kill)
 		return;
 	}
 
-	if (active_gltextures == kill)
+	for (link = &texhash[TexMgr_HashKey (kill->owner, kill->name)]; *link; link = &(*link)->hashnext)
 	{
-		active_gltextures = kill->next;
-		kill->next = free_gltextures;
-		free_gltextures = kill;
-
-		GL_DeleteTexture(kill);
-		numgltextures--;
+		if (*link == kill)
+			break;
+	}
+	if (!*link)
+	{
+		Con_Printf ("TexMgr_FreeTexture: not found\n");
 		return;
 	}
+	*link = kill->hashnext;
 
-	for (glt = active_gltextures; glt; glt = glt->next)
-	{
-		if (glt->next == kill)
-		{
-			glt->next = kill->next;
-			kill->next = free_gltextures;
-			free_gltextures = kill;
+	if (kill->prev)
+		kill->prev->next = kill->next;
+	else
+		active_gltextures = kill->next;
+	if (kill->next)
+		kill->next->prev = kill->prev;
 
-			GL_DeleteTexture(kill);
-			numgltextures--;
-			return;
-		}
-	}
+	kill->next = free_gltextures;
+	free_gltextures = kill;
 
-	Con_Printf ("TexMgr_FreeTexture: not found\n");
+	GL_DeleteTexture(kill);
+	numgltextures--;
 }
 
 /*
@@ -541,6 +650,7 @@ void TexMgr_NewGame (void)
 {
 	TexMgr_FreeTextures (0, TEXPREF_PERSIST); //deletes all textures where TEXPREF_PERSIST is unset
 	TexMgr_LoadPalette ();
+	texcachedirready = false; //gamedir may have changed
 }
 
 /*
@@ -586,6 +696,8 @@ void TexMgr_RecalcWarpImageSize (void)
 			GL_Bind (glt);
 			glTexImage2D (GL_TEXTURE_2D, 0, gl_solid_format, gl_warpimagesize, gl_warpimagesize, 0, GL_RGBA, GL_UNSIGNED_BYTE, dummy);
 			glt->width = glt->height = gl_warpimagesize;
+			glt->bytes = gl_warpimagesize * gl_warpimagesize * 4;
+			glt->glformat = gl_solid_format;
 		}
 	}
 
@@ -609,6 +721,7 @@ void TexMgr_Init (void)
 	// init texture list
 	free_gltextures = (gltexture_t *) Hunk_AllocName (MAX_GLTEXTURES * sizeof(gltexture_t), "gltextures");
 	active_gltextures = NULL;
+	memset (texhash, 0, sizeof(texhash));
 	for (i = 0; i < MAX_GLTEXTURES - 1; i++)
 		free_gltextures[i].next = &free_gltextures[i+1];
 	free_gltextures[i].next = NULL;
@@ -616,9 +729,13 @@ void TexMgr_Init (void)
 
 	// palette
 	TexMgr_LoadPalette ();
+	TexMgr_InitKernels ();
 
 	Cvar_RegisterVariable (&gl_max_size);
 	Cvar_RegisterVariable (&gl_picmip);
+	Cvar_RegisterVariable (&gl_texcache);
+	Cvar_RegisterVariable (&gl_texcache_compress);
+	Cvar_RegisterVariable (&gl_texture_budget);
 	Cvar_RegisterVariable (&gl_texture_anisotropy);
 	Cvar_SetCallback (&gl_texture_anisotropy, &TexMgr_Anisotropy_f);
 	gl_texturemode.string = glmodes[glmode_idx].name;
@@ -627,6 +744,10 @@ void TexMgr_Init (void)
 	Cmd_AddCommand ("gl_describetexturemodes", &TexMgr_DescribeTextureModes_f);
 	Cmd_AddCommand ("imagelist", &TexMgr_Imagelist_f);
 	Cmd_AddCommand ("imagedump", &TexMgr_Imagedump_f);
+	Cmd_AddCommand ("texloadtimes", &TexMgr_LoadTimes_f);
+	Cmd_AddCommand ("testtexkernels", &TexMgr_TestKernels_f);
+	Cmd_AddCommand ("timetexload", &TexMgr_TimeTexLoad_f);
+	Cmd_AddCommand ("compresstextures", &TexMgr_CompressTextures_f);
 
 	// poll max size from hardware
 	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &gl_hardware_maxsize);
@@ -651,6 +772,86 @@ void TexMgr_Init (void)
 ================================================================================
 */
 
+#define MAX_TEXMIPLEVELS	16
+
+//cpu side stages of loading an image, timed for texloadtimes
+enum {TEXSTAGE_CONVERT, TEXSTAGE_RESAMPLE, TEXSTAGE_MIPMAP, TEXSTAGE_EDGEFIX, TEXSTAGE_COMPRESS, TEXSTAGE_CACHE, TEXSTAGE_UPLOAD, NUM_TEXSTAGES};
+static const char *texstagenames[NUM_TEXSTAGES] = {"convert", "resample", "mipmap", "edgefix", "compress", "cache", "upload"};
+
+//working buffers of one image; malloc'd rather than on the hunk so the
+//worker threads can use them
+typedef struct
+{
+	void	*blocks[8];
+	int		numblocks;
+} texscratch_t;
+
+//an image ready to upload, all mip levels back to back
+typedef struct
+{
+	byte		*data;
+	GLenum		format;		//0 for GL_RGBA, else a compressed format
+	int			numlevels;
+	int			width[MAX_TEXMIPLEVELS];
+	int			height[MAX_TEXMIPLEVELS];
+	int			offset[MAX_TEXMIPLEVELS];	//in bytes
+	int			size[MAX_TEXMIPLEVELS];		//in bytes
+} texmips_t;
+
+//the cvars an image is processed with, read when it's loaded so the worker
+//threads never look at a cvar the main thread can be changing
+typedef struct
+{
+	int			picmip;		//gl_picmip, clamped; textures with TEXPREF_NOPICMIP ignore it
+	int			maxsize;	//gl_max_size
+	qboolean	fullbrights;
+	qboolean	cache;		//gl_texcache, and the directory is there
+	qboolean	compress;	//gl_texcache_compress, and s3tc is supported
+} texsettings_t;
+
+/*
+================
+TexMgr_ScratchAlloc
+================
+*/
+static void *TexMgr_ScratchAlloc (texscratch_t *scratch, int size)
+{
+	void *block;
+
+	if (scratch->numblocks == (int)(sizeof(scratch->blocks)/sizeof(scratch->blocks[0])))
+		Sys_Error ("TexMgr_ScratchAlloc: too many blocks");
+	block = malloc (size);
+	if (!block)
+		Sys_Error ("TexMgr_ScratchAlloc: failed on %i bytes", size);
+	scratch->blocks[scratch->numblocks++] = block;
+	return block;
+}
+
+/*
+================
+TexMgr_ScratchFree
+================
+*/
+static void TexMgr_ScratchFree (texscratch_t *scratch)
+{
+	while (scratch->numblocks)
+		free (scratch->blocks[--scratch->numblocks]);
+}
+
+/*
+================
+TexMgr_StageTime -- a finer clock than Sys_DoubleTime, for the stage timings
+================
+*/
+static double TexMgr_StageTime (void)
+{
+#if defined(USE_SDL2)
+	return (double)SDL_GetPerformanceCounter () / (double)SDL_GetPerformanceFrequency ();
+#else
+	return Sys_DoubleTime ();
+#endif
+}
+
 /*
 ================
 TexMgr_Pad -- return smallest power of two greater than or equal to s
@@ -666,19 +867,45 @@ int TexMgr_Pad (int s)
 
 /*
 ===============
-TexMgr_SafeTextureSize -- return a size with hardware and user prefs in mind
+TexMgr_LimitTextureSize -- TexMgr_SafeTextureSize with the given gl_max_size
 ===============
 */
-int TexMgr_SafeTextureSize (int s)
+static int TexMgr_LimitTextureSize (int s, int maxsize)
 {
 	if (!gl_texture_NPOT)
 		s = TexMgr_Pad(s);
-	if ((int)gl_max_size.value > 0)
-		s = q_min(TexMgr_Pad((int)gl_max_size.value), s);
+	if (maxsize > 0)
+		s = q_min(TexMgr_Pad(maxsize), s);
 	s = q_min(gl_hardware_maxsize, s);
 	return s;
 }
 
+/*
+===============
+TexMgr_SafeTextureSize -- return a size with hardware and user prefs in mind
+===============
+*/
+int TexMgr_SafeTextureSize (int s)
+{
+	return TexMgr_LimitTextureSize (s, (int)gl_max_size.value);
+}
+
+/*
+================
+TexMgr_GetSettings
+================
+*/
+static void TexMgr_GetSettings (texsettings_t *settings)
+{
+	extern cvar_t gl_fullbrights;
+
+	settings->picmip = q_max((int)gl_picmip.value, 0);
+	settings->maxsize = (int)gl_max_size.value;
+	settings->fullbrights = gl_fullbrights.value != 0;
+	settings->cache = gl_texcache.value && texcachedirready;
+	settings->compress = gl_texcache_compress.value && gl_texture_s3tc;
+}
+
 /*
 ================
 TexMgr_PadConditional -- only pad if a texture of that size would be padded. (used for tex coords)
@@ -692,41 +919,57 @@ int TexMgr_PadConditional (int s)
 		return s;
 }
 
+/*
+================================================================================
+
+	PIXEL KERNELS
+
+the mipmap and palette loops, in plain C and in SIMD versions picked at
+startup. every version must give exactly the same bytes as the plain C one;
+testtexkernels checks this and times them.
+
+================================================================================
+*/
+
+typedef struct
+{
+	const char	*name;
+	void		(*mipmapw) (byte *data, int outpixels);	//average pixel pairs in place
+	void		(*mipmaph) (byte *data, int width, int height);	//average row pairs in place
+	void		(*palette) (unsigned *out, const byte *in, int pixels, const unsigned *pal);
+} texkernels_t;
+
 /*
 ================
-TexMgr_MipMapW
+TexMgr_MipMapW_C
 ================
 */
-static unsigned *TexMgr_MipMapW (unsigned *data, int width, int height)
+static void TexMgr_MipMapW_C (byte *data, int outpixels)
 {
-	int	i, size;
+	int	i;
 	byte	*out, *in;
 
-	out = in = (byte *)data;
-	size = (width*height)>>1;
-
-	for (i = 0; i < size; i++, out += 4, in += 8)
+	out = in = data;
+	for (i = 0; i < outpixels; i++, out += 4, in += 8)
 	{
 		out[0] = (in[0] + in[4])>>1;
 		out[1] = (in[1] + in[5])>>1;
 		out[2] = (in[2] + in[6])>>1;
 		out[3] = (in[3] + in[7])>>1;
 	}
-
-	return data;
 }
 
 /*
 ================
-TexMgr_MipMapH
+TexMgr_MipMapH_C
 ================
 */
-static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
+static void TexMgr_MipMapH_C (byte *data, int width, int height)
 {
 	int	i, j;
 	byte	*out, *in;
 
-	out = in = (byte *)data;
+	out = in = data;
 	height>>=1;
 	width<<=2;
 
@@ -740,132 +983,559 @@ static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
 			out[3] = (in[3] + in[width+3])>>1;
 		}
 	}
-
-	return data;
 }
 
 /*
 ================
-TexMgr_ResampleTexture -- bilinear resample
+TexMgr_Palette_C
 ================
 */
-static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight, qboolean alpha)
+static void TexMgr_Palette_C (unsigned *out, const byte *in, int pixels, const unsigned *pal)
 {
-	byte *nwpx, *nepx, *swpx, *sepx, *dest;
-	unsigned xfrac, yfrac, x, y, modx, mody, imodx, imody, injump, outjump;
-	unsigned *out;
-	int i, j, outwidth, outheight;
-
-	if (inwidth == TexMgr_Pad(inwidth) && inheight == TexMgr_Pad(inheight))
-		return in;
-
-	outwidth = TexMgr_Pad(inwidth);
-	outheight = TexMgr_Pad(inheight);
-	out = (unsigned *) Hunk_Alloc(outwidth*outheight*4);
-
-	xfrac = ((inwidth-1) << 16) / (outwidth-1);
-	yfrac = ((inheight-1) << 16) / (outheight-1);
-	y = outjump = 0;
-
-	for (i = 0; i < outheight; i++)
-	{
-		mody = (y>>8) & 0xFF;
-		imody = 256 - mody;
-		injump = (y>>16) * inwidth;
-		x = 0;
+	int i;
 
-		for (j = 0; j < outwidth; j++)
-		{
-			modx = (x>>8) & 0xFF;
-			imodx = 256 - modx;
+	for (i = 0; i < pixels; i++)
+		*out++ = pal[*in++];
+}
 
-			nwpx = (byte *)(in + (x>>16) + injump);
-			nepx = nwpx + 4;
-			swpx = nwpx + inwidth*4;
-			sepx = swpx + 4;
+static const texkernels_t texkernels_c = {"C", TexMgr_MipMapW_C, TexMgr_MipMapH_C, TexMgr_Palette_C};
 
-			dest = (byte *)(out + outjump + j);
+#ifdef TEXMGR_SSE2
+/*
+================
+TexMgr_Average_SSE2 -- (a + b) >> 1 per byte; _mm_avg_epu8 rounds up, so
+take off the bit it rounded with
+================
+*/
+static __m128i TexMgr_Average_SSE2 (__m128i a, __m128i b)
+{
+	return _mm_sub_epi8 (_mm_avg_epu8 (a, b), _mm_and_si128 (_mm_xor_si128 (a, b), _mm_set1_epi8 (1)));
+}
 
-			dest[0] = (nwpx[0]*imodx*imody + nepx[0]*modx*imody + swpx[0]*imodx*mody + sepx[0]*modx*mody)>>16;
-			dest[1] = (nwpx[1]*imodx*imody + nepx[1]*modx*imody + swpx[1]*imodx*mody + sepx[1]*modx*mody)>>16;
-			dest[2] = (nwpx[2]*imodx*imody + nepx[2]*modx*imody + swpx[2]*imodx*mody + sepx[2]*modx*mody)>>16;
-			if (alpha)
-				dest[3] = (nwpx[3]*imodx*imody + nepx[3]*modx*imody + swpx[3]*imodx*mody + sepx[3]*modx*mody)>>16;
-			else
-				dest[3] = 255;
+/*
+================
+TexMgr_MipMapW_SSE2 -- four output pixels at a time
+================
+*/
+static void TexMgr_MipMapW_SSE2 (byte *data, int outpixels)
+{
+	__m128i	a, b;
+	int		i;
 
-			x += xfrac;
-		}
-		outjump += outwidth;
-		y += yfrac;
+	for (i = 0; i + 4 <= outpixels; i += 4)
+	{
+		a = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)(data + i*8)), _MM_SHUFFLE(3,1,2,0));
+		b = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)(data + i*8 + 16)), _MM_SHUFFLE(3,1,2,0));
+		_mm_storeu_si128 ((__m128i *)(data + i*4), TexMgr_Average_SSE2 (_mm_unpacklo_epi64 (a, b), _mm_unpackhi_epi64 (a, b)));
 	}
 
-	return out;
+	if (i < outpixels)
+	{
+		memmove (data + i*4, data + i*8, (outpixels - i) * 8);
+		TexMgr_MipMapW_C (data + i*4, outpixels - i);
+	}
 }
 
 /*
-===============
-TexMgr_AlphaEdgeFix
-
-eliminate pink edges on sprites, etc.
-operates in place on 32bit data
-===============
+================
+TexMgr_MipMapH_SSE2 -- sixteen bytes of a row at a time
+================
 */
-static void TexMgr_AlphaEdgeFix (byte *data, int width, int height)
+static void TexMgr_MipMapH_SSE2 (byte *data, int width, int height)
 {
-	int	i, j, n = 0, b, c[3] = {0,0,0},
-		lastrow, thisrow, nextrow,
-		lastpix, thispix, nextpix;
-	byte	*dest = data;
+	byte	*out, *in0, *in1;
+	int		i, j, rowbytes;
 
-	for (i = 0; i < height; i++)
+	rowbytes = width * 4;
+	for (i = 0; i < (height>>1); i++)
 	{
-		lastrow = width * 4 * ((i == 0) ? height-1 : i-1);
-		thisrow = width * 4 * i;
-		nextrow = width * 4 * ((i == height-1) ? 0 : i+1);
+		out = data + i * rowbytes;
+		in0 = data + i * 2 * rowbytes;
+		in1 = in0 + rowbytes;
+		for (j = 0; j + 16 <= rowbytes; j += 16)
+			_mm_storeu_si128 ((__m128i *)(out + j), TexMgr_Average_SSE2 (_mm_loadu_si128 ((const __m128i *)(in0 + j)), _mm_loadu_si128 ((const __m128i *)(in1 + j))));
+		for ( ; j < rowbytes; j++)
+			out[j] = (in0[j] + in1[j])>>1;
+	}
+}
 
-		for (j = 0; j < width; j++, dest += 4)
-		{
-			if (dest[3]) //not transparent
-				continue;
+static const texkernels_t texkernels_sse2 = {"SSE2", TexMgr_MipMapW_SSE2, TexMgr_MipMapH_SSE2, TexMgr_Palette_C};
+#endif //TEXMGR_SSE2
 
-			lastpix = 4 * ((j == 0) ? width-1 : j-1);
-			thispix = 4 * j;
-			nextpix = 4 * ((j == width-1) ? 0 : j+1);
+#ifdef TEXMGR_AVX2
+/*
+================
+TexMgr_Average_AVX2
+================
+*/
+static __attribute__((target("avx2"))) __m256i TexMgr_Average_AVX2 (__m256i a, __m256i b)
+{
+	return _mm256_sub_epi8 (_mm256_avg_epu8 (a, b), _mm256_and_si256 (_mm256_xor_si256 (a, b), _mm256_set1_epi8 (1)));
+}
 
-			b = lastrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = thisrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = nextrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = lastrow + thispix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = nextrow + thispix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = lastrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = thisrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
-			b = nextrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+/*
+================
+TexMgr_MipMapW_AVX2 -- eight output pixels at a time
+================
+*/
+static __attribute__((target("avx2"))) void TexMgr_MipMapW_AVX2 (byte *data, int outpixels)
+{
+	__m256i	a, b, evenodd;
+	int		i;
 
-			//average all non-transparent neighbors
-			if (n)
-			{
-				dest[0] = (byte)(c[0]/n);
-				dest[1] = (byte)(c[1]/n);
-				dest[2] = (byte)(c[2]/n);
+	evenodd = _mm256_setr_epi32 (0, 2, 4, 6, 1, 3, 5, 7);
+	for (i = 0; i + 8 <= outpixels; i += 8)
+	{
+		a = _mm256_permutevar8x32_epi32 (_mm256_loadu_si256 ((const __m256i *)(data + i*8)), evenodd);
+		b = _mm256_permutevar8x32_epi32 (_mm256_loadu_si256 ((const __m256i *)(data + i*8 + 32)), evenodd);
+		_mm256_storeu_si256 ((__m256i *)(data + i*4), TexMgr_Average_AVX2 (_mm256_permute2x128_si256 (a, b, 0x20), _mm256_permute2x128_si256 (a, b, 0x31)));
+	}
 
-				n = c[0] = c[1] = c[2] = 0;
-			}
-		}
+	if (i < outpixels)
+	{
+		memmove (data + i*4, data + i*8, (outpixels - i) * 8);
+		TexMgr_MipMapW_C (data + i*4, outpixels - i);
 	}
 }
 
 /*
-===============
-TexMgr_PadEdgeFixW -- special case of AlphaEdgeFix for textures that only need it because they were padded
-
-operates in place on 32bit data, and expects unpadded height and width values
-===============
+================
+TexMgr_MipMapH_AVX2 -- thirty-two bytes of a row at a time
+================
 */
-static void TexMgr_PadEdgeFixW (byte *data, int width, int height)
+static __attribute__((target("avx2"))) void TexMgr_MipMapH_AVX2 (byte *data, int width, int height)
 {
-	byte *src, *dst;
-	int i, padw, padh;
+	byte	*out, *in0, *in1;
+	int		i, j, rowbytes;
+
+	rowbytes = width * 4;
+	for (i = 0; i < (height>>1); i++)
+	{
+		out = data + i * rowbytes;
+		in0 = data + i * 2 * rowbytes;
+		in1 = in0 + rowbytes;
+		for (j = 0; j + 32 <= rowbytes; j += 32)
+			_mm256_storeu_si256 ((__m256i *)(out + j), TexMgr_Average_AVX2 (_mm256_loadu_si256 ((const __m256i *)(in0 + j)), _mm256_loadu_si256 ((const __m256i *)(in1 + j))));
+		for ( ; j < rowbytes; j++)
+			out[j] = (in0[j] + in1[j])>>1;
+	}
+}
+
+/*
+================
+TexMgr_Palette_AVX2 -- eight lookups per gather
+================
+*/
+static __attribute__((target("avx2"))) void TexMgr_Palette_AVX2 (unsigned *out, const byte *in, int pixels, const unsigned *pal)
+{
+	__m256i	indexes;
+	int		i;
+
+	for (i = 0; i + 8 <= pixels; i += 8)
+	{
+		indexes = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(in + i)));
+		_mm256_storeu_si256 ((__m256i *)(out + i), _mm256_i32gather_epi32 ((const int *)pal, indexes, 4));
+	}
+	for ( ; i < pixels; i++)
+		out[i] = pal[in[i]];
+}
+
+static const texkernels_t texkernels_avx2 = {"AVX2", TexMgr_MipMapW_AVX2, TexMgr_MipMapH_AVX2, TexMgr_Palette_AVX2};
+#endif //TEXMGR_AVX2
+
+#ifdef TEXMGR_NEON
+/*
+================
+TexMgr_MipMapW_NEON -- vld2 splits even and odd pixels, vhadd truncates like the C
+================
+*/
+static void TexMgr_MipMapW_NEON (byte *data, int outpixels)
+{
+	uint32x4x2_t	pairs;
+	int				i;
+
+	for (i = 0; i + 4 <= outpixels; i += 4)
+	{
+		pairs = vld2q_u32 ((const uint32_t *)(data + i*8));
+		vst1q_u8 (data + i*4, vhaddq_u8 (vreinterpretq_u8_u32 (pairs.val[0]), vreinterpretq_u8_u32 (pairs.val[1])));
+	}
+
+	if (i < outpixels)
+	{
+		memmove (data + i*4, data + i*8, (outpixels - i) * 8);
+		TexMgr_MipMapW_C (data + i*4, outpixels - i);
+	}
+}
+
+/*
+================
+TexMgr_MipMapH_NEON
+================
+*/
+static void TexMgr_MipMapH_NEON (byte *data, int width, int height)
+{
+	byte	*out, *in0, *in1;
+	int		i, j, rowbytes;
+
+	rowbytes = width * 4;
+	for (i = 0; i < (height>>1); i++)
+	{
+		out = data + i * rowbytes;
+		in0 = data + i * 2 * rowbytes;
+		in1 = in0 + rowbytes;
+		for (j = 0; j + 16 <= rowbytes; j += 16)
+			vst1q_u8 (out + j, vhaddq_u8 (vld1q_u8 (in0 + j), vld1q_u8 (in1 + j)));
+		for ( ; j < rowbytes; j++)
+			out[j] = (in0[j] + in1[j])>>1;
+	}
+}
+
+static const texkernels_t texkernels_neon = {"NEON", TexMgr_MipMapW_NEON, TexMgr_MipMapH_NEON, TexMgr_Palette_C};
+#endif //TEXMGR_NEON
+
+static const texkernels_t *texkernels = &texkernels_c;
+
+/*
+================
+TexMgr_SupportedKernels -- fills list with the kernel sets this cpu can run,
+best last
+================
+*/
+static int TexMgr_SupportedKernels (const texkernels_t **list)
+{
+	int count = 0;
+
+	list[count++] = &texkernels_c;
+#ifdef TEXMGR_SSE2
+	if (SDL_HasSSE2 ())
+		list[count++] = &texkernels_sse2;
+#endif
+#ifdef TEXMGR_AVX2
+	if (SDL_HasAVX2 ())
+		list[count++] = &texkernels_avx2;
+#endif
+#ifdef TEXMGR_NEON
+	list[count++] = &texkernels_neon;
+#endif
+	return count;
+}
+
+/*
+================
+TexMgr_InitKernels -- "-notexsimd" keeps the plain C loops
+================
+*/
+static void TexMgr_InitKernels (void)
+{
+	const texkernels_t	*list[4];
+	int					count;
+
+	count = TexMgr_SupportedKernels (list);
+	texkernels = COM_CheckParm ("-notexsimd") ? &texkernels_c : list[count-1];
+	Con_DPrintf ("Texture kernels: %s\n", texkernels->name);
+}
+
+/*
+================
+TexMgr_CheckKernels -- runs every kernel set on a copy of an 8bit image and
+compares the results with the C ones; returns the number of mismatches
+================
+*/
+static int TexMgr_CheckKernels (const texkernels_t **list, int count, const byte *pixels, int width, int height, const char *name)
+{
+	unsigned	*ref, *test;
+	int			i, size, w, h, bad;
+
+	size = width * height;
+	ref = (unsigned *) malloc (size * 4);
+	test = (unsigned *) malloc (size * 4);
+	bad = 0;
+
+	for (i = 1; i < count; i++)
+	{
+		texkernels_c.palette (ref, pixels, size, d_8to24table);
+		list[i]->palette (test, pixels, size, d_8to24table);
+		if (memcmp (ref, test, size * 4))
+		{
+			Con_Printf ("%s: %s palette differs on %s (%ix%i)\n", "testtexkernels", list[i]->name, name, width, height);
+			bad++;
+			continue;
+		}
+
+	// walk the mip chain the way TexMgr_BuildMips32 does
+		for (w = width, h = height; w > 1 || h > 1; )
+		{
+			if (w > 1)
+			{
+				texkernels_c.mipmapw ((byte *)ref, (w*h)>>1);
+				list[i]->mipmapw ((byte *)test, (w*h)>>1);
+				w >>= 1;
+			}
+			if (h > 1)
+			{
+				texkernels_c.mipmaph ((byte *)ref, w, h);
+				list[i]->mipmaph ((byte *)test, w, h);
+				h >>= 1;
+			}
+			if (memcmp (ref, test, w * h * 4))
+			{
+				Con_Printf ("%s: %s mipmap differs on %s at %ix%i\n", "testtexkernels", list[i]->name, name, w, h);
+				bad++;
+				break;
+			}
+		}
+	}
+
+	free (ref);
+	free (test);
+	return bad;
+}
+
+/*
+================
+TexMgr_TestKernels_f -- testtexkernels: checks the SIMD kernels against the
+C ones on random images and the gfx.wad and world textures, then times them
+================
+*/
+static void TexMgr_TestKernels_f (void)
+{
+	static const int sizes[][2] = {{1,1}, {2,2}, {3,5}, {7,1}, {16,16}, {33,17}, {64,3}, {130,66}, {256,256}, {1024,512}};
+	extern texture_t *r_notexture_mip, *r_notexture_mip2;
+	const texkernels_t	*list[4];
+	lumpinfo_t	*lump;
+	qpic_t		*pic;
+	texture_t	*tx;
+	byte		*pixels;
+	unsigned	*rgba;
+	double		start, mw, mh, pal;
+	int			i, j, count, tested, bad, w, h, passes;
+
+	count = TexMgr_SupportedKernels (list);
+	tested = bad = 0;
+
+// random images of awkward sizes
+	for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); i++)
+	{
+		pixels = (byte *) malloc (sizes[i][0] * sizes[i][1]);
+		for (j = 0; j < sizes[i][0] * sizes[i][1]; j++)
+			pixels[j] = rand() & 255;
+		bad += TexMgr_CheckKernels (list, count, pixels, sizes[i][0], sizes[i][1], "random");
+		free (pixels);
+		tested++;
+	}
+
+// real images
+	for (i = 0, lump = wad_lumps; i < wad_numlumps; i++, lump++)
+	{
+		if (lump->type != TYP_QPIC)
+			continue;
+		pic = (qpic_t *)(wad_base + lump->filepos);
+		w = LittleLong (pic->width);
+		h = LittleLong (pic->height);
+		if (w <= 0 || h <= 0 || w * h + 8 > lump->size)
+			continue;
+		bad += TexMgr_CheckKernels (list, count, pic->data, w, h, lump->name);
+		tested++;
+	}
+	if (cl.worldmodel)
+	{
+		for (i = 0; i < cl.worldmodel->numtextures; i++)
+		{
+			tx = cl.worldmodel->textures[i];
+			if (!tx || !tx->width || tx == r_notexture_mip || tx == r_notexture_mip2)
+				continue;
+			bad += TexMgr_CheckKernels (list, count, (byte *)(tx+1), tx->width, tx->height, tx->name);
+			tested++;
+		}
+	}
+
+	Con_Printf ("%i images, %i kernel sets, %i mismatches\n", tested, count, bad);
+
+// throughput on a 1024x1024 image
+	w = h = 1024;
+	passes = 16;
+	pixels = (byte *) malloc (w * h);
+	rgba = (unsigned *) malloc (w * h * 4);
+	for (j = 0; j < w * h; j++)
+		pixels[j] = rand() & 255;
+
+	Con_Printf ("%-6s %10s %10s %10s MPix/s\n", "", "palette", "mipmapw", "mipmaph");
+	for (i = 0; i < count; i++)
+	{
+		mw = mh = 0;
+		start = TexMgr_StageTime ();
+		for (j = 0; j < passes; j++)
+			list[i]->palette (rgba, pixels, w * h, d_8to24table);
+		pal = TexMgr_StageTime () - start;
+
+		for (j = 0; j < passes; j++)
+		{
+			list[i]->palette (rgba, pixels, w * h, d_8to24table);
+			start = TexMgr_StageTime ();
+			list[i]->mipmapw ((byte *)rgba, (w*h)>>1);
+			mw += TexMgr_StageTime () - start;
+
+			list[i]->palette (rgba, pixels, w * h, d_8to24table);
+			start = TexMgr_StageTime ();
+			list[i]->mipmaph ((byte *)rgba, w, h);
+			mh += TexMgr_StageTime () - start;
+		}
+
+		Con_Printf ("%-6s %10.1f %10.1f %10.1f%s\n", list[i]->name,
+			passes * w * h / q_max(pal, 1e-6) / 1e6,
+			passes * w * h / q_max(mw, 1e-6) / 1e6,
+			passes * w * h / q_max(mh, 1e-6) / 1e6,
+			(list[i] == texkernels) ? " (in use)" : "");
+	}
+
+	free (pixels);
+	free (rgba);
+}
+
+/*
+================
+TexMgr_MipMapW
+================
+*/
+static unsigned *TexMgr_MipMapW (unsigned *data, int width, int height)
+{
+	texkernels->mipmapw ((byte *)data, (width*height)>>1);
+	return data;
+}
+
+/*
+================
+TexMgr_MipMapH
+================
+*/
+static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
+{
+	texkernels->mipmaph ((byte *)data, width, height);
+	return data;
+}
+
+/*
+================
+TexMgr_ResampleTexture -- bilinear resample
+================
+*/
+static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight, qboolean alpha, texscratch_t *scratch)
+{
+	byte *nwpx, *nepx, *swpx, *sepx, *dest;
+	unsigned xfrac, yfrac, x, y, modx, mody, imodx, imody, injump, outjump;
+	unsigned *out;
+	int i, j, outwidth, outheight;
+
+	if (inwidth == TexMgr_Pad(inwidth) && inheight == TexMgr_Pad(inheight))
+		return in;
+
+	outwidth = TexMgr_Pad(inwidth);
+	outheight = TexMgr_Pad(inheight);
+	out = (unsigned *) TexMgr_ScratchAlloc(scratch, outwidth*outheight*4);
+
+	xfrac = ((inwidth-1) << 16) / (outwidth-1);
+	yfrac = ((inheight-1) << 16) / (outheight-1);
+	y = outjump = 0;
+
+	for (i = 0; i < outheight; i++)
+	{
+		mody = (y>>8) & 0xFF;
+		imody = 256 - mody;
+		injump = (y>>16) * inwidth;
+		x = 0;
+
+		for (j = 0; j < outwidth; j++)
+		{
+			modx = (x>>8) & 0xFF;
+			imodx = 256 - modx;
+
+			nwpx = (byte *)(in + (x>>16) + injump);
+			nepx = nwpx + 4;
+			swpx = nwpx + inwidth*4;
+			sepx = swpx + 4;
+
+			dest = (byte *)(out + outjump + j);
+
+			dest[0] = (nwpx[0]*imodx*imody + nepx[0]*modx*imody + swpx[0]*imodx*mody + sepx[0]*modx*mody)>>16;
+			dest[1] = (nwpx[1]*imodx*imody + nepx[1]*modx*imody + swpx[1]*imodx*mody + sepx[1]*modx*mody)>>16;
+			dest[2] = (nwpx[2]*imodx*imody + nepx[2]*modx*imody + swpx[2]*imodx*mody + sepx[2]*modx*mody)>>16;
+			if (alpha)
+				dest[3] = (nwpx[3]*imodx*imody + nepx[3]*modx*imody + swpx[3]*imodx*mody + sepx[3]*modx*mody)>>16;
+			else
+				dest[3] = 255;
+
+			x += xfrac;
+		}
+		outjump += outwidth;
+		y += yfrac;
+	}
+
+	return out;
+}
+
+/*
+===============
+TexMgr_AlphaEdgeFix
+
+eliminate pink edges on sprites, etc.
+operates in place on 32bit data
+===============
+*/
+static void TexMgr_AlphaEdgeFix (byte *data, int width, int height)
+{
+	int	i, j, n = 0, b, c[3] = {0,0,0},
+		lastrow, thisrow, nextrow,
+		lastpix, thispix, nextpix;
+	byte	*dest = data;
+
+	for (i = 0; i < height; i++)
+	{
+		lastrow = width * 4 * ((i == 0) ? height-1 : i-1);
+		thisrow = width * 4 * i;
+		nextrow = width * 4 * ((i == height-1) ? 0 : i+1);
+
+		for (j = 0; j < width; j++, dest += 4)
+		{
+			if (dest[3]) //not transparent
+				continue;
+
+			lastpix = 4 * ((j == 0) ? width-1 : j-1);
+			thispix = 4 * j;
+			nextpix = 4 * ((j == width-1) ? 0 : j+1);
+
+			b = lastrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = thisrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = nextrow + lastpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = lastrow + thispix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = nextrow + thispix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = lastrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = thisrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+			b = nextrow + nextpix; if (data[b+3]) {c[0] += data[b]; c[1] += data[b+1]; c[2] += data[b+2]; n++;}
+
+			//average all non-transparent neighbors
+			if (n)
+			{
+				dest[0] = (byte)(c[0]/n);
+				dest[1] = (byte)(c[1]/n);
+				dest[2] = (byte)(c[2]/n);
+
+				n = c[0] = c[1] = c[2] = 0;
+			}
+		}
+	}
+}
+
+/*
+===============
+TexMgr_PadEdgeFixW -- special case of AlphaEdgeFix for textures that only need it because they were padded
+
+operates in place on 32bit data, and expects unpadded height and width values
+===============
+*/
+static void TexMgr_PadEdgeFixW (byte *data, int width, int height)
+{
+	byte *src, *dst;
+	int i, padw, padh;
 
 	padw = TexMgr_PadConditional(width);
 	padh = TexMgr_PadConditional(height);
@@ -938,15 +1608,12 @@ static void TexMgr_PadEdgeFixH (byte *data, int width, int height)
 TexMgr_8to32
 ================
 */
-static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
+static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal, texscratch_t *scratch)
 {
-	int i;
-	unsigned *out, *data;
-
-	out = data = (unsigned *) Hunk_Alloc(pixels*4);
+	unsigned *data;
 
-	for (i = 0; i < pixels; i++)
-		*out++ = usepal[*in++];
+	data = (unsigned *) TexMgr_ScratchAlloc(scratch, pixels*4);
+	texkernels->palette (data, in, pixels, usepal);
 
 	return data;
 }
@@ -956,7 +1623,7 @@ static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
 TexMgr_PadImageW -- return image with width padded up to power-of-two dimentions
 ================
 */
-static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
+static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte, texscratch_t *scratch)
 {
 	int i, j, outwidth;
 	byte *out, *data;
@@ -966,7 +1633,7 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 
 	outwidth = TexMgr_Pad(width);
 
-	out = data = (byte *) Hunk_Alloc(outwidth*height);
+	out = data = (byte *) TexMgr_ScratchAlloc(scratch, outwidth*height);
 
 	for (i = 0; i < height; i++)
 	{
@@ -984,7 +1651,7 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 TexMgr_PadImageH -- return image with height padded up to power-of-two dimentions
 ================
 */
-static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
+static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte, texscratch_t *scratch)
 {
 	int i, srcpix, dstpix;
 	byte *data, *out;
@@ -995,7 +1662,7 @@ static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
 	srcpix = width * height;
 	dstpix = width * TexMgr_Pad(height);
 
-	out = data = (byte *) Hunk_Alloc(dstpix);
+	out = data = (byte *) TexMgr_ScratchAlloc(scratch, dstpix);
 
 	for (i = 0; i < srcpix; i++)
 		*out++ = *in++;
@@ -1007,181 +1674,1354 @@ static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
 
 /*
 ================
-TexMgr_LoadImage32 -- handles 32bit source data
+TexMgr_Convert8 -- turns 8bit source data into 32bit
 ================
 */
-static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
+static unsigned *TexMgr_Convert8 (gltexture_t *glt, byte *data, const texsettings_t *settings, texscratch_t *scratch, double *times)
 {
-	int	internalformat,	miplevel, mipwidth, mipheight, picmip;
+	qboolean padw = false, padh = false;
+	byte padbyte;
+	unsigned int *usepal;
+	double time;
+	int i;
 
-	if (!gl_texture_NPOT)
+	time = TexMgr_StageTime ();
+
+	// HACK HACK HACK -- taken from tomazquake
+	if (strstr(glt->name, "shot1sid") &&
+	    glt->width == 32 && glt->height == 32 &&
+	    CRC_Block(data, 1024) == 65393)
+	{
+		// This texture in b_shell1.bsp has some of the first 32 pixels painted white.
+		// They are invisible in software, but look really ugly in GL. So we just copy
+		// 32 pixels from the bottom to make it look nice.
+		memcpy (data, data + 32*31, 32);
+	}
+
+	// detect false alpha cases
+	if (glt->flags & TEXPREF_ALPHA && !(glt->flags & TEXPREF_CONCHARS))
+	{
+		for (i = 0; i < (int) (glt->width * glt->height); i++)
+			if (data[i] == 255) //transparent index
+				break;
+		if (i == (int) (glt->width * glt->height))
+			glt->flags -= TEXPREF_ALPHA;
+	}
+
+	// choose palette and padbyte
+	if (glt->flags & TEXPREF_FULLBRIGHT)
+	{
+		if (glt->flags & TEXPREF_ALPHA)
+			usepal = d_8to24table_fbright_fence;
+		else
+			usepal = d_8to24table_fbright;
+		padbyte = 0;
+	}
+	else if (glt->flags & TEXPREF_NOBRIGHT && settings->fullbrights)
+	{
+		if (glt->flags & TEXPREF_ALPHA)
+			usepal = d_8to24table_nobright_fence;
+		else
+			usepal = d_8to24table_nobright;
+		padbyte = 0;
+	}
+	else if (glt->flags & TEXPREF_CONCHARS)
+	{
+		usepal = d_8to24table_conchars;
+		padbyte = 0;
+	}
+	else
+	{
+		usepal = d_8to24table;
+		padbyte = 255;
+	}
+
+	// pad each dimention, but only if it's not going to be downsampled later
+	if (glt->flags & TEXPREF_PAD)
+	{
+		if ((int) glt->width < TexMgr_LimitTextureSize(glt->width, settings->maxsize))
+		{
+			data = TexMgr_PadImageW (data, glt->width, glt->height, padbyte, scratch);
+			glt->width = TexMgr_Pad(glt->width);
+			padw = true;
+		}
+		if ((int) glt->height < TexMgr_LimitTextureSize(glt->height, settings->maxsize))
+		{
+			data = TexMgr_PadImageH (data, glt->width, glt->height, padbyte, scratch);
+			glt->height = TexMgr_Pad(glt->height);
+			padh = true;
+		}
+	}
+
+	// convert to 32bit
+	data = (byte *)TexMgr_8to32(data, glt->width * glt->height, usepal, scratch);
+	times[TEXSTAGE_CONVERT] += TexMgr_StageTime () - time;
+
+	// fix edges
+	time = TexMgr_StageTime ();
+	if (glt->flags & TEXPREF_ALPHA)
+		TexMgr_AlphaEdgeFix (data, glt->width, glt->height);
+	else
+	{
+		if (padw)
+			TexMgr_PadEdgeFixW (data, glt->source_width, glt->source_height);
+		if (padh)
+			TexMgr_PadEdgeFixH (data, glt->source_width, glt->source_height);
+	}
+	times[TEXSTAGE_EDGEFIX] += TexMgr_StageTime () - time;
+
+	return (unsigned *)data;
+}
+
+/*
+================
+TexMgr_BuildMips32 -- resamples and picmips 32bit data, then builds the mip chain
+================
+*/
+static void TexMgr_BuildMips32 (gltexture_t *glt, unsigned *data, const texsettings_t *settings, texscratch_t *scratch, texmips_t *mips, double *times)
+{
+	int	mipwidth, mipheight, picmip, size;
+	double time;
+	unsigned *level;
+
+	if (!gl_texture_NPOT)
 	{
 		// resample up
-		data = TexMgr_ResampleTexture (data, glt->width, glt->height, glt->flags & TEXPREF_ALPHA);
+		time = TexMgr_StageTime ();
+		data = TexMgr_ResampleTexture (data, glt->width, glt->height, glt->flags & TEXPREF_ALPHA, scratch);
 		glt->width = TexMgr_Pad(glt->width);
 		glt->height = TexMgr_Pad(glt->height);
+		times[TEXSTAGE_RESAMPLE] += TexMgr_StageTime () - time;
 	}
 
 	// mipmap down
-	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
-	mipwidth = TexMgr_SafeTextureSize (glt->width >> picmip);
-	mipheight = TexMgr_SafeTextureSize (glt->height >> picmip);
+	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : settings->picmip;
+	mipwidth = TexMgr_LimitTextureSize (glt->width >> picmip, settings->maxsize);
+	mipheight = TexMgr_LimitTextureSize (glt->height >> picmip, settings->maxsize);
 	while ((int) glt->width > mipwidth)
 	{
+		time = TexMgr_StageTime ();
 		TexMgr_MipMapW (data, glt->width, glt->height);
 		glt->width >>= 1;
+		times[TEXSTAGE_MIPMAP] += TexMgr_StageTime () - time;
 		if (glt->flags & TEXPREF_ALPHA)
+		{
+			time = TexMgr_StageTime ();
 			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+			times[TEXSTAGE_EDGEFIX] += TexMgr_StageTime () - time;
+		}
 	}
 	while ((int) glt->height > mipheight)
 	{
+		time = TexMgr_StageTime ();
 		TexMgr_MipMapH (data, glt->width, glt->height);
 		glt->height >>= 1;
+		times[TEXSTAGE_MIPMAP] += TexMgr_StageTime () - time;
 		if (glt->flags & TEXPREF_ALPHA)
+		{
+			time = TexMgr_StageTime ();
 			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+			times[TEXSTAGE_EDGEFIX] += TexMgr_StageTime () - time;
+		}
 	}
 
-	// upload
-	GL_Bind (glt);
-	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
-	glTexImage2D (GL_TEXTURE_2D, 0, internalformat, glt->width, glt->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	// level 0 is used where it is
+	mips->format = 0;
+	mips->numlevels = 1;
+	mips->width[0] = mipwidth = glt->width;
+	mips->height[0] = mipheight = glt->height;
+	mips->offset[0] = 0;
+	mips->size[0] = mipwidth * mipheight * 4;
+	mips->data = (byte *)data;
+	if (!(glt->flags & TEXPREF_MIPMAP) || (mipwidth == 1 && mipheight == 1))
+		return;
 
-	// upload mipmaps
-	if (glt->flags & TEXPREF_MIPMAP)
+	// the smaller levels each start as a copy of the one above
+	time = TexMgr_StageTime ();
+	for (size = 0; mipwidth > 1 || mipheight > 1; )
+	{
+		size += mipwidth * mipheight;
+		mipwidth = q_max(mipwidth >> 1, 1);
+		mipheight = q_max(mipheight >> 1, 1);
+	}
+	size += 1;
+	mips->data = (byte *) TexMgr_ScratchAlloc (scratch, size * 4);
+	memcpy (mips->data, data, glt->width * glt->height * 4);
+
+	mipwidth = glt->width;
+	mipheight = glt->height;
+	while ((mipwidth > 1 || mipheight > 1) && mips->numlevels < MAX_TEXMIPLEVELS)
+	{
+		mips->offset[mips->numlevels] = mips->offset[mips->numlevels-1] + mipwidth * mipheight * 4;
+		level = (unsigned *)(mips->data + mips->offset[mips->numlevels]);
+		memcpy (level, mips->data + mips->offset[mips->numlevels-1], mipwidth * mipheight * 4);
+		if (mipwidth > 1)
+		{
+			TexMgr_MipMapW (level, mipwidth, mipheight);
+			mipwidth >>= 1;
+		}
+		if (mipheight > 1)
+		{
+			TexMgr_MipMapH (level, mipwidth, mipheight);
+			mipheight >>= 1;
+		}
+		mips->width[mips->numlevels] = mipwidth;
+		mips->height[mips->numlevels] = mipheight;
+		mips->size[mips->numlevels] = mipwidth * mipheight * 4;
+		mips->numlevels++;
+	}
+	times[TEXSTAGE_MIPMAP] += TexMgr_StageTime () - time;
+}
+
+/*
+================================================================================
+
+	TEXTURE COMPRESSION
+
+a small range fit BC1/BC3 (DXT1/DXT5) encoder: the endpoints are the corners
+of each block's color bounding box, inset a little, and every pixel takes
+the nearest of the four colors
+
+================================================================================
+*/
+
+/*
+================
+TexMgr_Pack565
+================
+*/
+static unsigned short TexMgr_Pack565 (const byte *c)
+{
+	return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+/*
+================
+TexMgr_Unpack565
+================
+*/
+static void TexMgr_Unpack565 (unsigned short c, int *out)
+{
+	out[0] = ((c >> 11) & 31) * 255 / 31;
+	out[1] = ((c >> 5) & 63) * 255 / 63;
+	out[2] = (c & 31) * 255 / 31;
+}
+
+/*
+================
+TexMgr_EncodeColorBlock -- 8 bytes of BC1 color for 16 rgba pixels
+================
+*/
+static void TexMgr_EncodeColorBlock (const byte *pixels, byte *out)
+{
+	byte			mins[3], maxs[3];
+	int				palette[4][3], c0[3], c1[3];
+	unsigned short	e0, e1;
+	unsigned		indexes, best, dist;
+	int				i, j, k, inset, d;
+
+	mins[0] = mins[1] = mins[2] = 255;
+	maxs[0] = maxs[1] = maxs[2] = 0;
+	for (i = 0; i < 16; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			mins[j] = q_min(mins[j], pixels[i*4+j]);
+			maxs[j] = q_max(maxs[j], pixels[i*4+j]);
+		}
+	}
+	for (j = 0; j < 3; j++)
 	{
-		mipwidth = glt->width;
-		mipheight = glt->height;
+		inset = (maxs[j] - mins[j]) >> 4;
+		mins[j] += inset;
+		maxs[j] -= inset;
+	}
 
-		for (miplevel=1; mipwidth > 1 || mipheight > 1; miplevel++)
+	e0 = TexMgr_Pack565 (maxs);
+	e1 = TexMgr_Pack565 (mins);
+	indexes = 0;
+	if (e0 != e1)
+	{
+		if (e0 < e1) //four color mode needs e0 > e1
+		{
+			unsigned short swap = e0;
+			e0 = e1;
+			e1 = swap;
+		}
+		TexMgr_Unpack565 (e0, c0);
+		TexMgr_Unpack565 (e1, c1);
+		for (j = 0; j < 3; j++)
+		{
+			palette[0][j] = c0[j];
+			palette[1][j] = c1[j];
+			palette[2][j] = (2 * c0[j] + c1[j]) / 3;
+			palette[3][j] = (c0[j] + 2 * c1[j]) / 3;
+		}
+		for (i = 0; i < 16; i++)
 		{
-			if (mipwidth > 1)
+			best = 0;
+			for (k = 0, dist = ~0u; k < 4; k++)
 			{
-				TexMgr_MipMapW (data, mipwidth, mipheight);
-				mipwidth >>= 1;
+				unsigned sum = 0;
+				for (j = 0; j < 3; j++)
+				{
+					d = pixels[i*4+j] - palette[k][j];
+					sum += d * d;
+				}
+				if (sum < dist)
+				{
+					dist = sum;
+					best = k;
+				}
 			}
-			if (mipheight > 1)
+			indexes |= best << (i * 2);
+		}
+	}
+
+	out[0] = e0 & 255;
+	out[1] = e0 >> 8;
+	out[2] = e1 & 255;
+	out[3] = e1 >> 8;
+	out[4] = indexes & 255;
+	out[5] = (indexes >> 8) & 255;
+	out[6] = (indexes >> 16) & 255;
+	out[7] = indexes >> 24;
+}
+
+/*
+================
+TexMgr_EncodeAlphaBlock -- 8 bytes of BC3 alpha for 16 rgba pixels
+================
+*/
+static void TexMgr_EncodeAlphaBlock (const byte *pixels, byte *out)
+{
+	int		palette[8], a0, a1, i, k, best, dist, d;
+	unsigned	bits[2];
+
+	a0 = 0;
+	a1 = 255;
+	for (i = 0; i < 16; i++)
+	{
+		a0 = q_max(a0, pixels[i*4+3]);
+		a1 = q_min(a1, pixels[i*4+3]);
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+	bits[0] = bits[1] = 0;
+	if (a0 != a1)
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		for (k = 1; k < 7; k++)
+			palette[k+1] = ((7 - k) * a0 + k * a1) / 7;
+		for (i = 0; i < 16; i++)
+		{
+			best = 0;
+			for (k = 0, dist = 256; k < 8; k++)
 			{
-				TexMgr_MipMapH (data, mipwidth, mipheight);
-				mipheight >>= 1;
+				d = abs (pixels[i*4+3] - palette[k]);
+				if (d < dist)
+				{
+					dist = d;
+					best = k;
+				}
 			}
-			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, mipwidth, mipheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			// 48 bits of 3 bit indexes, split over two words
+			if (i < 8)
+				bits[0] |= best << (i * 3);
+			else
+				bits[1] |= best << ((i - 8) * 3);
 		}
 	}
 
-	// set filter modes
-	TexMgr_SetFilterModes (glt);
+	out[2] = bits[0] & 255;
+	out[3] = (bits[0] >> 8) & 255;
+	out[4] = (bits[0] >> 16) & 255;
+	out[5] = bits[1] & 255;
+	out[6] = (bits[1] >> 8) & 255;
+	out[7] = (bits[1] >> 16) & 255;
+}
+
+/*
+================
+TexMgr_CompressedSize
+================
+*/
+int TexMgr_CompressedSize (GLenum format, int width, int height)
+{
+	return Image_CompressedLevelSize (format, width, height);
+}
+
+/*
+================
+TexMgr_CompressImage -- encodes rgba as BC1, or BC3 if alpha is set; blocks
+hanging off the edge repeat the last row and column
+================
+*/
+void TexMgr_CompressImage (const byte *in, int width, int height, qboolean alpha, byte *out)
+{
+	byte	block[16*4];
+	int		bx, by, x, y, sx, sy;
+
+	for (by = 0; by < height; by += 4)
+	{
+		for (bx = 0; bx < width; bx += 4)
+		{
+			for (y = 0; y < 4; y++)
+			{
+				sy = q_min(by + y, height - 1);
+				for (x = 0; x < 4; x++)
+				{
+					sx = q_min(bx + x, width - 1);
+					memcpy (block + (y*4 + x)*4, in + (sy*width + sx)*4, 4);
+				}
+			}
+			if (alpha)
+			{
+				TexMgr_EncodeAlphaBlock (block, out);
+				out += 8;
+			}
+			TexMgr_EncodeColorBlock (block, out);
+			out += 8;
+		}
+	}
+}
+
+/*
+================
+TexMgr_CompressMips -- replaces an rgba mip chain with a compressed one
+================
+*/
+static void TexMgr_CompressMips (gltexture_t *glt, texscratch_t *scratch, texmips_t *mips, double *times)
+{
+	GLenum	format;
+	byte	*data;
+	int		i, size;
+	double	time;
+
+	if (mips->format || (mips->width[0] & 3) || (mips->height[0] & 3))
+		return;
+
+	time = TexMgr_StageTime ();
+	format = (glt->flags & TEXPREF_ALPHA) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	for (i = 0, size = 0; i < mips->numlevels; i++)
+		size += TexMgr_CompressedSize (format, mips->width[i], mips->height[i]);
+	data = (byte *) TexMgr_ScratchAlloc (scratch, size);
+
+	for (i = 0, size = 0; i < mips->numlevels; i++)
+	{
+		TexMgr_CompressImage (mips->data + mips->offset[i], mips->width[i], mips->height[i], format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT, data + size);
+		mips->offset[i] = size;
+		mips->size[i] = TexMgr_CompressedSize (format, mips->width[i], mips->height[i]);
+		size += mips->size[i];
+	}
+	mips->data = data;
+	mips->format = format;
+	times[TEXSTAGE_COMPRESS] += TexMgr_StageTime () - time;
+}
+
+#define MAX_COMPRESSIMAGES	8192
+
+/*
+================
+TexMgr_CompressTextures_f -- compresstextures [dir]: writes a dds for every
+tga, png and pcx in a directory of the search path (textures/ by default) to
+the same place under the gamedir, so later loads skip decoding, mipmapping
+and compressing. BC1, or BC3 if the image has any alpha, with as many mip
+levels as the size halves evenly.
+================
+*/
+static void TexMgr_CompressTextures_f (void)
+{
+	char		(*names)[MAX_QPATH];
+	char		dir[MAX_QPATH], name[MAX_QPATH], path[MAX_OSPATH];
+	compressedimage_t	*image;
+	byte		*data;
+	unsigned	format;
+	qboolean	alpha;
+	int			count, written, i, j, width, height, numlevels, mark;
+	double		start, inbytes, outbytes;
+
+	q_snprintf (dir, sizeof(dir), "%s/", (Cmd_Argc () > 1) ? Cmd_Argv (1) : "textures");
+	names = (char (*)[MAX_QPATH]) malloc (MAX_COMPRESSIMAGES * MAX_QPATH);
+	count = Image_ListImages (dir, names, MAX_COMPRESSIMAGES);
+
+	start = Sys_DoubleTime ();
+	written = 0;
+	inbytes = outbytes = 0;
+	for (i = 0; i < count; i++)
+	{
+		mark = Hunk_LowMark ();
+		COM_StripExtension (names[i], name, sizeof(name));
+		if (!(data = Image_LoadImage (name, &width, &height)))
+		{
+			Hunk_FreeToLowMark (mark);
+			continue;
+		}
+
+		for (j = 0, alpha = false; j < width * height && !alpha; j++)
+			alpha = (data[j*4+3] < 255);
+		format = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+		// the box filter needs even sizes, so stop at the first odd one
+		for (numlevels = 1, j = 0; (width >> j > 1 || height >> j > 1); numlevels++, j++)
+			if ((width >> j > 1 && (width >> j) & 1) || (height >> j > 1 && (height >> j) & 1))
+				break;
+
+		image = Image_AllocCompressed (format, width, height, numlevels);
+		for (j = 0; j < image->numlevels; j++)
+		{
+			if (j > 0)
+			{
+				if (image->width[j-1] > 1)
+					TexMgr_MipMapW ((unsigned *)data, image->width[j-1], image->height[j-1]);
+				if (image->height[j-1] > 1)
+					TexMgr_MipMapH ((unsigned *)data, image->width[j], image->height[j-1]);
+			}
+			TexMgr_CompressImage (data, image->width[j], image->height[j], alpha, (byte *)image + image->offset[j]);
+		}
+
+		q_snprintf (path, sizeof(path), "%s/%s.dds", com_gamedir, name);
+		COM_CreatePath (path);
+		if (Image_WriteDDSFile (path, image))
+		{
+			written++;
+			inbytes += width * height * 4.0;
+			outbytes += image->totalsize - sizeof(compressedimage_t);
+		}
+		else
+			Con_Printf ("couldn't write %s\n", path);
+		Hunk_FreeToLowMark (mark);
+	}
+	free (names);
+
+	Con_Printf ("wrote %i of %i images in %s as dds, %.1f MB of rgba to %.1f MB, in %.1f s\n",
+		written, count, dir, inbytes / 0x100000, outbytes / 0x100000, Sys_DoubleTime () - start);
+}
+
+/*
+================================================================================
+
+	TEXTURE CACHE
+
+finished mip chains are saved in <gamedir>/texcache, named by a hash of the
+source pixels and everything else that changes the result, so the next
+load of the same image (next launch, vid_restart, another map using it)
+reads it back instead of converting and mipmapping it again
+
+================================================================================
+*/
+
+#define TEXCACHE_VERSION	1
+
+
+typedef struct
+{
+	char		magic[4];	//"QSTC"
+	int			version;
+	unsigned	key[2];
+	int			width, height, flags;
+	int			format;
+	int			numlevels;
+	int			levelwidth[MAX_TEXMIPLEVELS];
+	int			levelheight[MAX_TEXMIPLEVELS];
+	int			offset[MAX_TEXMIPLEVELS];
+	int			size[MAX_TEXMIPLEVELS];
+} texcacheheader_t;
+
+/*
+================
+TexMgr_CacheEnabled -- colormapped skins and tiny images aren't worth a file
+================
+*/
+static qboolean TexMgr_CacheEnabled (gltexture_t *glt, const texsettings_t *settings)
+{
+	return settings->cache && !(glt->flags & TEXPREF_WARPIMAGE) && glt->shirt == -1 && glt->pants == -1 &&
+		glt->source_width * glt->source_height >= 32*32;
+}
+
+/*
+================
+TexMgr_CacheKey -- the name isn't part of it, so maps sharing a texture share the file
+================
+*/
+static void TexMgr_CacheKey (gltexture_t *glt, const texsettings_t *settings, const byte *data, unsigned *key)
+{
+	int		params[10];
+	int		size;
+
+	size = glt->source_width * glt->source_height;
+	if (glt->source_format == SRC_RGBA)
+		size *= 4;
+
+	params[0] = TEXCACHE_VERSION;
+	params[1] = glt->source_width;
+	params[2] = glt->source_height;
+	params[3] = glt->source_format;
+	params[4] = glt->flags;
+	params[5] = (glt->flags & TEXPREF_NOPICMIP) ? 0 : settings->picmip;
+	params[6] = settings->fullbrights;
+	params[7] = gl_texture_NPOT;
+	params[8] = TexMgr_LimitTextureSize (1 << 30, settings->maxsize);
+	params[9] = settings->compress;
+
+	COM_HashInit (key);
+	COM_HashBytes (key, params, sizeof(params));
+	COM_HashBytes (key, d_8to24table, sizeof(d_8to24table));
+	COM_HashBytes (key, data, size);
+}
+
+/*
+================
+TexMgr_CachePath
+================
+*/
+static void TexMgr_CachePath (const unsigned *key, char *path, size_t pathsize)
+{
+	q_snprintf (path, pathsize, "%s/texcache/%08x%08x.qtc", com_gamedir, key[0], key[1]);
+}
+
+/*
+================
+TexMgr_CacheHeaderValid -- the levels must be the formats and sizes the cache
+writes, packed back to back from the end of the header, and fit in the file.
+the flags are already in the key; the file only has them after conversion,
+which can drop TEXPREF_ALPHA for false alpha images and nothing else
+================
+*/
+static qboolean TexMgr_CacheHeaderValid (gltexture_t *glt, const texsettings_t *settings, const texcacheheader_t *header, long datasize)
+{
+	int		i, w, h, maxsize, size, total;
+
+	if (header->format && header->format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && header->format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		return false;
+	if (header->format && !gl_texture_s3tc)
+		return false;
+	if (header->flags != (int)glt->flags && header->flags != (int)(glt->flags & ~TEXPREF_ALPHA))
+		return false;
+	if (header->numlevels < 1 || header->numlevels > MAX_TEXMIPLEVELS)
+		return false;
+	if (header->width != header->levelwidth[0] || header->height != header->levelheight[0])
+		return false;
+
+	maxsize = TexMgr_LimitTextureSize (1 << 30, settings->maxsize);
+	for (i = 0, total = 0; i < header->numlevels; i++)
+	{
+		w = header->levelwidth[i];
+		h = header->levelheight[i];
+		if (w < 1 || h < 1 || w > maxsize || h > maxsize)
+			return false;
+		size = header->format ? TexMgr_CompressedSize (header->format, w, h) : w * h * 4;
+		if (header->offset[i] != total || header->size[i] != size || size > datasize - total)
+			return false;
+		total += size;
+	}
+
+	return true;
+}
+
+/*
+================
+TexMgr_CacheRead -- fills mips and the size and flags of glt on a hit. uses stdio
+because it runs on the worker threads.  anything that doesn't check out is
+a miss, and the image is converted again and the file rewritten
+================
+*/
+static qboolean TexMgr_CacheRead (gltexture_t *glt, const texsettings_t *settings, const unsigned *key, texscratch_t *scratch, texmips_t *mips)
+{
+	texcacheheader_t	header;
+	char	path[MAX_OSPATH];
+	FILE	*f;
+	long	filesize;
+	int		i, size;
+
+	TexMgr_CachePath (key, path, sizeof(path));
+	if (!(f = fopen (path, "rb")))
+		return false;
+
+	if (fseek (f, 0, SEEK_END) || (filesize = ftell (f)) < (long)sizeof(header) || fseek (f, 0, SEEK_SET) ||
+		fread (&header, sizeof(header), 1, f) != 1 || memcmp (header.magic, "QSTC", 4) ||
+		header.version != TEXCACHE_VERSION || header.key[0] != key[0] || header.key[1] != key[1] ||
+		!TexMgr_CacheHeaderValid (glt, settings, &header, filesize - (long)sizeof(header)))
+	{
+		fclose (f);
+		return false;
+	}
+
+	size = header.offset[header.numlevels-1] + header.size[header.numlevels-1];
+	mips->data = (byte *) TexMgr_ScratchAlloc (scratch, size);
+	if (fread (mips->data, size, 1, f) != 1)
+	{
+		fclose (f);
+		return false;
+	}
+	fclose (f);
+
+	mips->format = header.format;
+	mips->numlevels = header.numlevels;
+	for (i = 0; i < header.numlevels; i++)
+	{
+		mips->width[i] = header.levelwidth[i];
+		mips->height[i] = header.levelheight[i];
+		mips->offset[i] = header.offset[i];
+		mips->size[i] = header.size[i];
+	}
+	glt->width = header.width;
+	glt->height = header.height;
+	glt->flags = header.flags; //same as TexMgr_Convert8 would leave them
+	return true;
+}
+
+/*
+================
+TexMgr_CacheWrite -- writes to a temporary name and renames it, since two
+workers can be saving the same image
+================
+*/
+static void TexMgr_CacheWrite (gltexture_t *glt, const unsigned *key, texmips_t *mips)
+{
+	texcacheheader_t	header;
+	char	path[MAX_OSPATH], temp[MAX_OSPATH];
+	FILE	*f;
+	int		i, size;
+	qboolean	ok;
+
+	memset (&header, 0, sizeof(header));
+	memcpy (header.magic, "QSTC", 4);
+	header.version = TEXCACHE_VERSION;
+	header.key[0] = key[0];
+	header.key[1] = key[1];
+	header.width = glt->width;
+	header.height = glt->height;
+	header.flags = glt->flags;
+	header.format = mips->format;
+	header.numlevels = mips->numlevels;
+	for (i = 0; i < mips->numlevels; i++)
+	{
+		header.levelwidth[i] = mips->width[i];
+		header.levelheight[i] = mips->height[i];
+		header.offset[i] = mips->offset[i] - mips->offset[0];
+		header.size[i] = mips->size[i];
+	}
+	size = header.offset[mips->numlevels-1] + header.size[mips->numlevels-1];
+
+	TexMgr_CachePath (key, path, sizeof(path));
+	q_snprintf (temp, sizeof(temp), "%s.%p", path, (void *)mips);
+	if (!(f = fopen (temp, "wb")))
+		return;
+	ok = fwrite (&header, sizeof(header), 1, f) == 1 && fwrite (mips->data + mips->offset[0], size, 1, f) == 1;
+	ok = (fclose (f) == 0) && ok;
+
+	remove (path); //rename won't replace a file on windows
+	if (!ok || rename (temp, path))
+		remove (temp);
+}
+
+/*
+================
+TexMgr_ProcessImage -- everything up to the upload; touches no gl state, so
+the worker threads can run it
+================
+*/
+static void TexMgr_ProcessImage (gltexture_t *glt, byte *data, const texsettings_t *settings, texscratch_t *scratch, texmips_t *mips, double *times)
+{
+	unsigned	key[2];
+	qboolean	cache;
+	double		time;
+
+	glt->cachestate = TEXCACHE_NONE;
+	if ((cache = TexMgr_CacheEnabled (glt, settings)))
+	{
+		time = TexMgr_StageTime ();
+		TexMgr_CacheKey (glt, settings, data, key);
+		if (TexMgr_CacheRead (glt, settings, key, scratch, mips))
+		{
+			glt->cachestate = TEXCACHE_HIT;
+			times[TEXSTAGE_CACHE] += TexMgr_StageTime () - time;
+			return;
+		}
+		times[TEXSTAGE_CACHE] += TexMgr_StageTime () - time;
+	}
+
+	if (glt->source_format == SRC_INDEXED)
+		data = (byte *)TexMgr_Convert8 (glt, data, settings, scratch, times);
+
+	TexMgr_BuildMips32 (glt, (unsigned *)data, settings, scratch, mips, times);
+
+	if (cache)
+	{
+		if (settings->compress)
+			TexMgr_CompressMips (glt, scratch, mips, times);
+
+		time = TexMgr_StageTime ();
+		TexMgr_CacheWrite (glt, key, mips);
+		glt->cachestate = TEXCACHE_MISS;
+		times[TEXSTAGE_CACHE] += TexMgr_StageTime () - time;
+	}
+}
+
+/*
+================
+TexMgr_UploadMips
+================
+*/
+static void TexMgr_UploadMips (gltexture_t *glt, texmips_t *mips, double *times)
+{
+	int	internalformat, miplevel;
+	double time;
+
+	time = TexMgr_StageTime ();
+
+	GL_Bind (glt);
+	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+	glt->bytes = 0;
+	glt->glformat = mips->format ? mips->format : (unsigned int)internalformat;
+	glt->residency = TEXRES_FULL;
+	glt->evictlevel = 0;
+	for (miplevel = 0; miplevel < mips->numlevels; miplevel++)
+	{
+		glt->bytes += mips->size[miplevel];
+		if (mips->format)
+			GL_CompressedTexImage2DFunc (GL_TEXTURE_2D, miplevel, mips->format, mips->width[miplevel], mips->height[miplevel], 0, mips->size[miplevel], mips->data + mips->offset[miplevel]);
+		else
+			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, mips->width[miplevel], mips->height[miplevel], 0, GL_RGBA, GL_UNSIGNED_BYTE, mips->data + mips->offset[miplevel]);
+	}
+
+	// dds and ktx files may stop short of 1x1
+	if (glt->flags & TEXPREF_MIPMAP)
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mips->numlevels - 1);
+
+	// set filter modes
+	TexMgr_SetFilterModes (glt);
+
+	times[TEXSTAGE_UPLOAD] += TexMgr_StageTime () - time;
+}
+
+/*
+================
+TexMgr_AddLoadTimes
+================
+*/
+static double	texmgr_loadtimes[NUM_TEXSTAGES];
+static int		texmgr_loadcount;
+
+static void TexMgr_AddLoadTimes (gltexture_t *glt, double *times)
+{
+	int i;
+
+	glt->loadtime = 0;
+	for (i = 0; i < NUM_TEXSTAGES; i++)
+	{
+		texmgr_loadtimes[i] += times[i];
+		glt->loadtime += times[i];
+	}
+	texmgr_loadcount++;
+}
+
+/*
+================
+TexMgr_LoadImageNow -- handles 8bit and 32bit source data on this thread
+================
+*/
+static void TexMgr_LoadImageNow (gltexture_t *glt, byte *data)
+{
+	texsettings_t	settings;
+	texscratch_t	scratch;
+	texmips_t		mips;
+	double			times[NUM_TEXSTAGES];
+
+	memset (&scratch, 0, sizeof(scratch));
+	memset (times, 0, sizeof(times));
+
+	TexMgr_GetSettings (&settings);
+	TexMgr_ProcessImage (glt, data, &settings, &scratch, &mips, times);
+	TexMgr_UploadMips (glt, &mips, times);
+	TexMgr_ScratchFree (&scratch);
+
+	TexMgr_AddLoadTimes (glt, times);
+}
+
+/*
+================
+TexMgr_LoadLightmap -- handles lightmap data
+================
+*/
+static void TexMgr_LoadLightmap (gltexture_t *glt, byte *data)
+{
+	// upload it
+	GL_Bind (glt);
+	glTexImage2D (GL_TEXTURE_2D, 0, lightmap_bytes, glt->width, glt->height, 0, gl_lightmap_format, GL_UNSIGNED_BYTE, data);
+	glt->bytes = glt->width * glt->height * lightmap_bytes;
+	glt->glformat = lightmap_bytes;
+
+	// set filter modes
+	TexMgr_SetFilterModes (glt);
+}
+
+/*
+================
+TexMgr_LoadCompressed -- handles dds and ktx data, which goes straight to gl.
+gl_picmip and gl_max_size skip the levels they'd have mipmapped away.
+================
+*/
+static void TexMgr_LoadCompressed (gltexture_t *glt, byte *data)
+{
+	compressedimage_t	*image = (compressedimage_t *)data;
+	texmips_t	mips;
+	double		times[NUM_TEXSTAGES];
+	int			picmip, maxwidth, maxheight, first, i;
+
+	memset (times, 0, sizeof(times));
+
+	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+	maxwidth = TexMgr_SafeTextureSize (image->width[0] >> picmip);
+	maxheight = TexMgr_SafeTextureSize (image->height[0] >> picmip);
+	for (first = 0; first < image->numlevels - 1; first++)
+		if (image->width[first] <= maxwidth && image->height[first] <= maxheight)
+			break;
+
+	mips.data = data;
+	mips.format = image->format;
+	mips.numlevels = (glt->flags & TEXPREF_MIPMAP) ? q_min(image->numlevels - first, MAX_TEXMIPLEVELS) : 1;
+	for (i = 0; i < mips.numlevels; i++)
+	{
+		mips.width[i] = image->width[first + i];
+		mips.height[i] = image->height[first + i];
+		mips.offset[i] = image->offset[first + i];
+		mips.size[i] = image->size[first + i];
+	}
+	glt->width = mips.width[0];
+	glt->height = mips.height[0];
+	glt->cachestate = TEXCACHE_NONE;
+
+	TexMgr_UploadMips (glt, &mips, times);
+	TexMgr_AddLoadTimes (glt, times);
+}
+
+/*
+================================================================================
+
+	WORKER THREADS
+
+between TexMgr_BeginBatch and TexMgr_EndBatch, 8bit and 32bit images are
+converted and mipmapped on a pool of threads. the gltexture_t is returned
+right away but isn't uploaded until the worker is done with it, so nothing
+may draw with it, or read its size or flags, before TexMgr_EndBatch.  a
+batch ended without waiting is uploaded a bit at a time by
+TexMgr_ResidencyFrame, and draws as nulltexture until then.
+
+================================================================================
+*/
+
+#define MAX_TEXWORKERS	8
+
+typedef struct texjob_s
+{
+	struct texjob_s	*next;
+	gltexture_t		*glt;		//uploaded by the main thread
+	gltexture_t		work;		//copy the worker changes the size and flags of
+	byte			*data;		//copy of the source data
+	texsettings_t	settings;
+	texscratch_t	scratch;
+	texmips_t		mips;
+	double			times[NUM_TEXSTAGES];
+} texjob_t;
+
+static SDL_Thread	*texworkers[MAX_TEXWORKERS];
+static int			numtexworkers = -1;	//-1 until TexMgr_StartWorkers
+static SDL_mutex	*texjobmutex;
+static SDL_cond		*texjobcond;		//signalled when a job is queued
+static SDL_cond		*texdonecond;		//signalled when a job is finished
+static texjob_t		*texjobs, **texjobstail = &texjobs;		//waiting for a worker
+static texjob_t		*texdone, **texdonetail = &texdone;		//waiting for upload
+static int			texjobsoutstanding;	//queued but not uploaded yet
+static qboolean		texworkersquit;		//set by TexMgr_Shutdown
+static qboolean		texbatching;
+static double		texbatchstart, texbatchtime;
+
+/*
+================
+TexMgr_WorkerThread
+================
+*/
+static int TexMgr_WorkerThread (void *unused)
+{
+	texjob_t	*job;
+
+	SDL_LockMutex (texjobmutex);
+	for (;;)
+	{
+		while (!texjobs && !texworkersquit)
+			SDL_CondWait (texjobcond, texjobmutex);
+		if (texworkersquit)
+			break;
+		job = texjobs;
+		if (!(texjobs = job->next))
+			texjobstail = &texjobs;
+		SDL_UnlockMutex (texjobmutex);
+
+		TexMgr_ProcessImage (&job->work, job->data, &job->settings, &job->scratch, &job->mips, job->times);
+
+		SDL_LockMutex (texjobmutex);
+		job->next = NULL;
+		*texdonetail = job;
+		texdonetail = &job->next;
+		SDL_CondSignal (texdonecond);
+	}
+	SDL_UnlockMutex (texjobmutex);
+
+	return 0;
+}
+
+/*
+================
+TexMgr_StartWorkers -- "-texthreads 0" loads everything on the main thread
+================
+*/
+static void TexMgr_StartWorkers (void)
+{
+	int		i;
+
+	i = COM_CheckParm ("-texthreads");
+	if (i && i < com_argc-1)
+		numtexworkers = atoi (com_argv[i+1]);
+	else
+#if defined(USE_SDL2)
+		numtexworkers = SDL_GetCPUCount () - 1;
+#else
+		numtexworkers = 2;
+#endif
+	numtexworkers = CLAMP (0, numtexworkers, MAX_TEXWORKERS);
+	if (!numtexworkers)
+		return;
+
+	texjobmutex = SDL_CreateMutex ();
+	texjobcond = SDL_CreateCond ();
+	texdonecond = SDL_CreateCond ();
+	for (i = 0; i < numtexworkers; i++)
+	{
+#if defined(USE_SDL2)
+		texworkers[i] = SDL_CreateThread (TexMgr_WorkerThread, "texworker", NULL);
+#else
+		texworkers[i] = SDL_CreateThread (TexMgr_WorkerThread, NULL);
+#endif
+		if (!texworkers[i])
+			break;
+	}
+	numtexworkers = i;
+	Con_DPrintf ("%i texture loading threads\n", numtexworkers);
+}
+
+/*
+================
+TexMgr_QueueImage
+================
+*/
+static void TexMgr_QueueImage (gltexture_t *glt, byte *data)
+{
+	texjob_t	*job;
+	int			size;
+
+	size = glt->source_width * glt->source_height;
+	if (glt->source_format == SRC_RGBA)
+		size *= 4;
+
+	job = (texjob_t *) calloc (1, sizeof(texjob_t));
+	if (!job || !(job->data = (byte *) malloc (size)))
+		Sys_Error ("TexMgr_QueueImage: out of memory");
+	memcpy (job->data, data, size);
+
+	// jobs are uploaded as they finish, so an older image of the same texture
+	// (a TEXPREF_OVERWRITE reload within one batch) could land after this one
+	while (glt->queued)
+		TexMgr_UploadFinished (true);
+
+	job->glt = glt;
+	job->work = *glt;
+	job->work.width = glt->source_width; //glt may still be showing an evicted texture's size
+	job->work.height = glt->source_height;
+	TexMgr_GetSettings (&job->settings);
+	glt->queued++;
+	glt->residency = TEXRES_LOADING;
+
+	SDL_LockMutex (texjobmutex);
+	*texjobstail = job;
+	texjobstail = &job->next;
+	texjobsoutstanding++;
+	SDL_CondSignal (texjobcond);
+	SDL_UnlockMutex (texjobmutex);
+}
+
+/*
+================
+TexMgr_UploadFinished -- uploads whatever the workers have finished, waiting
+for at least one job if wait is set
+================
+*/
+static void TexMgr_UploadFinished (qboolean wait)
+{
+	texjob_t	*job, *next;
+
+	SDL_LockMutex (texjobmutex);
+	if (wait)
+	{
+		while (!texdone)
+			SDL_CondWait (texdonecond, texjobmutex);
+	}
+	job = texdone;
+	texdone = NULL;
+	texdonetail = &texdone;
+	SDL_UnlockMutex (texjobmutex);
+
+	for ( ; job; job = next)
+	{
+		next = job->next;
+
+		job->glt->width = job->work.width;
+		job->glt->height = job->work.height;
+		job->glt->flags = job->work.flags;
+		job->glt->cachestate = job->work.cachestate;
+		TexMgr_UploadMips (job->glt, &job->mips, job->times);
+		TexMgr_AddLoadTimes (job->glt, job->times);
+
+		job->glt->queued--;
+		TexMgr_ScratchFree (&job->scratch);
+		free (job->data);
+		free (job);
+		texjobsoutstanding--;
+	}
+}
+
+/*
+================
+TexMgr_FinishJobs -- waits for and uploads every queued image
+================
+*/
+static void TexMgr_FinishJobs (void)
+{
+	while (texjobsoutstanding)
+		TexMgr_UploadFinished (true);
+}
+
+/*
+================
+TexMgr_FreeJobs
+================
+*/
+static void TexMgr_FreeJobs (texjob_t *job)
+{
+	texjob_t	*next;
+
+	for ( ; job; job = next)
+	{
+		next = job->next;
+		job->glt->queued--;
+		TexMgr_ScratchFree (&job->scratch);
+		free (job->data);
+		free (job);
+	}
+}
+
+/*
+================
+TexMgr_Shutdown -- stops the worker threads.  anything they haven't
+finished is dropped, the textures are about to go with the gl context
+================
+*/
+void TexMgr_Shutdown (void)
+{
+	int		i;
+
+	if (numtexworkers <= 0)
+		return;
+
+	SDL_LockMutex (texjobmutex);
+	texworkersquit = true;
+	SDL_CondBroadcast (texjobcond);
+	SDL_UnlockMutex (texjobmutex);
+
+	for (i = 0; i < numtexworkers; i++)
+		SDL_WaitThread (texworkers[i], NULL);
+
+	TexMgr_FreeJobs (texjobs);
+	TexMgr_FreeJobs (texdone);
+	texjobs = NULL;
+	texdone = NULL;
+	texjobstail = &texjobs;
+	texdonetail = &texdone;
+	texjobsoutstanding = 0;
+
+	SDL_DestroyCond (texdonecond);
+	SDL_DestroyCond (texjobcond);
+	SDL_DestroyMutex (texjobmutex);
+	numtexworkers = 0;
+}
+
+/*
+================
+TexMgr_BeginBatch -- keeptimes adds this batch to the texloadtimes of the
+last one instead of starting over
+================
+*/
+void TexMgr_BeginBatch (qboolean keeptimes)
+{
+	if (isDedicated || texbatching)
+		return;
+
+	if (numtexworkers == -1)
+		TexMgr_StartWorkers ();
+
+	if (!keeptimes)
+	{
+		memset (texmgr_loadtimes, 0, sizeof(texmgr_loadtimes));
+		texmgr_loadcount = 0;
+		texbatchtime = 0;
+	}
+	texbatchstart = TexMgr_StageTime ();
+	texbatching = true;
+}
+
+/*
+================
+TexMgr_EndBatch -- uploads everything loaded since TexMgr_BeginBatch, or
+without wait, leaves what isn't finished yet to TexMgr_ResidencyFrame
+================
+*/
+void TexMgr_EndBatch (qboolean wait)
+{
+	if (!texbatching)
+		return;
+
+	if (wait)
+		TexMgr_FinishJobs ();
+	else if (texjobsoutstanding)
+		TexMgr_UploadFinished (false);
+
+	texbatching = false;
+	texbatchtime += TexMgr_StageTime () - texbatchstart;
+	Con_DPrintf ("loaded %i textures in %.1f ms\n", texmgr_loadcount, texbatchtime * 1000.0);
 }
 
 /*
 ================
-TexMgr_LoadImage8 -- handles 8bit source data, then passes it to LoadImage32
+TexMgr_LoadTimes_f -- texloadtimes: the stages of the last map's texture loads
 ================
 */
-static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
+static void TexMgr_LoadTimes_f (void)
 {
-	extern cvar_t gl_fullbrights;
-	qboolean padw = false, padh = false;
-	byte padbyte;
-	unsigned int *usepal;
-	int i;
+	double	total;
+	int		i;
 
-	// HACK HACK HACK -- taken from tomazquake
-	if (strstr(glt->name, "shot1sid") &&
-	    glt->width == 32 && glt->height == 32 &&
-	    CRC_Block(data, 1024) == 65393)
+	Con_Printf ("%i textures, %i threads, %.1f ms\n", texmgr_loadcount, q_max(numtexworkers, 0), texbatchtime * 1000.0);
+	for (i = 0, total = 0; i < NUM_TEXSTAGES; i++)
 	{
-		// This texture in b_shell1.bsp has some of the first 32 pixels painted white.
-		// They are invisible in software, but look really ugly in GL. So we just copy
-		// 32 pixels from the bottom to make it look nice.
-		memcpy (data, data + 32*31, 32);
+		Con_Printf ("  %-8s %8.1f ms\n", texstagenames[i], texmgr_loadtimes[i] * 1000.0);
+		total += texmgr_loadtimes[i];
 	}
+	Con_Printf ("  %-8s %8.1f ms (across all threads)\n", "total", total * 1000.0);
+}
 
-	// detect false alpha cases
-	if (glt->flags & TEXPREF_ALPHA && !(glt->flags & TEXPREF_CONCHARS))
-	{
-		for (i = 0; i < (int) (glt->width * glt->height); i++)
-			if (data[i] == 255) //transparent index
-				break;
-		if (i == (int) (glt->width * glt->height))
-			glt->flags -= TEXPREF_ALPHA;
-	}
+/*
+================
+TexMgr_TimeTexLoad_f -- timetexload [count]: loads a synthetic mod's worth of
+small textures the way models do, then times looking each one up and
+freeing them all
+================
+*/
+static void TexMgr_TimeTexLoad_f (void)
+{
+	static qmodel_t	benchowner;
+	char	name[64];
+	byte	*data;
+	int		count, i, j, found;
+	double	start, loadtime, hashtime, lineartime, freetime;
 
-	// choose palette and padbyte
-	if (glt->flags & TEXPREF_FULLBRIGHT)
-	{
-		if (glt->flags & TEXPREF_ALPHA)
-			usepal = d_8to24table_fbright_fence;
-		else
-			usepal = d_8to24table_fbright;
-		padbyte = 0;
-	}
-	else if (glt->flags & TEXPREF_NOBRIGHT && gl_fullbrights.value)
-	{
-		if (glt->flags & TEXPREF_ALPHA)
-			usepal = d_8to24table_nobright_fence;
-		else
-			usepal = d_8to24table_nobright;
-		padbyte = 0;
-	}
-	else if (glt->flags & TEXPREF_CONCHARS)
-	{
-		usepal = d_8to24table_conchars;
-		padbyte = 0;
-	}
-	else
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 20000;
+	count = CLAMP (1, count, MAX_GLTEXTURES - numgltextures);
+
+	data = (byte *) malloc (count * 4*4*4);
+	for (i = 0; i < count * 4*4*4; i++)
+		data[i] = rand () & 255;
+
+	start = TexMgr_StageTime ();
+	for (i = 0; i < count; i++)
 	{
-		usepal = d_8to24table;
-		padbyte = 255;
+		q_snprintf (name, sizeof(name), "progs/bench%i.mdl:frame%i", i / 16, i % 16);
+		TexMgr_LoadImage (&benchowner, name, 4, 4, SRC_RGBA, data + i * 4*4*4, "", (src_offset_t)(data + i * 4*4*4), TEXPREF_OVERWRITE | TEXPREF_NOPICMIP);
 	}
+	loadtime = TexMgr_StageTime () - start;
 
-	// pad each dimention, but only if it's not going to be downsampled later
-	if (glt->flags & TEXPREF_PAD)
+	for (j = 0; j < 2; j++)
 	{
-		if ((int) glt->width < TexMgr_SafeTextureSize(glt->width))
-		{
-			data = TexMgr_PadImageW (data, glt->width, glt->height, padbyte);
-			glt->width = TexMgr_Pad(glt->width);
-			padw = true;
-		}
-		if ((int) glt->height < TexMgr_SafeTextureSize(glt->height))
+		start = TexMgr_StageTime ();
+		for (i = 0, found = 0; i < count; i++)
 		{
-			data = TexMgr_PadImageH (data, glt->width, glt->height, padbyte);
-			glt->height = TexMgr_Pad(glt->height);
-			padh = true;
+			q_snprintf (name, sizeof(name), "progs/bench%i.mdl:frame%i", i / 16, i % 16);
+			if (j ? TexMgr_FindTextureLinear (&benchowner, name) : TexMgr_FindTexture (&benchowner, name))
+				found++;
 		}
+		if (found != count)
+			Con_Printf ("%s lookup found %i of %i\n", j ? "linear" : "hashed", found, count);
+		if (j)
+			lineartime = TexMgr_StageTime () - start;
+		else
+			hashtime = TexMgr_StageTime () - start;
 	}
 
-	// convert to 32bit
-	data = (byte *)TexMgr_8to32(data, glt->width * glt->height, usepal);
+	start = TexMgr_StageTime ();
+	TexMgr_FreeTexturesForOwner (&benchowner);
+	freetime = TexMgr_StageTime () - start;
+	free (data);
 
-	// fix edges
-	if (glt->flags & TEXPREF_ALPHA)
-		TexMgr_AlphaEdgeFix (data, glt->width, glt->height);
-	else
-	{
-		if (padw)
-			TexMgr_PadEdgeFixW (data, glt->source_width, glt->source_height);
-		if (padh)
-			TexMgr_PadEdgeFixH (data, glt->source_width, glt->source_height);
-	}
+	Con_Printf ("%i textures: load %.1f ms, lookup %.2f ms (linear scan %.1f ms), free %.1f ms\n",
+		count, loadtime * 1000.0, hashtime * 1000.0, lineartime * 1000.0, freetime * 1000.0);
+}
 
-	// upload it
-	TexMgr_LoadImage32 (glt, (unsigned *)data);
+/*
+================
+TexMgr_CompressedUsable -- whether gl can take a dds or ktx image as it is
+================
+*/
+static qboolean TexMgr_CompressedUsable (compressedimage_t *image)
+{
+	if (image->format == GL_COMPRESSED_RGBA_BPTC_UNORM_ARB && !gl_texture_bptc)
+		return false;
+	if (!gl_texture_NPOT && (image->width[0] != TexMgr_Pad (image->width[0]) || image->height[0] != TexMgr_Pad (image->height[0])))
+		return false;
+	return gl_texture_s3tc;
 }
 
 /*
 ================
-TexMgr_LoadLightmap -- handles lightmap data
+TexMgr_LoadExternalImage -- for replacement textures: reads name.dds or
+name.ktx if gl can use it as it is, else name.tga, png or pcx. returns hunk
+data to pass to TexMgr_LoadImage as the returned format.
 ================
 */
-static void TexMgr_LoadLightmap (gltexture_t *glt, byte *data)
+byte *TexMgr_LoadExternalImage (const char *name, int *width, int *height, enum srcformat *format)
 {
-	// upload it
-	GL_Bind (glt);
-	glTexImage2D (GL_TEXTURE_2D, 0, lightmap_bytes, glt->width, glt->height, 0, gl_lightmap_format, GL_UNSIGNED_BYTE, data);
+	compressedimage_t	*image;
+	int		mark;
 
-	// set filter modes
-	TexMgr_SetFilterModes (glt);
+	if (gl_texture_s3tc)
+	{
+		mark = Hunk_LowMark ();
+		image = Image_LoadCompressed (name);
+		if (image && TexMgr_CompressedUsable (image))
+		{
+			*width = image->width[0];
+			*height = image->height[0];
+			*format = SRC_COMPRESSED;
+			return (byte *)image;
+		}
+		if (image)
+			Con_DPrintf ("TexMgr_LoadExternalImage: %s can't be used as it is, looking for other formats\n", name);
+		Hunk_FreeToLowMark (mark);
+	}
+
+	*format = SRC_RGBA;
+	return Image_LoadImage (name, width, height);
 }
 
 /*
@@ -1194,7 +3034,6 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 {
 	unsigned short crc;
 	gltexture_t *glt;
-	int mark;
 
 	if (isDedicated)
 		return NULL;
@@ -1211,6 +3050,9 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 	case SRC_RGBA:
 		crc = CRC_Block(data, width * height * 4);
 		break;
+	case SRC_COMPRESSED:
+		crc = CRC_Block(data, ((compressedimage_t *)data)->totalsize);
+		break;
 	default: /* not reachable but avoids compiler warnings */
 		crc = 0;
 	}
@@ -1220,11 +3062,9 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 			return glt;
 	}
 	else
-		glt = TexMgr_NewTexture ();
+		glt = TexMgr_NewTexture (owner, name);
 
 	// copy data
-	glt->owner = owner;
-	q_strlcpy (glt->name, name, sizeof(glt->name));
 	glt->width = width;
 	glt->height = height;
 	glt->flags = flags;
@@ -1236,24 +3076,43 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 	glt->source_width = width;
 	glt->source_height = height;
 	glt->source_crc = crc;
+	glt->cachestate = TEXCACHE_NONE;
+	glt->loadtime = 0;
+	glt->bytes = 0;
+	glt->glformat = 0;
+	glt->residency = TEXRES_FULL;
+	glt->evictlevel = 0;
+
+	// the workers can't create directories, so do it for them
+	if (!texcachedirready && gl_texcache.value)
+	{
+		char dirname[MAX_OSPATH];
+		q_snprintf (dirname, sizeof(dirname), "%s/texcache", com_gamedir);
+		Sys_mkdir (dirname);
+		texcachedirready = true;
+	}
 
 	//upload it
-	mark = Hunk_LowMark();
-
 	switch (glt->source_format)
 	{
 	case SRC_INDEXED:
-		TexMgr_LoadImage8 (glt, data);
+	case SRC_RGBA:
+		if (texbatching && numtexworkers > 0 && !(flags & TEXPREF_WARPIMAGE))
+			TexMgr_QueueImage (glt, data);
+		else
+			TexMgr_LoadImageNow (glt, data);
 		break;
 	case SRC_LIGHTMAP:
 		TexMgr_LoadLightmap (glt, data);
 		break;
-	case SRC_RGBA:
-		TexMgr_LoadImage32 (glt, (unsigned *)data);
+	case SRC_COMPRESSED:
+		TexMgr_LoadCompressed (glt, data);
 		break;
 	}
 
-	Hunk_FreeToLowMark(mark);
+	// upload anything the workers have finished while we're here
+	if (texjobsoutstanding)
+		TexMgr_UploadFinished (false);
 
 	return glt;
 }
@@ -1268,18 +3127,12 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 
 /*
 ================
-TexMgr_ReloadImage -- reloads a texture, and colormaps it if needed
+TexMgr_LoadSource -- reads the source data of a texture back in, on the hunk
 ================
 */
-void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants)
+static byte *TexMgr_LoadSource (gltexture_t *glt)
 {
-	byte	translation[256];
-	byte	*src, *dst, *data = NULL, *translated;
-	int	mark, size, i;
-//
-// get source data
-//
-	mark = Hunk_LowMark ();
+	byte	*data = NULL;
 
 	if (glt->source_file[0] && glt->source_offset)
 	{
@@ -1288,7 +3141,7 @@ void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants)
 		FILE *f;
 		COM_FOpenFile(glt->source_file, &f, NULL);
 		if (!f)
-			goto invalid;
+			return NULL;
 		fseek (f, glt->source_offset, SEEK_CUR);
 		size = (long) (glt->source_width * glt->source_height);
 		/* should be SRC_INDEXED, but no harm being paranoid:  */
@@ -1301,13 +3154,30 @@ void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants)
 		fclose (f);
 	}
 	else if (glt->source_file[0] && !glt->source_offset)
-		data = Image_LoadImage (glt->source_file, (int *)&glt->source_width, (int *)&glt->source_height); //simple file
+		data = TexMgr_LoadExternalImage (glt->source_file, (int *)&glt->source_width, (int *)&glt->source_height, &glt->source_format); //simple file
 	else if (!glt->source_file[0] && glt->source_offset)
 		data = (byte *) glt->source_offset; //image in memory
 
-	if (!data)
+	return data;
+}
+
+/*
+================
+TexMgr_ReloadImage -- reloads a texture, and colormaps it if needed
+================
+*/
+void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants)
+{
+	byte	translation[256];
+	byte	*src, *dst, *data, *translated;
+	int	mark, size, i;
+//
+// get source data
+//
+	mark = Hunk_LowMark ();
+
+	if (!(data = TexMgr_LoadSource (glt)))
 	{
-invalid:
 		Con_Printf ("TexMgr_ReloadImage: invalid source for %s\n", glt->name);
 		Hunk_FreeToLowMark(mark);
 		return;
@@ -1376,13 +3246,14 @@ invalid:
 	switch (glt->source_format)
 	{
 	case SRC_INDEXED:
-		TexMgr_LoadImage8 (glt, data);
+	case SRC_RGBA:
+		TexMgr_LoadImageNow (glt, data);
 		break;
 	case SRC_LIGHTMAP:
 		TexMgr_LoadLightmap (glt, data);
 		break;
-	case SRC_RGBA:
-		TexMgr_LoadImage32 (glt, (unsigned *)data);
+	case SRC_COMPRESSED:
+		TexMgr_LoadCompressed (glt, data);
 		break;
 	}
 
@@ -1429,6 +3300,238 @@ void TexMgr_ReloadNobrightImages (void)
 	for (glt = active_gltextures; glt; glt = glt->next)
 		if (glt->flags & TEXPREF_NOBRIGHT)
 			TexMgr_ReloadImage(glt, -1, -1);
+
+	R_DeleteWorldTextureArrays (); //the arrays hold copies of the old pixels
+}
+
+/*
+================================================================================
+
+	TEXTURE RESIDENCY
+
+with gl_texture_budget set, the least recently bound textures are cut down
+to a few small mip levels whenever the total goes over budget. binding an
+evicted texture requests its full mip chain again, which is reloaded from
+the source (and texture cache) on the worker threads and uploaded when done;
+until then it draws with the low levels.
+
+================================================================================
+*/
+
+#define TEXRES_EVICTLEVELS	3	//1/64th of the memory
+#define TEXRES_GRACEFRAMES	16	//don't evict anything bound this recently
+#define TEXRES_MAXEVICTS	32	//per frame, when the levels are copied through a pbo
+#define TEXRES_MAXREADBACKS	4	//per frame otherwise; each one is a readback that stalls
+#define TEXRES_MAXRELOADS	4	//per frame; the source is read on this thread
+
+/*
+================
+TexMgr_Evictable
+================
+*/
+static qboolean TexMgr_Evictable (gltexture_t *glt)
+{
+	return glt->residency == TEXRES_FULL && !glt->evictlevel && !glt->packed && glt->source_format != SRC_COMPRESSED &&
+		(glt->flags & TEXPREF_MIPMAP) && !(glt->flags & (TEXPREF_PERSIST | TEXPREF_WARPIMAGE)) &&
+		glt->shirt == -1 && (glt->source_file[0] || glt->source_offset) &&
+		(glt->width >> TEXRES_EVICTLEVELS) >= 8 && (glt->height >> TEXRES_EVICTLEVELS) >= 8 &&
+		glt->visframe < r_framecount - TEXRES_GRACEFRAMES;
+}
+
+/*
+================
+TexMgr_EvictTexture -- moves the small mip levels down to the top of the
+chain. the gltexture_t keeps its full size, since texture coords don't care.
+with pbos the levels are copied through a buffer that never leaves the gpu,
+so nothing waits on the readback; otherwise they come back through the hunk.
+================
+*/
+static void TexMgr_EvictTexture (gltexture_t *glt)
+{
+	static GLuint	evictpbo;
+	int		internalformat, visframe, level, width, height, mark, size;
+	byte	*data;
+
+	mark = Hunk_LowMark ();
+	size = 0;
+	for (level = TEXRES_EVICTLEVELS; ; level++)
+	{
+		width = q_max(glt->width >> level, 1);
+		height = q_max(glt->height >> level, 1);
+		size += width * height * 4;
+		if (width == 1 && height == 1)
+			break;
+	}
+
+	visframe = glt->visframe; //binding it here doesn't count as a use
+	GL_Bind (glt);
+	glt->visframe = visframe;
+
+	if (gl_pbo_able)
+	{
+		if (!evictpbo)
+			GL_GenBuffersFunc (1, &evictpbo);
+		GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, evictpbo);
+		GL_BufferDataFunc (GL_PIXEL_PACK_BUFFER_ARB, size, NULL, GL_STREAM_COPY_ARB); //orphans the last eviction's copy
+		data = NULL; //offsets into the pbo
+	}
+	else
+		data = (byte *) Hunk_Alloc (size);
+
+	for (level = TEXRES_EVICTLEVELS, size = 0; ; level++)
+	{
+		width = q_max(glt->width >> level, 1);
+		height = q_max(glt->height >> level, 1);
+		glGetTexImage (GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, data + size);
+		size += width * height * 4;
+		if (width == 1 && height == 1)
+			break;
+	}
+
+	if (gl_pbo_able)
+	{
+		GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER_ARB, 0);
+		GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, evictpbo);
+	}
+
+	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+	glt->bytes = 0;
+	for (level = TEXRES_EVICTLEVELS; ; level++)
+	{
+		width = q_max(glt->width >> level, 1);
+		height = q_max(glt->height >> level, 1);
+		glTexImage2D (GL_TEXTURE_2D, level - TEXRES_EVICTLEVELS, internalformat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data + glt->bytes);
+		glt->bytes += width * height * 4;
+		if (width == 1 && height == 1)
+			break;
+	}
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - TEXRES_EVICTLEVELS);
+
+	if (gl_pbo_able)
+		GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	glt->glformat = internalformat;
+	glt->residency = TEXRES_EVICTED;
+	glt->evictlevel = TEXRES_EVICTLEVELS;
+	Hunk_FreeToLowMark (mark);
+}
+
+/*
+================
+TexMgr_RestoreTexture -- starts reloading the full mip chain of an evicted texture
+================
+*/
+static void TexMgr_RestoreTexture (gltexture_t *glt)
+{
+	byte	*data;
+	int		mark;
+
+	mark = Hunk_LowMark ();
+	if (!(data = TexMgr_LoadSource (glt)))
+	{
+		Con_DPrintf ("TexMgr_RestoreTexture: invalid source for %s\n", glt->name);
+		glt->residency = TEXRES_FULL; //keep the low levels for good; evictlevel stays set so it isn't evicted again
+		Hunk_FreeToLowMark (mark);
+		return;
+	}
+
+	//glt keeps its full size until the new levels are uploaded; the worker
+	//path starts from the source size in its own copy
+	if (glt->source_format == SRC_COMPRESSED) //replaced on disk since it was evicted
+		TexMgr_LoadCompressed (glt, data);
+	else if (numtexworkers > 0)
+		TexMgr_QueueImage (glt, data);
+	else
+	{
+		glt->width = glt->source_width;
+		glt->height = glt->source_height;
+		TexMgr_LoadImageNow (glt, data);
+	}
+
+	Hunk_FreeToLowMark (mark);
+}
+
+/*
+================
+TexMgr_MakeResident -- for code that reads a texture back
+================
+*/
+void TexMgr_MakeResident (gltexture_t *glt)
+{
+	if (glt->residency == TEXRES_LOADING)
+		TexMgr_FinishJobs ();
+	else if (glt->residency != TEXRES_FULL || glt->evictlevel)
+		TexMgr_ReloadImage (glt, -1, -1);
+}
+
+/*
+================
+TexMgr_ClearPacked -- the world texture arrays are gone, so the textures
+they were copied from are drawn, and can be evicted, again
+================
+*/
+void TexMgr_ClearPacked (void)
+{
+	gltexture_t	*glt;
+
+	for (glt = active_gltextures; glt; glt = glt->next)
+		glt->packed = false;
+}
+
+/*
+================
+TexMgr_CompareVisframe -- least recently bound first
+================
+*/
+static int TexMgr_CompareVisframe (const void *a, const void *b)
+{
+	return (*(gltexture_t **)a)->visframe - (*(gltexture_t **)b)->visframe;
+}
+
+/*
+================
+TexMgr_ResidencyFrame -- called once a frame, after drawing
+================
+*/
+void TexMgr_ResidencyFrame (void)
+{
+	static gltexture_t *candidates[MAX_GLTEXTURES];
+	gltexture_t	*glt;
+	int		numcandidates, reloads, maxevicts, i;
+	float	total, budget;
+
+	if (texjobsoutstanding && !texbatching)
+		TexMgr_UploadFinished (false);
+
+	total = R_WorldTextureArrayBytes ();
+	reloads = 0;
+	numcandidates = 0;
+	for (glt = active_gltextures; glt; glt = glt->next)
+	{
+		if (glt->residency == TEXRES_REQUESTED && reloads < TEXRES_MAXRELOADS)
+		{
+			if (numtexworkers == -1)
+				TexMgr_StartWorkers ();
+			TexMgr_RestoreTexture (glt);
+			reloads++;
+		}
+		if (TexMgr_Evictable (glt))
+			candidates[numcandidates++] = glt;
+		total += glt->bytes;
+	}
+
+	budget = gl_texture_budget.value * 0x100000;
+	if (budget <= 0 || total <= budget || !numcandidates)
+		return;
+
+	qsort (candidates, numcandidates, sizeof(gltexture_t *), TexMgr_CompareVisframe);
+	maxevicts = gl_pbo_able ? TEXRES_MAXEVICTS : TEXRES_MAXREADBACKS;
+	for (i = 0; i < numcandidates && i < maxevicts && total > budget; i++)
+	{
+		total -= candidates[i]->bytes;
+		TexMgr_EvictTexture (candidates[i]);
+		total += candidates[i]->bytes;
+	}
 }
 
 /*
@@ -1496,12 +3599,18 @@ void GL_Bind (gltexture_t *texture)
 {
 	if (!texture)
 		texture = nulltexture;
+	else if (texture->residency == TEXRES_LOADING && !texture->bytes)
+		texture = nulltexture; //queued by TexMgr_EndBatch (false) and nothing uploaded yet
+
+	texture->visframe = r_framecount;
+	if (texture->residency == TEXRES_EVICTED)
+		texture->residency = TEXRES_REQUESTED; //TexMgr_ResidencyFrame reloads it
 
 	if (texture->texnum != currenttexture[currenttarget - GL_TEXTURE0_ARB])
 	{
 		currenttexture[currenttarget - GL_TEXTURE0_ARB] = texture->texnum;
 		glBindTexture (GL_TEXTURE_2D, texture->texnum);
-		texture->visframe = r_framecount;
+		rs_texbinds++;
 	}
 }
 
@@ -39,7 +39,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define TEXPREF_CONCHARS		0x0400	// use conchars palette
 #define TEXPREF_WARPIMAGE		0x0800	// resize this texture when warpimagesize changes
 
-enum srcformat {SRC_INDEXED, SRC_LIGHTMAP, SRC_RGBA};
+enum srcformat {SRC_INDEXED, SRC_LIGHTMAP, SRC_RGBA, SRC_COMPRESSED};
 
 typedef uintptr_t src_offset_t;
 
@@ -47,6 +47,8 @@ typedef struct gltexture_s {
 //managed by texture manager
 	GLuint			texnum;
 	struct gltexture_s	*next;
+	struct gltexture_s	*prev; //in active_gltextures
+	struct gltexture_s	*hashnext; //in the (owner, name) index
 	qmodel_t		*owner;
 //managed by image loading
 	char			name[64];
@@ -55,7 +57,7 @@ typedef struct gltexture_s {
 	unsigned int		flags;
 	char			source_file[MAX_QPATH]; //relative filepath to data source, or "" if source is in memory
 	src_offset_t		source_offset; //byte offset into file, or memory address
-	enum srcformat		source_format; //format of pixel data (indexed, lightmap, or rgba)
+	enum srcformat		source_format; //format of pixel data (indexed, lightmap, rgba, or a compressedimage_t)
 	unsigned int		source_width; //size of image in source data
 	unsigned int		source_height; //size of image in source data
 	unsigned short		source_crc; //generated by source data before modifications
@@ -63,8 +65,21 @@ typedef struct gltexture_s {
 	char				pants; //0-13 pants color, or -1 if never colormapped
 //used for rendering
 	int			visframe; //matches r_framecount if texture was bound this frame
+//load statistics, for imagelist
+	byte			cachestate; //TEXCACHE_ value of the last load
+	float			loadtime; //seconds spent on the last load
+//residency
+	int			bytes; //size of the levels in video memory
+	unsigned int		glformat; //internal format the levels were uploaded as
+	byte			residency; //TEXRES_ state
+	byte			evictlevel; //mip levels dropped while evicted
+	byte			packed; //copied into a world texture array, which is drawn instead
+	byte			queued; //worker jobs for it that haven't been uploaded yet
 } gltexture_t;
 
+enum {TEXCACHE_NONE, TEXCACHE_HIT, TEXCACHE_MISS};
+enum {TEXRES_FULL, TEXRES_EVICTED, TEXRES_REQUESTED, TEXRES_LOADING};
+
 extern gltexture_t *notexture;
 extern gltexture_t *nulltexture;
 
@@ -79,13 +94,16 @@ extern unsigned int d_8to24table_pants[256];
 
 float TexMgr_FrameUsage (void);
 gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name);
-gltexture_t *TexMgr_NewTexture (void);
+gltexture_t *TexMgr_NewTexture (qmodel_t *owner, const char *name);
 void TexMgr_FreeTexture (gltexture_t *kill);
 void TexMgr_FreeTextures (unsigned int flags, unsigned int mask);
 void TexMgr_FreeTexturesForOwner (qmodel_t *owner);
 void TexMgr_NewGame (void);
 void TexMgr_Init (void);
+void TexMgr_Shutdown (void);
 void TexMgr_DeleteTextureObjects (void);
+void TexMgr_BeginBatch (qboolean keeptimes);
+void TexMgr_EndBatch (qboolean wait);
 
 // IMAGE LOADING
 gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int height, enum srcformat format,
@@ -93,10 +111,16 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants);
 void TexMgr_ReloadImages (void);
 void TexMgr_ReloadNobrightImages (void);
+void TexMgr_ResidencyFrame (void);
+void TexMgr_MakeResident (gltexture_t *glt);
+void TexMgr_ClearPacked (void);
+byte *TexMgr_LoadExternalImage (const char *name, int *width, int *height, enum srcformat *format);
 
 int TexMgr_Pad(int s);
 int TexMgr_SafeTextureSize (int s);
 int TexMgr_PadConditional (int s);
+int TexMgr_CompressedSize (GLenum format, int width, int height);
+void TexMgr_CompressImage (const byte *in, int width, int height, qboolean alpha, byte *out);
 
 // TEXTURE BINDING & TEXTURE UNIT SWITCHING
 
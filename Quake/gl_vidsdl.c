@@ -101,10 +101,16 @@ qboolean gl_anisotropy_able = false; //johnfitz
 float gl_max_anisotropy; //johnfitz
 qboolean gl_texture_NPOT = false; //ericw
 qboolean gl_vbo_able = false; //ericw
+qboolean gl_pbo_able = false;
+qboolean gl_texture_s3tc = false;
+qboolean gl_texture_bptc = false;
 qboolean gl_glsl_able = false; //ericw
 GLint gl_max_texture_units = 0; //ericw
 qboolean gl_glsl_gamma_able = false; //ericw
 qboolean gl_glsl_alias_able = false; //ericw
+qboolean gl_instancing_able = false;
+qboolean gl_texture_array_able = false;
+GLint gl_max_array_layers = 0;
 int gl_stencilbits;
 
 PFNGLMULTITEXCOORD2FARBPROC GL_MTexCoord2fFunc = NULL; //johnfitz
@@ -115,6 +121,9 @@ PFNGLBUFFERDATAARBPROC GL_BufferDataFunc = NULL; //ericw
 PFNGLBUFFERSUBDATAARBPROC GL_BufferSubDataFunc = NULL; //ericw
 PFNGLDELETEBUFFERSARBPROC GL_DeleteBuffersFunc = NULL; //ericw
 PFNGLGENBUFFERSARBPROC GL_GenBuffersFunc = NULL; //ericw
+PFNGLMAPBUFFERARBPROC GL_MapBufferFunc = NULL;
+PFNGLUNMAPBUFFERARBPROC GL_UnmapBufferFunc = NULL;
+QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc = NULL;
 
 QS_PFNGLCREATESHADERPROC GL_CreateShaderFunc = NULL; //ericw
 QS_PFNGLDELETESHADERPROC GL_DeleteShaderFunc = NULL; //ericw
@@ -140,6 +149,13 @@ QS_PFNGLUNIFORM1FPROC GL_Uniform1fFunc = NULL; //ericw
 QS_PFNGLUNIFORM3FPROC GL_Uniform3fFunc = NULL; //ericw
 QS_PFNGLUNIFORM4FPROC GL_Uniform4fFunc = NULL; //ericw
 
+QS_PFNGLDRAWARRAYSINSTANCEDPROC GL_DrawArraysInstancedFunc = NULL;
+QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc = NULL;
+QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc = NULL;
+
+QS_PFNGLTEXIMAGE3DPROC GL_TexImage3DFunc = NULL;
+QS_PFNGLTEXSUBIMAGE3DPROC GL_TexSubImage3DFunc = NULL;
+
 // VR Related
 QS_PFNGLGENFRAMEBUFFERSPROC GL_GenFramebuffersFunc = NULL;
 QS_PFNGLBINDFRAMEBUFFERPROC GL_BindFramebufferFunc = NULL;
@@ -775,7 +791,11 @@ static void VID_Restart (void)
 	GLSLGamma_DeleteTexture ();
 	R_DeleteShaders ();
 	GL_DeleteBModelVertexBuffer ();
+	R_DeleteSpriteVertexBuffer ();
+	R_DeleteWorldTextureArrays ();
+	SCR_DeleteCaptureBuffers ();
 	GLMesh_DeleteVertexBuffers ();
+	GL_DeleteParticleVertexBuffers ();
 
 //
 // set new mode
@@ -1217,6 +1237,120 @@ static void GL_CheckExtensions (void)
 		Con_Warning ("GLSL alias model rendering not available, using Fitz renderer\n");
 	}
 
+	// ARB_instanced_arrays and ARB_draw_instanced, for particles and alias
+	// model shadows.  the divisor comes from the first and the draw calls
+	// from the second (or GL 3.1)
+	//
+	if (COM_CheckParm("-noinstancing"))
+		Con_Warning ("Instanced arrays disabled at command line\n");
+	else if (gl_glsl_able && gl_vbo_able && GL_ParseExtensionList(gl_extensions, "GL_ARB_instanced_arrays") &&
+		(GL_ParseExtensionList(gl_extensions, "GL_ARB_draw_instanced") || gl_version_major > 3 || (gl_version_major == 3 && gl_version_minor >= 1)))
+	{
+		GL_DrawArraysInstancedFunc = (QS_PFNGLDRAWARRAYSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawArraysInstancedARB");
+		if (!GL_DrawArraysInstancedFunc)
+			GL_DrawArraysInstancedFunc = (QS_PFNGLDRAWARRAYSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawArraysInstanced");
+		GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstancedARB");
+		if (!GL_DrawElementsInstancedFunc)
+			GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstanced");
+		GL_VertexAttribDivisorFunc = (QS_PFNGLVERTEXATTRIBDIVISORPROC) SDL_GL_GetProcAddress("glVertexAttribDivisorARB");
+		if (GL_DrawArraysInstancedFunc && GL_DrawElementsInstancedFunc && GL_VertexAttribDivisorFunc)
+		{
+			Con_Printf("FOUND: ARB_instanced_arrays\n");
+			gl_instancing_able = true;
+		}
+		else
+		{
+			Con_Warning ("ARB_instanced_arrays not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("ARB_instanced_arrays not available, using immediate mode particles\n");
+	}
+
+	// ARB_pixel_buffer_object, for screen capture readback
+	//
+	if (COM_CheckParm("-nopbo"))
+		Con_Warning ("Pixel buffer objects disabled at command line\n");
+	else if (gl_vbo_able && GL_ParseExtensionList(gl_extensions, "GL_ARB_pixel_buffer_object"))
+	{
+		GL_MapBufferFunc = (PFNGLMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glMapBufferARB");
+		GL_UnmapBufferFunc = (PFNGLUNMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glUnmapBufferARB");
+		if (GL_MapBufferFunc && GL_UnmapBufferFunc)
+		{
+			Con_Printf("FOUND: ARB_pixel_buffer_object\n");
+			gl_pbo_able = true;
+		}
+		else
+		{
+			Con_Warning ("ARB_pixel_buffer_object not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("ARB_pixel_buffer_object not available, screenshots read back synchronously\n");
+	}
+
+	// EXT_texture_compression_s3tc, for the texture cache
+	//
+	if (COM_CheckParm("-nos3tc"))
+		Con_Warning ("S3TC texture compression disabled at command line\n");
+	else if (GL_ParseExtensionList(gl_extensions, "GL_EXT_texture_compression_s3tc"))
+	{
+		GL_CompressedTexImage2DFunc = (QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) SDL_GL_GetProcAddress("glCompressedTexImage2DARB");
+		if (GL_CompressedTexImage2DFunc)
+		{
+			Con_Printf("FOUND: EXT_texture_compression_s3tc\n");
+			gl_texture_s3tc = true;
+		}
+		else
+		{
+			Con_Warning ("EXT_texture_compression_s3tc not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("EXT_texture_compression_s3tc not available\n");
+	}
+
+	// ARB_texture_compression_bptc, for BC7 dds/ktx textures
+	//
+	if (COM_CheckParm("-nobptc"))
+		Con_Warning ("BPTC texture compression disabled at command line\n");
+	else if (gl_texture_s3tc && GL_ParseExtensionList(gl_extensions, "GL_ARB_texture_compression_bptc"))
+	{
+		Con_Printf("FOUND: ARB_texture_compression_bptc\n");
+		gl_texture_bptc = true;
+	}
+	else
+	{
+		Con_Warning ("ARB_texture_compression_bptc not available\n");
+	}
+
+	// EXT_texture_array, for world textures
+	//
+	if (COM_CheckParm("-notexturearrays"))
+		Con_Warning ("Texture arrays disabled at command line\n");
+	else if (gl_glsl_able && gl_vbo_able && gl_max_texture_units >= 3 && GL_ParseExtensionList(gl_extensions, "GL_EXT_texture_array"))
+	{
+		GL_TexImage3DFunc = (QS_PFNGLTEXIMAGE3DPROC) SDL_GL_GetProcAddress("glTexImage3D");
+		GL_TexSubImage3DFunc = (QS_PFNGLTEXSUBIMAGE3DPROC) SDL_GL_GetProcAddress("glTexSubImage3D");
+		if (GL_TexImage3DFunc && GL_TexSubImage3DFunc)
+		{
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &gl_max_array_layers);
+			Con_Printf("FOUND: EXT_texture_array (%d layers)\n", (int)gl_max_array_layers);
+			gl_texture_array_able = true;
+		}
+		else
+		{
+			Con_Warning ("EXT_texture_array not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("EXT_texture_array not available, binding world textures one by one\n");
+	}
+
 	// VR Related
 	GL_GenFramebuffersFunc = (QS_PFNGLGENFRAMEBUFFERSPROC)SDL_GL_GetProcAddress("glGenFramebuffers");
 	GL_BindFramebufferFunc = (QS_PFNGLBINDFRAMEBUFFERPROC)SDL_GL_GetProcAddress("glBindFramebuffer");
@@ -1328,6 +1462,10 @@ static void GL_Init (void)
 	//johnfitz
 
 	GLAlias_CreateShaders ();
+	GLParticle_CreateShaders ();
+	GLSky_CreateShaders ();
+	GLWarp_CreateShaders ();
+	GLWorld_CreateShaders ();
 	GL_ClearBufferBindings ();	
 }
 
@@ -27,6 +27,7 @@ extern cvar_t r_drawflat;
 cvar_t r_oldwater = {"r_oldwater", "0", CVAR_ARCHIVE};
 cvar_t r_waterquality = {"r_waterquality", "8", CVAR_NONE};
 cvar_t r_waterwarp = {"r_waterwarp", "1", CVAR_NONE};
+cvar_t r_watershader = {"r_watershader", "1", CVAR_ARCHIVE};
 
 int gl_warpimagesize;
 float load_subdivide_size; //johnfitz -- remember what subdivide_size value was when this map was loaded
@@ -51,6 +52,68 @@ msurface_t	*warpface;
 
 cvar_t gl_subdivide_size = {"gl_subdivide_size", "128", CVAR_ARCHIVE};
 
+// polys subdivided after load, when r_oldwater is turned on while the water
+// shader skipped them, come from these instead of the hunk: a hunk
+// allocation in the middle of a frame could flush cached models. freed
+// with the map's brush models in Mod_ClearAll.
+#define WARPBLOCK_SIZE	0x10000
+
+typedef struct warpblock_s
+{
+	byte				data[WARPBLOCK_SIZE];
+	int					used;
+	struct warpblock_s	*next;
+} warpblock_t;
+
+static warpblock_t	*warpblocks;
+static qboolean		warpafterload; //allocate from warpblocks
+
+/*
+================
+GL_AllocWarpPoly
+================
+*/
+static glpoly_t *GL_AllocWarpPoly (int size)
+{
+	warpblock_t	*b;
+	byte		*p;
+
+	if (!warpafterload)
+		return (glpoly_t *) Hunk_Alloc (size);
+
+	size = (size + 15) & ~15;
+	if (!warpblocks || warpblocks->used + size > WARPBLOCK_SIZE)
+	{
+		b = (warpblock_t *) malloc (sizeof(warpblock_t));
+		if (!b)
+			Sys_Error ("GL_AllocWarpPoly: out of memory");
+		b->used = 0;
+		b->next = warpblocks;
+		warpblocks = b;
+	}
+
+	p = warpblocks->data + warpblocks->used;
+	warpblocks->used += size;
+	memset (p, 0, size);
+	return (glpoly_t *) p;
+}
+
+/*
+================
+GL_FreeWarpPolys -- the surfaces pointing at them are going away with the hunk
+================
+*/
+void GL_FreeWarpPolys (void)
+{
+	warpblock_t	*next;
+
+	for ( ; warpblocks; warpblocks = next)
+	{
+		next = warpblocks->next;
+		free (warpblocks);
+	}
+}
+
 void BoundPoly (int numverts, float *verts, vec3_t mins, vec3_t maxs)
 {
 	int		i, j;
@@ -138,7 +201,7 @@ void SubdividePolygon (int numverts, float *verts)
 		return;
 	}
 
-	poly = (glpoly_t *) Hunk_Alloc (sizeof(glpoly_t) + (numverts-4) * VERTEXSIZE*sizeof(float));
+	poly = GL_AllocWarpPoly (sizeof(glpoly_t) + (numverts-4) * VERTEXSIZE*sizeof(float));
 	poly->next = warpface->polys->next;
 	warpface->polys->next = poly;
 	poly->numverts = numverts;
@@ -172,6 +235,23 @@ void GL_SubdivideSurface (msurface_t *fa)
 	SubdividePolygon (fa->polys->numverts, verts[0]);
 }
 
+/*
+================
+GL_SubdividedPolys -- the r_oldwater polys of a turb surface, subdividing it
+first if that was skipped at load for the water shader
+================
+*/
+glpoly_t *GL_SubdividedPolys (msurface_t *fa)
+{
+	if (!fa->polys->next)
+	{
+		warpafterload = true;
+		GL_SubdivideSurface (fa);
+		warpafterload = false;
+	}
+	return fa->polys->next;
+}
+
 /*
 ================
 DrawWaterPoly -- johnfitz
@@ -226,6 +306,9 @@ void R_UpdateWarpTextures (void)
 	if (r_oldwater.value || cl.paused || r_drawflat_cheatsafe || r_lightmap_cheatsafe)
 		return;
 
+	if (R_WaterShaderActive ())
+		return; //warp is done per pixel, nothing to render
+
 	warptess = 128.0/CLAMP (3.0, floor(r_waterquality.value), 64.0);
 
 	for (i=0; i<cl.worldmodel->numtextures; i++)
@@ -270,3 +353,208 @@ void R_UpdateWarpTextures (void)
 	//if viewsize is less than 100, we need to redraw the frame around the viewport
 	scr_tileclear_updates = 0;
 }
+
+//==============================================================================
+//
+//  PER-PIXEL WATER
+//
+//==============================================================================
+
+static GLuint r_water_program;
+
+// uniforms used in water shader
+static GLuint timeLoc;
+static GLuint texLoc;
+
+/*
+=============
+GLWarp_CreateShaders
+
+the warp that R_UpdateWarpTextures renders into the warpimage, evaluated per
+pixel on the undivided poly instead
+=============
+*/
+void GLWarp_CreateShaders (void)
+{
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+		"	gl_FrontColor = gl_Color;\n"
+		"	gl_Position = ftransform();\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * gl_Vertex);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	// same as WARPCALC, with turbsin[] replaced by the sine it samples
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Tex;\n"
+		"uniform float Time;\n"
+		"void main()\n"
+		"{\n"
+		"	vec2 st = gl_TexCoord[0].xy * 128.0;\n"
+		"	vec2 tc = (st + 8.0 * sin(st.yx * (3.14159265 / 64.0) + Time)) * (1.0 / 64.0);\n"
+		"	vec4 result = texture2D(Tex, tc) * gl_Color;\n"
+		"	// apply GL_EXP2 fog (from the orange book)\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * gl_FogFragCoord * gl_FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result.rgb = mix(gl_Fog.color.rgb, result.rgb, fog);\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	r_water_program = GL_CreateProgram (vertSource, fragSource, 0, NULL);
+
+	if (r_water_program != 0)
+	{
+	// get uniform locations
+		timeLoc = GL_GetUniformLocation (&r_water_program, "Time");
+		texLoc = GL_GetUniformLocation (&r_water_program, "Tex");
+	}
+}
+
+/*
+=============
+R_WaterShaderActive
+
+true if water should be drawn with R_BeginWaterShader instead of warpimages
+=============
+*/
+qboolean R_WaterShaderActive (void)
+{
+	return r_water_program != 0 && r_watershader.value && !r_oldwater.value;
+}
+
+/*
+=============
+R_BeginWaterShader
+
+bind the water texture itself (not the warpimage) to TMU 0 after this
+=============
+*/
+void R_BeginWaterShader (void)
+{
+	GL_UseProgramFunc (r_water_program);
+	GL_Uniform1fFunc (timeLoc, fmod (cl.time, 2 * M_PI));
+	GL_Uniform1iFunc (texLoc, 0);
+}
+
+/*
+=============
+R_EndWaterShader
+=============
+*/
+void R_EndWaterShader (void)
+{
+	GL_UseProgramFunc (0);
+}
+
+/*
+=============
+R_WarpGridCoord
+
+texture coordinate the warpimage holds at (x,y), as interpolated across the
+triangle strips R_UpdateWarpTextures draws
+=============
+*/
+static float R_WarpGridCoord (float x, float y, float warptess)
+{
+	float	x0, y0, fx, fy;
+	float	v00, v10, v01, v11;
+
+	x0 = floor (x / warptess) * warptess;
+	y0 = floor (y / warptess) * warptess;
+	fx = (x - x0) / warptess;
+	fy = (y - y0) / warptess;
+
+	v00 = WARPCALC(x0, y0);
+	v10 = WARPCALC(x0 + warptess, y0);
+	v01 = WARPCALC(x0, y0 + warptess);
+	v11 = WARPCALC(x0 + warptess, y0 + warptess);
+
+	if (fx + fy <= 1)
+		return v00 + fx * (v10 - v00) + fy * (v01 - v00);
+	else
+		return v11 + (1 - fx) * (v01 - v11) + (1 - fy) * (v10 - v11);
+}
+
+/*
+=============
+R_CountWaterVerts -- vertices in a surface's subdivided polys
+=============
+*/
+static int R_CountWaterVerts (msurface_t *s)
+{
+	glpoly_t	*p;
+	int			count;
+
+	count = 0;
+	for (p = GL_SubdividedPolys (s); p; p = p->next)
+		count += p->numverts;
+	return count;
+}
+
+/*
+=============
+R_CompareWarp_f -- compares the per-pixel warp with the render-to-texture warp
+=============
+*/
+void R_CompareWarp_f (void)
+{
+	int			i, j, numsurfs, numtextures, basevers, subverts, strips, stripverts;
+	float		x, y, warptess, tc, err, maxerr, toterr;
+	msurface_t	*s;
+	texture_t	*tx;
+
+	warptess = 128.0/CLAMP (3.0, floor(r_waterquality.value), 64.0);
+
+	// warpimage vs per pixel, in texels of a 64x64 water texture
+	maxerr = toterr = 0;
+	for (i=0 ; i<256 ; i++)
+	{
+		for (j=0 ; j<256 ; j++)
+		{
+			x = i * 0.5;
+			y = j * 0.5;
+			tc = (x + 8 * sin (y * M_PI / 64 + cl.time)) / 64;
+			err = fabs (tc - R_WarpGridCoord (x, y, warptess)) * 64;
+			maxerr = q_max (maxerr, err);
+			toterr += err;
+		}
+	}
+	Con_Printf ("warp difference: %.3f texels max, %.3f mean (r_waterquality %g)\n",
+				maxerr, toterr / (256*256), r_waterquality.value);
+
+	if (!cl.worldmodel)
+		return;
+
+	// geometry and passes the other paths need for this map
+	numsurfs = basevers = subverts = 0;
+	for (i=0, s=cl.worldmodel->surfaces ; i<cl.worldmodel->numsurfaces ; i++, s++)
+	{
+		if (!(s->flags & SURF_DRAWTURB))
+			continue;
+		numsurfs++;
+		basevers += s->polys->numverts;
+		subverts += R_CountWaterVerts (s);
+	}
+
+	numtextures = 0;
+	for (i=0 ; i<cl.worldmodel->numtextures ; i++)
+	{
+		tx = cl.worldmodel->textures[i];
+		if (tx && tx->warpimage)
+			numtextures++;
+	}
+	strips = (int)ceil (128.0 / warptess);
+	stripverts = strips * 2 * ((int)(128.01 / warptess) + 1);
+
+	Con_Printf ("%i water surfaces: %i verts per-pixel, %i verts subdivided (r_oldwater)\n", numsurfs, basevers, subverts);
+	Con_Printf ("render-to-texture: %i warp textures, %i draws + %i copies, %i verts per frame when all are visible\n",
+				numtextures, numtextures * strips, numtextures, numtextures * stripverts);
+	Con_Printf ("per-pixel path is %s\n", R_WaterShaderActive () ? "active" : "not active");
+}
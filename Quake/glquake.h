@@ -50,6 +50,10 @@ extern	int glx, gly, glwidth, glheight;
 
 void R_TimeRefresh_f (void);
 void R_ReadPointFile_f (void);
+void R_CompareWarp_f (void);
+void R_CheckTexArrays_f (void);
+void R_TimeSprites_f (void);
+void R_TimePostProcess_f (void);
 texture_t *R_TextureAnimation (texture_t *base, int frame);
 
 typedef struct surfcache_s
@@ -84,15 +88,14 @@ typedef struct
 typedef enum {
 	pt_static, pt_grav, pt_slowgrav, pt_fire, pt_explode, pt_explode2, pt_blob, pt_blob2
 } ptype_t;
+#define	NUM_PARTICLE_TYPES	(pt_blob2 + 1)
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
+// a particle as filled in by the effect spawners; r_part.c stores them
+// per type as arrays, so this is not what gets simulated or drawn
 typedef struct particle_s
 {
-// driver-usable fields
 	vec3_t		org;
-	float		color;
-// drivers never touch the following fields
-	struct particle_s	*next;
+	int			color;
 	vec3_t		vel;
 	float		ramp;
 	float		die;
@@ -140,6 +143,7 @@ extern	cvar_t	r_telealpha;
 extern	cvar_t	r_slimealpha;
 extern	cvar_t	r_dynamic;
 extern	cvar_t	r_novis;
+extern	cvar_t	r_alphasort;
 
 extern	cvar_t	gl_clear;
 extern	cvar_t	gl_cull;
@@ -177,6 +181,9 @@ extern PFNGLBUFFERSUBDATAARBPROC  GL_BufferSubDataFunc;
 extern PFNGLDELETEBUFFERSARBPROC  GL_DeleteBuffersFunc;
 extern PFNGLGENBUFFERSARBPROC  GL_GenBuffersFunc;
 extern	qboolean	gl_vbo_able;
+extern PFNGLMAPBUFFERARBPROC  GL_MapBufferFunc;
+extern PFNGLUNMAPBUFFERARBPROC  GL_UnmapBufferFunc;
+extern	qboolean	gl_pbo_able;
 //ericw
 
 //ericw -- GLSL
@@ -234,6 +241,41 @@ extern	qboolean	gl_glsl_gamma_able;
 extern	qboolean	gl_glsl_alias_able;
 // ericw --
 
+// instanced arrays
+typedef void (APIENTRYP QS_PFNGLDRAWARRAYSINSTANCEDPROC) (GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+typedef void (APIENTRYP QS_PFNGLDRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount);
+typedef void (APIENTRYP QS_PFNGLVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+
+extern QS_PFNGLDRAWARRAYSINSTANCEDPROC GL_DrawArraysInstancedFunc;
+extern QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc;
+extern QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc;
+extern	qboolean	gl_instancing_able;
+
+// EXT_texture_array, for world textures
+#define GL_TEXTURE_2D_ARRAY_EXT			0x8C1A
+#define GL_MAX_ARRAY_TEXTURE_LAYERS_EXT	0x88FF
+typedef void (APIENTRYP QS_PFNGLTEXIMAGE3DPROC) (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void *pixels);
+typedef void (APIENTRYP QS_PFNGLTEXSUBIMAGE3DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void *pixels);
+
+extern QS_PFNGLTEXIMAGE3DPROC GL_TexImage3DFunc;
+extern QS_PFNGLTEXSUBIMAGE3DPROC GL_TexSubImage3DFunc;
+extern	qboolean	gl_texture_array_able;
+extern	GLint		gl_max_array_layers;
+
+// EXT_texture_compression_s3tc, for the texture cache and dds/ktx textures
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT	0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT	0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+typedef void (APIENTRYP QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data);
+
+extern QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc;
+extern	qboolean	gl_texture_s3tc;
+
+// ARB_texture_compression_bptc, for BC7 dds/ktx textures
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_ARB	0x8E8C
+extern	qboolean	gl_texture_bptc;
+
 //ericw -- NPOT texture support
 extern	qboolean	gl_texture_NPOT;
 
@@ -302,6 +344,11 @@ extern qboolean gl_renderbuffers_able;
 //johnfitz -- rendering statistics
 extern int rs_brushpolys, rs_aliaspolys, rs_skypolys, rs_particles, rs_fogpolys;
 extern int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+extern int rs_particlebytes;
+extern int rs_transitems, rs_transbatches;
+extern double rs_transsort;
+extern int rs_mergedbmodels;
+extern int rs_texbinds;
 extern float rs_megatexels;
 
 //johnfitz -- track developer statistics that vary every frame
@@ -329,6 +376,8 @@ extern overflowtimes_t dev_overflows; //this stores the last time overflow messa
 //johnfitz -- moved here from r_brush.c
 extern int gl_lightmap_format, lightmap_bytes;
 #define MAX_LIGHTMAPS 512 //johnfitz -- was 64
+#define LMBLOCK_WIDTH	128
+#define LMBLOCK_HEIGHT	128
 extern gltexture_t *lightmap_textures[MAX_LIGHTMAPS]; //johnfitz -- changed to an array
 
 extern int gl_warpimagesize; //johnfitz -- for water warp
@@ -365,6 +414,11 @@ void R_StoreEfrags (efrag_t **ppefrag);
 qboolean R_CullModelForEntity (entity_t *e);
 void R_RotateForEntity (vec3_t origin, vec3_t angles);
 void R_MarkLights (dlight_t *light, int num, mnode_t *node);
+void R_MarkMergedLights (dlight_t *light, int num);
+void R_ClearMergedBModels (void);
+void GLWorld_CreateShaders (void);
+void R_DeleteWorldTextureArrays (void);
+int R_WorldTextureArrayBytes (void);
 
 void R_InitParticles (void);
 void R_DrawParticles (void);
@@ -374,11 +428,18 @@ void R_ClearParticles (void);
 void R_TranslatePlayerSkin (int playernum);
 void R_TranslateNewPlayerSkin (int playernum); //johnfitz -- this handles cases when the actual texture changes
 void R_UpdateWarpTextures (void);
+void GLWarp_CreateShaders (void);
+qboolean R_WaterShaderActive (void);
+void R_BeginWaterShader (void);
+void R_EndWaterShader (void);
 
 void R_DrawWorld (void);
 void R_DrawAliasModel (entity_t *e);
 void R_DrawBrushModel (entity_t *e);
 void R_DrawSpriteModel (entity_t *e);
+void R_BatchSpriteModel (entity_t *e);
+void R_FlushSpriteBatch (void);
+void R_DeleteSpriteVertexBuffer (void);
 
 void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain);
 
@@ -393,6 +454,8 @@ void R_RebuildAllLightmaps (void);
 int R_LightPoint (vec3_t p);
 
 void GL_SubdivideSurface (msurface_t *fa);
+glpoly_t *GL_SubdividedPolys (msurface_t *fa);
+void GL_FreeWarpPolys (void);
 void R_BuildLightMap (msurface_t *surf, byte *dest, int stride);
 void R_RenderDynamicLightmaps (msurface_t *fa);
 void R_UploadLightmaps (void);
@@ -407,7 +470,10 @@ GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int
 void R_DeleteShaders (void);
 
 void GLAlias_CreateShaders (void);
+void GLParticle_CreateShaders (void);
+void GL_DeleteParticleVertexBuffers (void);
 void GL_DrawAliasShadow (entity_t *e);
+void GL_DrawAliasShadows (entity_t **ents, int numents);
 void DrawGLTriangleFan (glpoly_t *p);
 void DrawGLPoly (glpoly_t *p);
 void DrawWaterPoly (glpoly_t *p);
@@ -418,6 +484,7 @@ void Sky_DrawSky (void);
 void Sky_NewMap (void);
 void Sky_LoadTexture (texture_t *mt);
 void Sky_LoadSkyBox (const char *name);
+void GLSky_CreateShaders (void);
 
 void TexMgr_RecalcWarpImageSize (void);
 
@@ -425,12 +492,19 @@ void R_ClearTextureChains (qmodel_t *mod, texchain_t chain);
 void R_ChainSurface (msurface_t *surf, texchain_t chain);
 void R_DrawTextureChains (qmodel_t *model, entity_t *ent, texchain_t chain);
 void R_DrawWorld_Water (void);
+void R_DrawWaterBatch (msurface_t **surfs, int count, float alpha);
+
+typedef enum {trans_water, trans_entity, trans_dlights, trans_particles} transkind_t;
+qboolean R_AddTransparent (transkind_t kind, void *data, vec3_t org, gltexture_t *texture, float alpha);
+void R_DrawTransparent (void);
 
 void GL_BindBuffer (GLenum target, GLuint buffer);
 void GL_ClearBufferBindings ();
 
 void GLSLGamma_DeleteTexture (void);
 void GLSLGamma_GammaCorrect (void);
+qboolean GLSLGamma_EyeNeedsPostProcess (void);
+qboolean GLSLGamma_ResolveEye (GLuint mstexture, int samples, int width, int height);
 
 float GL_WaterAlphaForSurface (msurface_t *fa);
 
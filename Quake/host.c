@@ -146,6 +146,7 @@ void Host_Error (const char *error, ...)
 	inerror = true;
 
 	SCR_EndLoadingPlaque ();		// reenable screen updates
+	TexMgr_EndBatch (true);			// finish any texture loads the error interrupted
 
 	va_start (argptr,error);
 	q_vsnprintf (string, sizeof(string), error, argptr);
@@ -577,15 +578,17 @@ qboolean Host_FilterTime (float time)
 
 	//johnfitz -- max fps cvar
 	maxfps = CLAMP (10.0, host_maxfps.value, 1000.0);
-	if (!cls.timedemo && realtime - oldrealtime < 1.0/maxfps)
+	if (!cls.timedemo && !SCR_CaptureFrametime () && realtime - oldrealtime < 1.0/maxfps)
 		return false; // framerate is too high
 	//johnfitz
 
 	host_frametime = realtime - oldrealtime;
 	oldrealtime = realtime;
 
+	if (SCR_CaptureFrametime () > 0) // capture_start renders a fixed timestep
+		host_frametime = SCR_CaptureFrametime ();
 	//johnfitz -- host_timescale is more intuitive than host_framerate
-	if (host_timescale.value > 0)
+	else if (host_timescale.value > 0)
 		host_frametime *= host_timescale.value;
 	//johnfitz
 	else if (host_framerate.value > 0)
@@ -863,6 +866,7 @@ void Host_Init (void)
 		DemoList_Init (); //ericw
 		VID_Init ();
 		IN_Init ();
+		Image_Init ();
 		TexMgr_Init (); //johnfitz
 		Draw_Init ();
 		SCR_Init ();
@@ -928,6 +932,8 @@ void Host_Shutdown(void)
 
 	if (cls.state != ca_dedicated)
 	{
+		SCR_ShutdownCapture ();
+		TexMgr_Shutdown ();
 		VR_Shutdown();
 		if (con_initialized)
 			History_Shutdown ();
@@ -22,42 +22,59 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //image.c -- image loading
 
 #include "quakedef.h"
+#ifndef _WIN32
+#include <dirent.h>
+#endif
 
 static char loadfilename[MAX_OSPATH]; //file scope so that error messages can use it
+static qboolean imagequiet; //testimages feeds the decoders garbage on purpose
 
-typedef struct stdio_buffer_s {
-	FILE *f;
-	unsigned char buffer[1024];
-	int size;
-	int pos;
-} stdio_buffer_t;
+#define MAX_IMAGESIZE	16384 //width or height; anything bigger is a broken header
 
-static stdio_buffer_t *Buf_Alloc(FILE *f)
+static void Image_Warning (const char *fmt, ...) __attribute__((__format__(__printf__,1,2)));
+static void Image_Warning (const char *fmt, ...)
 {
-	stdio_buffer_t *buf = (stdio_buffer_t *) calloc(1, sizeof(stdio_buffer_t));
-	buf->f = f;
-	return buf;
-}
+	va_list		argptr;
+	char		msg[1024];
 
-static void Buf_Free(stdio_buffer_t *buf)
-{
-	free(buf);
+	if (imagequiet)
+		return;
+
+	va_start (argptr, fmt);
+	q_vsnprintf (msg, sizeof(msg), fmt, argptr);
+	va_end (argptr);
+
+	Con_Warning ("%s", msg);
 }
 
-static inline int Buf_GetC(stdio_buffer_t *buf)
+/*
+============
+Image_ReadFile -- reads the rest of an open file (com_filesize bytes, which
+works inside pak files too) in one go, and closes it. the buffer is malloc'd
+so the decoded image can still go on the hunk.
+============
+*/
+static byte *Image_ReadFile (FILE *f, int *size)
 {
-	if (buf->pos >= buf->size)
+	byte	*buf;
+
+	*size = com_filesize;
+	buf = (byte *) malloc (q_max(*size, 1));
+	if (!buf || fread (buf, 1, *size, f) != (size_t)*size)
 	{
-		buf->size = fread(buf->buffer, 1, sizeof(buf->buffer), buf->f);
-		buf->pos = 0;
-		
-		if (buf->size == 0)
-			return EOF;
+		Image_Warning ("Image_ReadFile: couldn't read %s\n", loadfilename);
+		free (buf);
+		buf = NULL;
 	}
+	fclose (f);
 
-	return buf->buffer[buf->pos++];
+	return buf;
 }
 
+static byte *Image_DecodeTGA (const byte *in, int size, int *width, int *height);
+static byte *Image_DecodePCX (const byte *in, int size, int *width, int *height);
+static byte *Image_DecodePNG (const byte *in, int size, int *width, int *height);
+
 /*
 ============
 Image_LoadImage
@@ -76,6 +93,11 @@ byte *Image_LoadImage (const char *name, int *width, int *height)
 	if (f)
 		return Image_LoadTGA (f, width, height);
 
+	q_snprintf (loadfilename, sizeof(loadfilename), "%s.png", name);
+	COM_FOpenFile (loadfilename, &f, NULL);
+	if (f)
+		return Image_LoadPNG (f, width, height);
+
 	q_snprintf (loadfilename, sizeof(loadfilename), "%s.pcx", name);
 	COM_FOpenFile (loadfilename, &f, NULL);
 	if (f)
@@ -90,63 +112,60 @@ byte *Image_LoadImage (const char *name, int *width, int *height)
 //
 //==============================================================================
 
-typedef struct targaheader_s {
-	unsigned char 	id_length, colormap_type, image_type;
-	unsigned short	colormap_index, colormap_length;
-	unsigned char	colormap_size;
-	unsigned short	x_origin, y_origin, width, height;
-	unsigned char	pixel_size, attributes;
-} targaheader_t;
-
 #define TARGAHEADERSIZE 18 //size on disk
 
-targaheader_t targa_header;
-
-int fgetLittleShort (FILE *f)
-{
-	byte	b1, b2;
-
-	b1 = fgetc(f);
-	b2 = fgetc(f);
-
-	return (short)(b1 + b2*256);
-}
-
-int fgetLittleLong (FILE *f)
+/*
+============
+Image_WriteTGARowRLE -- run-length encodes one row, never letting a packet
+cross into the next row
+============
+*/
+static void Image_WriteTGARowRLE (FILE *f, const byte *row, int width, int bytes)
 {
-	byte	b1, b2, b3, b4;
+	int		i, n;
 
-	b1 = fgetc(f);
-	b2 = fgetc(f);
-	b3 = fgetc(f);
-	b4 = fgetc(f);
+	for (i = 0; i < width; i += n)
+	{
+	// a run of identical pixels
+		for (n = 1; i + n < width && n < 128 && !memcmp (row + i*bytes, row + (i+n)*bytes, bytes); n++)
+			;
+		if (n > 1)
+		{
+			fputc (0x80 | (n - 1), f);
+			fwrite (row + i*bytes, bytes, 1, f);
+			continue;
+		}
 
-	return b1 + (b2<<8) + (b3<<16) + (b4<<24);
+	// raw pixels up to where the next run starts
+		for (n = 1; i + n < width && n < 128; n++)
+			if (i + n + 1 < width && !memcmp (row + (i+n)*bytes, row + (i+n+1)*bytes, bytes))
+				break;
+		fputc (n - 1, f);
+		fwrite (row + i*bytes, bytes, n, f);
+	}
 }
 
 /*
 ============
-Image_WriteTGA -- writes RGB or RGBA data to a TGA file
-
-returns true if successful
+Image_WriteTGAFile -- writes RGB or RGBA data to a TGA file at a full path,
+optionally run-length encoded
 
-TODO: support BGRA and BGR formats (since opengl can return them, and we don't have to swap)
+returns true if successful. only uses stdio, so it's safe to call from the
+screen capture thread. swaps red and blue in data.
 ============
 */
-qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown)
+qboolean Image_WriteTGAFile (const char *pathname, byte *data, int width, int height, int bpp, qboolean upsidedown, qboolean rle)
 {
-	int		handle, i, size, temp, bytes;
-	char	pathname[MAX_OSPATH];
+	FILE	*f;
+	int		i, size, temp, bytes;
 	byte	header[TARGAHEADERSIZE];
 
-	Sys_mkdir (com_gamedir); //if we've switched to a nonexistant gamedir, create it now so we don't crash
-	q_snprintf (pathname, sizeof(pathname), "%s/%s", com_gamedir, name);
-	handle = Sys_FileOpenWrite (pathname);
-	if (handle == -1)
+	f = fopen (pathname, "wb");
+	if (!f)
 		return false;
 
 	Q_memset (&header, 0, TARGAHEADERSIZE);
-	header[2] = 2; // uncompressed type
+	header[2] = rle ? 10 : 2; // run-length encoded or uncompressed type
 	header[12] = width&255;
 	header[13] = width>>8;
 	header[14] = height&255;
@@ -165,11 +184,38 @@ qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, in
 		data[i+2] = temp;
 	}
 
-	Sys_FileWrite (handle, &header, TARGAHEADERSIZE);
-	Sys_FileWrite (handle, data, size);
-	Sys_FileClose (handle);
+	fwrite (&header, TARGAHEADERSIZE, 1, f);
+	if (rle)
+	{
+		for (i=0; i<height; i++)
+			Image_WriteTGARowRLE (f, data + i*width*bytes, width, bytes);
+	}
+	else
+		fwrite (data, size, 1, f);
+
+	i = ferror (f);
+	fclose (f);
 
-	return true;
+	return !i;
+}
+
+/*
+============
+Image_WriteTGA -- writes RGB or RGBA data to a TGA file
+
+returns true if successful
+
+TODO: support BGRA and BGR formats (since opengl can return them, and we don't have to swap)
+============
+*/
+qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown)
+{
+	char	pathname[MAX_OSPATH];
+
+	Sys_mkdir (com_gamedir); //if we've switched to a nonexistant gamedir, create it now so we don't crash
+	q_snprintf (pathname, sizeof(pathname), "%s/%s", com_gamedir, name);
+
+	return Image_WriteTGAFile (pathname, data, width, height, bpp, upsidedown, false);
 }
 
 /*
@@ -179,189 +225,155 @@ Image_LoadTGA
 */
 byte *Image_LoadTGA (FILE *fin, int *width, int *height)
 {
-	int				columns, rows, numPixels;
-	byte			*pixbuf;
-	int				row, column;
-	byte			*targa_rgba;
-	int				realrow; //johnfitz -- fix for upside-down targas
-	qboolean		upside_down; //johnfitz -- fix for upside-down targas
-	stdio_buffer_t	*buf;
+	byte	*buf, *data;
+	int		size;
+
+	if (!(buf = Image_ReadFile (fin, &size)))
+		return NULL;
+	data = Image_DecodeTGA (buf, size, width, height);
+	free (buf);
 
-	targa_header.id_length = fgetc(fin);
-	targa_header.colormap_type = fgetc(fin);
-	targa_header.image_type = fgetc(fin);
+	return data;
+}
 
-	targa_header.colormap_index = fgetLittleShort(fin);
-	targa_header.colormap_length = fgetLittleShort(fin);
-	targa_header.colormap_size = fgetc(fin);
-	targa_header.x_origin = fgetLittleShort(fin);
-	targa_header.y_origin = fgetLittleShort(fin);
-	targa_header.width = fgetLittleShort(fin);
-	targa_header.height = fgetLittleShort(fin);
-	targa_header.pixel_size = fgetc(fin);
-	targa_header.attributes = fgetc(fin);
+/*
+=============
+Image_DecodeTGA -- types 2 and 10 (rgb) and 3 and 11 (greyscale). rows are
+written straight to their final place, bottom-up or not, and runs are filled
+a pixel at a time rather than a byte at a time.
+=============
+*/
+static byte *Image_DecodeTGA (const byte *in, int size, int *width, int *height)
+{
+	const byte	*end = in + size;
+	int			columns, rows, type, bytes, row, column, count, i;
+	unsigned	pixel = 0, *rowstart;
+	byte		*targa_rgba, *out;
+	qboolean	upside_down, rle, run;
 
-	if (targa_header.image_type!=2 && targa_header.image_type!=10)
-		Sys_Error ("Image_LoadTGA: %s is not a type 2 or type 10 targa\n", loadfilename);
+	if (size < TARGAHEADERSIZE)
+	{
+		Image_Warning ("Image_LoadTGA: %s is truncated\n", loadfilename);
+		return NULL;
+	}
 
-	if (targa_header.colormap_type !=0 || (targa_header.pixel_size!=32 && targa_header.pixel_size!=24))
-		Sys_Error ("Image_LoadTGA: %s is not a 24bit or 32bit targa\n", loadfilename);
+	type = in[2];
+	columns = in[12] | (in[13] << 8);
+	rows = in[14] | (in[15] << 8);
+	bytes = in[16] / 8;
+	upside_down = !(in[17] & 0x20); //johnfitz -- fix for upside-down targas
+	rle = (type == 10 || type == 11);
 
-	columns = targa_header.width;
-	rows = targa_header.height;
-	numPixels = columns * rows;
-	upside_down = !(targa_header.attributes & 0x20); //johnfitz -- fix for upside-down targas
+	if (type != 2 && type != 3 && type != 10 && type != 11)
+	{
+		Image_Warning ("Image_LoadTGA: %s is not a type 2, 3, 10 or 11 targa\n", loadfilename);
+		return NULL;
+	}
+	if (in[1] != 0 || ((type & 3) == 2 && in[16] != 32 && in[16] != 24) || ((type & 3) == 3 && in[16] != 8))
+	{
+		Image_Warning ("Image_LoadTGA: %s is not a 24bit or 32bit targa\n", loadfilename);
+		return NULL;
+	}
+	if (!columns || !rows || columns > MAX_IMAGESIZE || rows > MAX_IMAGESIZE)
+	{
+		Image_Warning ("Image_LoadTGA: %s has a bad size (%i x %i)\n", loadfilename, columns, rows);
+		return NULL;
+	}
 
-	targa_rgba = (byte *) Hunk_Alloc (numPixels*4);
+	in += TARGAHEADERSIZE + in[0]; // skip TARGA image comment
 
-	if (targa_header.id_length != 0)
-		fseek(fin, targa_header.id_length, SEEK_CUR);  // skip TARGA image comment
+	// a run covers at most 128 pixels, so a file this short can't be real
+	if ((rle ? (double)columns * rows / 128 * (1 + bytes) : (double)columns * rows * bytes) > end - in)
+	{
+		Image_Warning ("Image_LoadTGA: %s is truncated\n", loadfilename);
+		return NULL;
+	}
 
-	buf = Buf_Alloc(fin);
+	targa_rgba = (byte *) Hunk_Alloc (columns * rows * 4);
 
-	if (targa_header.image_type==2) // Uncompressed, RGB images
+	row = 0;
+	column = 0;
+	rowstart = (unsigned *)(targa_rgba + (upside_down ? rows - 1 : 0) * columns * 4);
+	while (row < rows)
 	{
-		for(row=rows-1; row>=0; row--)
+		run = false;
+		if (rle)
 		{
-			//johnfitz -- fix for upside-down targas
-			realrow = upside_down ? row : rows - 1 - row;
-			pixbuf = targa_rgba + realrow*columns*4;
-			//johnfitz
-			for(column=0; column<columns; column++)
+			if (in >= end)
+				break;
+			count = 1 + (*in & 0x7f);
+			run = (*in++ & 0x80) != 0;
+			if (end - in < (run ? 1 : count) * bytes)
+				break;
+			if (run) // run-length packet
 			{
-				unsigned char red,green,blue,alphabyte;
-				switch (targa_header.pixel_size)
-				{
-				case 24:
-					blue = Buf_GetC(buf);
-					green = Buf_GetC(buf);
-					red = Buf_GetC(buf);
-					*pixbuf++ = red;
-					*pixbuf++ = green;
-					*pixbuf++ = blue;
-					*pixbuf++ = 255;
-					break;
-				case 32:
-					blue = Buf_GetC(buf);
-					green = Buf_GetC(buf);
-					red = Buf_GetC(buf);
-					alphabyte = Buf_GetC(buf);
-					*pixbuf++ = red;
-					*pixbuf++ = green;
-					*pixbuf++ = blue;
-					*pixbuf++ = alphabyte;
-					break;
-				}
+				if (bytes == 1)
+					pixel = in[0] | (in[0] << 8) | (in[0] << 16) | 0xff000000u;
+				else
+					pixel = in[2] | (in[1] << 8) | (in[0] << 16) | ((bytes == 4 ? in[3] : 255u) << 24);
+				pixel = LittleLong (pixel);
+				in += bytes;
 			}
 		}
-	}
-	else if (targa_header.image_type==10) // Runlength encoded RGB images
-	{
-		unsigned char red,green,blue,alphabyte,packetHeader,packetSize,j;
-		for(row=rows-1; row>=0; row--)
+		else
+			count = columns * rows; //the whole image is one raw packet
+
+		// a packet may run across rows
+		while (count && row < rows)
 		{
-			//johnfitz -- fix for upside-down targas
-			realrow = upside_down ? row : rows - 1 - row;
-			pixbuf = targa_rgba + realrow*columns*4;
-			//johnfitz
-			for(column=0; column<columns; )
+			i = q_min(count, columns - column);
+			out = (byte *)(rowstart + column);
+			count -= i;
+			column += i;
+
+			if (run)
+			{
+				for ( ; i; i--, out += 4)
+					memcpy (out, &pixel, 4);
+			}
+			else if (bytes == 4)
+			{
+				for ( ; i; i--, in += 4, out += 4)
+				{
+					out[0] = in[2];
+					out[1] = in[1];
+					out[2] = in[0];
+					out[3] = in[3];
+				}
+			}
+			else if (bytes == 3)
 			{
-				packetHeader=Buf_GetC(buf);
-				packetSize = 1 + (packetHeader & 0x7f);
-				if (packetHeader & 0x80) // run-length packet
+				for ( ; i; i--, in += 3, out += 4)
 				{
-					switch (targa_header.pixel_size)
-					{
-					case 24:
-						blue = Buf_GetC(buf);
-						green = Buf_GetC(buf);
-						red = Buf_GetC(buf);
-						alphabyte = 255;
-						break;
-					case 32:
-						blue = Buf_GetC(buf);
-						green = Buf_GetC(buf);
-						red = Buf_GetC(buf);
-						alphabyte = Buf_GetC(buf);
-						break;
-					default: /* avoid compiler warnings */
-						blue = red = green = alphabyte = 0;
-					}
-
-					for(j=0;j<packetSize;j++)
-					{
-						*pixbuf++=red;
-						*pixbuf++=green;
-						*pixbuf++=blue;
-						*pixbuf++=alphabyte;
-						column++;
-						if (column==columns) // run spans across rows
-						{
-							column=0;
-							if (row>0)
-								row--;
-							else
-								goto breakOut;
-							//johnfitz -- fix for upside-down targas
-							realrow = upside_down ? row : rows - 1 - row;
-							pixbuf = targa_rgba + realrow*columns*4;
-							//johnfitz
-						}
-					}
+					out[0] = in[2];
+					out[1] = in[1];
+					out[2] = in[0];
+					out[3] = 255;
 				}
-				else // non run-length packet
+			}
+			else
+			{
+				for ( ; i; i--, in++, out += 4)
 				{
-					for(j=0;j<packetSize;j++)
-					{
-						switch (targa_header.pixel_size)
-						{
-						case 24:
-							blue = Buf_GetC(buf);
-							green = Buf_GetC(buf);
-							red = Buf_GetC(buf);
-							*pixbuf++ = red;
-							*pixbuf++ = green;
-							*pixbuf++ = blue;
-							*pixbuf++ = 255;
-							break;
-						case 32:
-							blue = Buf_GetC(buf);
-							green = Buf_GetC(buf);
-							red = Buf_GetC(buf);
-							alphabyte = Buf_GetC(buf);
-							*pixbuf++ = red;
-							*pixbuf++ = green;
-							*pixbuf++ = blue;
-							*pixbuf++ = alphabyte;
-							break;
-						default: /* avoid compiler warnings */
-							blue = red = green = alphabyte = 0;
-						}
-						column++;
-						if (column==columns) // pixel packet run spans across rows
-						{
-							column=0;
-							if (row>0)
-								row--;
-							else
-								goto breakOut;
-							//johnfitz -- fix for upside-down targas
-							realrow = upside_down ? row : rows - 1 - row;
-							pixbuf = targa_rgba + realrow*columns*4;
-							//johnfitz
-						}
-					}
+					out[0] = out[1] = out[2] = in[0];
+					out[3] = 255;
 				}
 			}
-			breakOut:;
+
+			if (column == columns)
+			{
+				column = 0;
+				row++;
+				rowstart += upside_down ? -columns : columns;
+			}
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(fin);
+	if (row < rows)
+		Image_Warning ("Image_LoadTGA: %s is truncated\n", loadfilename);
 
-	*width = (int)(targa_header.width);
-	*height = (int)(targa_header.height);
+	*width = columns;
+	*height = rows;
 	return targa_rgba;
 }
 
@@ -393,16 +405,38 @@ Image_LoadPCX
 ============
 */
 byte *Image_LoadPCX (FILE *f, int *width, int *height)
+{
+	byte	*buf, *data;
+	int		size;
+
+	if (!(buf = Image_ReadFile (f, &size)))
+		return NULL;
+	data = Image_DecodePCX (buf, size, width, height);
+	free (buf);
+
+	return data;
+}
+
+/*
+============
+Image_DecodePCX
+============
+*/
+static byte *Image_DecodePCX (const byte *in, int size, int *width, int *height)
 {
 	pcxheader_t	pcx;
-	int			x, y, w, h, readbyte, runlength, start;
-	byte		*p, *data;
-	byte		palette[768];
-	stdio_buffer_t  *buf;
+	const byte	*end;
+	int			x, y, w, h, readbyte, runlength, i;
+	unsigned	palette[256], pixel, *p;
+	byte		*data;
 
-	start = ftell (f); //save start of file (since we might be inside a pak file, SEEK_SET might not be the start of the pcx)
+	if (size < (int)sizeof(pcx) + 768)
+	{
+		Image_Warning ("'%s' is truncated\n", loadfilename);
+		return NULL;
+	}
 
-	fread(&pcx, sizeof(pcx), 1, f);
+	memcpy (&pcx, in, sizeof(pcx));
 	pcx.xmin = (unsigned short)LittleShort (pcx.xmin);
 	pcx.ymin = (unsigned short)LittleShort (pcx.ymin);
 	pcx.xmax = (unsigned short)LittleShort (pcx.xmax);
@@ -410,60 +444,1647 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 	pcx.bytes_per_line = (unsigned short)LittleShort (pcx.bytes_per_line);
 
 	if (pcx.signature != 0x0A)
-		Sys_Error ("'%s' is not a valid PCX file", loadfilename);
+	{
+		Image_Warning ("'%s' is not a valid PCX file\n", loadfilename);
+		return NULL;
+	}
 
 	if (pcx.version != 5)
-		Sys_Error ("'%s' is version %i, should be 5", loadfilename, pcx.version);
+	{
+		Image_Warning ("'%s' is version %i, should be 5\n", loadfilename, pcx.version);
+		return NULL;
+	}
 
 	if (pcx.encoding != 1 || pcx.bits_per_pixel != 8 || pcx.color_planes != 1)
-		Sys_Error ("'%s' has wrong encoding or bit depth", loadfilename);
+	{
+		Image_Warning ("'%s' has wrong encoding or bit depth\n", loadfilename);
+		return NULL;
+	}
 
 	w = pcx.xmax - pcx.xmin + 1;
 	h = pcx.ymax - pcx.ymin + 1;
-
-	data = (byte *) Hunk_Alloc((w*h+1)*4); //+1 to allow reading padding byte on last line
+	if (w <= 0 || h <= 0 || w > MAX_IMAGESIZE || h > MAX_IMAGESIZE || pcx.bytes_per_line < w ||
+		(double)pcx.bytes_per_line * h / 63 * 2 > size) //a run covers at most 63 bytes
+	{
+		Image_Warning ("'%s' has a bad size (%i x %i)\n", loadfilename, w, h);
+		return NULL;
+	}
 
 	//load palette
-	fseek (f, start + com_filesize - 768, SEEK_SET);
-	fread (palette, 1, 768, f);
+	end = in + size - 768;
+	for (i = 0; i < 256; i++)
+		palette[i] = LittleLong (end[i*3] | (end[i*3+1] << 8) | (end[i*3+2] << 16) | 0xff000000u);
 
-	//back to start of image data
-	fseek (f, start + sizeof(pcx), SEEK_SET);
+	data = (byte *) Hunk_Alloc (w*h*4);
 
-	buf = Buf_Alloc(f);
-
-	for (y=0; y<h; y++)
+	in += sizeof(pcx);
+	for (y = 0; y < h; y++)
 	{
-		p = data + y * w * 4;
+		p = (unsigned *)data + y * w;
 
-		for (x=0; x<(pcx.bytes_per_line); ) //read the extra padding byte if necessary
+		for (x = 0; x < pcx.bytes_per_line; ) //skip the extra padding byte if necessary
 		{
-			readbyte = Buf_GetC(buf);
-
-			if(readbyte >= 0xC0)
+			if (in >= end)
+				break;
+			readbyte = *in++;
+			if (readbyte >= 0xC0)
 			{
+				if (in >= end)
+					break;
 				runlength = readbyte & 0x3F;
-				readbyte = Buf_GetC(buf);
+				readbyte = *in++;
 			}
 			else
 				runlength = 1;
 
-			while(runlength--)
-			{
-				p[0] = palette[readbyte*3];
-				p[1] = palette[readbyte*3+1];
-				p[2] = palette[readbyte*3+2];
-				p[3] = 255;
-				p += 4;
-				x++;
-			}
+			// the padding never gets written, and neither does a run past the end of the line
+			pixel = palette[readbyte];
+			for (i = x; i < q_min(x + runlength, w); i++)
+				p[i] = pixel;
+			x += runlength;
+		}
+		if (x < pcx.bytes_per_line)
+		{
+			Image_Warning ("'%s' is truncated\n", loadfilename);
+			break;
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(f);
-
 	*width = w;
 	*height = h;
 	return data;
 }
+
+//==============================================================================
+//
+//  PNG
+//
+//==============================================================================
+
+/*
+the inflater is table driven: codes up to PNG_FASTBITS long are found with one
+lookup of the next bits, longer ones by comparing against the first code of
+each length
+*/
+
+#define PNG_FASTBITS	9
+#define PNG_MAXPAD		64	//zero bytes read past the end before giving up
+
+typedef struct
+{
+	unsigned short	fast[1 << PNG_FASTBITS];	//(length << 9) | symbol, 0 for longer codes
+	int				maxcode[17];	//first code of the next length, left justified to 16 bits
+	unsigned short	firstcode[16];
+	unsigned short	firstsymbol[16];
+	byte			size[288];
+	unsigned short	value[288];
+} pnghuff_t;
+
+typedef struct
+{
+	const byte	*in, *end;
+	unsigned	bits;
+	int			numbits;
+	int			pad;		//bytes of zeros made up past the end
+	byte		*out, *outstart, *outend;
+} pnginflate_t;
+
+static const unsigned short png_lengthbase[31] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258,0,0};
+static const byte png_lengthextra[31] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0};
+static const unsigned short png_distbase[32] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0};
+static const byte png_distextra[32] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13,0,0};
+
+/*
+============
+Image_BitReverse16
+============
+*/
+static int Image_BitReverse16 (int n)
+{
+	n = ((n & 0xAAAA) >> 1) | ((n & 0x5555) << 1);
+	n = ((n & 0xCCCC) >> 2) | ((n & 0x3333) << 2);
+	n = ((n & 0xF0F0) >> 4) | ((n & 0x0F0F) << 4);
+	n = ((n & 0xFF00) >> 8) | ((n & 0x00FF) << 8);
+	return n;
+}
+
+/*
+============
+Image_BuildHuffman -- canonical huffman codes from a list of code lengths
+============
+*/
+static qboolean Image_BuildHuffman (pnghuff_t *h, const byte *sizes, int num)
+{
+	int		count[17], nextcode[16];
+	int		i, j, code, symbol, s;
+
+	memset (count, 0, sizeof(count));
+	memset (h->fast, 0, sizeof(h->fast));
+	for (i = 0; i < num; i++)
+		count[sizes[i]]++;
+	count[0] = 0;
+
+	code = 0;
+	symbol = 0;
+	for (i = 1; i < 16; i++)
+	{
+		nextcode[i] = code;
+		h->firstcode[i] = code;
+		h->firstsymbol[i] = symbol;
+		code += count[i];
+		if (count[i] && code - 1 >= (1 << i))
+			return false; //oversubscribed
+		h->maxcode[i] = code << (16 - i);
+		code <<= 1;
+		symbol += count[i];
+	}
+	h->maxcode[16] = 0x10000;
+
+	for (i = 0; i < num; i++)
+	{
+		s = sizes[i];
+		if (!s)
+			continue;
+		j = nextcode[s] - h->firstcode[s] + h->firstsymbol[s];
+		h->size[j] = s;
+		h->value[j] = i;
+		if (s <= PNG_FASTBITS)
+		{
+			for (j = Image_BitReverse16 (nextcode[s]) >> (16 - s); j < (1 << PNG_FASTBITS); j += 1 << s)
+				h->fast[j] = (s << 9) | i;
+		}
+		nextcode[s]++;
+	}
+
+	return true;
+}
+
+/*
+============
+Image_FillBits -- tops the bit buffer up to at least 25 bits
+============
+*/
+static void Image_FillBits (pnginflate_t *z)
+{
+	while (z->numbits <= 24)
+	{
+		if (z->in < z->end)
+			z->bits |= (unsigned)*z->in++ << z->numbits;
+		else
+			z->pad++;
+		z->numbits += 8;
+	}
+}
+
+/*
+============
+Image_GetBits
+============
+*/
+static int Image_GetBits (pnginflate_t *z, int n)
+{
+	int		v;
+
+	if (z->numbits < n)
+		Image_FillBits (z);
+	v = z->bits & ((1 << n) - 1);
+	z->bits >>= n;
+	z->numbits -= n;
+	return v;
+}
+
+/*
+============
+Image_DecodeSymbol -- returns -1 for a code that isn't in the table
+============
+*/
+static int Image_DecodeSymbol (pnginflate_t *z, const pnghuff_t *h)
+{
+	int		b, s, k;
+
+	if (z->numbits < 16)
+		Image_FillBits (z);
+
+	b = h->fast[z->bits & ((1 << PNG_FASTBITS) - 1)];
+	if (b)
+	{
+		s = b >> 9;
+		z->bits >>= s;
+		z->numbits -= s;
+		return b & 511;
+	}
+
+	k = Image_BitReverse16 (z->bits & 0xffff);
+	for (s = PNG_FASTBITS + 1; k >= h->maxcode[s]; s++)
+		;
+	if (s >= 16)
+		return -1;
+	b = (k >> (16 - s)) - h->firstcode[s] + h->firstsymbol[s];
+	if (b < 0 || b >= 288 || h->size[b] != s)
+		return -1;
+	z->bits >>= s;
+	z->numbits -= s;
+	return h->value[b];
+}
+
+/*
+============
+Image_InflateBlock -- one huffman coded block
+============
+*/
+static qboolean Image_InflateBlock (pnginflate_t *z, const pnghuff_t *lit, const pnghuff_t *dist)
+{
+	int		sym, len, d;
+	byte	*src;
+
+	for (;;)
+	{
+		if (z->pad > PNG_MAXPAD)
+			return false;
+
+		sym = Image_DecodeSymbol (z, lit);
+		if (sym < 0)
+			return false;
+		if (sym < 256)
+		{
+			if (z->out == z->outend)
+				return false;
+			*z->out++ = sym;
+			continue;
+		}
+		if (sym == 256)
+			return true;
+
+		sym -= 257;
+		if (sym >= 29)
+			return false;
+		len = png_lengthbase[sym] + (png_lengthextra[sym] ? Image_GetBits (z, png_lengthextra[sym]) : 0);
+
+		sym = Image_DecodeSymbol (z, dist);
+		if (sym < 0 || sym >= 30)
+			return false;
+		d = png_distbase[sym] + (png_distextra[sym] ? Image_GetBits (z, png_distextra[sym]) : 0);
+
+		if (d > z->out - z->outstart || len > z->outend - z->out)
+			return false;
+		src = z->out - d;
+		if (d == 1)
+			memset (z->out, *src, len);
+		else if (d >= len)
+			memcpy (z->out, src, len);
+		else
+		{
+			for (sym = 0; sym < len; sym++)
+				z->out[sym] = src[sym]; //overlapping copy repeats the pattern
+		}
+		z->out += len;
+	}
+}
+
+/*
+============
+Image_DynamicHuffman -- reads the code tables at the start of a dynamic block
+============
+*/
+static qboolean Image_DynamicHuffman (pnginflate_t *z, pnghuff_t *lit, pnghuff_t *dist)
+{
+	static const byte order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+	pnghuff_t	codelengths;
+	byte		sizes[286+32], lengthsizes[19];
+	int			hlit, hdist, hclen, n, c, repeat, fill;
+
+	hlit = Image_GetBits (z, 5) + 257;
+	hdist = Image_GetBits (z, 5) + 1;
+	hclen = Image_GetBits (z, 4) + 4;
+	if (hlit > 286 || hdist > 30)
+		return false;
+
+	memset (lengthsizes, 0, sizeof(lengthsizes));
+	for (n = 0; n < hclen; n++)
+		lengthsizes[order[n]] = Image_GetBits (z, 3);
+	if (!Image_BuildHuffman (&codelengths, lengthsizes, 19))
+		return false;
+
+	for (n = 0; n < hlit + hdist; )
+	{
+		c = Image_DecodeSymbol (z, &codelengths);
+		if (c < 0 || z->pad > PNG_MAXPAD)
+			return false;
+		if (c < 16)
+		{
+			sizes[n++] = c;
+			continue;
+		}
+		if (c == 16)
+		{
+			if (!n)
+				return false;
+			repeat = Image_GetBits (z, 2) + 3;
+			fill = sizes[n-1];
+		}
+		else if (c == 17)
+		{
+			repeat = Image_GetBits (z, 3) + 3;
+			fill = 0;
+		}
+		else
+		{
+			repeat = Image_GetBits (z, 7) + 11;
+			fill = 0;
+		}
+		if (n + repeat > hlit + hdist)
+			return false;
+		memset (sizes + n, fill, repeat);
+		n += repeat;
+	}
+
+	return Image_BuildHuffman (lit, sizes, hlit) && Image_BuildHuffman (dist, sizes + hlit, hdist);
+}
+
+/*
+============
+Image_Inflate -- decompresses a zlib stream into out, which must come out
+exactly outsize bytes
+============
+*/
+static qboolean Image_Inflate (const byte *in, int insize, byte *out, int outsize)
+{
+	pnginflate_t	z;
+	pnghuff_t		*lit, *dist;
+	byte			sizes[288+32];
+	int				final, type, len, i;
+	qboolean		ok;
+
+	if (insize < 2 || (in[0] & 15) != 8 || ((in[0] << 8) | in[1]) % 31 || (in[1] & 32))
+		return false; //not deflate, or has a preset dictionary
+
+	memset (&z, 0, sizeof(z));
+	z.in = in + 2;
+	z.end = in + insize;
+	z.out = z.outstart = out;
+	z.outend = out + outsize;
+
+	lit = (pnghuff_t *) malloc (2 * sizeof(pnghuff_t));
+	if (!lit)
+		return false;
+	dist = lit + 1;
+
+	ok = true;
+	do
+	{
+		final = Image_GetBits (&z, 1);
+		type = Image_GetBits (&z, 2);
+		switch (type)
+		{
+		case 0: //stored
+			Image_GetBits (&z, z.numbits & 7);
+			len = Image_GetBits (&z, 16);
+			if (Image_GetBits (&z, 16) != (len ^ 0xffff) || len > z.outend - z.out)
+			{
+				ok = false;
+				break;
+			}
+			while (len && z.numbits >= 8)
+			{
+				*z.out++ = Image_GetBits (&z, 8);
+				len--;
+			}
+			if (len > z.end - z.in)
+			{
+				ok = false;
+				break;
+			}
+			memcpy (z.out, z.in, len);
+			z.out += len;
+			z.in += len;
+			break;
+		case 1: //fixed codes
+			for (i = 0; i < 288; i++)
+				sizes[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+			for (i = 0; i < 32; i++)
+				sizes[288+i] = 5;
+			ok = Image_BuildHuffman (lit, sizes, 288) && Image_BuildHuffman (dist, sizes + 288, 32) &&
+				Image_InflateBlock (&z, lit, dist);
+			break;
+		case 2: //dynamic codes
+			ok = Image_DynamicHuffman (&z, lit, dist) && Image_InflateBlock (&z, lit, dist);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+	} while (ok && !final && z.pad <= PNG_MAXPAD);
+
+	free (lit);
+	return ok && z.out == z.outend && z.pad <= PNG_MAXPAD;
+}
+
+/*
+============
+Image_Paeth
+============
+*/
+static int Image_Paeth (int a, int b, int c)
+{
+	int	p, pa, pb, pc;
+
+	p = a + b - c;
+	pa = abs (p - a);
+	pb = abs (p - b);
+	pc = abs (p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/*
+============
+Image_UnfilterPNG -- undoes the filter of each row in place. rows are
+rowbytes long plus the filter type byte in front.
+============
+*/
+static qboolean Image_UnfilterPNG (byte *data, int rows, int rowbytes, int bpp)
+{
+	byte	*row, *prev;
+	int		x, y;
+
+	for (y = 0, prev = NULL; y < rows; y++, prev = row)
+	{
+		row = data + y * (rowbytes + 1) + 1;
+		switch (row[-1])
+		{
+		case 0: //none
+			break;
+		case 1: //sub
+			for (x = bpp; x < rowbytes; x++)
+				row[x] += row[x-bpp];
+			break;
+		case 2: //up
+			if (prev)
+				for (x = 0; x < rowbytes; x++)
+					row[x] += prev[x];
+			break;
+		case 3: //average
+			for (x = 0; x < rowbytes; x++)
+				row[x] += ((x >= bpp ? row[x-bpp] : 0) + (prev ? prev[x] : 0)) >> 1;
+			break;
+		case 4: //paeth
+			for (x = 0; x < rowbytes; x++)
+				row[x] += Image_Paeth (x >= bpp ? row[x-bpp] : 0, prev ? prev[x] : 0, (prev && x >= bpp) ? prev[x-bpp] : 0);
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+typedef struct
+{
+	int			width, height, depth, colortype, channels;
+	int			numpalette;
+	byte		palette[256*4];
+	qboolean	haskey;
+	int			key[3];		//tRNS color that's transparent, for types 0 and 2
+} pnginfo_t;
+
+/*
+============
+Image_PNGSample -- sample n of a row, at any bit depth, scaled to 8 bits
+unless it's a palette index. rawvalue gets the unscaled value.
+============
+*/
+static int Image_PNGSample (const pnginfo_t *png, const byte *row, int n, int *rawvalue)
+{
+	int		v, shift;
+
+	switch (png->depth)
+	{
+	case 16:
+		*rawvalue = (row[n*2] << 8) | row[n*2+1];
+		return row[n*2];
+	case 8:
+		*rawvalue = row[n];
+		return row[n];
+	default:
+		shift = 8 - png->depth - (n * png->depth & 7);
+		v = (row[n * png->depth >> 3] >> shift) & ((1 << png->depth) - 1);
+		*rawvalue = v;
+		if (png->colortype == 3)
+			return v;
+		return v * 255 / ((1 << png->depth) - 1);
+	}
+}
+
+/*
+============
+Image_ConvertPNGRow -- expands one unfiltered row to rgba, every xstep pixels
+============
+*/
+static void Image_ConvertPNGRow (const pnginfo_t *png, const byte *row, int width, byte *out, int xstep)
+{
+	int		x, c, v[4], raw[4];
+
+	for (x = 0; x < width; x++, out += xstep * 4)
+	{
+		for (c = 0; c < png->channels; c++)
+			v[c] = Image_PNGSample (png, row, x * png->channels + c, &raw[c]);
+
+		switch (png->colortype)
+		{
+		case 0: //grey
+			out[0] = out[1] = out[2] = v[0];
+			out[3] = (png->haskey && raw[0] == png->key[0]) ? 0 : 255;
+			break;
+		case 2: //rgb
+			out[0] = v[0];
+			out[1] = v[1];
+			out[2] = v[2];
+			out[3] = (png->haskey && raw[0] == png->key[0] && raw[1] == png->key[1] && raw[2] == png->key[2]) ? 0 : 255;
+			break;
+		case 3: //palette
+			if (v[0] < png->numpalette)
+				memcpy (out, png->palette + v[0] * 4, 4);
+			else
+			{
+				out[0] = out[1] = out[2] = 0;
+				out[3] = 255;
+			}
+			break;
+		case 4: //grey and alpha
+			out[0] = out[1] = out[2] = v[0];
+			out[3] = v[1];
+			break;
+		case 6: //rgba
+			out[0] = v[0];
+			out[1] = v[1];
+			out[2] = v[2];
+			out[3] = v[3];
+			break;
+		}
+	}
+}
+
+/*
+============
+Image_PNGLong -- pngs are big-endian
+============
+*/
+static unsigned Image_PNGLong (const byte *p)
+{
+	return ((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*
+============
+Image_LoadPNG
+============
+*/
+byte *Image_LoadPNG (FILE *f, int *width, int *height)
+{
+	byte	*buf, *data;
+	int		size;
+
+	if (!(buf = Image_ReadFile (f, &size)))
+		return NULL;
+	data = Image_DecodePNG (buf, size, width, height);
+	free (buf);
+
+	return data;
+}
+
+/*
+============
+Image_DecodePNG -- all the standard color types and bit depths, and interlacing.
+the IDAT chunks are gathered up and inflated in one go.
+============
+*/
+static byte *Image_DecodePNG (const byte *in, int size, int *width, int *height)
+{
+	static const byte signature[8] = {137,80,78,71,13,10,26,10};
+	static const byte adam7[7][4] = {{0,0,8,8},{4,0,8,8},{0,4,4,8},{2,0,4,4},{0,2,2,4},{1,0,2,2},{0,1,1,2}}; //xstart, ystart, xstep, ystep
+	pnginfo_t	png;
+	const byte	*end = in + size, *chunk;
+	byte		*idat = NULL, *raw = NULL, *rgba = NULL, *rawpos;
+	int			idatsize = 0, rawsize, chunksize, i, x, y, interlace, numpasses, pass;
+	unsigned	length;
+	double		plausible;
+	int			passwidth[7], passheight[7], passrowbytes[7], bitsperpixel;
+	qboolean	seenheader = false;
+
+	if (size < 8 || memcmp (in, signature, 8))
+	{
+		Image_Warning ("Image_LoadPNG: %s is not a png\n", loadfilename);
+		return NULL;
+	}
+
+	memset (&png, 0, sizeof(png));
+	interlace = 0;
+	for (chunk = in + 8; end - chunk >= 12; chunk += 12 + chunksize)
+	{
+		length = Image_PNGLong (chunk);
+		if (length > (unsigned)(end - chunk - 12))
+			break;
+		chunksize = length;
+
+		if (!memcmp (chunk + 4, "IHDR", 4) && chunksize >= 13)
+		{
+			png.width = q_min(Image_PNGLong (chunk + 8), MAX_IMAGESIZE + 1);
+			png.height = q_min(Image_PNGLong (chunk + 12), MAX_IMAGESIZE + 1);
+			png.depth = chunk[16];
+			png.colortype = chunk[17];
+			interlace = chunk[20];
+			if (chunk[18] || chunk[19] || interlace > 1)
+				goto bad;
+			seenheader = true;
+		}
+		else if (!memcmp (chunk + 4, "PLTE", 4))
+		{
+			png.numpalette = q_min(chunksize / 3, 256);
+			for (i = 0; i < png.numpalette; i++)
+			{
+				memcpy (png.palette + i*4, chunk + 8 + i*3, 3);
+				png.palette[i*4+3] = 255;
+			}
+		}
+		else if (!memcmp (chunk + 4, "tRNS", 4))
+		{
+			if (png.colortype == 3)
+			{
+				for (i = 0; i < q_min(chunksize, png.numpalette); i++)
+					png.palette[i*4+3] = chunk[8+i];
+			}
+			else if (chunksize >= 2 * (png.colortype == 2 ? 3 : 1))
+			{
+				png.haskey = true;
+				for (i = 0; i < 3 && i * 2 + 1 < chunksize; i++)
+					png.key[i] = (chunk[8+i*2] << 8) | chunk[9+i*2];
+			}
+		}
+		else if (!memcmp (chunk + 4, "IDAT", 4))
+		{
+			rawpos = (byte *) realloc (idat, idatsize + chunksize);
+			if (!rawpos)
+				goto bad;
+			idat = rawpos;
+			memcpy (idat + idatsize, chunk + 8, chunksize);
+			idatsize += chunksize;
+		}
+		else if (!memcmp (chunk + 4, "IEND", 4))
+			break;
+	}
+
+	if (!seenheader || !idat)
+		goto bad;
+
+	switch (png.colortype)
+	{
+	case 0: png.channels = 1; break;
+	case 2: png.channels = 3; break;
+	case 3: png.channels = 1; break;
+	case 4: png.channels = 2; break;
+	case 6: png.channels = 4; break;
+	default: goto bad;
+	}
+	if ((png.depth != 1 && png.depth != 2 && png.depth != 4 && png.depth != 8 && png.depth != 16) ||
+		(png.depth < 8 && png.channels != 1) || (png.depth == 16 && png.colortype == 3))
+		goto bad;
+	if (png.width <= 0 || png.height <= 0 || png.width > MAX_IMAGESIZE || png.height > MAX_IMAGESIZE)
+		goto bad;
+
+	// sizes of the passes, or of the one pass if it isn't interlaced
+	bitsperpixel = png.channels * png.depth;
+	numpasses = interlace ? 7 : 1;
+	plausible = 0;
+	for (pass = 0; pass < numpasses; pass++)
+	{
+		if (interlace)
+		{
+			passwidth[pass] = (png.width - adam7[pass][0] + adam7[pass][2] - 1) / adam7[pass][2];
+			passheight[pass] = (png.height - adam7[pass][1] + adam7[pass][3] - 1) / adam7[pass][3];
+			if (passwidth[pass] <= 0 || passheight[pass] <= 0)
+				passwidth[pass] = passheight[pass] = 0;
+		}
+		else
+		{
+			passwidth[pass] = png.width;
+			passheight[pass] = png.height;
+		}
+		passrowbytes[pass] = (passwidth[pass] * bitsperpixel + 7) / 8;
+		plausible += (double)passheight[pass] * (passrowbytes[pass] + (passwidth[pass] ? 1 : 0));
+	}
+
+	// deflate can't do better than about 1032:1, so a short file can't be real
+	if (plausible > (double)idatsize * 1032 + 1024 || plausible > 0x40000000)
+		goto bad;
+	rawsize = (int)plausible;
+
+	raw = (byte *) malloc (rawsize);
+	if (!raw || !Image_Inflate (idat, idatsize, raw, rawsize))
+		goto bad;
+
+	rgba = (byte *) Hunk_Alloc (png.width * png.height * 4);
+	for (pass = 0, rawpos = raw; pass < numpasses; pass++)
+	{
+		if (!passwidth[pass])
+			continue;
+		if (!Image_UnfilterPNG (rawpos, passheight[pass], passrowbytes[pass], q_max(bitsperpixel / 8, 1)))
+			goto bad;
+		for (y = 0; y < passheight[pass]; y++, rawpos += passrowbytes[pass] + 1)
+		{
+			x = interlace ? adam7[pass][0] : 0;
+			i = interlace ? adam7[pass][1] + y * adam7[pass][3] : y;
+			Image_ConvertPNGRow (&png, rawpos + 1, passwidth[pass], rgba + (i * png.width + x) * 4, interlace ? adam7[pass][2] : 1);
+		}
+	}
+
+	free (idat);
+	free (raw);
+	*width = png.width;
+	*height = png.height;
+	return rgba;
+
+bad:
+	Image_Warning ("Image_LoadPNG: %s is unsupported or corrupt\n", loadfilename);
+	free (idat);
+	free (raw);
+	return NULL; //rgba, if it got that far, is freed with the caller's hunk mark
+}
+
+//==============================================================================
+//
+//  DDS AND KTX
+//
+//  block compressed images with their mip levels already made, handed to gl
+//  as they are. only 2D textures in BC1, BC2, BC3 and BC7 are read.
+//
+//==============================================================================
+
+#define DDS_HEADERSIZE		128	//magic and DDS_HEADER
+#define DDS_DX10SIZE		20	//DDS_HEADER_DXT10, if the fourcc is DX10
+#define DDSD_MIPMAPCOUNT	0x20000
+#define DDPF_ALPHAPIXELS	0x1
+#define DDPF_FOURCC			0x4
+#define DDSCAPS_COMPLEX		0x8
+#define DDSCAPS_TEXTURE		0x1000
+#define DDSCAPS_MIPMAP		0x400000
+#define DDSCAPS2_CUBEMAP	0x200
+#define DDSCAPS2_VOLUME		0x200000
+
+#define KTX_HEADERSIZE		64
+
+static const byte ktx_identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+/*
+============
+Image_ReadLong -- a 32 bit value of either byte order
+============
+*/
+static unsigned Image_ReadLong (const byte *p, qboolean bigendian)
+{
+	if (bigendian)
+		return Image_PNGLong (p);
+	return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/*
+============
+Image_BlockBytes -- bytes per 4x4 block of a compressed format, or 0 if it's
+not one we read
+============
+*/
+static int Image_BlockBytes (unsigned format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+/*
+============
+Image_CompressedLevelSize
+============
+*/
+int Image_CompressedLevelSize (unsigned format, int width, int height)
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * Image_BlockBytes (format);
+}
+
+/*
+============
+Image_AllocCompressed -- lays out the levels of a compressed image on the hunk.
+levels that would be smaller than 1x1, or past MAX_IMAGELEVELS, are dropped.
+============
+*/
+compressedimage_t *Image_AllocCompressed (unsigned format, int width, int height, int numlevels)
+{
+	compressedimage_t	*image;
+	int		i, total;
+	compressedimage_t	layout;
+
+	memset (&layout, 0, sizeof(layout));
+	layout.format = format;
+	total = sizeof(compressedimage_t);
+	for (i = 0; i < q_min(numlevels, MAX_IMAGELEVELS); i++)
+	{
+		layout.width[i] = width;
+		layout.height[i] = height;
+		layout.offset[i] = total;
+		layout.size[i] = Image_CompressedLevelSize (format, width, height);
+		total += layout.size[i];
+		layout.numlevels++;
+		if (width == 1 && height == 1)
+			break;
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+	layout.totalsize = total;
+
+	image = (compressedimage_t *) Hunk_Alloc (total);
+	memcpy (image, &layout, sizeof(layout));
+	return image;
+}
+
+/*
+============
+Image_DecodeDDS
+============
+*/
+static compressedimage_t *Image_DecodeDDS (const byte *in, int size)
+{
+	compressedimage_t	*image;
+	unsigned	format, flags, pfflags, caps2;
+	int			width, height, levels, dataofs, i;
+
+	if (size < DDS_HEADERSIZE || memcmp (in, "DDS ", 4) || Image_ReadLong (in + 4, false) != 124)
+		return NULL;
+
+	flags = Image_ReadLong (in + 8, false);
+	height = (int) q_min(Image_ReadLong (in + 12, false), MAX_IMAGESIZE + 1);
+	width = (int) q_min(Image_ReadLong (in + 16, false), MAX_IMAGESIZE + 1);
+	levels = (flags & DDSD_MIPMAPCOUNT) ? (int) q_min(Image_ReadLong (in + 28, false), MAX_IMAGELEVELS) : 1;
+	pfflags = Image_ReadLong (in + 80, false);
+	caps2 = Image_ReadLong (in + 112, false);
+	dataofs = DDS_HEADERSIZE;
+
+	if (!(pfflags & DDPF_FOURCC) || (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)))
+		goto unsupported;
+
+	if (!memcmp (in + 84, "DXT1", 4))
+		format = (pfflags & DDPF_ALPHAPIXELS) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	else if (!memcmp (in + 84, "DXT3", 4))
+		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+	else if (!memcmp (in + 84, "DXT5", 4))
+		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	else if (!memcmp (in + 84, "DX10", 4))
+	{
+		if (size < DDS_HEADERSIZE + DDS_DX10SIZE)
+			goto truncated;
+		// only plain 2D textures; the _SRGB variants would need srgb decode
+		if (Image_ReadLong (in + 132, false) != 3 || Image_ReadLong (in + 140, false) > 1)
+			goto unsupported;
+		switch (Image_ReadLong (in + 128, false))
+		{
+		case 71:	format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;		break;	//DXGI_FORMAT_BC1_UNORM
+		case 74:	format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;		break;	//DXGI_FORMAT_BC2_UNORM
+		case 77:	format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;		break;	//DXGI_FORMAT_BC3_UNORM
+		case 98:	format = GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;		break;	//DXGI_FORMAT_BC7_UNORM
+		default:	goto unsupported;
+		}
+		dataofs += DDS_DX10SIZE;
+	}
+	else
+		goto unsupported;
+
+	if (width < 1 || width > MAX_IMAGESIZE || height < 1 || height > MAX_IMAGESIZE)
+	{
+		Image_Warning ("Image_LoadDDS: %s has a bad size (%i x %i)\n", loadfilename, width, height);
+		return NULL;
+	}
+
+	if (Image_CompressedLevelSize (format, width, height) > size - dataofs)
+		goto truncated;
+
+	image = Image_AllocCompressed (format, width, height, q_max(levels, 1));
+	for (i = 0; i < image->numlevels; i++)
+	{
+		if (image->size[i] > size - dataofs)
+		{
+			if (i == 0)
+				goto truncated;
+			image->numlevels = i; //keep the levels that are there
+			break;
+		}
+		memcpy ((byte *)image + image->offset[i], in + dataofs, image->size[i]);
+		dataofs += image->size[i];
+	}
+	return image;
+
+unsupported:
+	Image_Warning ("Image_LoadDDS: %s is not a 2D BC1, BC2, BC3 or BC7 dds\n", loadfilename);
+	return NULL;
+truncated:
+	Image_Warning ("Image_LoadDDS: %s is truncated\n", loadfilename);
+	return NULL;
+}
+
+/*
+============
+Image_DecodeKTX -- KTX 1.1, either byte order
+============
+*/
+static compressedimage_t *Image_DecodeKTX (const byte *in, int size)
+{
+	compressedimage_t	*image;
+	qboolean	swap;
+	unsigned	format, levelsize;
+	int			width, height, levels, dataofs, i;
+
+	if (size < KTX_HEADERSIZE || memcmp (in, ktx_identifier, sizeof(ktx_identifier)))
+		return NULL;
+
+	if (Image_ReadLong (in + 12, false) == 0x04030201)
+		swap = false;
+	else if (Image_ReadLong (in + 12, true) == 0x04030201)
+		swap = true;
+	else
+		goto unsupported;
+
+	format = Image_ReadLong (in + 28, swap);
+	width = (int) q_min(Image_ReadLong (in + 36, swap), MAX_IMAGESIZE + 1);
+	height = (int) q_min(Image_ReadLong (in + 40, swap), MAX_IMAGESIZE + 1);
+	levels = (int) q_min(Image_ReadLong (in + 56, swap), MAX_IMAGELEVELS);
+	dataofs = KTX_HEADERSIZE + (int) q_min(Image_ReadLong (in + 60, swap), (unsigned)size);
+
+	// gltype 0 means compressed; no 3D textures, arrays or cubemaps
+	if (Image_ReadLong (in + 16, swap) != 0 || !Image_BlockBytes (format) ||
+		Image_ReadLong (in + 44, swap) != 0 || Image_ReadLong (in + 48, swap) != 0 || Image_ReadLong (in + 52, swap) != 1)
+		goto unsupported;
+
+	if (width < 1 || width > MAX_IMAGESIZE || height < 1 || height > MAX_IMAGESIZE)
+	{
+		Image_Warning ("Image_LoadKTX: %s has a bad size (%i x %i)\n", loadfilename, width, height);
+		return NULL;
+	}
+
+	if (Image_CompressedLevelSize (format, width, height) > size - dataofs - 4)
+		goto truncated;
+
+	image = Image_AllocCompressed (format, width, height, q_max(levels, 1));
+	for (i = 0; i < image->numlevels; i++)
+	{
+		if (dataofs > size - 4)
+			levelsize = 0;
+		else
+			levelsize = Image_ReadLong (in + dataofs, swap);
+		if (levelsize != (unsigned)image->size[i] || image->size[i] > size - dataofs - 4)
+		{
+			if (i == 0)
+				goto truncated;
+			image->numlevels = i;
+			break;
+		}
+		memcpy ((byte *)image + image->offset[i], in + dataofs + 4, image->size[i]);
+		dataofs += 4 + ((image->size[i] + 3) & ~3);
+	}
+	return image;
+
+unsupported:
+	Image_Warning ("Image_LoadKTX: %s is not a 2D BC1, BC2, BC3 or BC7 ktx\n", loadfilename);
+	return NULL;
+truncated:
+	Image_Warning ("Image_LoadKTX: %s is truncated\n", loadfilename);
+	return NULL;
+}
+
+/*
+============
+Image_LoadCompressed -- looks for name.dds, then name.ktx
+
+returns a pointer to a hunk allocated compressedimage_t, with the levels
+after it
+============
+*/
+compressedimage_t *Image_LoadCompressed (const char *name)
+{
+	compressedimage_t	*image;
+	FILE	*f;
+	byte	*buf;
+	int		size, i;
+	static const char *exts[2] = {"dds", "ktx"};
+
+	for (i = 0; i < 2; i++)
+	{
+		q_snprintf (loadfilename, sizeof(loadfilename), "%s.%s", name, exts[i]);
+		COM_FOpenFile (loadfilename, &f, NULL);
+		if (!f)
+			continue;
+		if (!(buf = Image_ReadFile (f, &size)))
+			return NULL;
+		image = (i == 0) ? Image_DecodeDDS (buf, size) : Image_DecodeKTX (buf, size);
+		free (buf);
+		return image;
+	}
+
+	return NULL;
+}
+
+/*
+============
+Image_PutLong -- little endian, as dds wants
+============
+*/
+static void Image_PutLong (byte *p, unsigned v)
+{
+	p[0] = v & 255;
+	p[1] = (v >> 8) & 255;
+	p[2] = (v >> 16) & 255;
+	p[3] = v >> 24;
+}
+
+/*
+============
+Image_WriteDDSFile -- writes a compressed image and its levels to a dds file
+at a full path. BC7 gets a DX10 header, the others a plain fourcc.
+============
+*/
+qboolean Image_WriteDDSFile (const char *pathname, const compressedimage_t *image)
+{
+	FILE	*f;
+	byte	header[DDS_HEADERSIZE + DDS_DX10SIZE];
+	int		i, headersize;
+	const char	*fourcc;
+
+	switch (image->format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:	fourcc = "DXT1";	break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:	fourcc = "DXT3";	break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:	fourcc = "DXT5";	break;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:	fourcc = "DX10";	break;
+	default:
+		return false;
+	}
+
+	f = fopen (pathname, "wb");
+	if (!f)
+		return false;
+
+	memset (header, 0, sizeof(header));
+	memcpy (header, "DDS ", 4);
+	Image_PutLong (header + 4, 124);
+	Image_PutLong (header + 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000 | DDSD_MIPMAPCOUNT); //caps, height, width, pixelformat, linearsize
+	Image_PutLong (header + 12, image->height[0]);
+	Image_PutLong (header + 16, image->width[0]);
+	Image_PutLong (header + 20, image->size[0]);
+	Image_PutLong (header + 28, image->numlevels);
+	Image_PutLong (header + 76, 32); //DDS_PIXELFORMAT size
+	Image_PutLong (header + 80, DDPF_FOURCC | ((image->format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? DDPF_ALPHAPIXELS : 0));
+	memcpy (header + 84, fourcc, 4);
+	Image_PutLong (header + 108, DDSCAPS_TEXTURE | ((image->numlevels > 1) ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+	headersize = DDS_HEADERSIZE;
+	if (image->format == GL_COMPRESSED_RGBA_BPTC_UNORM_ARB)
+	{
+		Image_PutLong (header + 128, 98); //DXGI_FORMAT_BC7_UNORM
+		Image_PutLong (header + 132, 3); //D3D10_RESOURCE_DIMENSION_TEXTURE2D
+		Image_PutLong (header + 140, 1); //array size
+		headersize += DDS_DX10SIZE;
+	}
+
+	fwrite (header, headersize, 1, f);
+	for (i = 0; i < image->numlevels; i++)
+		fwrite ((const byte *)image + image->offset[i], image->size[i], 1, f);
+
+	i = ferror (f);
+	fclose (f);
+
+	return !i;
+}
+
+//==============================================================================
+//
+//  TESTS AND BENCHMARKS
+//
+//==============================================================================
+
+/*
+two real pngs, made with zlib at level 9: a 16x16 rgba gradient that uses all
+five row filters, and a 13x7 4-bit palette image with tRNS and interlacing
+*/
+static const byte testpng_rgba[432] = {
+	137,80,78,71,13,10,26,10,0,0,0,13,73,72,68,82,
+	0,0,0,16,0,0,0,16,8,6,0,0,0,31,243,255,
+	97,0,0,0,181,73,68,65,84,120,218,157,146,33,110,3,
+	49,16,69,167,77,65,160,143,224,35,248,8,134,129,115,4,
+	31,193,71,48,11,140,89,96,134,45,92,179,133,49,11,140,
+	89,96,204,2,51,108,23,68,74,167,237,110,21,85,81,155,
+	20,60,125,143,70,26,240,252,1,0,174,10,84,175,65,159,
+	13,152,147,5,123,68,192,131,3,183,247,224,119,1,194,54,
+	66,236,8,168,77,144,154,12,121,83,160,172,43,212,21,3,
+	47,95,64,41,57,192,131,2,51,252,39,95,229,0,128,50,
+	66,17,24,158,157,103,160,117,152,207,249,50,159,195,229,43,
+	237,229,153,249,237,243,34,104,65,141,196,155,247,196,111,123,
+	196,171,66,219,107,244,103,131,238,100,81,29,17,225,224,208,
+	236,61,234,93,192,178,141,152,59,66,110,19,214,38,94,38,
+	207,65,0,0,0,182,73,68,65,84,99,220,20,12,235,138,
+	105,197,72,34,209,185,143,95,16,33,101,248,79,142,18,39,
+	57,207,231,12,22,11,145,168,69,136,25,5,161,224,4,47,
+	4,65,9,36,36,33,11,69,168,223,34,71,137,60,138,186,
+	151,127,237,137,174,138,82,175,41,156,13,197,147,165,122,68,
+	226,131,163,188,247,84,118,129,244,54,146,233,136,160,77,164,
+	154,76,110,83,200,175,43,217,21,19,138,196,148,198,38,78,
+	248,225,153,249,166,137,40,120,65,254,89,165,59,205,187,191,
+	159,129,247,99,19,245,40,102,18,244,216,124,211,196,242,163,
+	121,143,206,204,87,197,181,215,92,206,134,243,201,114,58,34,
+	211,193,113,220,123,14,187,192,126,27,217,117,196,216,38,182,
+	77,102,179,41,172,215,149,213,138,25,150,239,101,112,80,47,
+	53,96,196,6,0,0,0,0,73,69,78,68,174,66,96,130,
+};
+static const byte testpng_palette[202] = {
+	137,80,78,71,13,10,26,10,0,0,0,13,73,72,68,82,
+	0,0,0,13,0,0,0,7,4,3,0,0,1,86,89,234,
+	191,0,0,0,33,80,76,84,69,0,255,0,20,235,7,40,
+	215,14,60,195,21,80,175,28,100,155,35,120,135,42,140,115,
+	49,160,95,56,180,75,63,200,55,70,253,97,7,34,0,0,
+	0,11,116,82,78,83,0,25,50,75,100,125,150,175,200,225,
+	250,56,41,137,111,0,0,0,32,73,68,65,84,120,218,99,
+	224,96,112,100,104,140,100,80,91,192,176,184,128,193,173,75,
+	56,128,65,56,124,130,2,136,96,8,159,160,194,96,248,36,
+	85,0,0,0,33,73,68,65,84,48,65,37,131,65,37,99,
+	33,131,178,107,122,231,2,33,3,6,16,105,18,86,192,0,
+	34,43,102,49,0,0,233,197,16,188,60,214,248,5,0,0,
+	0,0,73,69,78,68,174,66,96,130,
+};
+
+#define TESTIMAGE_W	37
+#define TESTIMAGE_H	23
+
+typedef struct
+{
+	const char	*name;
+	byte		*data;
+	int			size;
+	byte		*(*decode) (const byte *in, int size, int *width, int *height);
+	int			width, height;
+	byte		*expected;	//rgba
+} testimage_t;
+
+/*
+============
+Image_TestPixel -- the indexed test pattern has runs of every length, some
+crossing rows
+============
+*/
+static int Image_TestPixel (int x, int y)
+{
+	return ((x / 5) * 13 + (y / 3) * 7 + (x * y > 400 ? 1 : 0)) & 255;
+}
+
+/*
+============
+Image_TestPalette
+============
+*/
+static void Image_TestPalette (int i, byte *rgb)
+{
+	rgb[0] = i;
+	rgb[1] = 255 - i;
+	rgb[2] = i * 3;
+}
+
+/*
+============
+Image_MakeTestTGA -- encodes the test pattern with 8, 24 or 32 bits, raw or
+run-length encoded, stored bottom-up or top-down
+============
+*/
+static void Image_MakeTestTGA (testimage_t *t, int bpp, qboolean rle, qboolean topdown)
+{
+	byte	*p, *e, *pixels;
+	int		x, y, i, n, bytes, count;
+
+	bytes = bpp / 8;
+	t->width = TESTIMAGE_W;
+	t->height = TESTIMAGE_H;
+	t->expected = (byte *) malloc (TESTIMAGE_W * TESTIMAGE_H * 4);
+	pixels = (byte *) malloc (TESTIMAGE_W * TESTIMAGE_H * 4);
+	t->data = p = (byte *) calloc (1, TARGAHEADERSIZE + TESTIMAGE_W * TESTIMAGE_H * (bytes + 1) + 16);
+
+	// pixels in file order, in the file's byte order
+	for (i = 0; i < TESTIMAGE_W * TESTIMAGE_H; i++)
+	{
+		x = i % TESTIMAGE_W;
+		y = topdown ? i / TESTIMAGE_W : TESTIMAGE_H - 1 - i / TESTIMAGE_W;
+		n = Image_TestPixel (x, y);
+		e = t->expected + (y * TESTIMAGE_W + x) * 4;
+		if (bytes == 1)
+		{
+			e[0] = e[1] = e[2] = pixels[i] = n;
+			e[3] = 255;
+			continue;
+		}
+		Image_TestPalette (n, e);
+		e[3] = (bytes == 4) ? (byte)(x * 16) : 255;
+		pixels[i*bytes+0] = e[2];
+		pixels[i*bytes+1] = e[1];
+		pixels[i*bytes+2] = e[0];
+		if (bytes == 4)
+			pixels[i*bytes+3] = e[3];
+	}
+
+	p[0] = 3; //comment to skip
+	p[2] = (bytes == 1 ? 3 : 2) + (rle ? 8 : 0);
+	p[12] = TESTIMAGE_W;
+	p[14] = TESTIMAGE_H;
+	p[16] = bpp;
+	p[17] = topdown ? 0x20 : 0;
+	p += TARGAHEADERSIZE + 3;
+
+	if (!rle)
+	{
+		memcpy (p, pixels, TESTIMAGE_W * TESTIMAGE_H * bytes);
+		p += TESTIMAGE_W * TESTIMAGE_H * bytes;
+	}
+	else
+	{
+		// packets run straight across the rows
+		count = TESTIMAGE_W * TESTIMAGE_H;
+		for (i = 0; i < count; i += n)
+		{
+			for (n = 1; i + n < count && n < 128 && !memcmp (pixels + i*bytes, pixels + (i+n)*bytes, bytes); n++)
+				;
+			if (n > 1)
+			{
+				*p++ = 0x80 | (n - 1);
+				memcpy (p, pixels + i*bytes, bytes);
+				p += bytes;
+				continue;
+			}
+			for (n = 1; i + n < count && n < 128 && memcmp (pixels + (i+n-1)*bytes, pixels + (i+n)*bytes, bytes); n++)
+				;
+			*p++ = n - 1;
+			memcpy (p, pixels + i*bytes, n * bytes);
+			p += n * bytes;
+		}
+	}
+
+	t->size = p - t->data;
+	t->decode = Image_DecodeTGA;
+	free (pixels);
+}
+
+/*
+============
+Image_MakeTestPCX -- the test pattern, with a padding byte on each line
+============
+*/
+static void Image_MakeTestPCX (testimage_t *t)
+{
+	pcxheader_t	*pcx;
+	byte		*p, line[TESTIMAGE_W + 1];
+	int			x, y, n, linebytes;
+
+	linebytes = (TESTIMAGE_W + 1) & ~1;
+	t->width = TESTIMAGE_W;
+	t->height = TESTIMAGE_H;
+	t->expected = (byte *) malloc (TESTIMAGE_W * TESTIMAGE_H * 4);
+	t->data = (byte *) calloc (1, sizeof(pcxheader_t) + TESTIMAGE_H * linebytes * 2 + 769);
+
+	pcx = (pcxheader_t *)t->data;
+	pcx->signature = 0x0A;
+	pcx->version = 5;
+	pcx->encoding = 1;
+	pcx->bits_per_pixel = 8;
+	pcx->color_planes = 1;
+	pcx->xmax = LittleShort (TESTIMAGE_W - 1);
+	pcx->ymax = LittleShort (TESTIMAGE_H - 1);
+	pcx->bytes_per_line = LittleShort (linebytes);
+
+	p = t->data + sizeof(pcxheader_t);
+	for (y = 0; y < TESTIMAGE_H; y++)
+	{
+		for (x = 0; x < linebytes; x++)
+		{
+			line[x] = (x < TESTIMAGE_W) ? Image_TestPixel (x, y) : 0;
+			if (x < TESTIMAGE_W)
+			{
+				Image_TestPalette (line[x], t->expected + (y * TESTIMAGE_W + x) * 4);
+				t->expected[(y * TESTIMAGE_W + x) * 4 + 3] = 255;
+			}
+		}
+		for (x = 0; x < linebytes; x += n)
+		{
+			for (n = 1; x + n < linebytes && n < 63 && line[x+n] == line[x]; n++)
+				;
+			if (n > 1 || line[x] >= 0xC0)
+				*p++ = 0xC0 | n;
+			*p++ = line[x];
+		}
+	}
+
+	*p++ = 0x0C;
+	for (n = 0; n < 256; n++, p += 3)
+		Image_TestPalette (n, p);
+
+	t->size = p - t->data;
+	t->decode = Image_DecodePCX;
+}
+
+/*
+============
+Image_MakeTestPNGs
+============
+*/
+static void Image_MakeTestPNG (testimage_t *t, const byte *png, int size, qboolean palette)
+{
+	int		x, y, i;
+	byte	*e;
+
+	t->data = (byte *) malloc (size);
+	memcpy (t->data, png, size);
+	t->size = size;
+	t->decode = Image_DecodePNG;
+	t->width = palette ? 13 : 16;
+	t->height = palette ? 7 : 16;
+	t->expected = (byte *) malloc (t->width * t->height * 4);
+
+	for (y = 0; y < t->height; y++)
+	{
+		for (x = 0; x < t->width; x++)
+		{
+			e = t->expected + (y * t->width + x) * 4;
+			if (palette)
+			{
+				i = (x + 2 * y) % 11;
+				e[0] = i * 20;
+				e[1] = 255 - i * 20;
+				e[2] = i * 7;
+				e[3] = i * 25;
+			}
+			else
+			{
+				e[0] = x * 16;
+				e[1] = y * 16;
+				e[2] = (x ^ y) * 16;
+				e[3] = 255 - x * 8;
+			}
+		}
+	}
+}
+
+/*
+============
+Image_Test_f -- testimages [iterations]: checks each decoder against known
+images, then feeds them randomly damaged copies. a crash or hang here is a bug.
+============
+*/
+static void Image_Test_f (void)
+{
+	testimage_t	tests[8];
+	byte		*fuzz, *data;
+	int			numtests, iterations, i, j, n, size, width, height, mark, passed, decoded;
+
+	iterations = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 20000;
+
+	memset (tests, 0, sizeof(tests));
+	numtests = 0;
+	tests[numtests].name = "tga raw 32 bit";
+	Image_MakeTestTGA (&tests[numtests++], 32, false, false);
+	tests[numtests].name = "tga rle 24 bit top-down";
+	Image_MakeTestTGA (&tests[numtests++], 24, true, true);
+	tests[numtests].name = "tga rle 32 bit";
+	Image_MakeTestTGA (&tests[numtests++], 32, true, false);
+	tests[numtests].name = "tga rle greyscale";
+	Image_MakeTestTGA (&tests[numtests++], 8, true, false);
+	tests[numtests].name = "pcx";
+	Image_MakeTestPCX (&tests[numtests++]);
+	tests[numtests].name = "png rgba";
+	Image_MakeTestPNG (&tests[numtests++], testpng_rgba, sizeof(testpng_rgba), false);
+	tests[numtests].name = "png palette interlaced";
+	Image_MakeTestPNG (&tests[numtests++], testpng_palette, sizeof(testpng_palette), true);
+
+	q_strlcpy (loadfilename, "test image", sizeof(loadfilename));
+	mark = Hunk_LowMark ();
+
+	// the real thing has to come out right
+	for (i = 0, passed = 0; i < numtests; i++)
+	{
+		data = tests[i].decode (tests[i].data, tests[i].size, &width, &height);
+		if (!data || width != tests[i].width || height != tests[i].height)
+			Con_Printf ("%s: FAILED, didn't decode\n", tests[i].name);
+		else if (memcmp (data, tests[i].expected, width * height * 4))
+			Con_Printf ("%s: FAILED, wrong pixels\n", tests[i].name);
+		else
+			passed++;
+		Hunk_FreeToLowMark (mark);
+	}
+	Con_Printf ("%i of %i images decoded correctly\n", passed, numtests);
+
+	// damaged copies must be rejected or decoded, nothing else
+	fuzz = (byte *) malloc (4096);
+	imagequiet = true;
+	for (i = 0, decoded = 0; i < iterations; i++)
+	{
+		testimage_t *t = &tests[rand () % numtests];
+
+		size = q_min(t->size, 4096);
+		memcpy (fuzz, t->data, size);
+		for (j = 1 + rand () % 8; j; j--)
+		{
+			n = rand () % size;
+			switch (rand () % 4)
+			{
+			case 0: fuzz[n] = rand (); break;
+			case 1: fuzz[n] ^= 1 << (rand () % 8); break;
+			case 2: fuzz[n] = 0xff; break;
+			case 3: fuzz[n] = 0; break;
+			}
+		}
+		if (!(rand () % 4))
+			size = rand () % size;
+
+		if (t->decode (fuzz, size, &width, &height))
+			decoded++;
+		Hunk_FreeToLowMark (mark);
+	}
+	imagequiet = false;
+	free (fuzz);
+
+	Con_Printf ("%i damaged images: %i decoded, %i rejected\n", iterations, decoded, iterations - decoded);
+
+	for (i = 0; i < numtests; i++)
+	{
+		free (tests[i].data);
+		free (tests[i].expected);
+	}
+}
+
+#define MAX_TIMEDIMAGES	8192
+
+/*
+============
+Image_AddListedImage
+============
+*/
+static void Image_AddListedImage (char (*names)[MAX_QPATH], int *count, int maxnames, const char *dir, const char *name)
+{
+	const char *ext = COM_FileGetExtension (name);
+
+	if (*count < maxnames && (!q_strcasecmp (ext, "tga") || !q_strcasecmp (ext, "png") || !q_strcasecmp (ext, "pcx")))
+		q_snprintf (names[(*count)++], MAX_QPATH, "%s%s", dir, name);
+}
+
+/*
+============
+Image_ListImages -- finds every tga, png and pcx in a directory of the search
+path, in directories and pak files alike. dir ends with a slash. files found
+more than once (in a pak and a directory, say) are listed more than once.
+============
+*/
+int Image_ListImages (const char *dir, char (*names)[MAX_QPATH], int maxnames)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA	fdat;
+	HANDLE		fhnd;
+#else
+	DIR		*dir_p;
+	struct dirent	*dir_t;
+#endif
+	char		path[MAX_OSPATH];
+	searchpath_t	*search;
+	int			count, i;
+
+	count = 0;
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (*search->filename) //directory
+		{
+#ifdef _WIN32
+			q_snprintf (path, sizeof(path), "%s/%s*", search->filename, dir);
+			fhnd = FindFirstFile(path, &fdat);
+			if (fhnd == INVALID_HANDLE_VALUE)
+				continue;
+			do
+			{
+				Image_AddListedImage (names, &count, maxnames, dir, fdat.cFileName);
+			} while (FindNextFile(fhnd, &fdat));
+			FindClose(fhnd);
+#else
+			q_snprintf (path, sizeof(path), "%s/%s", search->filename, dir);
+			dir_p = opendir(path);
+			if (dir_p == NULL)
+				continue;
+			while ((dir_t = readdir(dir_p)) != NULL)
+				Image_AddListedImage (names, &count, maxnames, dir, dir_t->d_name);
+			closedir(dir_p);
+#endif
+		}
+		else //pakfile
+		{
+			for (i = 0; i < search->pack->numfiles; i++)
+			{
+				if (!q_strncasecmp (search->pack->files[i].name, dir, strlen(dir)) && !strchr (search->pack->files[i].name + strlen(dir), '/'))
+					Image_AddListedImage (names, &count, maxnames, "", search->pack->files[i].name);
+			}
+		}
+	}
+
+	return count;
+}
+
+/*
+============
+Image_Time_f -- timeimages [dir]: reads and decodes every tga, png and pcx in
+a directory of the search path (textures/ by default) and reports throughput
+============
+*/
+static void Image_Time_f (void)
+{
+	static const char *exts[3] = {"tga", "png", "pcx"};
+	char		(*names)[MAX_QPATH];
+	char		dir[MAX_QPATH];
+	FILE		*f;
+	byte		*buf, *data;
+	int			count, i, j, k, size, width, height, mark, files[3], failed;
+	double		start, readtime, decodetime[3], inbytes[3], pixels[3];
+
+	q_snprintf (dir, sizeof(dir), "%s/", (Cmd_Argc () > 1) ? Cmd_Argv (1) : "textures");
+	names = (char (*)[MAX_QPATH]) malloc (MAX_TIMEDIMAGES * MAX_QPATH);
+	count = Image_ListImages (dir, names, MAX_TIMEDIMAGES);
+
+	memset (files, 0, sizeof(files));
+	memset (decodetime, 0, sizeof(decodetime));
+	memset (inbytes, 0, sizeof(inbytes));
+	memset (pixels, 0, sizeof(pixels));
+	readtime = 0;
+	failed = 0;
+	mark = Hunk_LowMark ();
+
+	// files found more than once (in a pak and a directory, say) are timed more than once
+	for (i = 0; i < count; i++)
+	{
+		for (k = 0; k < 3 && q_strcasecmp (COM_FileGetExtension (names[i]), exts[k]); k++)
+			;
+		q_strlcpy (loadfilename, names[i], sizeof(loadfilename));
+
+		start = Sys_DoubleTime ();
+		COM_FOpenFile (names[i], &f, NULL);
+		if (!f || !(buf = Image_ReadFile (f, &size)))
+		{
+			failed++;
+			continue;
+		}
+		readtime += Sys_DoubleTime () - start;
+
+		start = Sys_DoubleTime ();
+		data = (k == 0) ? Image_DecodeTGA (buf, size, &width, &height) :
+			(k == 1) ? Image_DecodePNG (buf, size, &width, &height) :
+			Image_DecodePCX (buf, size, &width, &height);
+		decodetime[k] += Sys_DoubleTime () - start;
+		free (buf);
+
+		if (data)
+		{
+			files[k]++;
+			inbytes[k] += size;
+			pixels[k] += width * height;
+		}
+		else
+			failed++;
+		Hunk_FreeToLowMark (mark);
+	}
+	free (names);
+
+	Con_Printf ("%i images in %s, read in %.1f ms\n", count, dir, readtime * 1000.0);
+	for (j = 0; j < 3; j++)
+	{
+		if (files[j])
+			Con_Printf ("  %s: %4i files, %6.1f MB, %7.1f Mpixels in %7.1f ms, %6.1f Mpixels/s\n", exts[j], files[j],
+				inbytes[j] / 0x100000, pixels[j] / 1000000.0, decodetime[j] * 1000.0, pixels[j] / 1000000.0 / q_max(decodetime[j], 0.001));
+	}
+	if (failed)
+		Con_Printf ("  %i failed\n", failed);
+}
+
+/*
+============
+Image_Init
+============
+*/
+void Image_Init (void)
+{
+	Cmd_AddCommand ("testimages", &Image_Test_f);
+	Cmd_AddCommand ("timeimages", &Image_Time_f);
+}
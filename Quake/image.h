@@ -25,12 +25,36 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //image.h -- image reading / writing
 
+#define MAX_IMAGELEVELS	16
+
+//a block compressed image and its mip levels, as read from a dds or ktx file.
+//the levels follow it in the same allocation.
+typedef struct
+{
+	unsigned	format;		//GL_COMPRESSED_ internal format
+	int			numlevels;
+	int			width[MAX_IMAGELEVELS];
+	int			height[MAX_IMAGELEVELS];
+	int			offset[MAX_IMAGELEVELS];	//in bytes, from the start of this struct
+	int			size[MAX_IMAGELEVELS];		//in bytes
+	int			totalsize;	//of this struct and the levels
+} compressedimage_t;
+
 //be sure to free the hunk after using these loading functions
 byte *Image_LoadTGA (FILE *f, int *width, int *height);
 byte *Image_LoadPCX (FILE *f, int *width, int *height);
+byte *Image_LoadPNG (FILE *f, int *width, int *height);
 byte *Image_LoadImage (const char *name, int *width, int *height);
+compressedimage_t *Image_LoadCompressed (const char *name);
+compressedimage_t *Image_AllocCompressed (unsigned format, int width, int height, int numlevels);
+int Image_CompressedLevelSize (unsigned format, int width, int height);
+int Image_ListImages (const char *dir, char (*names)[MAX_QPATH], int maxnames);
 
 qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown);
+qboolean Image_WriteTGAFile (const char *pathname, byte *data, int width, int height, int bpp, qboolean upsidedown, qboolean rle);
+qboolean Image_WriteDDSFile (const char *pathname, const compressedimage_t *image);
+
+void Image_Init (void);
 
 #endif	/* __GL_IMAGE_H */
 
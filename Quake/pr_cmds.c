@@ -265,7 +265,7 @@ setmodel(entity, model)
 static void PF_setmodel (void)
 {
 	int		i;
-	const char	*m, **check;
+	const char	*m;
 	qmodel_t	*mod;
 	edict_t		*e;
 
@@ -273,17 +273,12 @@ static void PF_setmodel (void)
 	m = G_STRING(OFS_PARM1);
 
 // check to see if model was properly precached
-	for (i = 0, check = sv.model_precache; *check; i++, check++)
-	{
-		if (!strcmp(*check, m))
-			break;
-	}
-
-	if (!*check)
+	i = SV_FindModelIndex (m);
+	if (i < 0)
 	{
 		PR_RunError ("no precache: %s", m);
 	}
-	e->v.model = PR_SetEngineString(*check);
+	e->v.model = PR_SetEngineString(sv.model_precache[i]);
 	e->v.modelindex = i; //SV_ModelIndex (m);
 
 	mod = sv.models[ (int)e->v.modelindex];  // Mod_ForName (m, true);
@@ -1095,18 +1090,12 @@ static void PF_precache_model (void)
 	G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
 	PR_CheckEmptyString (s);
 
-	for (i = 0; i < MAX_MODELS; i++)
-	{
-		if (!sv.model_precache[i])
-		{
-			sv.model_precache[i] = s;
-			sv.models[i] = Mod_ForName (s, true);
-			return;
-		}
-		if (!strcmp(sv.model_precache[i], s))
-			return;
-	}
-	PR_RunError ("PF_precache_model: overflow");
+	if (SV_FindModelIndex (s) >= 0)
+		return;
+	i = SV_AddModelPrecache (s);
+	if (i < 0)
+		PR_RunError ("PF_precache_model: overflow");
+	sv.models[i] = Mod_ForName (s, true);
 }
 
 
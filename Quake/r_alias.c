@@ -79,11 +79,48 @@ static GLuint fullbrightTexLoc;
 static GLuint useFullbrightTexLoc;
 static GLuint useOverbrightLoc;
 
+static GLuint r_aliasshadow_program;
+
+// uniforms used in the shadow shader
+static GLuint shadowBlendLoc;
+static GLuint shadowEntityRow0Loc;
+static GLuint shadowEntityRow1Loc;
+static GLuint shadowEntityRow2Loc;
+static GLuint shadowLightZLoc;
+static GLuint shadowSkewLoc;
+static GLuint shadowAlphaLoc;
+
+// instanced shadows: casters sharing a model and poses are one draw call,
+// the per entity values come from r_shadow_vbo instead of uniforms
+static GLuint r_aliasshadow_instanced_program;
+
+static GLuint instShadowSkewLoc;
+
+static GLuint r_shadow_vbo;		// instance data, refilled every draw
+
+typedef struct
+{
+	float	rows[3][4];		// R_ShadowEntityMatrix
+	float	blend, lightz, alpha, pad;
+} shadowinstance_t;
+
+typedef struct
+{
+	entity_t	*e;
+	aliashdr_t	*paliashdr;
+	int			pose1, pose2;
+	shadowinstance_t	inst;
+} shadowcaster_t;
+
 static const GLint pose1VertexAttrIndex = 0;
 static const GLint pose1NormalAttrIndex = 1;
 static const GLint pose2VertexAttrIndex = 2;
 static const GLint pose2NormalAttrIndex = 3;
 static const GLint texCoordsAttrIndex = 4;
+static const GLint shadowRow0AttrIndex = 5;
+static const GLint shadowRow1AttrIndex = 6;
+static const GLint shadowRow2AttrIndex = 7;
+static const GLint shadowParamsAttrIndex = 8;
 
 /*
 =============
@@ -187,6 +224,95 @@ void GLAlias_CreateShaders (void)
 		"	gl_FragColor = result;\n"
 		"}\n";
 
+	const glsl_attrib_binding_t shadowbindings[] = {
+		{ "Pose1Vert", pose1VertexAttrIndex },
+		{ "Pose2Vert", pose2VertexAttrIndex }
+	};
+
+	const GLchar *shadowVertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform float Blend;\n"
+		"uniform vec4 EntityRow0;\n"
+		"uniform vec4 EntityRow1;\n"
+		"uniform vec4 EntityRow2;\n"
+		"uniform float LightZ;\n"
+		"uniform vec4 ShadowSkew; // skew x, skew y, vertical scale, height \n"
+		"attribute vec4 Pose1Vert;\n"
+		"attribute vec4 Pose2Vert;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 lerpedVert = vec4(mix(Pose1Vert.xyz, Pose2Vert.xyz, Blend), 1.0);\n"
+		"	vec4 world = vec4(dot(EntityRow0, lerpedVert), dot(EntityRow1, lerpedVert), dot(EntityRow2, lerpedVert), 1.0);\n"
+		"	// flatten onto the floor below the entity\n"
+		"	float height = world.z - LightZ;\n"
+		"	world.xy += ShadowSkew.xy * height;\n"
+		"	world.z = LightZ + ShadowSkew.z * height + ShadowSkew.w;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * world;\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * world);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	const GLchar *shadowFragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform float Alpha;\n"
+		"void main()\n"
+		"{\n"
+		"	// apply GL_EXP2 fog (from the orange book)\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * gl_FogFragCoord * gl_FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	gl_FragColor = vec4(mix(gl_Fog.color.rgb, vec3(0.0), fog), Alpha);\n"
+		"}\n";
+
+	const glsl_attrib_binding_t instshadowbindings[] = {
+		{ "Pose1Vert", pose1VertexAttrIndex },
+		{ "Pose2Vert", pose2VertexAttrIndex },
+		{ "EntityRow0", shadowRow0AttrIndex },
+		{ "EntityRow1", shadowRow1AttrIndex },
+		{ "EntityRow2", shadowRow2AttrIndex },
+		{ "ShadowParams", shadowParamsAttrIndex }
+	};
+
+	const GLchar *instShadowVertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec4 ShadowSkew; // skew x, skew y, vertical scale, height \n"
+		"attribute vec4 Pose1Vert;\n"
+		"attribute vec4 Pose2Vert;\n"
+		"attribute vec4 EntityRow0;\n"
+		"attribute vec4 EntityRow1;\n"
+		"attribute vec4 EntityRow2;\n"
+		"attribute vec4 ShadowParams; // blend, light z, alpha\n"
+		"varying float Alpha;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 lerpedVert = vec4(mix(Pose1Vert.xyz, Pose2Vert.xyz, ShadowParams.x), 1.0);\n"
+		"	vec4 world = vec4(dot(EntityRow0, lerpedVert), dot(EntityRow1, lerpedVert), dot(EntityRow2, lerpedVert), 1.0);\n"
+		"	// flatten onto the floor below the entity\n"
+		"	float height = world.z - ShadowParams.y;\n"
+		"	world.xy += ShadowSkew.xy * height;\n"
+		"	world.z = ShadowParams.y + ShadowSkew.z * height + ShadowSkew.w;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * world;\n"
+		"	Alpha = ShadowParams.z;\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * world);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	const GLchar *instShadowFragSource = \
+		"#version 110\n"
+		"\n"
+		"varying float Alpha;\n"
+		"void main()\n"
+		"{\n"
+		"	// apply GL_EXP2 fog (from the orange book)\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * gl_FogFragCoord * gl_FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	gl_FragColor = vec4(mix(gl_Fog.color.rgb, vec3(0.0), fog), Alpha);\n"
+		"}\n";
+
 	if (!gl_glsl_alias_able)
 		return;
 
@@ -203,6 +329,31 @@ void GLAlias_CreateShaders (void)
 		useFullbrightTexLoc = GL_GetUniformLocation (&r_alias_program, "UseFullbrightTex");
 		useOverbrightLoc = GL_GetUniformLocation (&r_alias_program, "UseOverbright");
 	}
+
+	r_aliasshadow_program = GL_CreateProgram (shadowVertSource, shadowFragSource, sizeof(shadowbindings)/sizeof(shadowbindings[0]), shadowbindings);
+
+	if (r_aliasshadow_program != 0)
+	{
+	// get uniform locations
+		shadowBlendLoc = GL_GetUniformLocation (&r_aliasshadow_program, "Blend");
+		shadowEntityRow0Loc = GL_GetUniformLocation (&r_aliasshadow_program, "EntityRow0");
+		shadowEntityRow1Loc = GL_GetUniformLocation (&r_aliasshadow_program, "EntityRow1");
+		shadowEntityRow2Loc = GL_GetUniformLocation (&r_aliasshadow_program, "EntityRow2");
+		shadowLightZLoc = GL_GetUniformLocation (&r_aliasshadow_program, "LightZ");
+		shadowSkewLoc = GL_GetUniformLocation (&r_aliasshadow_program, "ShadowSkew");
+		shadowAlphaLoc = GL_GetUniformLocation (&r_aliasshadow_program, "Alpha");
+	}
+
+	if (!gl_instancing_able)
+		return;
+
+	r_aliasshadow_instanced_program = GL_CreateProgram (instShadowVertSource, instShadowFragSource, sizeof(instshadowbindings)/sizeof(instshadowbindings[0]), instshadowbindings);
+
+	if (r_aliasshadow_instanced_program != 0)
+	{
+	// get uniform locations
+		instShadowSkewLoc = GL_GetUniformLocation (&r_aliasshadow_instanced_program, "ShadowSkew");
+	}
 }
 
 /*
@@ -951,6 +1102,254 @@ void GL_DrawAliasShadow (entity_t *e)
 	glPopMatrix ();
 }
 
+/*
+=============
+R_ShadowEntityMatrix
+
+the rows of the matrix R_RotateForEntity and the alias scale would set up,
+for the shadow vertex shader
+=============
+*/
+static void R_ShadowEntityMatrix (aliashdr_t *paliashdr, lerpdata_t *lerpdata, float rows[3][4])
+{
+	float	yaw, pitch, roll;
+	float	sy, cy, sp, cp, sr, cr;
+	float	rot[3][3];
+	int		i, j;
+
+	yaw = lerpdata->angles[1] * M_PI_DIV_180;
+	pitch = -lerpdata->angles[0] * M_PI_DIV_180;
+	roll = lerpdata->angles[2] * M_PI_DIV_180;
+	sy = sin(yaw); cy = cos(yaw);
+	sp = sin(pitch); cp = cos(pitch);
+	sr = sin(roll); cr = cos(roll);
+
+// Rz(yaw) * Ry(-pitch) * Rx(roll), same order as the glRotatef calls
+	rot[0][0] = cy*cp;	rot[0][1] = cy*sp*sr - sy*cr;	rot[0][2] = cy*sp*cr + sy*sr;
+	rot[1][0] = sy*cp;	rot[1][1] = sy*sp*sr + cy*cr;	rot[1][2] = sy*sp*cr - cy*sr;
+	rot[2][0] = -sp;	rot[2][1] = cp*sr;				rot[2][2] = cp*cr;
+
+	for (i = 0; i < 3; i++)
+	{
+		rows[i][3] = lerpdata->origin[i];
+		for (j = 0; j < 3; j++)
+		{
+			rows[i][j] = rot[i][j] * paliashdr->scale[j];
+			rows[i][3] += rot[i][j] * paliashdr->scale_origin[j];
+		}
+	}
+}
+
+/*
+=============
+R_SetupShadowCaster
+
+false if e casts no shadow, otherwise sets up its pose and the values the
+shadow shaders take per entity
+=============
+*/
+static qboolean R_SetupShadowCaster (entity_t *e, shadowcaster_t *caster)
+{
+	lerpdata_t	lerpdata;
+
+	currententity = e;
+
+	if (R_CullModelForEntity(e))
+		return false;
+
+	if (e == &cl.viewent || e->model->flags & MOD_NOSHADOW)
+		return false;
+
+	entalpha = ENTALPHA_DECODE(e->alpha);
+	if (entalpha == 0)
+		return false;
+
+	caster->e = e;
+	caster->paliashdr = (aliashdr_t *)Mod_Extradata (e->model);
+	R_SetupAliasFrame (caster->paliashdr, e->frame, &lerpdata);
+	R_SetupEntityTransform (e, &lerpdata);
+	R_LightPoint (e->origin);
+	R_ShadowEntityMatrix (caster->paliashdr, &lerpdata, caster->inst.rows);
+
+	caster->pose1 = lerpdata.pose1;
+	caster->pose2 = lerpdata.pose2;
+	caster->inst.blend = (lerpdata.pose1 != lerpdata.pose2) ? lerpdata.blend : 0;
+	caster->inst.lightz = lightspot[2] + (lerpdata.origin[2] - e->origin[2]);
+	caster->inst.alpha = entalpha * 0.5;
+	caster->inst.pad = 0;
+	return true;
+}
+
+/*
+=============
+R_CompareShadowCasters -- groups casters that can share an instanced draw
+=============
+*/
+static int R_CompareShadowCasters (const void *a, const void *b)
+{
+	const shadowcaster_t *ca = (const shadowcaster_t *)a;
+	const shadowcaster_t *cb = (const shadowcaster_t *)b;
+
+	if (ca->e->model != cb->e->model)
+		return (ca->e->model < cb->e->model) ? -1 : 1;
+	if (ca->pose1 != cb->pose1)
+		return ca->pose1 - cb->pose1;
+	return ca->pose2 - cb->pose2;
+}
+
+/*
+=============
+GL_DrawAliasShadows_Instanced
+
+casters with the same model and poses are drawn with one
+glDrawElementsInstanced; their matrices, blend, floor height and alpha are
+uploaded once for the whole pass
+=============
+*/
+static void GL_DrawAliasShadows_Instanced (shadowcaster_t *casters, int numcasters)
+{
+	static shadowinstance_t	instances[MAX_VISEDICTS];
+	shadowcaster_t	*c;
+	int				i, first, count;
+
+	qsort (casters, numcasters, sizeof(shadowcaster_t), R_CompareShadowCasters);
+	for (i = 0; i < numcasters; i++)
+		instances[i] = casters[i].inst;
+
+// upload, letting the driver orphan last frame's storage
+	if (!r_shadow_vbo)
+		GL_GenBuffersFunc (1, &r_shadow_vbo);
+	GL_BindBuffer (GL_ARRAY_BUFFER, r_shadow_vbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, numcasters * sizeof(shadowinstance_t), instances, GL_STREAM_DRAW);
+
+	GL_UseProgramFunc (r_aliasshadow_instanced_program);
+	GL_Uniform4fFunc (instShadowSkewLoc, SHADOW_SKEW_X, SHADOW_SKEW_Y, SHADOW_VSCALE, SHADOW_HEIGHT);
+
+	GL_EnableVertexAttribArrayFunc (pose1VertexAttrIndex);
+	GL_EnableVertexAttribArrayFunc (pose2VertexAttrIndex);
+	GL_EnableVertexAttribArrayFunc (shadowRow0AttrIndex);
+	GL_EnableVertexAttribArrayFunc (shadowRow1AttrIndex);
+	GL_EnableVertexAttribArrayFunc (shadowRow2AttrIndex);
+	GL_EnableVertexAttribArrayFunc (shadowParamsAttrIndex);
+	GL_VertexAttribDivisorFunc (shadowRow0AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (shadowRow1AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (shadowRow2AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (shadowParamsAttrIndex, 1);
+
+	for (first = 0; first < numcasters; first += count)
+	{
+		c = &casters[first];
+		for (count = 1; first + count < numcasters; count++)
+			if (R_CompareShadowCasters (c, &casters[first + count]))
+				break;
+
+		currententity = c->e; //for GLARB_GetXYZOffset
+
+		GL_BindBuffer (GL_ARRAY_BUFFER, r_shadow_vbo);
+		GL_VertexAttribPointerFunc (shadowRow0AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(shadowinstance_t), (void *)(first * sizeof(shadowinstance_t)));
+		GL_VertexAttribPointerFunc (shadowRow1AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(shadowinstance_t), (void *)(first * sizeof(shadowinstance_t) + 4 * sizeof(float)));
+		GL_VertexAttribPointerFunc (shadowRow2AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(shadowinstance_t), (void *)(first * sizeof(shadowinstance_t) + 8 * sizeof(float)));
+		GL_VertexAttribPointerFunc (shadowParamsAttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(shadowinstance_t), (void *)(first * sizeof(shadowinstance_t) + 12 * sizeof(float)));
+
+		GL_BindBuffer (GL_ARRAY_BUFFER, c->e->model->meshvbo);
+		GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, c->e->model->meshindexesvbo);
+		GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (c->paliashdr, c->pose1));
+		GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (c->paliashdr, c->pose2));
+
+		GL_DrawElementsInstancedFunc (GL_TRIANGLES, c->paliashdr->numindexes, GL_UNSIGNED_SHORT, (void *)(intptr_t)c->e->model->vboindexofs, count);
+
+		rs_aliaspasses += c->paliashdr->numtris * count;
+	}
+
+	GL_VertexAttribDivisorFunc (shadowRow0AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (shadowRow1AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (shadowRow2AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (shadowParamsAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (shadowRow0AttrIndex);
+	GL_DisableVertexAttribArrayFunc (shadowRow1AttrIndex);
+	GL_DisableVertexAttribArrayFunc (shadowRow2AttrIndex);
+	GL_DisableVertexAttribArrayFunc (shadowParamsAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose1VertexAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose2VertexAttrIndex);
+	GL_UseProgramFunc (0);
+}
+
+/*
+=============
+GL_DrawAliasShadows
+
+draws the shadows of all the given entities with one set of state changes;
+the poses come straight from the mesh vbos and are lerped and flattened in
+the vertex shader. with instancing, casters sharing a model and poses are
+also one draw call. falls back to GL_DrawAliasShadow without glsl.
+=============
+*/
+void GL_DrawAliasShadows (entity_t **ents, int numents)
+{
+	static shadowcaster_t	casters[MAX_VISEDICTS];
+	shadowcaster_t	*c;
+	int			i, numcasters;
+
+	if (!r_aliasshadow_program)
+	{
+		for (i = 0; i < numents; i++)
+		{
+			currententity = ents[i];
+			GL_DrawAliasShadow (currententity);
+		}
+		return;
+	}
+
+	numcasters = 0;
+	for (i = 0; i < numents && numcasters < MAX_VISEDICTS; i++)
+		if (R_SetupShadowCaster (ents[i], &casters[numcasters]))
+			numcasters++;
+	if (!numcasters)
+		return;
+
+	glDepthMask (GL_FALSE);
+	glEnable (GL_BLEND);
+
+	if (r_aliasshadow_instanced_program)
+		GL_DrawAliasShadows_Instanced (casters, numcasters);
+	else
+	{
+		GL_UseProgramFunc (r_aliasshadow_program);
+		GL_EnableVertexAttribArrayFunc (pose1VertexAttrIndex);
+		GL_EnableVertexAttribArrayFunc (pose2VertexAttrIndex);
+		GL_Uniform4fFunc (shadowSkewLoc, SHADOW_SKEW_X, SHADOW_SKEW_Y, SHADOW_VSCALE, SHADOW_HEIGHT);
+
+		for (i = 0; i < numcasters; i++)
+		{
+			c = &casters[i];
+			currententity = c->e; //for GLARB_GetXYZOffset
+
+			GL_Uniform1fFunc (shadowBlendLoc, c->inst.blend);
+			GL_Uniform4fFunc (shadowEntityRow0Loc, c->inst.rows[0][0], c->inst.rows[0][1], c->inst.rows[0][2], c->inst.rows[0][3]);
+			GL_Uniform4fFunc (shadowEntityRow1Loc, c->inst.rows[1][0], c->inst.rows[1][1], c->inst.rows[1][2], c->inst.rows[1][3]);
+			GL_Uniform4fFunc (shadowEntityRow2Loc, c->inst.rows[2][0], c->inst.rows[2][1], c->inst.rows[2][2], c->inst.rows[2][3]);
+			GL_Uniform1fFunc (shadowLightZLoc, c->inst.lightz);
+			GL_Uniform1fFunc (shadowAlphaLoc, c->inst.alpha);
+
+			GL_BindBuffer (GL_ARRAY_BUFFER, c->e->model->meshvbo);
+			GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, c->e->model->meshindexesvbo);
+			GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (c->paliashdr, c->pose1));
+			GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (c->paliashdr, c->pose2));
+
+			glDrawElements (GL_TRIANGLES, c->paliashdr->numindexes, GL_UNSIGNED_SHORT, (void *)(intptr_t)c->e->model->vboindexofs);
+
+			rs_aliaspasses += c->paliashdr->numtris;
+		}
+
+		GL_DisableVertexAttribArrayFunc (pose1VertexAttrIndex);
+		GL_DisableVertexAttribArrayFunc (pose2VertexAttrIndex);
+		GL_UseProgramFunc (0);
+	}
+
+	glDisable (GL_BLEND);
+	glDepthMask (GL_TRUE);
+}
+
 /*
 =================
 R_DrawAliasModel_ShowTris -- johnfitz
@@ -30,8 +30,8 @@ extern cvar_t gl_zfix; // QuakeSpasm z-fighting fix
 int		gl_lightmap_format;
 int		lightmap_bytes;
 
-#define	BLOCK_WIDTH	128
-#define	BLOCK_HEIGHT	128
+#define	BLOCK_WIDTH		LMBLOCK_WIDTH
+#define	BLOCK_HEIGHT	LMBLOCK_HEIGHT
 
 gltexture_t	*lightmap_textures[MAX_LIGHTMAPS]; //johnfitz -- changed to an array
 
@@ -156,7 +156,7 @@ void R_DrawSequentialPoly (msurface_t *s)
 	{
 		if ((s->flags & SURF_DRAWTURB) && r_oldwater.value)
 		{
-			for (p = s->polys->next; p; p = p->next)
+			for (p = GL_SubdividedPolys (s); p; p = p->next)
 			{
 				srand((unsigned int) (uintptr_t) p);
 				glColor3f (rand()%256/255.0, rand()%256/255.0, rand()%256/255.0);
@@ -260,13 +260,21 @@ void R_DrawSequentialPoly (msurface_t *s)
 		if (r_oldwater.value)
 		{
 			GL_Bind (s->texinfo->texture->gltexture);
-			for (p = s->polys->next; p; p = p->next)
+			for (p = GL_SubdividedPolys (s); p; p = p->next)
 			{
 				DrawWaterPoly (p);
 				rs_brushpasses++;
 			}
 			rs_brushpasses++;
 		}
+		else if (R_WaterShaderActive ())
+		{
+			GL_Bind (s->texinfo->texture->gltexture);
+			R_BeginWaterShader ();
+			DrawGLPoly (s->polys);
+			R_EndWaterShader ();
+			rs_brushpasses++;
+		}
 		else
 		{
 			GL_Bind (s->texinfo->texture->warpimage);
@@ -642,7 +650,7 @@ void R_DrawBrushModel_ShowTris (entity_t *e)
 			(!(psurf->flags & SURF_PLANEBACK) && (dot > BACKFACE_EPSILON)))
 		{
 			if ((psurf->flags & SURF_DRAWTURB) && r_oldwater.value)
-				for (p = psurf->polys->next; p; p = p->next)
+				for (p = GL_SubdividedPolys (psurf); p; p = p->next)
 					DrawGLTriangleFan (p);
 			else
 				DrawGLTriangleFan (psurf->polys);
@@ -773,6 +781,20 @@ qmodel_t	*currentmodel;
 
 int	nColinElim;
 
+/*
+========================
+GL_FillSurfaceLightmap -- builds the lightmap of an already placed surface
+========================
+*/
+static void GL_FillSurfaceLightmap (msurface_t *surf)
+{
+	byte	*base;
+
+	base = lightmaps + surf->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
+	base += (surf->light_t * BLOCK_WIDTH + surf->light_s) * lightmap_bytes;
+	R_BuildLightMap (surf, base, BLOCK_WIDTH*lightmap_bytes);
+}
+
 /*
 ========================
 GL_CreateSurfaceLightmap
@@ -781,23 +803,21 @@ GL_CreateSurfaceLightmap
 void GL_CreateSurfaceLightmap (msurface_t *surf)
 {
 	int		smax, tmax;
-	byte	*base;
 
 	smax = (surf->extents[0]>>4)+1;
 	tmax = (surf->extents[1]>>4)+1;
 
 	surf->lightmaptexturenum = AllocBlock (smax, tmax, &surf->light_s, &surf->light_t);
-	base = lightmaps + surf->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
-	base += (surf->light_t * BLOCK_WIDTH + surf->light_s) * lightmap_bytes;
-	R_BuildLightMap (surf, base, BLOCK_WIDTH*lightmap_bytes);
+	GL_FillSurfaceLightmap (surf);
 }
 
 /*
 ================
-BuildSurfaceDisplayList -- called at level load time
+BuildSurfaceDisplayList -- called at level load time, on the load threads.
+fills in the poly GL_BuildLightmaps allocated.
 ================
 */
-void BuildSurfaceDisplayList (msurface_t *fa)
+static void BuildSurfaceDisplayList (qmodel_t *m, msurface_t *fa)
 {
 	int			i, lindex, lnumverts;
 	medge_t		*pedges, *r_pedge;
@@ -806,30 +826,27 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 	glpoly_t	*poly;
 
 // reconstruct the polygon
-	pedges = currentmodel->edges;
+	pedges = m->edges;
 	lnumverts = fa->numedges;
 
 	//
 	// draw texture
 	//
-	poly = (glpoly_t *) Hunk_Alloc (sizeof(glpoly_t) + (lnumverts-4) * VERTEXSIZE*sizeof(float));
-	poly->next = fa->polys;
-	fa->polys = poly;
-	poly->numverts = lnumverts;
+	poly = fa->polys;
 
 	for (i=0 ; i<lnumverts ; i++)
 	{
-		lindex = currentmodel->surfedges[fa->firstedge + i];
+		lindex = m->surfedges[fa->firstedge + i];
 
 		if (lindex > 0)
 		{
 			r_pedge = &pedges[lindex];
-			vec = r_pcurrentvertbase[r_pedge->v[0]].position;
+			vec = m->vertexes[r_pedge->v[0]].position;
 		}
 		else
 		{
 			r_pedge = &pedges[-lindex];
-			vec = r_pcurrentvertbase[r_pedge->v[1]].position;
+			vec = m->vertexes[r_pedge->v[1]].position;
 		}
 		s = DotProduct (vec, fa->texinfo->vecs[0]) + fa->texinfo->vecs[0][3];
 		s /= fa->texinfo->texture->width;
@@ -865,6 +882,24 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 	poly->numverts = lnumverts;
 }
 
+/*
+================
+R_BuildDisplayLists -- load job
+================
+*/
+static const char *R_BuildDisplayLists (int first, int last, void *data)
+{
+	qmodel_t	*m = (qmodel_t *)data;
+	int			i;
+
+	for (i=first ; i<last ; i++)
+	{
+		if (!(m->surfaces[i].flags & SURF_DRAWTILED))
+			BuildSurfaceDisplayList (m, m->surfaces + i);
+	}
+	return NULL;
+}
+
 /*
 ==================
 GL_BuildLightmaps -- called at level load time
@@ -878,7 +913,11 @@ void GL_BuildLightmaps (void)
 	char	name[16];
 	byte	*data;
 	int		i, j;
-	qmodel_t	*m;
+	qmodel_t	*m, *world;
+	msurface_t	*fa;
+	glpoly_t	*poly;
+	double	start;
+	int		*worldallocated, numworldlightmaps;
 
 	memset (allocated, 0, sizeof(allocated));
 	last_lightmap_allocated = 0;
@@ -904,6 +943,10 @@ void GL_BuildLightmaps (void)
 		Sys_Error ("GL_BuildLightmaps: bad lightmap format");
 	}
 
+	Mod_ProfileStage (NULL, &start);
+	world = NULL;
+	worldallocated = NULL;
+	numworldlightmaps = 0;
 	for (j=1 ; j<MAX_MODELS ; j++)
 	{
 		m = cl.model_precache[j];
@@ -913,15 +956,59 @@ void GL_BuildLightmaps (void)
 			continue;
 		r_pcurrentvertbase = m->vertexes;
 		currentmodel = m;
+
+		// the world goes first, so the blocks the bsp cache placed it in are still free
+		if (j == 1 && m->cachedlightmaps)
+		{
+			memcpy (allocated, m->cachedallocated, m->cachedlightmaps * sizeof(allocated[0]));
+			last_lightmap_allocated = m->cachedlightmaps - 1;
+			for (i=0 ; i<m->numsurfaces ; i++)
+			{
+				fa = m->surfaces + i;
+				if (!(fa->flags & SURF_DRAWTILED))
+					GL_FillSurfaceLightmap (fa);
+			}
+			continue;
+		}
+
 		for (i=0 ; i<m->numsurfaces ; i++)
 		{
 			//johnfitz -- rewritten to use SURF_DRAWTILED instead of the sky/water flags
-			if (m->surfaces[i].flags & SURF_DRAWTILED)
+			fa = m->surfaces + i;
+			if (fa->flags & SURF_DRAWTILED)
 				continue;
-			GL_CreateSurfaceLightmap (m->surfaces + i);
-			BuildSurfaceDisplayList (m->surfaces + i);
+			GL_CreateSurfaceLightmap (fa);
 			//johnfitz
+
+			// the verts are filled in on the load threads. a model loaded
+			// from the bsp cache already has its poly, just not its placement
+			if (fa->polys)
+				continue;
+			poly = (glpoly_t *) Hunk_Alloc (sizeof(glpoly_t) + (fa->numedges-4) * VERTEXSIZE*sizeof(float));
+			poly->next = fa->polys;
+			fa->polys = poly;
+			poly->numverts = fa->numedges;
 		}
+		Mod_QueueLoadJob ("display lists", R_BuildDisplayLists, m->numsurfaces, m);
+
+		if (j == 1 && !m->cacheloaded)
+		{
+			// allocator state after the world, for the bsp cache
+			world = m;
+			numworldlightmaps = last_lightmap_allocated + 1;
+			worldallocated = (int *) malloc (numworldlightmaps * sizeof(allocated[0]));
+			memcpy (worldallocated, allocated, numworldlightmaps * sizeof(allocated[0]));
+		}
+	}
+	Mod_ProfileStage ("lightmaps", &start);
+	Mod_RunLoadJobs ();
+	Mod_ProfileStage ("display lists", &start);
+
+	if (worldallocated)
+	{
+		Mod_WriteBSPCache (world, worldallocated, numworldlightmaps);
+		free (worldallocated);
+		Mod_ProfileStage ("bsp cache write", &start);
 	}
 
 	//
@@ -944,6 +1031,7 @@ void GL_BuildLightmaps (void)
 			 SRC_LIGHTMAP, data, "", (src_offset_t)data, TEXPREF_LINEAR | TEXPREF_NOPICMIP);
 		//johnfitz
 	}
+	Mod_ProfileStage ("lightmap upload", &start);
 
 	//johnfitz -- warn about exceeding old limits
 	if (i >= 64)
@@ -960,6 +1048,7 @@ void GL_BuildLightmaps (void)
 */
 
 GLuint gl_bmodel_vbo = 0;
+GLuint gl_bmodel_posvbo = 0; // positions only, same vertex order, for the depth prepass
 
 void GL_DeleteBModelVertexBuffer (void)
 {
@@ -967,7 +1056,9 @@ void GL_DeleteBModelVertexBuffer (void)
 		return;
 
 	GL_DeleteBuffersFunc (1, &gl_bmodel_vbo);
+	GL_DeleteBuffersFunc (1, &gl_bmodel_posvbo);
 	gl_bmodel_vbo = 0;
+	gl_bmodel_posvbo = 0;
 
 	GL_ClearBufferBindings ();
 }
@@ -977,15 +1068,16 @@ void GL_DeleteBModelVertexBuffer (void)
 GL_BuildBModelVertexBuffer
 
 Deletes gl_bmodel_vbo if it already exists, then rebuilds it with all
-surfaces from world + all brush models
+surfaces from world + all brush models. gl_bmodel_posvbo gets just the
+positions of the same verts.
 ==================
 */
 void GL_BuildBModelVertexBuffer (void)
 {
 	unsigned int	numverts, varray_bytes, varray_index;
-	int		i, j;
+	int		i, j, k;
 	qmodel_t	*m;
-	float		*varray;
+	float		*varray, *parray;
 
 	if (!(gl_vbo_able && gl_mtexable && gl_max_texture_units >= 3))
 		return;
@@ -993,6 +1085,8 @@ void GL_BuildBModelVertexBuffer (void)
 // ask GL for a name for our VBO
 	GL_DeleteBuffersFunc (1, &gl_bmodel_vbo);
 	GL_GenBuffersFunc (1, &gl_bmodel_vbo);
+	GL_DeleteBuffersFunc (1, &gl_bmodel_posvbo);
+	GL_GenBuffersFunc (1, &gl_bmodel_posvbo);
 	
 // count all verts in all models
 	numverts = 0;
@@ -1031,6 +1125,14 @@ void GL_BuildBModelVertexBuffer (void)
 // upload to GPU
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_vbo);
 	GL_BufferDataFunc (GL_ARRAY_BUFFER, varray_bytes, varray, GL_STATIC_DRAW);
+
+// positions only
+	parray = (float *) malloc (3 * sizeof(float) * numverts);
+	for (k=0 ; k<(int)numverts ; k++)
+		VectorCopy ((varray + VERTEXSIZE * k), (parray + 3 * k));
+	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_posvbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, 3 * sizeof(float) * numverts, parray, GL_STATIC_DRAW);
+	free (parray);
 	free (varray);
 	
 // invalidate the cached bindings
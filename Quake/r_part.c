@@ -23,26 +23,145 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
-#define MAX_PARTICLES			2048	// default max # of particles at one
+#define MAX_PARTICLES			65536	// default max # of particles at one
 										//  time
 #define ABSOLUTE_MIN_PARTICLES	512		// no fewer than this no matter what's
 										//  on the command line
+#define ABSOLUTE_MAX_PARTICLES	4194304	// no more than this either
+#define PARTICLE_GROWSIZE		1024	// smallest allocation for a group
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define USE_SSE_PARTICLES
+#include <xmmintrin.h>
+#endif
 
 int		ramp1[8] = {0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61};
 int		ramp2[8] = {0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66};
 int		ramp3[8] = {0x6d, 0x6b, 6, 5, 4, 3};
 
-particle_t	*active_particles, *free_particles, *particles;
+/*
+particles are kept as structure-of-arrays, one group per ptype_t, so the
+per-frame update runs straight through contiguous arrays with no branching
+on type.  dead particles are removed by moving the last one into their slot,
+so the order inside a group is not stable.
+*/
+typedef struct
+{
+	int		numparticles;
+	int		maxparticles;	// allocated size of the arrays below
+	float	*org[3];		// one array per axis
+	float	*vel[3];
+	float	*ramp;
+	float	*die;
+	byte	*color;
+	void	*base;			// single allocation holding all of the above
+} partgroup_t;
+
+static partgroup_t	partgroups[NUM_PARTICLE_TYPES];
 
 vec3_t			r_pright, r_pup, r_ppn;
 
-int			r_numparticles;
+int			r_numparticles;		// limit for all groups together
+static int	r_activeparticles;	// live particles in all groups together
+
+static void R_TimeParticles_f (void);
+static void R_CheckEmitters_f (void);
+
+/*
+emitters stand in for a whole effect whose particles only depend on their
+starting state and the time since they were spawned.  nothing is simulated
+on the CPU: the vertex shader evaluates every particle in closed form from
+the emitter record and a static table of random bytes.  the closed forms are
+the exact solutions of the per-frame updates in R_RunParticleGroups at a
+frame time of EMITTER_STEP, so both paths agree at that rate.
+*/
+typedef enum
+{
+	emit_explosion,		// pt_explode and pt_explode2, as R_ParticleExplosion
+	emit_lavasplash,	// pt_slowgrav, as R_LavaSplash
+	emit_telesplash		// pt_slowgrav, as R_TeleportSplash
+} emittertype_t;
+
+typedef struct
+{
+	emittertype_t	type;
+	vec3_t			org;
+	float			start;		// cl.time when spawned
+	float			life;		// longest any of its particles can live
+	int				count;		// number of particles
+	int				base;		// first row of r_emitterrandom used
+} partemitter_t;
+
+#define MAX_PARTICLE_EMITTERS	256
+#define MAX_EMITTER_PARTICLES	1024
+#define EMITTER_RANDOMROWS		(MAX_EMITTER_PARTICLES * 2)
+#define EMITTER_STEP			(1.0 / 72)
+
+static partemitter_t	emitters[MAX_PARTICLE_EMITTERS];
+static int				r_numemitters;
+static byte				r_emitterrandom[EMITTER_RANDOMROWS][8];
+
+cvar_t	r_gpuparticles = {"r_gpuparticles","0", CVAR_ARCHIVE};
 
 gltexture_t *particletexture, *particletexture1, *particletexture2, *particletexture3, *particletexture4; //johnfitz
+gltexture_t *particlepalette; // 256x1 copy of d_8to24table for the particle shader
 float texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
 
 cvar_t	r_particles = {"r_particles","1", CVAR_ARCHIVE}; //johnfitz
 cvar_t	r_quadparticles = {"r_quadparticles","1", CVAR_ARCHIVE}; //johnfitz
+cvar_t	r_instancedparticles = {"r_instancedparticles","1", CVAR_ARCHIVE};
+
+// instanced rendering: one billboard per particle, expanded in the vertex shader
+typedef struct
+{
+	float	org[3];
+	float	scale;
+	byte	color[4];		// only [0] is used, as a palette index
+} partinstance_t;
+
+static GLuint r_particle_program;
+
+// uniforms used in vert shader
+static GLuint upLoc;
+static GLuint rightLoc;
+static GLuint texScaleLoc;
+
+// uniforms used in frag shader
+static GLuint texLoc;
+static GLuint paletteLoc;
+
+static const GLint cornerAttrIndex = 0;
+static const GLint originAttrIndex = 1;
+static const GLint colorAttrIndex = 2;
+
+static GLuint r_particle_vbo;		// instance data, refilled every draw
+static GLuint r_particle_cornervbo;	// quad corners followed by triangle corners
+
+// emitters: one instance per particle index, everything else is uniforms
+static GLuint r_emitter_program;
+
+static GLuint emitTypeLoc;
+static GLuint emitOriginLoc;
+static GLuint emitTimeLoc;
+static GLuint emitGravityLoc;
+static GLuint emitStepLoc;
+static GLuint emitUpLoc;
+static GLuint emitRightLoc;
+static GLuint emitViewOrgLoc;
+static GLuint emitViewForwardLoc;
+static GLuint emitScaleLoc;
+static GLuint emitTexScaleLoc;
+static GLuint emitTexLoc;
+static GLuint emitPaletteLoc;
+
+static const GLint emitIndexAttrIndex = 1;
+static const GLint emitRandom0AttrIndex = 2;
+static const GLint emitRandom1AttrIndex = 3;
+
+static GLuint r_emitter_vbo;		// particle indices followed by r_emitterrandom
+
+static partinstance_t	*r_particle_instances;
+static int				r_maxparticleinstances;
 
 /*
 ===============
@@ -112,6 +231,9 @@ void R_InitParticleTextures (void)
 		}
 	particletexture3 = TexMgr_LoadImage (NULL, "particle3", 64, 64, SRC_RGBA, particle3_data, "", (src_offset_t)particle3_data, TEXPREF_PERSIST | TEXPREF_ALPHA | TEXPREF_LINEAR);
 
+	// palette lookup for instanced particles, which only carry a color index
+	particlepalette = TexMgr_LoadImage (NULL, "particlepalette", 256, 1, SRC_RGBA, (byte *)d_8to24table, "", (src_offset_t)d_8to24table, TEXPREF_PERSIST | TEXPREF_NEAREST | TEXPREF_NOPICMIP);
+
 	//set default
 	particletexture = particletexture1;
 	texturescalefactor = 1.27;
@@ -141,6 +263,280 @@ static void R_SetParticleTexture_f (cvar_t *var)
 	}
 }
 
+/*
+===============
+R_ResizeParticleGroup
+
+grows the arrays of a group so that at least newmax particles fit
+===============
+*/
+static qboolean R_ResizeParticleGroup (partgroup_t *g, int newmax)
+{
+	byte	*base;
+	float	*f;
+	int		i;
+
+	if (newmax <= g->maxparticles)
+		return true;
+
+	base = (byte *) malloc (newmax * (8 * sizeof(float) + 1));
+	if (!base)
+		return false;
+
+	f = (float *) base;
+	for (i=0 ; i<3 ; i++, f += newmax)
+	{
+		if (g->numparticles)
+			memcpy (f, g->org[i], g->numparticles * sizeof(float));
+		g->org[i] = f;
+	}
+	for (i=0 ; i<3 ; i++, f += newmax)
+	{
+		if (g->numparticles)
+			memcpy (f, g->vel[i], g->numparticles * sizeof(float));
+		g->vel[i] = f;
+	}
+	if (g->numparticles)
+	{
+		memcpy (f, g->ramp, g->numparticles * sizeof(float));
+		memcpy (f + newmax, g->die, g->numparticles * sizeof(float));
+		memcpy (f + newmax * 2, g->color, g->numparticles);
+	}
+	g->ramp = f;
+	g->die = f + newmax;
+	g->color = (byte *)(f + newmax * 2);
+
+	free (g->base);
+	g->base = base;
+	g->maxparticles = newmax;
+	return true;
+}
+
+/*
+===============
+R_FreeParticleGroup
+===============
+*/
+static void R_FreeParticleGroup (partgroup_t *g)
+{
+	free (g->base);
+	memset (g, 0, sizeof(*g));
+}
+
+/*
+===============
+R_StoreParticle
+
+appends a particle to a group that has room for it
+===============
+*/
+static void R_StoreParticle (partgroup_t *g, const particle_t *p)
+{
+	int		i;
+
+	i = g->numparticles++;
+	g->org[0][i] = p->org[0];
+	g->org[1][i] = p->org[1];
+	g->org[2][i] = p->org[2];
+	g->vel[0][i] = p->vel[0];
+	g->vel[1][i] = p->vel[1];
+	g->vel[2][i] = p->vel[2];
+	g->ramp[i] = p->ramp;
+	g->die[i] = p->die;
+	g->color[i] = (byte) p->color;
+}
+
+/*
+===============
+R_AddParticle
+
+copies a freshly spawned particle into the group for its type.
+returns false if the particle limit has been reached.
+===============
+*/
+static qboolean R_AddParticle (const particle_t *p)
+{
+	partgroup_t	*g;
+	int			i;
+
+	if (r_activeparticles >= r_numparticles)
+		return false;
+
+	g = &partgroups[p->type];
+	if (g->numparticles == g->maxparticles)
+	{
+		i = q_min (q_max (g->maxparticles * 2, PARTICLE_GROWSIZE), r_numparticles);
+		if (!R_ResizeParticleGroup (g, i))
+			return false;
+	}
+
+	R_StoreParticle (g, p);
+	r_activeparticles++;
+	return true;
+}
+
+/*
+===============
+R_AddEmitter
+
+records an effect to be evaluated on the GPU.  returns false if the effect
+has to be spawned as ordinary particles instead.
+===============
+*/
+static qboolean R_AddEmitter (emittertype_t type, vec3_t org)
+{
+	partemitter_t	*e;
+
+	if (!r_gpuparticles.value || !r_emitter_program)
+		return false;
+	if (r_numemitters == MAX_PARTICLE_EMITTERS)
+		return false;
+
+	e = &emitters[r_numemitters++];
+	e->type = type;
+	VectorCopy (org, e->org);
+	e->start = cl.time;
+	e->base = rand() % (EMITTER_RANDOMROWS - MAX_EMITTER_PARTICLES);
+
+	switch (type)
+	{
+	case emit_explosion:
+		e->count = 1024;
+		e->life = 0.8;	// pt_explode ramp from 0 to 8 at 10 per second
+		break;
+	case emit_lavasplash:
+		e->count = 32 * 32;
+		e->life = 2 + 31 * 0.02;
+		break;
+	case emit_telesplash:
+		e->count = 8 * 8 * 14;
+		e->life = 0.2 + 7 * 0.02;
+		break;
+	}
+
+	return true;
+}
+
+/*
+===============
+R_EmitterParticle
+
+starting state of particle i of an emitter, as the matching spawn function
+would produce it, with the random numbers taken from r_emitterrandom
+===============
+*/
+static void R_EmitterParticle (const partemitter_t *e, int i, particle_t *p)
+{
+	const byte	*rnd = r_emitterrandom[e->base + i];
+	vec3_t		dir;
+	int			j, ii, jj, kk;
+
+	p->die = e->start + e->life;
+	p->ramp = 0;
+
+	switch (e->type)
+	{
+	case emit_explosion:
+		p->type = (i & 1) ? pt_explode : pt_explode2;
+		p->color = ramp1[0];
+		p->ramp = rnd[6] & 3;
+		for (j=0 ; j<3 ; j++)
+			p->org[j] = e->org[j] + (rnd[j] & 31) - 16;
+		p->vel[0] = rnd[3] * 2 - 256;
+		p->vel[1] = rnd[4] * 2 - 256;
+		p->vel[2] = rnd[5] * 2 - 256;
+		return;
+
+	case emit_lavasplash:
+		ii = i / 32 - 16;
+		jj = i % 32 - 16;
+		dir[0] = jj*8 + (rnd[0] & 7);
+		dir[1] = ii*8 + (rnd[1] & 7);
+		dir[2] = 256;
+		p->org[0] = e->org[0] + dir[0];
+		p->org[1] = e->org[1] + dir[1];
+		p->org[2] = e->org[2] + (rnd[2] & 63);
+		p->die = e->start + 2 + (rnd[4] & 31) * 0.02;
+		p->color = 224 + (rnd[5] & 7);
+		break;
+
+	case emit_telesplash:
+		ii = (i / (8 * 14)) * 4 - 16;
+		jj = ((i / 14) % 8) * 4 - 16;
+		kk = (i % 14) * 4 - 24;
+		dir[0] = jj*8;
+		dir[1] = ii*8;
+		dir[2] = kk*8;
+		p->org[0] = e->org[0] + ii + (rnd[0] & 3);
+		p->org[1] = e->org[1] + jj + (rnd[1] & 3);
+		p->org[2] = e->org[2] + kk + (rnd[2] & 3);
+		p->die = e->start + 0.2 + (rnd[4] & 7) * 0.02;
+		p->color = 7 + (rnd[5] & 7);
+		break;
+	}
+
+	p->type = pt_slowgrav;
+	VectorNormalize (dir);
+	VectorScale (dir, 50 + (rnd[3] & 63), p->vel);
+}
+
+/*
+===============
+R_EvalEmitterParticle
+
+CPU reference for the emitter vertex shader; keep the two in sync.
+returns false if the particle is dead at time t after the emitter spawned.
+===============
+*/
+static qboolean R_EvalEmitterParticle (const partemitter_t *e, int i, float t, float gravity, vec3_t org, int *color)
+{
+	particle_t	p;
+	float		ramp, a, an;
+	int			n;
+
+	R_EmitterParticle (e, i, &p);
+	VectorCopy (p.org, org);
+	*color = p.color;
+
+	if (p.type == pt_slowgrav)
+	{
+		if (e->start + t > p.die)
+			return false;
+		VectorMA (org, t, p.vel, org);
+		org[2] -= gravity * t * (t - EMITTER_STEP) * 0.5;
+		return true;
+	}
+
+	if (p.type == pt_explode)
+	{
+		ramp = p.ramp + t * 10;
+		if (ramp >= 8)
+			return false;
+		n = (int)ramp;
+		*color = ramp1[n];
+		a = 1 + 4 * EMITTER_STEP;
+		an = pow (a, t / EMITTER_STEP);
+		org[0] += p.vel[0] * (an - 1) / 4;
+		org[1] += p.vel[1] * (an - 1) / 4;
+		org[2] += (p.vel[2] - gravity / 4) * (an - 1) / 4 + gravity * t / 4;
+	}
+	else
+	{
+		ramp = p.ramp + t * 15;
+		if (ramp >= 8)
+			return false;
+		n = (int)ramp;
+		*color = ramp2[n];
+		a = 1 - EMITTER_STEP;
+		an = pow (a, t / EMITTER_STEP);
+		org[0] += p.vel[0] * (1 - an);
+		org[1] += p.vel[1] * (1 - an);
+		org[2] += (p.vel[2] + gravity) * (1 - an) - gravity * t;
+	}
+
+	return true;
+}
+
 /*
 ===============
 R_InitParticles
@@ -157,18 +553,27 @@ void R_InitParticles (void)
 		r_numparticles = (int)(Q_atoi(com_argv[i+1]));
 		if (r_numparticles < ABSOLUTE_MIN_PARTICLES)
 			r_numparticles = ABSOLUTE_MIN_PARTICLES;
+		if (r_numparticles > ABSOLUTE_MAX_PARTICLES)
+			r_numparticles = ABSOLUTE_MAX_PARTICLES;
 	}
 	else
 	{
 		r_numparticles = MAX_PARTICLES;
 	}
 
-	particles = (particle_t *)
-			Hunk_AllocName (r_numparticles * sizeof(particle_t), "particles");
+	// group arrays are allocated on demand in R_AddParticle
+
+	for (i=0 ; i<EMITTER_RANDOMROWS * 8 ; i++)
+		r_emitterrandom[0][i] = rand() & 255;
 
 	Cvar_RegisterVariable (&r_particles); //johnfitz
 	Cvar_SetCallback (&r_particles, R_SetParticleTexture_f);
 	Cvar_RegisterVariable (&r_quadparticles); //johnfitz
+	Cvar_RegisterVariable (&r_instancedparticles);
+	Cvar_RegisterVariable (&r_gpuparticles);
+
+	Cmd_AddCommand ("timeparticles", R_TimeParticles_f);
+	Cmd_AddCommand ("checkemitters", R_CheckEmitters_f);
 
 	R_InitParticleTextures (); //johnfitz
 }
@@ -189,7 +594,7 @@ float	timescale = 0.01;
 void R_EntityParticles (entity_t *ent)
 {
 	int		i;
-	particle_t	*p;
+	particle_t	p;
 	float		angle;
 	float		sp, sy, cp, cy;
 //	float		sr, cr;
@@ -226,20 +631,18 @@ void R_EntityParticles (entity_t *ent)
 		forward[1] = cp*sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		p.die = cl.time + 0.01;
+		p.color = 0x6f;
+		p.ramp = 0;
+		p.type = pt_explode;
+		VectorCopy (vec3_origin, p.vel);
+
+		p.org[0] = ent->origin[0] + r_avertexnormals[i][0]*dist + forward[0]*beamlength;
+		p.org[1] = ent->origin[1] + r_avertexnormals[i][1]*dist + forward[1]*beamlength;
+		p.org[2] = ent->origin[2] + r_avertexnormals[i][2]*dist + forward[2]*beamlength;
+
+		if (!R_AddParticle (&p))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 0.01;
-		p->color = 0x6f;
-		p->type = pt_explode;
-
-		p->org[0] = ent->origin[0] + r_avertexnormals[i][0]*dist + forward[0]*beamlength;
-		p->org[1] = ent->origin[1] + r_avertexnormals[i][1]*dist + forward[1]*beamlength;
-		p->org[2] = ent->origin[2] + r_avertexnormals[i][2]*dist + forward[2]*beamlength;
 	}
 }
 
@@ -252,12 +655,10 @@ void R_ClearParticles (void)
 {
 	int		i;
 
-	free_particles = &particles[0];
-	active_particles = NULL;
-
-	for (i=0 ;i<r_numparticles ; i++)
-		particles[i].next = &particles[i+1];
-	particles[r_numparticles-1].next = NULL;
+	for (i=0 ; i<NUM_PARTICLE_TYPES ; i++)
+		partgroups[i].numparticles = 0;
+	r_activeparticles = 0;
+	r_numemitters = 0;
 }
 
 /*
@@ -271,7 +672,7 @@ void R_ReadPointFile_f (void)
 	vec3_t	org;
 	int		r;
 	int		c;
-	particle_t	*p;
+	particle_t	p;
 	char	name[MAX_QPATH];
 
 	if (cls.state != ca_connected)
@@ -295,21 +696,18 @@ void R_ReadPointFile_f (void)
 			break;
 		c++;
 
-		if (!free_particles)
+		p.die = 99999;
+		p.color = (-c)&15;
+		p.type = pt_static;
+		p.ramp = 0;
+		VectorCopy (vec3_origin, p.vel);
+		VectorCopy (org, p.org);
+
+		if (!R_AddParticle (&p))
 		{
 			Con_Printf ("Not enough free particles\n");
 			break;
 		}
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = 99999;
-		p->color = (-c)&15;
-		p->type = pt_static;
-		VectorCopy (vec3_origin, p->vel);
-		VectorCopy (org, p->org);
 	}
 
 	fclose (f);
@@ -351,38 +749,37 @@ R_ParticleExplosion
 void R_ParticleExplosion (vec3_t org)
 {
 	int			i, j;
-	particle_t	*p;
+	particle_t	p;
+
+	if (R_AddEmitter (emit_explosion, org))
+		return;
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
-			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 5;
-		p->color = ramp1[0];
-		p->ramp = rand()&3;
+		p.die = cl.time + 5;
+		p.color = ramp1[0];
+		p.ramp = rand()&3;
 		if (i & 1)
 		{
-			p->type = pt_explode;
+			p.type = pt_explode;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				p.org[j] = org[j] + ((rand()%32)-16);
+				p.vel[j] = (rand()%512)-256;
 			}
 		}
 		else
 		{
-			p->type = pt_explode2;
+			p.type = pt_explode2;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				p.org[j] = org[j] + ((rand()%32)-16);
+				p.vel[j] = (rand()%512)-256;
 			}
 		}
+
+		if (!R_AddParticle (&p))
+			return;
 	}
 }
 
@@ -394,28 +791,25 @@ R_ParticleExplosion2
 void R_ParticleExplosion2 (vec3_t org, int colorStart, int colorLength)
 {
 	int			i, j;
-	particle_t	*p;
+	particle_t	p;
 	int			colorMod = 0;
 
 	for (i=0; i<512; i++)
 	{
-		if (!free_particles)
-			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 0.3;
-		p->color = colorStart + (colorMod % colorLength);
+		p.die = cl.time + 0.3;
+		p.color = colorStart + (colorMod % colorLength);
 		colorMod++;
 
-		p->type = pt_blob;
+		p.type = pt_blob;
+		p.ramp = 0;
 		for (j=0 ; j<3 ; j++)
 		{
-			p->org[j] = org[j] + ((rand()%32)-16);
-			p->vel[j] = (rand()%512)-256;
+			p.org[j] = org[j] + ((rand()%32)-16);
+			p.vel[j] = (rand()%512)-256;
 		}
+
+		if (!R_AddParticle (&p))
+			return;
 	}
 }
 
@@ -427,39 +821,36 @@ R_BlobExplosion
 void R_BlobExplosion (vec3_t org)
 {
 	int			i, j;
-	particle_t	*p;
+	particle_t	p;
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
-			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 1 + (rand()&8)*0.05;
+		p.die = cl.time + 1 + (rand()&8)*0.05;
+		p.ramp = 0;
 
 		if (i & 1)
 		{
-			p->type = pt_blob;
-			p->color = 66 + rand()%6;
+			p.type = pt_blob;
+			p.color = 66 + rand()%6;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				p.org[j] = org[j] + ((rand()%32)-16);
+				p.vel[j] = (rand()%512)-256;
 			}
 		}
 		else
 		{
-			p->type = pt_blob2;
-			p->color = 150 + rand()%6;
+			p.type = pt_blob2;
+			p.color = 150 + rand()%6;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				p.org[j] = org[j] + ((rand()%32)-16);
+				p.vel[j] = (rand()%512)-256;
 			}
 		}
+
+		if (!R_AddParticle (&p))
+			return;
 	}
 }
 
@@ -471,52 +862,52 @@ R_RunParticleEffect
 void R_RunParticleEffect (vec3_t org, vec3_t dir, int color, int count)
 {
 	int			i, j;
-	particle_t	*p;
+	particle_t	p;
+
+	if (count == 1024 && R_AddEmitter (emit_explosion, org))
+		return;
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
-			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		if (count == 1024)
 		{	// rocket explosion
-			p->die = cl.time + 5;
-			p->color = ramp1[0];
-			p->ramp = rand()&3;
+			p.die = cl.time + 5;
+			p.color = ramp1[0];
+			p.ramp = rand()&3;
 			if (i & 1)
 			{
-				p->type = pt_explode;
+				p.type = pt_explode;
 				for (j=0 ; j<3 ; j++)
 				{
-					p->org[j] = org[j] + ((rand()%32)-16);
-					p->vel[j] = (rand()%512)-256;
+					p.org[j] = org[j] + ((rand()%32)-16);
+					p.vel[j] = (rand()%512)-256;
 				}
 			}
 			else
 			{
-				p->type = pt_explode2;
+				p.type = pt_explode2;
 				for (j=0 ; j<3 ; j++)
 				{
-					p->org[j] = org[j] + ((rand()%32)-16);
-					p->vel[j] = (rand()%512)-256;
+					p.org[j] = org[j] + ((rand()%32)-16);
+					p.vel[j] = (rand()%512)-256;
 				}
 			}
 		}
 		else
 		{
-			p->die = cl.time + 0.1*(rand()%5);
-			p->color = (color&~7) + (rand()&7);
-			p->type = pt_slowgrav;
+			p.die = cl.time + 0.1*(rand()%5);
+			p.color = (color&~7) + (rand()&7);
+			p.type = pt_slowgrav;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()&15)-8);
-				p->vel[j] = dir[j]*15;// + (rand()%300)-150;
+				p.org[j] = org[j] + ((rand()&15)-8);
+				p.vel[j] = dir[j]*15;// + (rand()%300)-150;
 			}
+			p.ramp = 0;
 		}
+
+		if (!R_AddParticle (&p))
+			return;
 	}
 }
 
@@ -528,36 +919,36 @@ R_LavaSplash
 void R_LavaSplash (vec3_t org)
 {
 	int			i, j, k;
-	particle_t	*p;
+	particle_t	p;
 	float		vel;
 	vec3_t		dir;
 
+	if (R_AddEmitter (emit_lavasplash, org))
+		return;
+
 	for (i=-16 ; i<16 ; i++)
 		for (j=-16 ; j<16 ; j++)
 			for (k=0 ; k<1 ; k++)
 			{
-				if (!free_particles)
-					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
-
-				p->die = cl.time + 2 + (rand()&31) * 0.02;
-				p->color = 224 + (rand()&7);
-				p->type = pt_slowgrav;
+				p.die = cl.time + 2 + (rand()&31) * 0.02;
+				p.color = 224 + (rand()&7);
+				p.type = pt_slowgrav;
+				p.ramp = 0;
 
 				dir[0] = j*8 + (rand()&7);
 				dir[1] = i*8 + (rand()&7);
 				dir[2] = 256;
 
-				p->org[0] = org[0] + dir[0];
-				p->org[1] = org[1] + dir[1];
-				p->org[2] = org[2] + (rand()&63);
+				p.org[0] = org[0] + dir[0];
+				p.org[1] = org[1] + dir[1];
+				p.org[2] = org[2] + (rand()&63);
 
 				VectorNormalize (dir);
 				vel = 50 + (rand()&63);
-				VectorScale (dir, vel, p->vel);
+				VectorScale (dir, vel, p.vel);
+
+				if (!R_AddParticle (&p))
+					return;
 			}
 }
 
@@ -569,36 +960,36 @@ R_TeleportSplash
 void R_TeleportSplash (vec3_t org)
 {
 	int			i, j, k;
-	particle_t	*p;
+	particle_t	p;
 	float		vel;
 	vec3_t		dir;
 
+	if (R_AddEmitter (emit_telesplash, org))
+		return;
+
 	for (i=-16 ; i<16 ; i+=4)
 		for (j=-16 ; j<16 ; j+=4)
 			for (k=-24 ; k<32 ; k+=4)
 			{
-				if (!free_particles)
-					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
-
-				p->die = cl.time + 0.2 + (rand()&7) * 0.02;
-				p->color = 7 + (rand()&7);
-				p->type = pt_slowgrav;
+				p.die = cl.time + 0.2 + (rand()&7) * 0.02;
+				p.color = 7 + (rand()&7);
+				p.type = pt_slowgrav;
+				p.ramp = 0;
 
 				dir[0] = j*8;
 				dir[1] = i*8;
 				dir[2] = k*8;
 
-				p->org[0] = org[0] + i + (rand()&3);
-				p->org[1] = org[1] + j + (rand()&3);
-				p->org[2] = org[2] + k + (rand()&3);
+				p.org[0] = org[0] + i + (rand()&3);
+				p.org[1] = org[1] + j + (rand()&3);
+				p.org[2] = org[2] + k + (rand()&3);
 
 				VectorNormalize (dir);
 				vel = 50 + (rand()&63);
-				VectorScale (dir, vel, p->vel);
+				VectorScale (dir, vel, p.vel);
+
+				if (!R_AddParticle (&p))
+					return;
 			}
 }
 
@@ -614,7 +1005,7 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 	vec3_t		vec;
 	float		len;
 	int			j;
-	particle_t	*p;
+	particle_t	p;
 	int			dec;
 	static int	tracercount;
 
@@ -632,202 +1023,773 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 	{
 		len -= dec;
 
-		if (!free_particles)
-			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		VectorCopy (vec3_origin, p->vel);
-		p->die = cl.time + 2;
+		VectorCopy (vec3_origin, p.vel);
+		p.die = cl.time + 2;
+		p.ramp = 0;
 
 		switch (type)
 		{
 			case 0:	// rocket trail
-				p->ramp = (rand()&3);
-				p->color = ramp3[(int)p->ramp];
-				p->type = pt_fire;
+				p.ramp = (rand()&3);
+				p.color = ramp3[(int)p.ramp];
+				p.type = pt_fire;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					p.org[j] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 1:	// smoke smoke
-				p->ramp = (rand()&3) + 2;
-				p->color = ramp3[(int)p->ramp];
-				p->type = pt_fire;
+				p.ramp = (rand()&3) + 2;
+				p.color = ramp3[(int)p.ramp];
+				p.type = pt_fire;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					p.org[j] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 2:	// blood
-				p->type = pt_grav;
-				p->color = 67 + (rand()&3);
+				p.type = pt_grav;
+				p.color = 67 + (rand()&3);
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					p.org[j] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 3:
 			case 5:	// tracer
-				p->die = cl.time + 0.5;
-				p->type = pt_static;
+				p.die = cl.time + 0.5;
+				p.type = pt_static;
 				if (type == 3)
-					p->color = 52 + ((tracercount&4)<<1);
+					p.color = 52 + ((tracercount&4)<<1);
 				else
-					p->color = 230 + ((tracercount&4)<<1);
+					p.color = 230 + ((tracercount&4)<<1);
 
 				tracercount++;
 
-				VectorCopy (start, p->org);
+				VectorCopy (start, p.org);
 				if (tracercount & 1)
 				{
-					p->vel[0] = 30*vec[1];
-					p->vel[1] = 30*-vec[0];
+					p.vel[0] = 30*vec[1];
+					p.vel[1] = 30*-vec[0];
 				}
 				else
 				{
-					p->vel[0] = 30*-vec[1];
-					p->vel[1] = 30*vec[0];
+					p.vel[0] = 30*-vec[1];
+					p.vel[1] = 30*vec[0];
 				}
 				break;
 
 			case 4:	// slight blood
-				p->type = pt_grav;
-				p->color = 67 + (rand()&3);
+				p.type = pt_grav;
+				p.color = 67 + (rand()&3);
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					p.org[j] = start[j] + ((rand()%6)-3);
 				len -= 3;
 				break;
 
 			case 6:	// voor trail
-				p->color = 9*16 + 8 + (rand()&3);
-				p->type = pt_static;
-				p->die = cl.time + 0.3;
+				p.color = 9*16 + 8 + (rand()&3);
+				p.type = pt_static;
+				p.die = cl.time + 0.3;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()&15)-8);
+					p.org[j] = start[j] + ((rand()&15)-8);
 				break;
+
+			default:
+				return;
 		}
 
+		if (!R_AddParticle (&p))
+			return;
+
 		VectorAdd (start, vec, start);
 	}
 }
 
 /*
 ===============
-CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
+R_KillParticles
+
+removes particles that died before time by moving the last particle of the
+group into their slot.  returns the number of particles removed.
 ===============
 */
-void CL_RunParticles (void)
+static int R_KillParticles (partgroup_t *g, double time)
 {
-	particle_t		*p, *kill;
-	int				i;
-	float			time1, time2, time3, dvel, frametime, grav;
-	extern	cvar_t	sv_gravity;
-
-	frametime = cl.time - cl.oldtime;
-	time3 = frametime * 15;
-	time2 = frametime * 10;
-	time1 = frametime * 5;
-	grav = frametime * sv_gravity.value * 0.05;
-	dvel = 4*frametime;
+	int		i, last, killed;
 
-	for ( ;; )
+	killed = 0;
+	for (i=0 ; i<g->numparticles ; )
 	{
-		kill = active_particles;
-		if (kill && kill->die < cl.time)
+		if (g->die[i] >= time)
 		{
-			active_particles = kill->next;
-			kill->next = free_particles;
-			free_particles = kill;
+			i++;
 			continue;
 		}
-		break;
-	}
-
-	for (p=active_particles ; p ; p=p->next)
-	{
-		for ( ;; )
-		{
-			kill = p->next;
-			if (kill && kill->die < cl.time)
-			{
-				p->next = kill->next;
-				kill->next = free_particles;
-				free_particles = kill;
-				continue;
-			}
-			break;
-		}
-
-		p->org[0] += p->vel[0]*frametime;
-		p->org[1] += p->vel[1]*frametime;
-		p->org[2] += p->vel[2]*frametime;
 
-		switch (p->type)
-		{
-		case pt_static:
-			break;
-		case pt_fire:
-			p->ramp += time1;
-			if (p->ramp >= 6)
-				p->die = -1;
-			else
-				p->color = ramp3[(int)p->ramp];
-			p->vel[2] += grav;
-			break;
+		last = --g->numparticles;
+		g->org[0][i] = g->org[0][last];
+		g->org[1][i] = g->org[1][last];
+		g->org[2][i] = g->org[2][last];
+		g->vel[0][i] = g->vel[0][last];
+		g->vel[1][i] = g->vel[1][last];
+		g->vel[2][i] = g->vel[2][last];
+		g->ramp[i] = g->ramp[last];
+		g->die[i] = g->die[last];
+		g->color[i] = g->color[last];
+		killed++;
+	}
 
-		case pt_explode:
-			p->ramp += time2;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp1[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	return killed;
+}
 
-		case pt_explode2:
-			p->ramp += time3;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp2[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] -= p->vel[i]*frametime;
-			p->vel[2] -= grav;
-			break;
+/*
+===============
+R_MoveParticles
 
-		case pt_blob:
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+org += vel * frametime
+===============
+*/
+static void R_MoveParticles (partgroup_t *g, float frametime)
+{
+	int		i, j, n;
+	float	*org, *vel;
 
-		case pt_blob2:
-			for (i=0 ; i<2 ; i++)
-				p->vel[i] -= p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	n = g->numparticles;
+	for (j=0 ; j<3 ; j++)
+	{
+		org = g->org[j];
+		vel = g->vel[j];
+		i = 0;
+#ifdef USE_SSE_PARTICLES
+		{
+			__m128	ft = _mm_set1_ps (frametime);
 
-		case pt_grav:
-		case pt_slowgrav:
-			p->vel[2] -= grav;
-			break;
+			for ( ; i + 4 <= n ; i += 4)
+				_mm_storeu_ps (org + i, _mm_add_ps (_mm_loadu_ps (org + i), _mm_mul_ps (_mm_loadu_ps (vel + i), ft)));
 		}
+#endif
+		for ( ; i < n ; i++)
+			org[i] += vel[i] * frametime;
 	}
 }
 
 /*
 ===============
-R_DrawParticles -- johnfitz -- moved all non-drawing code to CL_RunParticles
+R_AccelParticles
+
+vel[0,1] *= scalexy, vel[2] = vel[2] * scalez + addz
 ===============
 */
-void R_DrawParticles (void)
+static void R_AccelParticles (partgroup_t *g, float scalexy, float scalez, float addz)
 {
-	particle_t		*p;
+	int		i, j, n;
+	float	*vel;
+
+	n = g->numparticles;
+	if (scalexy != 1)
+	{
+		for (j=0 ; j<2 ; j++)
+		{
+			vel = g->vel[j];
+			i = 0;
+#ifdef USE_SSE_PARTICLES
+			{
+				__m128	s = _mm_set1_ps (scalexy);
+
+				for ( ; i + 4 <= n ; i += 4)
+					_mm_storeu_ps (vel + i, _mm_mul_ps (_mm_loadu_ps (vel + i), s));
+			}
+#endif
+			for ( ; i < n ; i++)
+				vel[i] *= scalexy;
+		}
+	}
+
+	vel = g->vel[2];
+	i = 0;
+#ifdef USE_SSE_PARTICLES
+	{
+		__m128	s = _mm_set1_ps (scalez);
+		__m128	a = _mm_set1_ps (addz);
+
+		for ( ; i + 4 <= n ; i += 4)
+			_mm_storeu_ps (vel + i, _mm_add_ps (_mm_mul_ps (_mm_loadu_ps (vel + i), s), a));
+	}
+#endif
+	for ( ; i < n ; i++)
+		vel[i] = vel[i] * scalez + addz;
+}
+
+/*
+===============
+R_RampParticles
+
+advances the color ramp, killing particles that run off the end of it
+===============
+*/
+static void R_RampParticles (partgroup_t *g, float step, float limit, const int *ramp)
+{
+	int		i, n;
+	float	r;
+
+	n = g->numparticles;
+	for (i=0 ; i<n ; i++)
+	{
+		r = g->ramp[i] += step;
+		if (r >= limit)
+			g->die[i] = -1;
+		else
+			g->color[i] = ramp[(int)r];
+	}
+}
+
+/*
+===============
+R_RunParticleGroups
+
+removes dead particles and moves the rest.  returns the number removed.
+===============
+*/
+static int R_RunParticleGroups (partgroup_t *groups, double time, float frametime, float grav)
+{
+	partgroup_t	*g;
+	int			t, killed;
+	float		dvel;
+
+	dvel = 4*frametime;
+	killed = 0;
+
+	for (t=0 ; t<NUM_PARTICLE_TYPES ; t++)
+	{
+		g = &groups[t];
+		killed += R_KillParticles (g, time);
+		if (!g->numparticles)
+			continue;
+
+		R_MoveParticles (g, frametime);
+
+		switch (t)
+		{
+		case pt_static:
+			break;
+		case pt_fire:
+			R_RampParticles (g, frametime * 5, 6, ramp3);
+			R_AccelParticles (g, 1, 1, grav);
+			break;
+		case pt_explode:
+			R_RampParticles (g, frametime * 10, 8, ramp1);
+			R_AccelParticles (g, 1 + dvel, 1 + dvel, -grav);
+			break;
+		case pt_explode2:
+			R_RampParticles (g, frametime * 15, 8, ramp2);
+			R_AccelParticles (g, 1 - frametime, 1 - frametime, -grav);
+			break;
+		case pt_blob:
+			R_AccelParticles (g, 1 + dvel, 1 + dvel, -grav);
+			break;
+		case pt_blob2:
+			R_AccelParticles (g, 1 - dvel, 1, -grav);
+			break;
+		case pt_grav:
+		case pt_slowgrav:
+			R_AccelParticles (g, 1, 1, -grav);
+			break;
+		}
+	}
+
+	return killed;
+}
+
+/*
+===============
+CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
+===============
+*/
+void CL_RunParticles (void)
+{
+	int				i;
+	float			frametime, grav;
+	extern	cvar_t	sv_gravity;
+
+	frametime = cl.time - cl.oldtime;
+	grav = frametime * sv_gravity.value * 0.05;
+
+	r_activeparticles -= R_RunParticleGroups (partgroups, cl.time, frametime, grav);
+
+	for (i=0 ; i<r_numemitters ; )
+	{
+		if (cl.time - emitters[i].start > emitters[i].life || cl.time < emitters[i].start)
+			emitters[i] = emitters[--r_numemitters];
+		else
+			i++;
+	}
+}
+
+/*
+=============
+GLParticle_CreateShaders
+=============
+*/
+void GLParticle_CreateShaders (void)
+{
+	const glsl_attrib_binding_t bindings[] = {
+		{ "Corner", cornerAttrIndex },
+		{ "Origin", originAttrIndex },
+		{ "Color", colorAttrIndex }
+	};
+
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 Up;\n"
+		"uniform vec3 Right;\n"
+		"uniform float TexScale;\n"
+		"attribute vec2 Corner;\n"
+		"attribute vec4 Origin; // w is the scale \n"
+		"attribute vec4 Color; // x is the palette index \n"
+		"varying float PaletteCoord;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 pos = vec4(Origin.xyz + (Corner.x * Up + Corner.y * Right) * Origin.w, 1.0);\n"
+		"	gl_TexCoord[0] = vec4(Corner * TexScale, 0.0, 0.0);\n"
+		"	PaletteCoord = (Color.x + 0.5) / 256.0;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * pos;\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * pos);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Tex;\n"
+		"uniform sampler2D Palette;\n"
+		"varying float PaletteCoord;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 result = texture2D(Tex, gl_TexCoord[0].xy);\n"
+		"	result.rgb *= texture2D(Palette, vec2(PaletteCoord, 0.5)).rgb;\n"
+		"	// apply GL_EXP2 fog (from the orange book)\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * gl_FogFragCoord * gl_FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result.rgb = mix(gl_Fog.color.rgb, result.rgb, fog);\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	const glsl_attrib_binding_t emitterBindings[] = {
+		{ "Corner", cornerAttrIndex },
+		{ "Index", emitIndexAttrIndex },
+		{ "Random0", emitRandom0AttrIndex },
+		{ "Random1", emitRandom1AttrIndex }
+	};
+
+	// must match R_EmitterParticle and R_EvalEmitterParticle
+	const GLchar *emitterVertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform int Type;\n"
+		"uniform vec3 Origin;\n"
+		"uniform float Time;\n"
+		"uniform float Gravity;\n"
+		"uniform float Step;\n"
+		"uniform vec3 Up;\n"
+		"uniform vec3 Right;\n"
+		"uniform vec3 ViewOrg;\n"
+		"uniform vec3 ViewForward;\n"
+		"uniform float Scale;\n"
+		"uniform float TexScale;\n"
+		"attribute vec2 Corner;\n"
+		"attribute float Index;\n"
+		"attribute vec4 Random0; // unnormalized bytes \n"
+		"attribute vec4 Random1;\n"
+		"varying float PaletteCoord;\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 org, vel, dir;\n"
+		"	float color, ramp, a, an;\n"
+		"	bool alive;\n"
+		"	if (Type == 0)\n"
+		"	{\n"
+		"		org = Origin + mod(Random0.xyz, 32.0) - 16.0;\n"
+		"		vel = vec3(Random0.w, Random1.xy) * 2.0 - 256.0;\n"
+		"		if (mod(Index, 2.0) == 1.0) // pt_explode \n"
+		"		{\n"
+		"			ramp = mod(Random1.z, 4.0) + Time * 10.0;\n"
+		"			color = 111.0 - 2.0 * floor(ramp);\n"
+		"			a = 1.0 + 4.0 * Step;\n"
+		"			an = pow(a, Time / Step);\n"
+		"			org.xy += vel.xy * (an - 1.0) / 4.0;\n"
+		"			org.z += (vel.z - Gravity / 4.0) * (an - 1.0) / 4.0 + Gravity * Time / 4.0;\n"
+		"		}\n"
+		"		else // pt_explode2 \n"
+		"		{\n"
+		"			ramp = mod(Random1.z, 4.0) + Time * 15.0;\n"
+		"			color = 111.0 - floor(ramp) - max(floor(ramp) - 5.0, 0.0);\n"
+		"			a = 1.0 - Step;\n"
+		"			an = pow(a, Time / Step);\n"
+		"			org.xy += vel.xy * (1.0 - an);\n"
+		"			org.z += (vel.z + Gravity) * (1.0 - an) - Gravity * Time;\n"
+		"		}\n"
+		"		alive = ramp < 8.0;\n"
+		"	}\n"
+		"	else // pt_slowgrav splashes \n"
+		"	{\n"
+		"		if (Type == 1)\n"
+		"		{\n"
+		"			float i = floor(Index / 32.0) - 16.0;\n"
+		"			float j = mod(Index, 32.0) - 16.0;\n"
+		"			dir = vec3(j * 8.0 + mod(Random0.x, 8.0), i * 8.0 + mod(Random0.y, 8.0), 256.0);\n"
+		"			org = Origin + vec3(dir.xy, mod(Random0.z, 64.0));\n"
+		"			alive = Time <= 2.0 + mod(Random1.x, 32.0) * 0.02;\n"
+		"			color = 224.0 + mod(Random1.y, 8.0);\n"
+		"		}\n"
+		"		else\n"
+		"		{\n"
+		"			float i = floor(Index / 112.0) * 4.0 - 16.0;\n"
+		"			float j = mod(floor(Index / 14.0), 8.0) * 4.0 - 16.0;\n"
+		"			float k = mod(Index, 14.0) * 4.0 - 24.0;\n"
+		"			dir = vec3(j, i, k) * 8.0;\n"
+		"			org = Origin + vec3(i, j, k) + mod(Random0.xyz, 4.0);\n"
+		"			alive = Time <= 0.2 + mod(Random1.x, 8.0) * 0.02;\n"
+		"			color = 7.0 + mod(Random1.y, 8.0);\n"
+		"		}\n"
+		"		vel = vec3(0.0);\n"
+		"		if (dot(dir, dir) > 0.0)\n"
+		"			vel = normalize(dir) * (50.0 + mod(Random0.w, 64.0));\n"
+		"		org += vel * Time;\n"
+		"		org.z -= Gravity * Time * (Time - Step) * 0.5;\n"
+		"	}\n"
+		"	if (!alive)\n"
+		"	{\n"
+		"		gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // outside the view volume \n"
+		"		return;\n"
+		"	}\n"
+		"	// hack a scale up to keep particles from disapearing \n"
+		"	float scale = dot(org - ViewOrg, ViewForward);\n"
+		"	scale = (scale < 20.0) ? 1.08 : 1.0 + scale * 0.004;\n"
+		"	vec4 pos = vec4(org + (Corner.x * Up + Corner.y * Right) * scale * Scale, 1.0);\n"
+		"	gl_TexCoord[0] = vec4(Corner * TexScale, 0.0, 0.0);\n"
+		"	PaletteCoord = (color + 0.5) / 256.0;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * pos;\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * pos);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	if (!gl_instancing_able || !gl_mtexable)
+		return;
+
+	r_particle_program = GL_CreateProgram (vertSource, fragSource, sizeof(bindings)/sizeof(bindings[0]), bindings);
+
+	if (r_particle_program != 0)
+	{
+	// get uniform locations
+		upLoc = GL_GetUniformLocation (&r_particle_program, "Up");
+		rightLoc = GL_GetUniformLocation (&r_particle_program, "Right");
+		texScaleLoc = GL_GetUniformLocation (&r_particle_program, "TexScale");
+		texLoc = GL_GetUniformLocation (&r_particle_program, "Tex");
+		paletteLoc = GL_GetUniformLocation (&r_particle_program, "Palette");
+	}
+
+	r_emitter_program = GL_CreateProgram (emitterVertSource, fragSource, sizeof(emitterBindings)/sizeof(emitterBindings[0]), emitterBindings);
+
+	if (r_emitter_program != 0)
+	{
+	// get uniform locations
+		emitTypeLoc = GL_GetUniformLocation (&r_emitter_program, "Type");
+		emitOriginLoc = GL_GetUniformLocation (&r_emitter_program, "Origin");
+		emitTimeLoc = GL_GetUniformLocation (&r_emitter_program, "Time");
+		emitGravityLoc = GL_GetUniformLocation (&r_emitter_program, "Gravity");
+		emitStepLoc = GL_GetUniformLocation (&r_emitter_program, "Step");
+		emitUpLoc = GL_GetUniformLocation (&r_emitter_program, "Up");
+		emitRightLoc = GL_GetUniformLocation (&r_emitter_program, "Right");
+		emitViewOrgLoc = GL_GetUniformLocation (&r_emitter_program, "ViewOrg");
+		emitViewForwardLoc = GL_GetUniformLocation (&r_emitter_program, "ViewForward");
+		emitScaleLoc = GL_GetUniformLocation (&r_emitter_program, "Scale");
+		emitTexScaleLoc = GL_GetUniformLocation (&r_emitter_program, "TexScale");
+		emitTexLoc = GL_GetUniformLocation (&r_emitter_program, "Tex");
+		emitPaletteLoc = GL_GetUniformLocation (&r_emitter_program, "Palette");
+	}
+	else
+	{
+		r_numemitters = 0;
+	}
+}
+
+/*
+=============
+GL_DeleteParticleVertexBuffers
+=============
+*/
+void GL_DeleteParticleVertexBuffers (void)
+{
+	if (!gl_instancing_able)
+		return;
+
+	GL_DeleteBuffersFunc (1, &r_particle_vbo);
+	GL_DeleteBuffersFunc (1, &r_particle_cornervbo);
+	GL_DeleteBuffersFunc (1, &r_emitter_vbo);
+	r_particle_vbo = 0;
+	r_particle_cornervbo = 0;
+	r_emitter_vbo = 0;
+
+	GL_ClearBufferBindings ();
+}
+
+/*
+===============
+R_ParticleScale
+
+hack a scale up to keep particles from disapearing
+===============
+*/
+static float R_ParticleScale (const vec3_t org)
+{
+	float	scale;
+
+	scale = (org[0] - r_origin[0]) * vpn[0]
+		  + (org[1] - r_origin[1]) * vpn[1]
+		  + (org[2] - r_origin[2]) * vpn[2];
+	if (scale < 20)
+		scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
+	else
+		scale = 1 + scale * 0.004;
+
+	return scale * texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+}
+
+/*
+===============
+R_BindParticleCorners
+
+binds the billboard corner buffer, creating it if needed
+===============
+*/
+static void R_BindParticleCorners (void)
+{
+	static const float corners[7][2] = {
+		{0,0}, {1,0}, {1,1}, {0,1},	// GL_TRIANGLE_FAN quad
+		{0,0}, {1,0}, {0,1}			// GL_TRIANGLES
+	};
+
+	if (!r_particle_cornervbo)
+	{
+		GL_GenBuffersFunc (1, &r_particle_cornervbo);
+		GL_BindBuffer (GL_ARRAY_BUFFER, r_particle_cornervbo);
+		GL_BufferDataFunc (GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	}
+	else
+		GL_BindBuffer (GL_ARRAY_BUFFER, r_particle_cornervbo);
+}
+
+/*
+===============
+R_DrawEmitters
+
+one instanced draw per emitter; only the uniforms change between them
+===============
+*/
+static void R_DrawEmitters (vec3_t up, vec3_t right)
+{
+	partemitter_t	*e;
+	int				i, rowofs;
+	qboolean		quads;
+	float			gravity;
+	extern	cvar_t	sv_gravity;
+
+	if (!r_emitter_vbo)
+	{
+		float	indices[MAX_EMITTER_PARTICLES];
+
+		for (i=0 ; i<MAX_EMITTER_PARTICLES ; i++)
+			indices[i] = i;
+
+		GL_GenBuffersFunc (1, &r_emitter_vbo);
+		GL_BindBuffer (GL_ARRAY_BUFFER, r_emitter_vbo);
+		GL_BufferDataFunc (GL_ARRAY_BUFFER, sizeof(indices) + sizeof(r_emitterrandom), NULL, GL_STATIC_DRAW);
+		GL_BufferSubDataFunc (GL_ARRAY_BUFFER, 0, sizeof(indices), indices);
+		GL_BufferSubDataFunc (GL_ARRAY_BUFFER, sizeof(indices), sizeof(r_emitterrandom), r_emitterrandom);
+	}
+
+	quads = r_quadparticles.value ? true : false;
+	gravity = sv_gravity.value * 0.05;
+	rowofs = MAX_EMITTER_PARTICLES * sizeof(float);
+
+	GL_UseProgramFunc (r_emitter_program);
+
+	GL_EnableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_EnableVertexAttribArrayFunc (emitIndexAttrIndex);
+	GL_EnableVertexAttribArrayFunc (emitRandom0AttrIndex);
+	GL_EnableVertexAttribArrayFunc (emitRandom1AttrIndex);
+	GL_VertexAttribDivisorFunc (emitIndexAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (emitRandom0AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (emitRandom1AttrIndex, 1);
+
+	R_BindParticleCorners ();
+	GL_VertexAttribPointerFunc (cornerAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, r_emitter_vbo);
+	GL_VertexAttribPointerFunc (emitIndexAttrIndex, 1, GL_FLOAT, GL_FALSE, 0, (void *)0);
+
+// set uniforms
+	GL_Uniform1fFunc (emitGravityLoc, gravity);
+	GL_Uniform1fFunc (emitStepLoc, EMITTER_STEP);
+	GL_Uniform3fFunc (emitUpLoc, up[0], up[1], up[2]);
+	GL_Uniform3fFunc (emitRightLoc, right[0], right[1], right[2]);
+	GL_Uniform3fFunc (emitViewOrgLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform3fFunc (emitViewForwardLoc, vpn[0], vpn[1], vpn[2]);
+	GL_Uniform1fFunc (emitScaleLoc, quads ? texturescalefactor / 2 : texturescalefactor);
+	GL_Uniform1fFunc (emitTexScaleLoc, quads ? 0.5 : 1.0);
+	GL_Uniform1iFunc (emitTexLoc, 0);
+	GL_Uniform1iFunc (emitPaletteLoc, 1);
+
+// set textures
+	GL_SelectTexture (GL_TEXTURE1);
+	GL_Bind (particlepalette);
+	GL_SelectTexture (GL_TEXTURE0);
+
+// draw
+	for (i=0, e=emitters ; i<r_numemitters ; i++, e++)
+	{
+		GL_VertexAttribPointerFunc (emitRandom0AttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, 8, (void *)(intptr_t)(rowofs + e->base * 8));
+		GL_VertexAttribPointerFunc (emitRandom1AttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, 8, (void *)(intptr_t)(rowofs + e->base * 8 + 4));
+
+		GL_Uniform1iFunc (emitTypeLoc, e->type);
+		GL_Uniform3fFunc (emitOriginLoc, e->org[0], e->org[1], e->org[2]);
+		GL_Uniform1fFunc (emitTimeLoc, cl.time - e->start);
+
+		if (quads)
+			GL_DrawArraysInstancedFunc (GL_TRIANGLE_FAN, 0, 4, e->count);
+		else
+			GL_DrawArraysInstancedFunc (GL_TRIANGLES, 4, 3, e->count);
+
+		rs_particles += e->count;
+		rs_particlebytes += sizeof(partemitter_t);
+	}
+
+// clean up
+	GL_VertexAttribDivisorFunc (emitIndexAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (emitRandom0AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (emitRandom1AttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_DisableVertexAttribArrayFunc (emitIndexAttrIndex);
+	GL_DisableVertexAttribArrayFunc (emitRandom0AttrIndex);
+	GL_DisableVertexAttribArrayFunc (emitRandom1AttrIndex);
+
+	GL_UseProgramFunc (0);
+}
+
+/*
+===============
+R_DrawParticles_Instanced
+
+fills one instance per particle, streams them into r_particle_vbo and
+draws everything with a single call.  returns false if the instance array
+couldn't be allocated, so the caller can draw them in immediate mode
+===============
+*/
+static qboolean R_DrawParticles_Instanced (vec3_t up, vec3_t right)
+{
+	partgroup_t		*g;
+	partinstance_t	*inst;
+	int				i, t, n, bytes;
+	qboolean		quads;
+
+	if (r_maxparticleinstances < r_activeparticles)
+	{
+		free (r_particle_instances);
+		r_maxparticleinstances = r_activeparticles;
+		r_particle_instances = (partinstance_t *) malloc (r_maxparticleinstances * sizeof(partinstance_t));
+		if (!r_particle_instances)
+		{
+			r_maxparticleinstances = 0;
+			return false;
+		}
+	}
+
+	quads = r_quadparticles.value ? true : false;
+
+	n = 0;
+	for (t=0 ; t<NUM_PARTICLE_TYPES ; t++)
+	{
+		g = &partgroups[t];
+		for (i=0 ; i<g->numparticles ; i++, n++)
+		{
+			inst = &r_particle_instances[n];
+			inst->org[0] = g->org[0][i];
+			inst->org[1] = g->org[1][i];
+			inst->org[2] = g->org[2][i];
+			inst->scale = R_ParticleScale (inst->org);
+			if (quads)
+				inst->scale /= 2.0; //quad is half the size of triangle
+			inst->color[0] = g->color[i];
+		}
+	}
+
+	R_BindParticleCorners ();
+	if (!r_particle_vbo)
+		GL_GenBuffersFunc (1, &r_particle_vbo);
+
+// upload, letting the driver orphan last draw's storage
+	bytes = n * sizeof(partinstance_t);
+	GL_BindBuffer (GL_ARRAY_BUFFER, r_particle_vbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, bytes, r_particle_instances, GL_STREAM_DRAW);
+
+	GL_UseProgramFunc (r_particle_program);
+
+	GL_EnableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_EnableVertexAttribArrayFunc (originAttrIndex);
+	GL_EnableVertexAttribArrayFunc (colorAttrIndex);
+
+	GL_VertexAttribPointerFunc (originAttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(partinstance_t), (void *)0);
+	GL_VertexAttribPointerFunc (colorAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(partinstance_t), (void *)(4 * sizeof(float)));
+	GL_VertexAttribDivisorFunc (originAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 1);
+
+	R_BindParticleCorners ();
+	GL_VertexAttribPointerFunc (cornerAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
+
+// set uniforms
+	GL_Uniform3fFunc (upLoc, up[0], up[1], up[2]);
+	GL_Uniform3fFunc (rightLoc, right[0], right[1], right[2]);
+	GL_Uniform1fFunc (texScaleLoc, quads ? 0.5 : 1.0);
+	GL_Uniform1iFunc (texLoc, 0);
+	GL_Uniform1iFunc (paletteLoc, 1);
+
+// set textures
+	GL_SelectTexture (GL_TEXTURE1);
+	GL_Bind (particlepalette);
+	GL_SelectTexture (GL_TEXTURE0);
+
+// draw
+	if (quads)
+		GL_DrawArraysInstancedFunc (GL_TRIANGLE_FAN, 0, 4, n);
+	else
+		GL_DrawArraysInstancedFunc (GL_TRIANGLES, 4, 3, n);
+
+// clean up
+	GL_VertexAttribDivisorFunc (originAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_DisableVertexAttribArrayFunc (originAttrIndex);
+	GL_DisableVertexAttribArrayFunc (colorAttrIndex);
+
+	GL_UseProgramFunc (0);
+
+	rs_particles += n;
+	rs_particlebytes += bytes;
+	return true;
+}
+
+/*
+===============
+R_DrawParticles -- johnfitz -- moved all non-drawing code to CL_RunParticles
+===============
+*/
+void R_DrawParticles (void)
+{
+	partgroup_t		*g;
+	int				i, t;
 	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright; //johnfitz -- p_ vectors
+	vec3_t			org, up, right, p_up, p_right, p_upright; //johnfitz -- p_ vectors
 	GLubyte			color[4], *c; //johnfitz -- particle transparency
 	extern	cvar_t	r_particles; //johnfitz
 	//float			alpha; //johnfitz -- particle transparency
@@ -835,8 +1797,7 @@ void R_DrawParticles (void)
 	if (!r_particles.value)
 		return;
 
-	//ericw -- avoid empty glBegin(),glEnd() pair below; causes issues on AMD
-	if (!active_particles)
+	if (!r_activeparticles && !r_numemitters)
 		return;
 
 	VectorScale (vup, 1.5, up);
@@ -847,26 +1808,34 @@ void R_DrawParticles (void)
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 	glDepthMask (GL_FALSE); //johnfitz -- fix for particle z-buffer bug
 
+	if (r_numemitters && r_emitter_program)
+		R_DrawEmitters (up, right);
+
+	//ericw -- avoid empty glBegin(),glEnd() pair below; causes issues on AMD
+	if (!r_activeparticles)
+		goto done;
+
+	if (r_instancedparticles.value && r_particle_program && R_DrawParticles_Instanced (up, right))
+		goto done;
+
 	if (r_quadparticles.value) //johnitz -- quads save fillrate
-	{
 		glBegin (GL_QUADS);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
+	else //johnitz --  triangles save verts
+		glBegin (GL_TRIANGLES);
 
-			scale /= 2.0; //quad is half the size of triangle
+	for (t=0 ; t<NUM_PARTICLE_TYPES ; t++)
+	{
+		g = &partgroups[t];
+		for (i=0 ; i<g->numparticles ; i++)
+		{
+			org[0] = g->org[0][i];
+			org[1] = g->org[1][i];
+			org[2] = g->org[2][i];
 
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+			scale = R_ParticleScale (org);
 
 			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
+			c = (GLubyte *) &d_8to24table[g->color[i]];
 			color[0] = c[0];
 			color[1] = c[1];
 			color[2] = c[2];
@@ -875,67 +1844,46 @@ void R_DrawParticles (void)
 			glColor4ubv(color);
 			//johnfitz
 
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
+			if (r_quadparticles.value)
+			{
+				scale /= 2.0; //quad is half the size of triangle
 
-			glTexCoord2f (0.5,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+				glTexCoord2f (0,0);
+				glVertex3fv (org);
 
-			glTexCoord2f (0.5,0.5);
-			VectorMA (p_up, scale, right, p_upright);
-			glVertex3fv (p_upright);
+				glTexCoord2f (0.5,0);
+				VectorMA (org, scale, up, p_up);
+				glVertex3fv (p_up);
 
-			glTexCoord2f (0,0.5);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+				glTexCoord2f (0.5,0.5);
+				VectorMA (p_up, scale, right, p_upright);
+				glVertex3fv (p_upright);
 
-			rs_particles++; //johnfitz //FIXME: just use r_numparticles
-		}
-		glEnd ();
-	}
-	else //johnitz --  triangles save verts
-	{
-		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
+				glTexCoord2f (0,0.5);
+				VectorMA (org, scale, right, p_right);
+				glVertex3fv (p_right);
+			}
 			else
-				scale = 1 + scale * 0.004;
-
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
-
-			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
-			color[0] = c[0];
-			color[1] = c[1];
-			color[2] = c[2];
-			//alpha = CLAMP(0, p->die + 0.5 - cl.time, 1);
-			color[3] = 255; //(int)(alpha * 255);
-			glColor4ubv(color);
-			//johnfitz
-
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
+			{
+				glTexCoord2f (0,0);
+				glVertex3fv (org);
 
-			glTexCoord2f (1,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+				glTexCoord2f (1,0);
+				VectorMA (org, scale, up, p_up);
+				glVertex3fv (p_up);
 
-			glTexCoord2f (0,1);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+				glTexCoord2f (0,1);
+				VectorMA (org, scale, right, p_right);
+				glVertex3fv (p_right);
+			}
 
 			rs_particles++; //johnfitz //FIXME: just use r_numparticles
 		}
-		glEnd ();
 	}
 
+	glEnd ();
+
+done:
 	glDepthMask (GL_TRUE); //johnfitz -- fix for particle z-buffer bug
 	glDisable (GL_BLEND);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
@@ -950,75 +1898,339 @@ R_DrawParticles_ShowTris -- johnfitz
 */
 void R_DrawParticles_ShowTris (void)
 {
-	particle_t		*p;
+	partgroup_t		*g;
+	int				i, t;
 	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright;
+	vec3_t			org, up, right, p_up, p_right, p_upright;
 	extern	cvar_t	r_particles;
 
 	if (!r_particles.value)
 		return;
 
+	if (!r_activeparticles)
+		return;
+
 	VectorScale (vup, 1.5, up);
 	VectorScale (vright, 1.5, right);
 
-	if (r_quadparticles.value)
+	if (!r_quadparticles.value)
+		glBegin (GL_TRIANGLES);
+
+	for (t=0 ; t<NUM_PARTICLE_TYPES ; t++)
 	{
-		for (p=active_particles ; p ; p=p->next)
+		g = &partgroups[t];
+		for (i=0 ; i<g->numparticles ; i++)
 		{
-			glBegin (GL_TRIANGLE_FAN);
-
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
+			org[0] = g->org[0][i];
+			org[1] = g->org[1][i];
+			org[2] = g->org[2][i];
+
+			scale = R_ParticleScale (org);
+
+			if (r_quadparticles.value)
+			{
+				scale /= 2.0; //quad is half the size of triangle
+
+				glBegin (GL_TRIANGLE_FAN);
+				glVertex3fv (org);
+
+				VectorMA (org, scale, up, p_up);
+				glVertex3fv (p_up);
+
+				VectorMA (p_up, scale, right, p_upright);
+				glVertex3fv (p_upright);
+
+				VectorMA (org, scale, right, p_right);
+				glVertex3fv (p_right);
+				glEnd ();
+			}
 			else
-				scale = 1 + scale * 0.004;
+			{
+				glVertex3fv (org);
 
-			scale /= 2.0; //quad is half the size of triangle
+				VectorMA (org, scale, up, p_up);
+				glVertex3fv (p_up);
 
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
+				VectorMA (org, scale, right, p_right);
+				glVertex3fv (p_right);
+			}
+		}
+	}
 
-			glVertex3fv (p->org);
+	if (!r_quadparticles.value)
+		glEnd ();
+}
 
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+/*
+===============
+R_TimeParticles_f
 
-			VectorMA (p_up, scale, right, p_upright);
-			glVertex3fv (p_upright);
+For program optimization.  Simulates a particle load without drawing it,
+once through the particle groups and once through a linked list the way
+CL_RunParticles used to walk it, and prints the cost of each.
+usage: timeparticles [count] [frames]
+===============
+*/
+typedef struct legacyparticle_s
+{
+	vec3_t		org;
+	float		color;
+	struct legacyparticle_s	*next;
+	vec3_t		vel;
+	float		ramp;
+	float		die;
+	ptype_t		type;
+} legacyparticle_t;
+
+static void R_RunLegacyParticles (legacyparticle_t **active, legacyparticle_t **freelist, double time, float frametime, float grav)
+{
+	legacyparticle_t	*p, *kill;
+	int					i;
+	float				time1, time2, time3, dvel;
 
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+	time3 = frametime * 15;
+	time2 = frametime * 10;
+	time1 = frametime * 5;
+	dvel = 4*frametime;
 
-			glEnd ();
+	for ( ;; )
+	{
+		kill = *active;
+		if (kill && kill->die < time)
+		{
+			*active = kill->next;
+			kill->next = *freelist;
+			*freelist = kill;
+			continue;
 		}
+		break;
 	}
-	else
+
+	for (p=*active ; p ; p=p->next)
 	{
-		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
+		for ( ;; )
 		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
+			kill = p->next;
+			if (kill && kill->die < time)
+			{
+				p->next = kill->next;
+				kill->next = *freelist;
+				*freelist = kill;
+				continue;
+			}
+			break;
+		}
 
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
+		p->org[0] += p->vel[0]*frametime;
+		p->org[1] += p->vel[1]*frametime;
+		p->org[2] += p->vel[2]*frametime;
+
+		switch (p->type)
+		{
+		case pt_static:
+			break;
+		case pt_fire:
+			p->ramp += time1;
+			if (p->ramp >= 6)
+				p->die = -1;
+			else
+				p->color = ramp3[(int)p->ramp];
+			p->vel[2] += grav;
+			break;
+		case pt_explode:
+			p->ramp += time2;
+			if (p->ramp >=8)
+				p->die = -1;
+			else
+				p->color = ramp1[(int)p->ramp];
+			for (i=0 ; i<3 ; i++)
+				p->vel[i] += p->vel[i]*dvel;
+			p->vel[2] -= grav;
+			break;
+		case pt_explode2:
+			p->ramp += time3;
+			if (p->ramp >=8)
+				p->die = -1;
+			else
+				p->color = ramp2[(int)p->ramp];
+			for (i=0 ; i<3 ; i++)
+				p->vel[i] -= p->vel[i]*frametime;
+			p->vel[2] -= grav;
+			break;
+		case pt_blob:
+			for (i=0 ; i<3 ; i++)
+				p->vel[i] += p->vel[i]*dvel;
+			p->vel[2] -= grav;
+			break;
+		case pt_blob2:
+			for (i=0 ; i<2 ; i++)
+				p->vel[i] -= p->vel[i]*dvel;
+			p->vel[2] -= grav;
+			break;
+		case pt_grav:
+		case pt_slowgrav:
+			p->vel[2] -= grav;
+			break;
+		}
+	}
+}
 
-			glVertex3fv (p->org);
+static void R_TimeParticles_f (void)
+{
+	partgroup_t			groups[NUM_PARTICLE_TYPES];
+	legacyparticle_t	*legacy, *active, *freelist, *lp;
+	particle_t			p;
+	int					count, frames, i, j, live;
+	double				start, soatime, listtime, time;
+	float				frametime, grav;
+
+	count = (Cmd_Argc() > 1) ? Q_atoi(Cmd_Argv(1)) : 1000000;
+	frames = (Cmd_Argc() > 2) ? Q_atoi(Cmd_Argv(2)) : 100;
+	count = q_max (count, 1);
+	frames = q_max (frames, 1);
+	frametime = 1.0 / 72;
+	grav = frametime * 800 * 0.05;
+
+	legacy = (legacyparticle_t *) malloc (count * sizeof(legacyparticle_t));
+	if (!legacy)
+	{
+		Con_Printf ("couldn't allocate %i particles\n", count);
+		return;
+	}
 
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+	memset (groups, 0, sizeof(groups));
+	for (i=0 ; i<NUM_PARTICLE_TYPES ; i++)
+	{
+		if (!R_ResizeParticleGroup (&groups[i], count / NUM_PARTICLE_TYPES + 1))
+		{
+			Con_Printf ("couldn't allocate %i particles\n", count);
+			goto done;
+		}
+	}
 
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+	// same starting state for both paths, with every type represented
+	active = NULL;
+	freelist = NULL;
+	for (i=0 ; i<count ; i++)
+	{
+		p.type = (ptype_t)(i % NUM_PARTICLE_TYPES);
+		p.die = 99999;
+		p.ramp = rand()&3;
+		p.color = ramp1[0];
+		for (j=0 ; j<3 ; j++)
+		{
+			p.org[j] = (rand()%4096)-2048;
+			p.vel[j] = (rand()%512)-256;
 		}
-		glEnd ();
+		R_StoreParticle (&groups[p.type], &p);
+
+		lp = &legacy[i];
+		VectorCopy (p.org, lp->org);
+		VectorCopy (p.vel, lp->vel);
+		lp->color = p.color;
+		lp->ramp = p.ramp;
+		lp->die = p.die;
+		lp->type = p.type;
+		lp->next = active;
+		active = lp;
+	}
+
+	live = count;
+	time = 0;
+	start = Sys_DoubleTime ();
+	for (i=0 ; i<frames ; i++)
+	{
+		time += frametime;
+		live -= R_RunParticleGroups (groups, time, frametime, grav);
 	}
+	soatime = Sys_DoubleTime () - start;
+
+	time = 0;
+	start = Sys_DoubleTime ();
+	for (i=0 ; i<frames ; i++)
+	{
+		time += frametime;
+		R_RunLegacyParticles (&active, &freelist, time, frametime, grav);
+	}
+	listtime = Sys_DoubleTime () - start;
+
+	Con_Printf ("%i particles, %i frames, %i left alive\n", count, frames, live);
+	Con_Printf ("groups:      %.3f ms/frame\n", soatime * 1000 / frames);
+	Con_Printf ("linked list: %.3f ms/frame\n", listtime * 1000 / frames);
+
+done:
+	for (i=0 ; i<NUM_PARTICLE_TYPES ; i++)
+		R_FreeParticleGroup (&groups[i]);
+	free (legacy);
 }
 
+/*
+===============
+R_CheckEmitters_f
+
+Spawns one emitter of each kind, runs its particles through the CPU
+simulation at EMITTER_STEP, and compares every frame against the closed form
+the emitter shader evaluates.
+===============
+*/
+static void R_CheckEmitters_f (void)
+{
+	static const char *names[] = {"explosion", "lavasplash", "telesplash"};
+	partgroup_t		groups[NUM_PARTICLE_TYPES];
+	partemitter_t	e;
+	particle_t		p;
+	vec3_t			org;
+	int				type, i, j, n, color, frames, compared, mismatched;
+	float			gravity, err, maxerr;
+
+	gravity = 800 * 0.05;
+	memset (groups, 0, sizeof(groups));
+	for (i=0 ; i<NUM_PARTICLE_TYPES ; i++)
+		R_ResizeParticleGroup (&groups[i], 1);
+
+	for (type=emit_explosion ; type<=emit_telesplash ; type++)
+	{
+		memset (&e, 0, sizeof(e));
+		e.type = (emittertype_t)type;
+		e.base = rand() % (EMITTER_RANDOMROWS - MAX_EMITTER_PARTICLES);
+		e.count = (type == emit_telesplash) ? 8 * 8 * 14 : 1024;
+		e.life = (type == emit_explosion) ? 0.8 : (type == emit_lavasplash) ? 2 + 31 * 0.02 : 0.2 + 7 * 0.02;
+		frames = (int)(e.life / EMITTER_STEP) + 1;
+
+		compared = mismatched = 0;
+		maxerr = 0;
+		for (i=0 ; i<e.count ; i++)
+		{
+			R_EmitterParticle (&e, i, &p);
+			for (j=0 ; j<NUM_PARTICLE_TYPES ; j++)
+				groups[j].numparticles = 0;
+			R_StoreParticle (&groups[p.type], &p);
+
+			for (n=1 ; n<=frames && groups[p.type].numparticles ; n++)
+			{
+				R_RunParticleGroups (groups, n * EMITTER_STEP, EMITTER_STEP, gravity * EMITTER_STEP);
+				if (!groups[p.type].numparticles)
+					break;
+
+				if (!R_EvalEmitterParticle (&e, i, n * EMITTER_STEP, gravity, org, &color))
+				{
+					mismatched++;
+					break;
+				}
+
+				for (j=0 ; j<3 ; j++)
+				{
+					err = fabs (org[j] - groups[p.type].org[j][0]);
+					maxerr = q_max (maxerr, err);
+				}
+				compared++;
+			}
+		}
+
+		Con_Printf ("%-10s %4i particles, %6i positions compared, max error %.4f, %i lifetime mismatches\n",
+					names[type], e.count, compared, maxerr, mismatched);
+	}
+
+	for (i=0 ; i<NUM_PARTICLE_TYPES ; i++)
+		R_FreeParticleGroup (&groups[i]);
+}
@@ -76,70 +76,78 @@ mspriteframe_t *R_GetSpriteFrame (entity_t *currentent)
 
 /*
 =================
-R_DrawSpriteModel -- johnfitz -- rewritten: now supports all orientations
+R_SpriteOrientation -- the up and right vectors of a sprite quad; false for
+unknown sprite types
 =================
 */
-void R_DrawSpriteModel (entity_t *e)
+static qboolean R_SpriteOrientation (entity_t *e, msprite_t *psprite, vec3_t s_up, vec3_t s_right)
 {
-	vec3_t			point, v_forward, v_right, v_up;
-	msprite_t		*psprite;
-	mspriteframe_t	*frame;
-	float			*s_up, *s_right;
+	vec3_t			v_forward;
 	float			angle, sr, cr;
 
-	//TODO: frustum cull it?
-
-	frame = R_GetSpriteFrame (e);
-	psprite = (msprite_t *) currententity->model->cache.data;
-
 	switch(psprite->type)
 	{
 	case SPR_VP_PARALLEL_UPRIGHT: //faces view plane, up is towards the heavens
-		v_up[0] = 0;
-		v_up[1] = 0;
-		v_up[2] = 1;
-		s_up = v_up;
-		s_right = vright;
+		s_up[0] = 0;
+		s_up[1] = 0;
+		s_up[2] = 1;
+		VectorCopy (vright, s_right);
 		break;
 	case SPR_FACING_UPRIGHT: //faces camera origin, up is towards the heavens
-		VectorSubtract(currententity->origin, r_origin, v_forward);
+		VectorSubtract(e->origin, r_origin, v_forward);
 		v_forward[2] = 0;
 		VectorNormalizeFast(v_forward);
-		v_right[0] = v_forward[1];
-		v_right[1] = -v_forward[0];
-		v_right[2] = 0;
-		v_up[0] = 0;
-		v_up[1] = 0;
-		v_up[2] = 1;
-		s_up = v_up;
-		s_right = v_right;
+		s_right[0] = v_forward[1];
+		s_right[1] = -v_forward[0];
+		s_right[2] = 0;
+		s_up[0] = 0;
+		s_up[1] = 0;
+		s_up[2] = 1;
 		break;
 	case SPR_VP_PARALLEL: //faces view plane, up is towards the top of the screen
-		s_up = vup;
-		s_right = vright;
+		VectorCopy (vup, s_up);
+		VectorCopy (vright, s_right);
 		break;
 	case SPR_ORIENTED: //pitch yaw roll are independent of camera
-		AngleVectors (currententity->angles, v_forward, v_right, v_up);
-		s_up = v_up;
-		s_right = v_right;
+		AngleVectors (e->angles, v_forward, s_right, s_up);
 		break;
 	case SPR_VP_PARALLEL_ORIENTED: //faces view plane, but obeys roll value
-		angle = currententity->angles[ROLL] * M_PI_DIV_180;
+		angle = e->angles[ROLL] * M_PI_DIV_180;
 		sr = sin(angle);
 		cr = cos(angle);
-		v_right[0] = vright[0] * cr + vup[0] * sr;
-		v_right[1] = vright[1] * cr + vup[1] * sr;
-		v_right[2] = vright[2] * cr + vup[2] * sr;
-		v_up[0] = vright[0] * -sr + vup[0] * cr;
-		v_up[1] = vright[1] * -sr + vup[1] * cr;
-		v_up[2] = vright[2] * -sr + vup[2] * cr;
-		s_up = v_up;
-		s_right = v_right;
+		s_right[0] = vright[0] * cr + vup[0] * sr;
+		s_right[1] = vright[1] * cr + vup[1] * sr;
+		s_right[2] = vright[2] * cr + vup[2] * sr;
+		s_up[0] = vright[0] * -sr + vup[0] * cr;
+		s_up[1] = vright[1] * -sr + vup[1] * cr;
+		s_up[2] = vright[2] * -sr + vup[2] * cr;
 		break;
 	default:
-		return;
+		return false;
 	}
 
+	return true;
+}
+
+/*
+=================
+R_DrawSpriteModel -- johnfitz -- rewritten: now supports all orientations
+=================
+*/
+void R_DrawSpriteModel (entity_t *e)
+{
+	vec3_t			point, s_up, s_right;
+	msprite_t		*psprite;
+	mspriteframe_t	*frame;
+
+	//TODO: frustum cull it?
+
+	frame = R_GetSpriteFrame (e);
+	psprite = (msprite_t *) currententity->model->cache.data;
+
+	if (!R_SpriteOrientation (e, psprite, s_up, s_right))
+		return;
+
 	//johnfitz: offset decals
 	if (psprite->type == SPR_ORIENTED)
 		GL_PolygonOffset (OFFSET_DECAL);
@@ -180,3 +188,323 @@ void R_DrawSpriteModel (entity_t *e)
 	if (psprite->type == SPR_ORIENTED)
 		GL_PolygonOffset (OFFSET_NONE);
 }
+
+/*
+===============================================================================
+
+SPRITE BATCHING
+
+opaque sprites are queued during the entity pass, sorted by frame texture,
+and drawn as one indexed triangle list per texture from a vertex buffer
+that's refilled every flush
+
+===============================================================================
+*/
+
+#define MAX_SPRITEBATCH		8192	// 4 verts each, so the indexes fit in shorts
+#define SPRITEVERTEXSIZE	5		// xyz st
+
+typedef struct
+{
+	entity_t		*e;
+	mspriteframe_t	*frame;
+	qboolean		decal;
+} spritebatchitem_t;
+
+typedef struct
+{
+	vec3_t			origin, s_up, s_right;
+	float			down, up, left, right;	// frame edges
+	float			smax, tmax;
+} spritequad_t;
+
+static spritebatchitem_t	spritebatch[MAX_SPRITEBATCH];
+static int					numspritebatch;
+static spritequad_t			spritequads[MAX_SPRITEBATCH];
+
+static float				spriteverts[MAX_SPRITEBATCH * 4 * SPRITEVERTEXSIZE];
+static unsigned short		spriteindexes[MAX_SPRITEBATCH * 6];
+static qboolean				spriteindexesbuilt;
+static GLuint				r_sprite_vbo;
+
+/*
+=================
+R_DeleteSpriteVertexBuffer
+=================
+*/
+void R_DeleteSpriteVertexBuffer (void)
+{
+	if (!r_sprite_vbo)
+		return;
+
+	GL_DeleteBuffersFunc (1, &r_sprite_vbo);
+	r_sprite_vbo = 0;
+
+	GL_ClearBufferBindings ();
+}
+
+/*
+=================
+R_SpriteBatchCompare -- by texture, decals last so the offset changes once
+=================
+*/
+static int R_SpriteBatchCompare (const void *a, const void *b)
+{
+	const spritebatchitem_t *sa = (const spritebatchitem_t *) a;
+	const spritebatchitem_t *sb = (const spritebatchitem_t *) b;
+
+	if (sa->decal != sb->decal)
+		return sa->decal - sb->decal;
+	if (sa->frame->gltexture->texnum != sb->frame->gltexture->texnum)
+		return (sa->frame->gltexture->texnum < sb->frame->gltexture->texnum) ? -1 : 1;
+	return 0;
+}
+
+/*
+=================
+R_BuildSpriteVerts -- fills spriteverts for the sorted batch
+
+the orientation needs a switch on the sprite type, so it is gathered into
+spritequads first.  the quads are then expanded in a loop of straight
+arithmetic over those contiguous floats, with no calls or branches, that
+the compiler is free to vectorize
+=================
+*/
+static int R_BuildSpriteVerts (void)
+{
+	spritebatchitem_t	*item;
+	spritequad_t		*q;
+	mspriteframe_t		*frame;
+	float				*v;
+	int					i, j;
+
+	for (i = 0, item = spritebatch, q = spritequads; i < numspritebatch; i++, item++, q++)
+	{
+		frame = item->frame;
+		R_SpriteOrientation (item->e, (msprite_t *) item->e->model->cache.data, q->s_up, q->s_right);
+		VectorCopy (item->e->origin, q->origin);
+		q->down = frame->down;
+		q->up = frame->up;
+		q->left = frame->left;
+		q->right = frame->right;
+		q->smax = frame->smax;
+		q->tmax = frame->tmax;
+	}
+
+// corners in the same order as R_DrawSpriteModel
+	for (i = 0, q = spritequads, v = spriteverts; i < numspritebatch; i++, q++, v += 4 * SPRITEVERTEXSIZE)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			v[j] = q->origin[j] + (q->down * q->s_up[j] + q->left * q->s_right[j]);
+			v[5+j] = q->origin[j] + (q->up * q->s_up[j] + q->left * q->s_right[j]);
+			v[10+j] = q->origin[j] + (q->up * q->s_up[j] + q->right * q->s_right[j]);
+			v[15+j] = q->origin[j] + (q->down * q->s_up[j] + q->right * q->s_right[j]);
+		}
+		v[3] = 0; v[4] = q->tmax;
+		v[8] = 0; v[9] = 0;
+		v[13] = q->smax; v[14] = 0;
+		v[18] = q->smax; v[19] = q->tmax;
+	}
+
+	return numspritebatch * 4;
+}
+
+/*
+=================
+R_FlushSpriteBatch -- draws and empties the sprite queue
+=================
+*/
+void R_FlushSpriteBatch (void)
+{
+	spritebatchitem_t	*item;
+	float				*base;
+	int					i, first, numverts;
+	qboolean			decal;
+
+	if (!numspritebatch)
+		return;
+
+	if (!spriteindexesbuilt)
+	{
+		for (i = 0; i < MAX_SPRITEBATCH; i++)
+		{
+			spriteindexes[i*6+0] = i*4+0;
+			spriteindexes[i*6+1] = i*4+1;
+			spriteindexes[i*6+2] = i*4+2;
+			spriteindexes[i*6+3] = i*4+0;
+			spriteindexes[i*6+4] = i*4+2;
+			spriteindexes[i*6+5] = i*4+3;
+		}
+		spriteindexesbuilt = true;
+	}
+
+	qsort (spritebatch, numspritebatch, sizeof(spritebatchitem_t), R_SpriteBatchCompare);
+	numverts = R_BuildSpriteVerts ();
+
+// stream the vertices
+	if (gl_vbo_able)
+	{
+		if (!r_sprite_vbo)
+			GL_GenBuffersFunc (1, &r_sprite_vbo);
+		GL_BindBuffer (GL_ARRAY_BUFFER, r_sprite_vbo);
+		GL_BufferDataFunc (GL_ARRAY_BUFFER, numverts * SPRITEVERTEXSIZE * sizeof(float), spriteverts, GL_STREAM_DRAW);
+		base = (float *)0;
+	}
+	else
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+		base = spriteverts;
+	}
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0); // indices come from client memory!
+
+	glVertexPointer (3, GL_FLOAT, SPRITEVERTEXSIZE * sizeof(float), base);
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glTexCoordPointer (2, GL_FLOAT, SPRITEVERTEXSIZE * sizeof(float), base + 3);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+	glColor3f (1,1,1);
+	GL_DisableMultitexture();
+	glEnable (GL_ALPHA_TEST);
+
+	decal = false;
+	for (first = 0; first < numspritebatch; )
+	{
+		item = &spritebatch[first];
+		for (i = first + 1; i < numspritebatch; i++)
+		{
+			if (spritebatch[i].decal != item->decal || spritebatch[i].frame->gltexture != item->frame->gltexture)
+				break;
+		}
+
+		//johnfitz: offset decals
+		if (item->decal != decal)
+		{
+			GL_PolygonOffset (item->decal ? OFFSET_DECAL : OFFSET_NONE);
+			decal = item->decal;
+		}
+
+		GL_Bind (item->frame->gltexture);
+		glDrawElements (GL_TRIANGLES, (i - first) * 6, GL_UNSIGNED_SHORT, spriteindexes + first * 6);
+		first = i;
+	}
+
+	if (decal)
+		GL_PolygonOffset (OFFSET_NONE);
+
+	glDisable (GL_ALPHA_TEST);
+	glDisableClientState (GL_VERTEX_ARRAY);
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+
+	numspritebatch = 0;
+}
+
+/*
+=================
+R_BatchSpriteModel -- queues a sprite for R_FlushSpriteBatch
+=================
+*/
+void R_BatchSpriteModel (entity_t *e)
+{
+	spritebatchitem_t	*item;
+	msprite_t			*psprite;
+
+	psprite = (msprite_t *) e->model->cache.data;
+	if (psprite->type > SPR_VP_PARALLEL_ORIENTED || psprite->type < 0)
+		return;
+
+	if (numspritebatch == MAX_SPRITEBATCH)
+		R_FlushSpriteBatch ();
+
+	item = &spritebatch[numspritebatch++];
+	item->e = e;
+	item->frame = R_GetSpriteFrame (e);
+	item->decal = (psprite->type == SPR_ORIENTED);
+}
+
+/*
+=================
+R_TimeSprites_f -- timesprites [count] [sprite]
+
+draws count copies of a sprite spread out in front of the view, one at a
+time and then batched, and prints how long each took
+=================
+*/
+void R_TimeSprites_f (void)
+{
+	const char	*name;
+	qmodel_t	*model;
+	entity_t	*ents, *e;
+	vec3_t		forward, right, up;
+	double		start, single, batched;
+	int			i, count, passes, side;
+
+	if (cls.state != ca_connected)
+	{
+		Con_Printf("Not connected to a server\n");
+		return;
+	}
+
+	count = (Cmd_Argc () >= 2) ? q_max(1, atoi (Cmd_Argv (1))) : 10000;
+	name = (Cmd_Argc () >= 3) ? Cmd_Argv (2) : "progs/s_explod.spr";
+
+	model = Mod_ForName (name, false);
+	if (!model || model->type != mod_sprite)
+	{
+		Con_Printf ("%s isn't a sprite\n", name);
+		return;
+	}
+
+	ents = (entity_t *) calloc (count, sizeof(entity_t));
+	if (!ents)
+	{
+		Con_Printf ("R_TimeSprites_f: Couldn't allocate memory\n");
+		return;
+	}
+
+// a grid of sprites facing the player, a little way out
+	AngleVectors (r_refdef.viewangles, forward, right, up);
+	side = (int) ceil (sqrt (count));
+	for (i = 0, e = ents; i < count; i++, e++)
+	{
+		e->model = model;
+		e->frame = i % ((msprite_t *) model->cache.data)->numframes;
+		e->alpha = ENTALPHA_DEFAULT;
+		e->syncbase = (float)(rand()&0x7fff) / 0x7fff;
+		VectorMA (r_refdef.vieworg, 256 + (i % 7) * 16, forward, e->origin);
+		VectorMA (e->origin, ((i % side) - side/2) * 8, right, e->origin);
+		VectorMA (e->origin, ((i / side) - side/2) * 8, up, e->origin);
+	}
+
+	passes = 16;
+	GL_BeginRendering (&glx, &gly, &glwidth, &glheight);
+	R_RenderView ();
+
+	glFinish ();
+	start = Sys_DoubleTime ();
+	for (i = 0; i < passes * count; i++)
+	{
+		currententity = &ents[i % count];
+		R_DrawSpriteModel (currententity);
+	}
+	glFinish ();
+	single = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (i = 0; i < passes * count; i++)
+	{
+		R_BatchSpriteModel (&ents[i % count]);
+		if (i % count == count - 1)
+			R_FlushSpriteBatch ();
+	}
+	glFinish ();
+	batched = Sys_DoubleTime () - start;
+
+	GL_EndRendering ();
+	free (ents);
+
+	Con_Printf ("%i sprites, %i passes\n", count, passes);
+	Con_Printf ("  one at a time: %.2f ms per pass\n", single * 1000.0 / passes);
+	Con_Printf ("  batched:       %.2f ms per pass\n", batched * 1000.0 / passes);
+}
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 extern cvar_t gl_fullbrights, r_drawflat, gl_overbright, r_oldwater, r_oldskyleaf, r_showtris; //johnfitz
+extern cvar_t r_zprepass, r_chainsort, r_overdraw, r_mergebmodels, r_texturearrays, gl_zfix;
 
 extern glpoly_t	*lightmap_polys[MAX_LIGHTMAPS];
 
@@ -32,6 +33,11 @@ byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel);
 extern byte mod_novis[MAX_MAP_LEAFS/8];
 int vis_changed; //if true, force pvs to be refreshed
 
+#define MAX_MERGED_BMODELS	MAX_VISEDICTS
+
+static entity_t	*mergedents[MAX_MERGED_BMODELS];
+static int		nummergedents;
+
 //==============================================================================
 //
 // SETUP CHAINS
@@ -70,6 +76,102 @@ void R_ChainSurface (msurface_t *surf, texchain_t chain)
 	surf->texinfo->texture->texturechains[chain] = surf;
 }
 
+/*
+===============
+R_CanMergeBModel
+
+true if the entity is a brush model that sits where it was built, so its
+surfaces can be drawn with the world's texture chains
+===============
+*/
+static qboolean R_CanMergeBModel (entity_t *e)
+{
+	qmodel_t	*m;
+	msurface_t	*s;
+	int			i;
+
+	m = e->model;
+	if (m->type != mod_brush || m->name[0] != '*')
+		return false;
+	if (e->origin[0] || e->origin[1] || e->origin[2] || e->angles[0] || e->angles[1] || e->angles[2])
+		return false;
+	if (e->alpha != ENTALPHA_DEFAULT || e->frame) // frame picks alternate animations
+		return false;
+
+	// sky on bmodels is handled by Sky_ProcessEntities
+	for (i=0, s=&m->surfaces[m->firstmodelsurface] ; i<m->nummodelsurfaces ; i++, s++)
+		if (s->flags & SURF_DRAWSKY)
+			return false;
+
+	return true;
+}
+
+/*
+===============
+R_MergeBModels
+
+picks the visible brush entities that can be drawn with the world. the world
+chains are only rebuilt when that set changes, e.g. when a door starts moving
+===============
+*/
+static void R_MergeBModels (void)
+{
+	entity_t	*merge[MAX_MERGED_BMODELS];
+	entity_t	*e;
+	int			i, count;
+
+	count = 0;
+	if (r_mergebmodels.value && r_drawentities.value && !gl_zfix.value)
+	{
+		for (i=0 ; i<cl_numvisedicts ; i++)
+		{
+			e = cl_visedicts[i];
+			if (R_CanMergeBModel (e))
+				merge[count++] = e;
+		}
+	}
+
+	if (count == nummergedents && !memcmp (merge, mergedents, count * sizeof(entity_t *)))
+		return;
+
+	for (i=0 ; i<nummergedents ; i++)
+		mergedents[i]->merged = false;
+	for (i=0 ; i<count ; i++)
+		merge[i]->merged = true;
+
+	memcpy (mergedents, merge, count * sizeof(entity_t *));
+	nummergedents = count;
+	vis_changed = true;
+}
+
+/*
+===============
+R_MarkMergedLights -- dlights for merged bmodels, which R_DrawBrushModel would have done
+===============
+*/
+void R_MarkMergedLights (dlight_t *light, int num)
+{
+	qmodel_t	*m;
+	int			i;
+
+	for (i=0 ; i<nummergedents ; i++)
+	{
+		m = mergedents[i]->model;
+		if (m->firstmodelsurface != 0)
+			R_MarkLights (light, num, m->nodes + m->hulls[0].firstclipnode);
+	}
+}
+
+/*
+===============
+R_ClearMergedBModels -- called on map change, the entities are about to be cleared
+===============
+*/
+void R_ClearMergedBModels (void)
+{
+	nummergedents = 0;
+}
+
 /*
 ===============
 R_MarkSurfaces -- johnfitz -- mark surfaces based on PVS and rebuild texture chains
@@ -87,6 +189,9 @@ void R_MarkSurfaces (void)
 	// clear lightmap chains
 	memset (lightmap_polys, 0, sizeof(lightmap_polys));
 
+	R_MergeBModels ();
+	rs_mergedbmodels = nummergedents;
+
 	// check this leaf for water portals
 	// TODO: loop through all water surfs and use distance to leaf cullbox
 	nearwaterportal = false;
@@ -162,6 +267,14 @@ void R_MarkSurfaces (void)
 		}
 	}
 #endif
+
+	// merged bmodels; R_CullSurfaces takes care of frustum and backface culling
+	for (i=0 ; i<nummergedents ; i++)
+	{
+		qmodel_t *m = mergedents[i]->model;
+		for (j=0, surf=&m->surfaces[m->firstmodelsurface] ; j<m->nummodelsurfaces ; j++, surf++)
+			R_ChainSurface(surf, chain_world);
+	}
 }
 
 /*
@@ -195,6 +308,75 @@ qboolean R_BackFaceCull (msurface_t *surf)
 	return false;
 }
 
+static int		*worldtexorder;		// world texture chains, nearest first
+static float	*worldtexdist;
+static int		worldtexordersize;
+static qboolean	worldtexordervalid;
+
+/*
+================
+R_SurfaceDistance -- squared distance from the view to the surface bounds
+================
+*/
+static float R_SurfaceDistance (msurface_t *s)
+{
+	float	d, dist;
+	int		i;
+
+	dist = 0;
+	for (i=0 ; i<3 ; i++)
+	{
+		if (r_origin[i] < s->mins[i])
+			d = s->mins[i] - r_origin[i];
+		else if (r_origin[i] > s->maxs[i])
+			d = r_origin[i] - s->maxs[i];
+		else
+			continue;
+		dist += d * d;
+	}
+	return dist;
+}
+
+/*
+================
+R_TextureDistanceCompare
+================
+*/
+static int R_TextureDistanceCompare (const void *a, const void *b)
+{
+	float da = worldtexdist[*(const int *)a];
+	float db = worldtexdist[*(const int *)b];
+
+	return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+/*
+================
+R_SortWorldTextures
+
+orders the world texture chains by their nearest visible surface, so the
+lit passes run roughly front to back and the depth test can reject more
+================
+*/
+static void R_SortWorldTextures (void)
+{
+	qsort (worldtexorder, cl.worldmodel->numtextures, sizeof(int), R_TextureDistanceCompare);
+}
+
+/*
+================
+R_TextureIndex
+
+index of the i'th texture chain to draw for this model and chain
+================
+*/
+static int R_TextureIndex (qmodel_t *model, texchain_t chain, int i)
+{
+	if (model == cl.worldmodel && chain == chain_world && worldtexordervalid)
+		return worldtexorder[i];
+	return i;
+}
+
 /*
 ================
 R_CullSurfaces -- johnfitz
@@ -205,10 +387,26 @@ void R_CullSurfaces (void)
 	msurface_t *s;
 	int i;
 	texture_t *t;
+	float dist;
 
 	if (!r_drawworld_cheatsafe)
 		return;
 
+	if (r_chainsort.value)
+	{
+		if (worldtexordersize < cl.worldmodel->numtextures)
+		{
+			worldtexordersize = cl.worldmodel->numtextures;
+			worldtexorder = (int *) realloc (worldtexorder, worldtexordersize * sizeof(int));
+			worldtexdist = (float *) realloc (worldtexdist, worldtexordersize * sizeof(float));
+		}
+		for (i=0 ; i<cl.worldmodel->numtextures ; i++)
+		{
+			worldtexorder[i] = i;
+			worldtexdist[i] = 1e30f; //no visible surfaces
+		}
+	}
+
 // ericw -- instead of testing (s->visframe == r_visframecount) on all world
 // surfaces, use the chained surfaces, which is exactly the same set of sufaces
 	for (i=0 ; i<cl.worldmodel->numtextures ; i++)
@@ -228,9 +426,20 @@ void R_CullSurfaces (void)
 				rs_brushpolys++; //count wpolys here
 				if (s->texinfo->texture->warpimage)
 					s->texinfo->texture->update_warp = true;
+				if (r_chainsort.value)
+				{
+					dist = R_SurfaceDistance (s);
+					if (dist < worldtexdist[i])
+						worldtexdist[i] = dist;
+				}
 			}
 		}
 	}
+
+	// r_framecount is bumped per eye after this, so remember it with a flag
+	worldtexordervalid = r_chainsort.value ? true : false;
+	if (worldtexordervalid)
+		R_SortWorldTextures ();
 }
 
 /*
@@ -324,7 +533,7 @@ void R_DrawTextureChains_ShowTris (qmodel_t *model, texchain_t chain)
 		{
 			for (s = t->texturechains[chain]; s; s = s->texturechain)
 				if (!s->culled)
-					for (p = s->polys->next; p; p = p->next)
+					for (p = GL_SubdividedPolys (s); p; p = p->next)
 					{
 						DrawGLTriangleFan (p);
 					}
@@ -362,7 +571,7 @@ void R_DrawTextureChains_Drawflat (qmodel_t *model, texchain_t chain)
 		{
 			for (s = t->texturechains[chain]; s; s = s->texturechain)
 				if (!s->culled)
-					for (p = s->polys->next; p; p = p->next)
+					for (p = GL_SubdividedPolys (s); p; p = p->next)
 					{
 						srand((unsigned int) (uintptr_t) p);
 						glColor3f (rand()%256/255.0, rand()%256/255.0, rand()%256/255.0);
@@ -519,7 +728,7 @@ void R_DrawTextureChains_Multitexture (qmodel_t *model, entity_t *ent, texchain_
 
 	for (i=0 ; i<model->numtextures ; i++)
 	{
-		t = model->textures[i];
+		t = model->textures[R_TextureIndex (model, chain, i)];
 
 		if (!t || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTILED | SURF_NOTEXTURE))
 			continue;
@@ -608,7 +817,7 @@ void R_DrawTextureChains_TextureOnly (qmodel_t *model, entity_t *ent, texchain_t
 
 	for (i=0 ; i<model->numtextures ; i++)
 	{
-		t = model->textures[i];
+		t = model->textures[R_TextureIndex (model, chain, i)];
 
 		if (!t || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTURB | SURF_DRAWSKY))
 			continue;
@@ -689,7 +898,7 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 						GL_Bind (t->gltexture);
 						bound = true;
 					}
-					for (p = s->polys->next; p; p = p->next)
+					for (p = GL_SubdividedPolys (s); p; p = p->next)
 					{
 						DrawWaterPoly (p);
 						rs_brushpasses++;
@@ -698,6 +907,33 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 			R_EndTransparentDrawing (entalpha);
 		}
 	}
+	else if (R_WaterShaderActive ())
+	{
+		R_BeginWaterShader ();
+		for (i=0 ; i<model->numtextures ; i++)
+		{
+			t = model->textures[i];
+			if (!t || !t->texturechains[chain] || !(t->texturechains[chain]->flags & SURF_DRAWTURB))
+				continue;
+			bound = false;
+			entalpha = 1.0f;
+			for (s = t->texturechains[chain]; s; s = s->texturechain)
+				if (!s->culled)
+				{
+					if (!bound) //only bind once we are sure we need this texture
+					{
+						entalpha = GL_WaterAlphaForEntitySurface (ent, s);
+						R_BeginTransparentDrawing (entalpha);
+						GL_Bind (t->gltexture);
+						bound = true;
+					}
+					DrawGLPoly (s->polys);
+					rs_brushpasses++;
+				}
+			R_EndTransparentDrawing (entalpha);
+		}
+		R_EndWaterShader ();
+	}
 	else
 	{
 		for (i=0 ; i<model->numtextures ; i++)
@@ -850,7 +1086,7 @@ void R_DrawTextureChains_Multitexture_VBO (qmodel_t *model, entity_t *ent, texch
 
 	for (i=0 ; i<model->numtextures ; i++)
 	{
-		t = model->textures[i];
+		t = model->textures[R_TextureIndex (model, chain, i)];
 
 		if (!t || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTILED | SURF_NOTEXTURE))
 			continue;
@@ -926,6 +1162,598 @@ void R_DrawTextureChains_Multitexture_VBO (qmodel_t *model, entity_t *ent, texch
 	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
 }
 
+//==============================================================================
+//
+// WORLD TEXTURE ARRAYS
+//
+//==============================================================================
+
+typedef struct gltexarray_s
+{
+	GLuint		texnum;
+	int			width, height, format;
+	int			numlayers;
+} gltexarray_t;
+
+typedef struct
+{
+	int			width, height, format;
+} texarraykey_t;
+
+static gltexarray_t	*worldtexarrays;
+static int			numworldtexarrays;
+static qboolean		worldtexarraysbuilt;	// tried packing the current world
+static qboolean		worldtexarraysusable;	// every world texture ended up in an array
+static int			worldtexarraybytes;		// counted against gl_texture_budget
+
+static GLuint	boundtexarrays[3]; // to avoid unnecessary array binds within one draw
+
+static GLuint r_world_program;
+
+// uniforms used in world shader
+static GLuint texLoc;
+static GLuint lightmapTexLoc;
+static GLuint fullbrightTexLoc;
+static GLuint layerLoc;
+static GLuint fullbrightLayerLoc;
+static GLuint lightScaleLoc;
+
+/*
+=============
+GLWorld_CreateShaders
+
+R_DrawTextureChains_Multitexture_VBO as a shader, taking the diffuse and
+fullbright textures from layers of texture arrays
+=============
+*/
+void GLWorld_CreateShaders (void)
+{
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+		"	gl_TexCoord[1] = gl_MultiTexCoord1;\n"
+		"	gl_FrontColor = gl_Color;\n"
+		"	gl_Position = ftransform();\n"
+		"	// fog\n"
+		"	vec3 ecPosition = vec3(gl_ModelViewMatrix * gl_Vertex);\n"
+		"	gl_FogFragCoord = abs(ecPosition.z);\n"
+		"}\n";
+
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"#extension GL_EXT_texture_array : enable\n"
+		"\n"
+		"uniform sampler2DArray Tex;\n"
+		"uniform sampler2D LightmapTex;\n"
+		"uniform sampler2DArray FullbrightTex;\n"
+		"uniform float Layer;\n"
+		"uniform float FullbrightLayer;\n"
+		"uniform float LightScale;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 result = texture2DArray(Tex, vec3(gl_TexCoord[0].xy, Layer));\n"
+		"	result *= gl_Color;\n"
+		"	result.rgb *= texture2D(LightmapTex, gl_TexCoord[1].xy).rgb * LightScale;\n"
+		"	if (FullbrightLayer >= 0.0)\n"
+		"		result.rgb += texture2DArray(FullbrightTex, vec3(gl_TexCoord[0].xy, FullbrightLayer)).rgb;\n"
+		"	result = clamp(result, 0.0, 1.0);\n"
+		"	// apply GL_EXP2 fog (from the orange book)\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * gl_FogFragCoord * gl_FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result.rgb = mix(gl_Fog.color.rgb, result.rgb, fog);\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	r_world_program = 0;
+
+	if (!gl_texture_array_able)
+		return;
+
+	r_world_program = GL_CreateProgram (vertSource, fragSource, 0, NULL);
+
+	if (r_world_program != 0)
+	{
+	// get uniform locations
+		texLoc = GL_GetUniformLocation (&r_world_program, "Tex");
+		lightmapTexLoc = GL_GetUniformLocation (&r_world_program, "LightmapTex");
+		fullbrightTexLoc = GL_GetUniformLocation (&r_world_program, "FullbrightTex");
+		layerLoc = GL_GetUniformLocation (&r_world_program, "Layer");
+		fullbrightLayerLoc = GL_GetUniformLocation (&r_world_program, "FullbrightLayer");
+		lightScaleLoc = GL_GetUniformLocation (&r_world_program, "LightScale");
+	}
+}
+
+/*
+=============
+R_GroupTextureArrays
+
+puts each key with a nonzero width into a group of identical keys at most
+maxlayers long, filling the open group for that key before starting another.
+keys with zero width get group and layer -1. returns the number of groups.
+makes no GL calls, so R_CheckTexArrays_f can run it on made up keys.
+=============
+*/
+static int R_GroupTextureArrays (const texarraykey_t *keys, int numkeys, int maxlayers, int *groups, int *layers)
+{
+	const texarraykey_t	*k;
+	int		*groupfirst, *groupsize;
+	int		i, j, numgroups;
+
+	groupfirst = (int *) malloc (q_max(numkeys, 1) * sizeof(int)); // first key in each group
+	groupsize = (int *) malloc (q_max(numkeys, 1) * sizeof(int));
+	numgroups = 0;
+
+	for (i = 0; i < numkeys; i++)
+	{
+		groups[i] = layers[i] = -1;
+		if (!keys[i].width)
+			continue;
+
+		for (j = numgroups - 1; j >= 0; j--)
+		{
+			k = &keys[groupfirst[j]];
+			if (k->width == keys[i].width && k->height == keys[i].height && k->format == keys[i].format &&
+				groupsize[j] < maxlayers)
+				break;
+		}
+
+		if (j < 0)
+		{
+			j = numgroups++;
+			groupfirst[j] = i;
+			groupsize[j] = 0;
+		}
+
+		groups[i] = j;
+		layers[i] = groupsize[j]++;
+	}
+
+	free (groupfirst);
+	free (groupsize);
+	return numgroups;
+}
+
+/*
+=============
+R_DeleteWorldTextureArrays
+
+called on map change, vid_restart and anything that changes the pixels or
+filtering of the textures the arrays were copied from; they are rebuilt the
+next time they are needed
+=============
+*/
+void R_DeleteWorldTextureArrays (void)
+{
+	int i;
+
+	for (i = 0; i < numworldtexarrays; i++)
+		glDeleteTextures (1, &worldtexarrays[i].texnum);
+
+	free (worldtexarrays);
+	worldtexarrays = NULL;
+	numworldtexarrays = 0;
+	worldtexarraybytes = 0;
+	worldtexarraysbuilt = false;
+	worldtexarraysusable = false;
+	TexMgr_ClearPacked ();
+}
+
+/*
+=============
+R_WorldTextureArrayBytes -- video memory held by the arrays, for the texture budget
+=============
+*/
+int R_WorldTextureArrayBytes (void)
+{
+	return worldtexarraybytes;
+}
+
+/*
+=============
+R_BuildWorldTextureArrays
+
+copies every mipmapped world texture and fullbright mask into a layer of a
+texture array shared with the other textures of its size and format. the
+pixels are read back from the textures the texture manager already uploaded,
+so external replacement textures and gl_picmip are packed as they are drawn.
+=============
+*/
+static void R_BuildWorldTextureArrays (void)
+{
+	qmodel_t		*model = cl.worldmodel;
+	texarraykey_t	*keys;
+	gltexture_t		**images;
+	gltexarray_t	*a;
+	texture_t		*t;
+	int				*groups, *layers;
+	int				i, n, level, w, h;
+	GLint			minfilter, magfilter;
+	GLfloat			anisotropy;
+	byte			*data;
+
+	R_DeleteWorldTextureArrays ();
+	worldtexarraysbuilt = true; // don't retry every frame if nothing could be packed
+
+	n = model->numtextures;
+	keys = (texarraykey_t *) calloc (2 * n + 1, sizeof(texarraykey_t));
+	images = (gltexture_t **) calloc (2 * n + 1, sizeof(gltexture_t *));
+	groups = (int *) malloc ((2 * n + 1) * sizeof(int));
+	layers = (int *) malloc ((2 * n + 1) * sizeof(int));
+
+// diffuse textures go in 0..n-1, fullbright masks in n..2n-1
+	for (i = 0; i < n; i++)
+	{
+		t = model->textures[i];
+		if (!t)
+			continue;
+		t->texarray = t->fbarray = NULL;
+		t->texlayer = t->fblayer = -1;
+		if (t->name[0] == '*' || !q_strncasecmp (t->name, "sky", 3))
+			continue; // drawn by the water and sky code
+		images[i] = t->gltexture;
+		images[n + i] = t->fullbright;
+	}
+
+	for (i = 0; i < 2 * n; i++)
+	{
+		// dds and ktx textures stay as they are, compressed and maybe without the small levels
+		if (!images[i] || !(images[i]->flags & TEXPREF_MIPMAP) || images[i]->source_format == SRC_COMPRESSED)
+			continue;
+		keys[i].width = images[i]->width;
+		keys[i].height = images[i]->height;
+		keys[i].format = (images[i]->flags & TEXPREF_ALPHA) ? GL_RGBA : GL_RGB;
+	}
+
+	numworldtexarrays = R_GroupTextureArrays (keys, 2 * n, gl_max_array_layers, groups, layers);
+	worldtexarrays = (gltexarray_t *) calloc (q_max(numworldtexarrays, 1), sizeof(gltexarray_t));
+
+	for (i = 0; i < 2 * n; i++)
+	{
+		if (groups[i] == -1)
+			continue;
+		a = &worldtexarrays[groups[i]];
+		a->width = keys[i].width;
+		a->height = keys[i].height;
+		a->format = keys[i].format;
+		a->numlayers = q_max(a->numlayers, layers[i] + 1);
+	}
+
+// allocate every level of every array; mip levels go down to 1x1 like TexMgr_Upload32
+	for (i = 0; i < numworldtexarrays; i++)
+	{
+		a = &worldtexarrays[i];
+		glGenTextures (1, &a->texnum);
+		glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, a->texnum);
+		for (level = 0, w = a->width, h = a->height; ; level++)
+		{
+			GL_TexImage3DFunc (GL_TEXTURE_2D_ARRAY_EXT, level, a->format, w, h, a->numlayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			worldtexarraybytes += w * h * a->numlayers * 4;
+			if (w == 1 && h == 1)
+				break;
+			w = q_max(w >> 1, 1);
+			h = q_max(h >> 1, 1);
+		}
+	}
+
+// copy the layers in
+	GL_SelectTexture (GL_TEXTURE0_ARB);
+	data = NULL;
+	for (i = 0; i < 2 * n; i++)
+	{
+		if (groups[i] == -1)
+			continue;
+		a = &worldtexarrays[groups[i]];
+		data = (byte *) realloc (data, a->width * a->height * 4);
+
+		TexMgr_MakeResident (images[i]);
+		GL_Bind (images[i]);
+		glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, a->texnum);
+		for (level = 0, w = a->width, h = a->height; ; level++)
+		{
+			glGetTexImage (GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			GL_TexSubImage3DFunc (GL_TEXTURE_2D_ARRAY_EXT, level, 0, 0, layers[i], w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			if (w == 1 && h == 1)
+				break;
+			w = q_max(w >> 1, 1);
+			h = q_max(h >> 1, 1);
+		}
+
+		if (layers[i] == 0) // filter the array like the textures in it
+		{
+			glGetTexParameteriv (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minfilter);
+			glGetTexParameteriv (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magfilter);
+			glTexParameteri (GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, minfilter);
+			glTexParameteri (GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER, magfilter);
+			if (gl_anisotropy_able)
+			{
+				glGetTexParameterfv (GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, &anisotropy);
+				glTexParameterf (GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+			}
+		}
+
+		if (i < n)
+		{
+			model->textures[i]->texarray = a;
+			model->textures[i]->texlayer = layers[i];
+		}
+		else
+		{
+			model->textures[i - n]->fbarray = a;
+			model->textures[i - n]->fblayer = layers[i];
+		}
+	}
+	glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, 0);
+	free (data);
+
+// the shader can't fall back to a plain texture, so any world texture that
+// didn't get packed means the whole model goes through the old path
+	worldtexarraysusable = true;
+	for (i = 0; i < 2 * n; i++)
+		if (images[i] && groups[i] == -1)
+			worldtexarraysusable = false;
+
+// the packed textures aren't bound while the arrays are drawn, so they must
+// not look unused to the texture budget
+	if (worldtexarraysusable)
+		for (i = 0; i < 2 * n; i++)
+			if (images[i])
+				images[i]->packed = true;
+
+	Con_DPrintf ("packed %i world textures into %i arrays\n", n, numworldtexarrays);
+
+	free (keys);
+	free (images);
+	free (groups);
+	free (layers);
+}
+
+/*
+=============
+R_TextureArraysActive
+
+true if the model's texture chains can be drawn with
+R_DrawTextureChains_TextureArrays. only the world and its submodels share
+the packed textures.
+=============
+*/
+static qboolean R_TextureArraysActive (qmodel_t *model)
+{
+	if (!r_texturearrays.value || !r_world_program || !cl.worldmodel)
+		return false;
+
+	if (model->textures != cl.worldmodel->textures)
+		return false;
+
+	if (!worldtexarraysbuilt)
+		R_BuildWorldTextureArrays ();
+
+	return worldtexarraysusable;
+}
+
+/*
+=============
+R_BindTextureArray
+=============
+*/
+static void R_BindTextureArray (GLenum target, gltexarray_t *a)
+{
+	if (boundtexarrays[target - GL_TEXTURE0_ARB] == a->texnum)
+		return;
+
+	GL_SelectTexture (target);
+	glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, a->texnum);
+	boundtexarrays[target - GL_TEXTURE0_ARB] = a->texnum;
+	rs_texbinds++;
+}
+
+/*
+=============
+R_DrawTextureChains_TextureArrays
+
+same as R_DrawTextureChains_Multitexture_VBO, but a texture change is a
+uniform change, and only a bind when the next texture lives in another array
+=============
+*/
+static void R_DrawTextureChains_TextureArrays (qmodel_t *model, entity_t *ent, texchain_t chain)
+{
+	int			i;
+	msurface_t	*s;
+	texture_t	*t, *anim;
+	qboolean	bound;
+	int			lastlightmap;
+
+	boundtexarrays[0] = boundtexarrays[1] = boundtexarrays[2] = 0;
+
+// Bind the buffers
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_vbo);
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0); // indices come from client memory!
+
+// Setup vertex array pointers
+	glVertexPointer (3, GL_FLOAT, VERTEXSIZE * sizeof(float), ((float *)0));
+	glEnableClientState (GL_VERTEX_ARRAY);
+
+	GL_ClientActiveTextureFunc (GL_TEXTURE0_ARB);
+	glTexCoordPointer (2, GL_FLOAT, VERTEXSIZE * sizeof(float), ((float *)0) + 3);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+	GL_ClientActiveTextureFunc (GL_TEXTURE1_ARB);
+	glTexCoordPointer (2, GL_FLOAT, VERTEXSIZE * sizeof(float), ((float *)0) + 5);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+// set uniforms
+	GL_UseProgramFunc (r_world_program);
+	GL_Uniform1iFunc (texLoc, 0);
+	GL_Uniform1iFunc (lightmapTexLoc, 1);
+	GL_Uniform1iFunc (fullbrightTexLoc, 2);
+	GL_Uniform1fFunc (lightScaleLoc, gl_overbright.value ? 2.0f : 1.0f);
+
+	for (i=0 ; i<model->numtextures ; i++)
+	{
+		t = model->textures[R_TextureIndex (model, chain, i)];
+
+		if (!t || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTILED | SURF_NOTEXTURE))
+			continue;
+
+		R_ClearBatch ();
+
+		bound = false;
+		lastlightmap = 0; // avoid compiler warning
+		for (s = t->texturechains[chain]; s; s = s->texturechain)
+			if (!s->culled)
+			{
+				if (!bound) //only bind once we are sure we need this texture
+				{
+					anim = R_TextureAnimation (t, ent != NULL ? ent->frame : 0);
+
+					R_BindTextureArray (GL_TEXTURE0_ARB, anim->texarray);
+					GL_Uniform1fFunc (layerLoc, anim->texlayer);
+
+					if (gl_fullbrights.value && anim->fullbright)
+					{
+						R_BindTextureArray (GL_TEXTURE2_ARB, anim->fbarray);
+						GL_Uniform1fFunc (fullbrightLayerLoc, anim->fblayer);
+					}
+					else
+						GL_Uniform1fFunc (fullbrightLayerLoc, -1);
+
+					if (t->texturechains[chain]->flags & SURF_DRAWFENCE)
+						glEnable (GL_ALPHA_TEST); // Flip alpha test back on
+
+					bound = true;
+					lastlightmap = s->lightmaptexturenum;
+				}
+
+				if (s->lightmaptexturenum != lastlightmap)
+					R_FlushBatch ();
+
+				GL_SelectTexture (GL_TEXTURE1_ARB);
+				GL_Bind (lightmap_textures[s->lightmaptexturenum]);
+				lastlightmap = s->lightmaptexturenum;
+				R_BatchSurface (s);
+
+				rs_brushpasses++;
+			}
+
+		R_FlushBatch ();
+
+		if (bound && t->texturechains[chain]->flags & SURF_DRAWFENCE)
+			glDisable (GL_ALPHA_TEST); // Flip alpha test back off
+	}
+
+// clean up
+	GL_UseProgramFunc (0);
+	GL_SelectTexture (GL_TEXTURE0_ARB);
+
+	glDisableClientState (GL_VERTEX_ARRAY);
+
+	GL_ClientActiveTextureFunc (GL_TEXTURE0_ARB);
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+	GL_ClientActiveTextureFunc (GL_TEXTURE1_ARB);
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+}
+
+/*
+=============
+R_CheckTexArrays_f -- checktexarrays
+
+runs R_GroupTextureArrays on random sizes and formats and checks that every
+group holds one size and format, stays within the layer limit, numbers its
+layers from 0 without gaps, and that no size is split over more groups than
+the limit requires. then reports how the current map packs.
+=============
+*/
+#define CHECK_TEXARRAY_KEYS	1024
+
+void R_CheckTexArrays_f (void)
+{
+	static texarraykey_t	keys[CHECK_TEXARRAY_KEYS];
+	static int		groups[CHECK_TEXARRAY_KEYS], layers[CHECK_TEXARRAY_KEYS];
+	static int		first[CHECK_TEXARRAY_KEYS], counts[CHECK_TEXARRAY_KEYS];
+	const texarraykey_t	*k, *k2;
+	int		trial, i, j, n, numgroups, maxlayers, errors;
+
+	errors = 0;
+	for (trial = 0; trial < 256; trial++)
+	{
+		n = trial ? rand () % CHECK_TEXARRAY_KEYS : 0;
+		maxlayers = 1 + rand () % 16;
+		for (i = 0; i < n; i++)
+		{
+			keys[i].width = (rand () % 5) ? 16 << (rand () % 3) : 0;
+			keys[i].height = 16 << (rand () % 3);
+			keys[i].format = (rand () % 2) ? GL_RGBA : GL_RGB;
+		}
+
+		numgroups = R_GroupTextureArrays (keys, n, maxlayers, groups, layers);
+
+		for (j = 0; j < numgroups; j++)
+		{
+			first[j] = -1;
+			counts[j] = 0;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (!keys[i].width)
+			{
+				if (groups[i] != -1)
+					errors++;
+				continue;
+			}
+			j = groups[i];
+			if (j < 0 || j >= numgroups)
+			{
+				errors++;
+				continue;
+			}
+			if (first[j] == -1)
+				first[j] = i;
+			k = &keys[first[j]];
+			if (k->width != keys[i].width || k->height != keys[i].height || k->format != keys[i].format)
+				errors++; // mixed sizes or formats in one array
+			if (layers[i] != counts[j]++)
+				errors++; // layer reused or skipped
+		}
+
+		for (j = 0; j < numgroups; j++)
+		{
+			if (counts[j] < 1 || counts[j] > maxlayers)
+				errors++;
+			if (counts[j] == maxlayers || first[j] == -1)
+				continue;
+			for (i = j + 1; i < numgroups; i++)
+			{
+				if (counts[i] == maxlayers || first[i] == -1)
+					continue;
+				k = &keys[first[j]];
+				k2 = &keys[first[i]];
+				if (k->width == k2->width && k->height == k2->height && k->format == k2->format)
+					errors++; // two partly filled arrays that could have been one
+			}
+		}
+	}
+
+	Con_Printf ("%i groupings checked, %i errors\n", trial, errors);
+
+	if (!cl.worldmodel || !r_world_program)
+		return;
+
+	if (!worldtexarraysbuilt)
+		R_BuildWorldTextureArrays ();
+
+	for (i = 0, j = 0, n = 0; i < numworldtexarrays; i++)
+	{
+		j = q_max(j, worldtexarrays[i].numlayers);
+		n += worldtexarrays[i].numlayers;
+	}
+	Con_Printf ("%s: %i textures in %i arrays, largest %i layers%s\n", cl.worldmodel->name, n, numworldtexarrays, j,
+			worldtexarraysusable ? "" : " (not all textures packed, using the old path)");
+}
+
 /*
 =============
 R_DrawWorld -- johnfitz -- rewritten
@@ -985,6 +1813,13 @@ void R_DrawTextureChains (qmodel_t *model, entity_t *ent, texchain_t chain)
 
 	R_DrawTextureChains_NoTexture (model, chain);
 
+	if (R_TextureArraysActive (model))
+	{
+		R_DrawTextureChains_TextureArrays (model, ent, chain);
+		R_EndTransparentDrawing (entalpha);
+		return;
+	}
+
 	if (gl_vbo_able && gl_texture_env_combine && gl_texture_env_add && gl_mtexable && gl_max_texture_units >= 3)
 	{
 		R_DrawTextureChains_Multitexture_VBO (model, ent, chain);
@@ -1106,6 +1941,105 @@ fullbrights:
 	}
 }
 
+/*
+=============
+R_DrawWorld_DepthPrepass
+
+lays down depth for the opaque world surfaces from the position-only VBO,
+so the lit passes only shade the nearest fragment of each pixel
+=============
+*/
+static void R_DrawWorld_DepthPrepass (void)
+{
+	int			i;
+	msurface_t	*s;
+	texture_t	*t;
+	extern GLuint gl_bmodel_posvbo;
+
+	if (!gl_bmodel_posvbo)
+		return;
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_posvbo);
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0); // indices come from client memory!
+
+	glVertexPointer (3, GL_FLOAT, 0, ((float *)0));
+	glEnableClientState (GL_VERTEX_ARRAY);
+
+	glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable (GL_TEXTURE_2D);
+
+	for (i=0 ; i<cl.worldmodel->numtextures ; i++)
+	{
+		t = cl.worldmodel->textures[R_TextureIndex (cl.worldmodel, chain_world, i)];
+
+		// fence textures are alpha tested, so their depth comes from the lit pass
+		if (!t || !t->texturechains[chain_world] || t->texturechains[chain_world]->flags & (SURF_DRAWTILED | SURF_DRAWFENCE))
+			continue;
+
+		R_ClearBatch ();
+		for (s = t->texturechains[chain_world]; s; s = s->texturechain)
+			if (!s->culled)
+				R_BatchSurface (s);
+		R_FlushBatch ();
+	}
+
+	glEnable (GL_TEXTURE_2D);
+	glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	glDisableClientState (GL_VERTEX_ARRAY);
+}
+
+/*
+=============
+R_DrawWorld_Overdraw
+
+draws the world while counting in the stencil buffer how many fragments
+pass the depth test at each pixel, then reads the count back
+=============
+*/
+static void R_DrawWorld_Overdraw (void)
+{
+	GLint	viewport[4];
+	byte	*counts;
+	int		i, numpixels, covered, fragments;
+
+	glClearStencil (0);
+	glClear (GL_STENCIL_BUFFER_BIT);
+	glStencilFunc (GL_ALWAYS, 0, ~0);
+	glStencilOp (GL_KEEP, GL_KEEP, GL_INCR);
+	glEnable (GL_STENCIL_TEST);
+
+	R_DrawTextureChains (cl.worldmodel, NULL, chain_world);
+
+	glDisable (GL_STENCIL_TEST);
+
+	glGetIntegerv (GL_VIEWPORT, viewport);
+	numpixels = viewport[2] * viewport[3];
+	counts = (byte *) malloc (numpixels);
+	if (!counts)
+	{
+		Con_Printf ("overdraw: couldn't allocate %i bytes for the readback\n", numpixels);
+		return;
+	}
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);/* for widths that aren't a multiple of 4 */
+	glReadPixels (viewport[0], viewport[1], viewport[2], viewport[3], GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, counts);
+
+	covered = fragments = 0;
+	for (i=0 ; i<numpixels ; i++)
+	{
+		if (counts[i])
+		{
+			covered++;
+			fragments += counts[i];
+		}
+	}
+	free (counts);
+
+	Con_Printf ("overdraw %.2f: %i fragments shaded for %i pixels (%s)\n",
+				covered ? (float)fragments / covered : 0.0f, fragments, covered,
+				r_zprepass.value ? "prepass" : "no prepass");
+}
+
 /*
 =============
 R_DrawWorld -- ericw -- moved from R_DrawTextureChains, which is no longer specific to the world.
@@ -1116,6 +2050,15 @@ void R_DrawWorld (void)
 	if (!r_drawworld_cheatsafe)
 		return;
 
+	if (r_zprepass.value && !r_drawflat_cheatsafe && !r_lightmap_cheatsafe)
+		R_DrawWorld_DepthPrepass ();
+
+	if (r_overdraw.value && gl_stencilbits)
+	{
+		R_DrawWorld_Overdraw ();
+		return;
+	}
+
 	R_DrawTextureChains (cl.worldmodel, NULL, chain_world);
 }
 
@@ -1126,10 +2069,108 @@ R_DrawWorld_Water -- ericw -- moved from R_DrawTextureChains_Water, which is no
 */
 void R_DrawWorld_Water (void)
 {
+	static msurface_t	*batch[256];
+	int			i, numbatch;
+	msurface_t	*s;
+	texture_t	*t;
+	vec3_t		org;
+	float		entalpha;
+
 	if (!r_drawworld_cheatsafe)
 		return;
 
-	R_DrawTextureChains_Water (cl.worldmodel, NULL, chain_world);
+	if (!r_alphasort.value || r_drawflat_cheatsafe || r_lightmap_cheatsafe)
+	{
+		R_DrawTextureChains_Water (cl.worldmodel, NULL, chain_world);
+		return;
+	}
+
+	// queue every visible surface so R_DrawTransparent can sort them against the alpha entities
+	for (i=0 ; i<cl.worldmodel->numtextures ; i++)
+	{
+		t = cl.worldmodel->textures[i];
+		if (!t || !t->texturechains[chain_world] || !(t->texturechains[chain_world]->flags & SURF_DRAWTURB))
+			continue;
+		entalpha = GL_WaterAlphaForSurface (t->texturechains[chain_world]);
+		if (entalpha == 1)
+		{
+			// opaque water doesn't need sorting, draw it now with the rest of the opaque world
+			numbatch = 0;
+			for (s = t->texturechains[chain_world]; s; s = s->texturechain)
+				if (!s->culled)
+				{
+					batch[numbatch++] = s;
+					if (numbatch == (int)(sizeof(batch)/sizeof(batch[0])))
+					{
+						R_DrawWaterBatch (batch, numbatch, 1);
+						numbatch = 0;
+					}
+				}
+			if (numbatch)
+				R_DrawWaterBatch (batch, numbatch, 1);
+			continue;
+		}
+		for (s = t->texturechains[chain_world]; s; s = s->texturechain)
+			if (!s->culled)
+			{
+				VectorAdd (s->mins, s->maxs, org);
+				VectorScale (org, 0.5, org);
+				if (!R_AddTransparent (trans_water, s, org, t->gltexture, entalpha))
+					R_DrawWaterBatch (&s, 1, entalpha);
+			}
+	}
+}
+
+/*
+=============
+R_DrawWaterBatch
+
+draws world water surfaces that share a texture and alpha, for R_DrawTransparent
+=============
+*/
+void R_DrawWaterBatch (msurface_t **surfs, int count, float alpha)
+{
+	texture_t	*t;
+	glpoly_t	*p;
+	int			i;
+
+	t = surfs[0]->texinfo->texture;
+	R_BeginTransparentDrawing (alpha);
+
+	if (r_oldwater.value)
+	{
+		GL_Bind (t->gltexture);
+		for (i=0 ; i<count ; i++)
+		{
+			for (p = GL_SubdividedPolys (surfs[i]); p; p = p->next)
+			{
+				DrawWaterPoly (p);
+				rs_brushpasses++;
+			}
+		}
+	}
+	else if (R_WaterShaderActive ())
+	{
+		GL_Bind (t->gltexture);
+		R_BeginWaterShader ();
+		for (i=0 ; i<count ; i++)
+		{
+			DrawGLPoly (surfs[i]->polys);
+			rs_brushpasses++;
+		}
+		R_EndWaterShader ();
+	}
+	else
+	{
+		GL_Bind (t->warpimage);
+		for (i=0 ; i<count ; i++)
+		{
+			DrawGLPoly (surfs[i]->polys);
+			rs_brushpasses++;
+		}
+	}
+
+	R_EndTransparentDrawing (alpha);
 }
 
 /*
@@ -93,6 +93,7 @@ typedef struct entity_s
 	vec3_t					currentorigin;	//johnfitz -- transform lerping
 	vec3_t					previousangles;	//johnfitz -- transform lerping
 	vec3_t					currentangles;	//johnfitz -- transform lerping
+	qboolean				merged;			// drawn as part of the world texture chains
 } entity_t;
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
@@ -41,6 +41,12 @@ void SCR_EndLoadingPlaque (void);
 
 int SCR_ModalMessage (const char *text, float timeout); //johnfitz -- added timeout
 
+void SCR_CaptureFrame (void);
+double SCR_CaptureFrametime (void);
+void SCR_StopCapture (void);
+void SCR_DeleteCaptureBuffers (void);
+void SCR_ShutdownCapture (void);
+
 extern	float		scr_con_current;
 extern	float		scr_conlines;		// lines of console to display
 
@@ -38,6 +38,8 @@ typedef struct
 
 typedef enum {ss_loading, ss_active} server_state_t;
 
+#define	MODEL_HASH_SIZE	1024	// power of two
+
 typedef struct
 {
 	qboolean	active;				// false if only a net client
@@ -55,6 +57,9 @@ typedef struct
 	struct qmodel_s	*worldmodel;
 	const char	*model_precache[MAX_MODELS];	// NULL terminated
 	struct qmodel_s	*models[MAX_MODELS];
+	int			num_model_precache;	// entries in model_precache
+	int			model_hash[MODEL_HASH_SIZE];	// index+1 of the last model_precache entry with each name hash, 0 = none
+	int			model_hashnext[MAX_MODELS];	// index+1 of the previous entry in the same chain
 	const char	*sound_precache[MAX_SOUNDS];	// NULL terminated
 	const char	*lightstyles[MAX_LIGHTSTYLES];
 	int			num_edicts;
@@ -203,6 +208,8 @@ void SV_SendClientMessages (void);
 void SV_ClearDatagram (void);
 
 int SV_ModelIndex (const char *name);
+int SV_FindModelIndex (const char *name);
+int SV_AddModelPrecache (const char *name);
 
 void SV_SetIdealPitch (void);
 
@@ -32,6 +32,8 @@ int		sv_protocol = PROTOCOL_FITZQUAKE; //johnfitz
 
 extern qboolean	pr_alpha_supported; //johnfitz
 
+static void SV_TimeModelIndex_f (void);
+
 //============================================================================
 
 /*
@@ -106,6 +108,7 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_altnoclip); //johnfitz
 
 	Cmd_AddCommand ("sv_protocol", &SV_Protocol_f); //johnfitz
+	Cmd_AddCommand ("timemodelindex", &SV_TimeModelIndex_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -1125,6 +1128,47 @@ SERVER SPAWNING
 ==============================================================================
 */
 
+/*
+================
+SV_FindModelIndex -- returns the model_precache index of name, or -1 if it
+hasn't been precached
+================
+*/
+int SV_FindModelIndex (const char *name)
+{
+	int		i;
+
+	if (!name || !name[0])
+		return 0;
+
+	for (i = sv.model_hash[COM_HashString (name) & (MODEL_HASH_SIZE - 1)]; i; i = sv.model_hashnext[i-1])
+		if (!strcmp(sv.model_precache[i-1], name))
+			return i-1;
+	return -1;
+}
+
+/*
+================
+SV_AddModelPrecache -- appends name to model_precache and returns its index,
+or -1 if the list is full.  the caller loads sv.models[index]
+================
+*/
+int SV_AddModelPrecache (const char *name)
+{
+	int		i;
+	unsigned	hash;
+
+	if (sv.num_model_precache == MAX_MODELS)
+		return -1;
+
+	i = sv.num_model_precache++;
+	hash = COM_HashString (name) & (MODEL_HASH_SIZE - 1);
+	sv.model_precache[i] = name;
+	sv.model_hashnext[i] = sv.model_hash[hash];
+	sv.model_hash[hash] = i+1;
+	return i;
+}
+
 /*
 ================
 SV_ModelIndex
@@ -1135,15 +1179,73 @@ int SV_ModelIndex (const char *name)
 {
 	int		i;
 
+	i = SV_FindModelIndex (name);
+	if (i < 0)
+		Sys_Error ("SV_ModelIndex: model %s not precached", name);
+	return i;
+}
+
+/*
+================
+SV_ModelIndexLinear -- the old scan, kept for timemodelindex to compare against
+================
+*/
+static int SV_ModelIndexLinear (const char *name)
+{
+	int		i;
+
 	if (!name || !name[0])
 		return 0;
 
 	for (i=0 ; i<MAX_MODELS && sv.model_precache[i] ; i++)
 		if (!strcmp(sv.model_precache[i], name))
 			return i;
-	if (i==MAX_MODELS || !sv.model_precache[i])
-		Sys_Error ("SV_ModelIndex: model %s not precached", name);
-	return i;
+	return -1;
+}
+
+/*
+================
+SV_TimeModelIndex_f -- timemodelindex [passes]: looks up every precached
+model through the hash and the linear scan, and checks they agree
+================
+*/
+static void SV_TimeModelIndex_f (void)
+{
+	int		passes, i, j, mismatches;
+	double	start, hashtime, lineartime;
+
+	if (!sv.active)
+	{
+		Con_Printf ("timemodelindex: no server running\n");
+		return;
+	}
+
+	passes = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
+	passes = q_max (passes, 1);
+
+	// duplicate names can't happen, so each entry must map back to itself
+	for (i = 1, mismatches = 0; i < sv.num_model_precache; i++)
+	{
+		if (SV_FindModelIndex (sv.model_precache[i]) != i || SV_ModelIndexLinear (sv.model_precache[i]) != i)
+			mismatches++;
+	}
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < passes; j++)
+		for (i = 1; i < sv.num_model_precache; i++)
+			SV_FindModelIndex (sv.model_precache[i]);
+	hashtime = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < passes; j++)
+		for (i = 1; i < sv.num_model_precache; i++)
+			SV_ModelIndexLinear (sv.model_precache[i]);
+	lineartime = Sys_DoubleTime () - start;
+
+	if (mismatches)
+		Con_Printf ("%i of %i models found at the wrong index\n", mismatches, sv.num_model_precache);
+	Con_Printf ("%i models x %i passes: hashed %.2f ms, linear scan %.2f ms\n",
+		sv.num_model_precache, passes, hashtime * 1000.0, lineartime * 1000.0);
 }
 
 /*
@@ -1416,11 +1518,11 @@ void SV_SpawnServer (const char *server)
 	SV_ClearWorld ();
 
 	sv.sound_precache[0] = dummy;
-	sv.model_precache[0] = dummy;
-	sv.model_precache[1] = sv.modelname;
+	SV_AddModelPrecache (dummy);
+	SV_AddModelPrecache (sv.modelname);
 	for (i=1 ; i<sv.worldmodel->numsubmodels ; i++)
 	{
-		sv.model_precache[1+i] = localmodels[i];
+		SV_AddModelPrecache (localmodels[i]);
 		sv.models[i+1] = Mod_ForName (localmodels[i], false);
 	}
 
@@ -184,6 +184,27 @@ void VR_UpdatePoses(void)
 
 void R_RenderScene(void);
 
+// Resolve an eye's multisampled render into the texture we submit. The view blend
+// and gamma are folded into the same pass when there are any, otherwise a blit
+// does the plain resolve.
+static void ResolveEye(FramebufferDesc_t* framebufferDesc)
+{
+	GL_BindFramebufferFunc(GL_FRAMEBUFFER, framebufferDesc->m_nResolveFramebufferId);
+
+	if (!GLSLGamma_EyeNeedsPostProcess() ||
+		!GLSLGamma_ResolveEye(framebufferDesc->m_nRenderTextureId, msaa_samples, vr_width, vr_height))
+	{
+		GL_BindFramebufferFunc(GL_READ_FRAMEBUFFER, framebufferDesc->m_nRenderFramebufferId);
+		GL_BindFramebufferFunc(GL_DRAW_FRAMEBUFFER, framebufferDesc->m_nResolveFramebufferId);
+
+		GL_BlitFramebufferFunc(0, 0, vr_width, vr_height, 0, 0, vr_width, vr_height,
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR);
+	}
+
+	GL_BindFramebufferFunc(GL_FRAMEBUFFER, 0);
+}
+
 void VR_RenderScene(void)
 {
 	int oldwidth = glwidth;
@@ -207,15 +228,7 @@ void VR_RenderScene(void)
 	GL_BindFramebufferFunc(GL_FRAMEBUFFER, 0);
 	glDisable(GL_MULTISAMPLE);
 
-	GL_BindFramebufferFunc(GL_READ_FRAMEBUFFER, VR_framebuffers[0].m_nRenderFramebufferId);
-	GL_BindFramebufferFunc(GL_DRAW_FRAMEBUFFER, VR_framebuffers[0].m_nResolveFramebufferId);
-
-	GL_BlitFramebufferFunc(0, 0, vr_width, vr_height, 0, 0, vr_width, vr_height,
-		GL_COLOR_BUFFER_BIT,
-		GL_LINEAR);
-
-	GL_BindFramebufferFunc(GL_READ_FRAMEBUFFER, 0);
-	GL_BindFramebufferFunc(GL_DRAW_FRAMEBUFFER, 0);
+	ResolveEye(&VR_framebuffers[0]);
 
 	glEnable(GL_MULTISAMPLE);
 
@@ -229,15 +242,7 @@ void VR_RenderScene(void)
 
 	glDisable(GL_MULTISAMPLE);
 
-	GL_BindFramebufferFunc(GL_READ_FRAMEBUFFER, VR_framebuffers[1].m_nRenderFramebufferId);
-	GL_BindFramebufferFunc(GL_DRAW_FRAMEBUFFER, VR_framebuffers[1].m_nResolveFramebufferId);
-
-	GL_BlitFramebufferFunc(0, 0, vr_width, vr_height, 0, 0, vr_width, vr_height,
-		GL_COLOR_BUFFER_BIT,
-		GL_LINEAR);
-
-	GL_BindFramebufferFunc(GL_READ_FRAMEBUFFER, 0);
-	GL_BindFramebufferFunc(GL_DRAW_FRAMEBUFFER, 0);
+	ResolveEye(&VR_framebuffers[1]);
 
 	glwidth = oldwidth;
 	glheight = oldheight;
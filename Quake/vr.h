@@ -19,6 +19,10 @@ typedef struct FramebufferDesc
 
 int vr_width, vr_height;
 
+extern FramebufferDesc_t VR_framebuffers[2];
+extern qboolean vr_initialized;
+extern const int msaa_samples;
+
 void VR_Init(void);
 void VR_Shutdown(void);
 qboolean VR_Enable(void);